@@ -473,9 +473,26 @@ namespace ChatClientWPF
                 };
 
                 var json = JsonSerializer.Serialize(messageData);
-                var content = new StringContent(json, Encoding.UTF8, "application/json");
 
-                var response = await client.PostAsync($"{baseUrl}/messages", content);
+                // Один ключ на все попытки: повтор после обрыва связи
+                // не создаст второе сообщение
+                var idempotencyKey = Guid.NewGuid().ToString();
+                HttpResponseMessage response = null;
+                for (int attempt = 1; response == null; attempt++)
+                {
+                    var request = new HttpRequestMessage(HttpMethod.Post, $"{baseUrl}/messages")
+                    {
+                        Content = new StringContent(json, Encoding.UTF8, "application/json")
+                    };
+                    request.Headers.Add("Idempotency-Key", idempotencyKey);
+                    try
+                    {
+                        response = await client.SendAsync(request);
+                    }
+                    catch (HttpRequestException) when (attempt < 3)
+                    {
+                    }
+                }
                 var responseString = await response.Content.ReadAsStringAsync();
 
                 if (response.IsSuccessStatusCode)
@@ -562,6 +579,19 @@ namespace ChatClientWPF
                             messages.Add(message);
                         }
 
+                        // Имена отправителей приходят в таблице users ответа;
+                        // без нее (старый сервер) - одним запросом
+                        var names = result.TryGetProperty("users", out var usersArray)
+                            ? ReadUserNames(usersArray)
+                            : await LoadUserNames(messages.Select(m => m.UserId).Distinct());
+                        foreach (var message in messages)
+                        {
+                            if (names.TryGetValue(message.UserId, out var name))
+                            {
+                                message.UserName = name;
+                            }
+                        }
+
                         lbMessages.ItemsSource = messages;
 
                         if (messages.Count > 0)
@@ -578,6 +608,48 @@ namespace ChatClientWPF
             }
         }
 
+        // Имена пользователей по id (GET /users?ids=1,2,3)
+        private async Task<Dictionary<int, string>> LoadUserNames(IEnumerable<int> userIds)
+        {
+            var names = new Dictionary<int, string>();
+            var ids = string.Join(",", userIds);
+            if (ids.Length == 0)
+            {
+                return names;
+            }
+
+            try
+            {
+                var response = await client.GetAsync($"{baseUrl}/users?ids={ids}");
+                if (response.IsSuccessStatusCode)
+                {
+                    var responseString = await response.Content.ReadAsStringAsync();
+                    var result = JsonSerializer.Deserialize<JsonElement>(responseString);
+
+                    if (result.TryGetProperty("users", out var usersArray))
+                    {
+                        names = ReadUserNames(usersArray);
+                    }
+                }
+            }
+            catch (Exception ex)
+            {
+                Console.WriteLine($"Ошибка загрузки имен пользователей: {ex.Message}");
+            }
+            return names;
+        }
+
+        // Список [{"id", "name", ...}] -> имена по id
+        private static Dictionary<int, string> ReadUserNames(JsonElement usersArray)
+        {
+            var names = new Dictionary<int, string>();
+            foreach (var user in usersArray.EnumerateArray())
+            {
+                names[user.GetProperty("id").GetInt32()] = user.GetProperty("name").GetString();
+            }
+            return names;
+        }
+
         // Обновление чатов
         private async void BtnRefreshChats_Click(object sender, RoutedEventArgs e)
         {
@@ -0,0 +1,192 @@
+﻿#include "AdmissionControl.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace {
+
+double toMs(AdmissionControl::Clock::duration d) {
+    return chrono::duration<double, milli>(d).count();
+}
+
+}
+
+AdmissionControl::Permit::Permit(AdmissionControl* owner, RouteClass routeClass)
+    : owner(owner), routeClass(routeClass), started(Clock::now()) {
+}
+
+AdmissionControl::Permit::Permit(Permit&& other) noexcept
+    : owner(other.owner), routeClass(other.routeClass), started(other.started) {
+    other.owner = nullptr;
+}
+
+AdmissionControl::Permit& AdmissionControl::Permit::operator=(Permit&& other) noexcept {
+    if (this != &other) {
+        if (owner) {
+            owner->release(routeClass, Clock::now() - started);
+        }
+        owner = other.owner;
+        routeClass = other.routeClass;
+        started = other.started;
+        other.owner = nullptr;
+    }
+    return *this;
+}
+
+AdmissionControl::Permit::~Permit() {
+    if (owner) {
+        owner->release(routeClass, Clock::now() - started);
+    }
+}
+
+AdmissionControl::AdmissionControl(const Config& auth, const Config& read, const Config& write) {
+    const Config* configs[] = { &auth, &read, &write };
+    const char* names[] = { "auth", "read", "write" };
+    for (size_t i = 0; i < routeClassCount; i++) {
+        auto& state = classes[i];
+        state.name = names[i];
+        state.config = *configs[i];
+        state.limit = static_cast<double>(clamp(state.config.initialLimit, state.config.minLimit, state.config.maxLimit));
+        state.intervalStart = Clock::now();
+    }
+}
+
+asio::awaitable<AdmissionControl::Permit> AdmissionControl::admit(RouteClass routeClass) {
+    auto& state = classes[static_cast<size_t>(routeClass)];
+    auto ex = co_await asio::this_coro::executor;
+
+    shared_ptr<Waiter> waiter;
+    {
+        lock_guard<mutex> lock(m);
+        auto now = Clock::now();
+        if (state.queue.empty() && state.inFlight < static_cast<size_t>(state.limit)) {
+            // Быстрый путь: свободный слот есть, очередь пуста
+            state.inFlight++;
+            state.admitted++;
+            recordQueueDelay(state, Clock::duration::zero(), now);
+        }
+        else if (state.queue.size() >= state.config.maxQueue) {
+            state.rejected++;
+            throw OverloadError();
+        }
+        else {
+            waiter = make_shared<Waiter>(ex);
+            waiter->enqueued = now;
+            waiter->timer.expires_after(state.overloaded ? state.config.target : state.config.queueTimeout);
+            state.queue.push_back(waiter);
+        }
+    }
+
+    if (waiter) {
+        // release() отменяет таймер, когда передает слот этому запросу
+        co_await waiter->timer.async_wait(asio::as_tuple(asio::use_awaitable));
+
+        lock_guard<mutex> lock(m);
+        if (!waiter->admitted) {
+            auto pos = find(state.queue.begin(), state.queue.end(), waiter);
+            if (pos != state.queue.end()) {
+                state.queue.erase(pos);
+            }
+            state.timedOut++;
+            recordQueueDelay(state, Clock::now() - waiter->enqueued, Clock::now());
+            throw OverloadError();
+        }
+    }
+
+    co_return Permit(this, routeClass);
+}
+
+vector<AdmissionControl::ClassStats> AdmissionControl::stats() const {
+    lock_guard<mutex> lock(m);
+    vector<ClassStats> result;
+    for (const auto& state : classes) {
+        ClassStats s;
+        s.name = state.name;
+        s.limit = state.limit;
+        s.inFlight = state.inFlight;
+        s.queued = state.queue.size();
+        s.overloaded = state.overloaded;
+        s.admitted = state.admitted;
+        s.rejected = state.rejected;
+        s.timedOut = state.timedOut;
+        if (state.admitted > 0) {
+            s.avgQueueMs = toMs(state.totalQueueDelay) / state.admitted;
+        }
+        s.shortLatencyMs = state.shortLatencyMs;
+        s.longLatencyMs = state.longLatencyMs;
+        result.push_back(s);
+    }
+    return result;
+}
+
+void AdmissionControl::release(RouteClass routeClass, Clock::duration latency) {
+    auto& state = classes[static_cast<size_t>(routeClass)];
+
+    vector<shared_ptr<Waiter>> woken;
+    {
+        lock_guard<mutex> lock(m);
+        state.inFlight--;
+        updateLimit(state, latency);
+
+        // Освободившиеся слоты передаются первым в очереди
+        auto now = Clock::now();
+        while (!state.queue.empty() && state.inFlight < static_cast<size_t>(state.limit)) {
+            auto waiter = move(state.queue.front());
+            state.queue.pop_front();
+
+            waiter->admitted = true;
+            state.inFlight++;
+            state.admitted++;
+            state.totalQueueDelay += now - waiter->enqueued;
+            recordQueueDelay(state, now - waiter->enqueued, now);
+            woken.push_back(move(waiter));
+        }
+    }
+
+    for (auto& waiter : woken) {
+        asio::post(waiter->timer.get_executor(), [waiter]() {
+            waiter->timer.cancel();
+        });
+    }
+}
+
+void AdmissionControl::recordQueueDelay(ClassState& state, Clock::duration delay, Clock::time_point now) {
+    state.intervalMinDelay = min(state.intervalMinDelay, delay);
+    if (now - state.intervalStart >= state.config.interval) {
+        // Перегрузка - если за весь интервал очередь ни разу не проходилась быстрее target
+        state.overloaded = state.intervalMinDelay > state.config.target;
+        state.intervalStart = now;
+        state.intervalMinDelay = Clock::duration::max();
+    }
+}
+
+void AdmissionControl::updateLimit(ClassState& state, Clock::duration latency) {
+    double sample = toMs(latency);
+    if (state.longLatencyMs == 0) {
+        state.shortLatencyMs = sample;
+        state.longLatencyMs = sample;
+        return;
+    }
+
+    state.shortLatencyMs = state.shortLatencyMs * 0.9 + sample * 0.1;
+    state.longLatencyMs = state.longLatencyMs * 0.99 + sample * 0.01;
+
+    // После спада нагрузки базовая задержка быстрее возвращается вниз
+    if (state.longLatencyMs > state.shortLatencyMs * 2) {
+        state.longLatencyMs *= 0.95;
+    }
+
+    // Лимит не наращивается, пока он используется меньше чем наполовину
+    if (state.inFlight + 1 < state.limit / 2) {
+        return;
+    }
+
+    double gradient = state.shortLatencyMs > 0
+        ? clamp(state.longLatencyMs / state.shortLatencyMs, 0.5, 1.0)
+        : 1.0;
+    double newLimit = state.limit * gradient + sqrt(state.limit);
+    newLimit = clamp(newLimit, static_cast<double>(state.config.minLimit), static_cast<double>(state.config.maxLimit));
+    state.limit = state.limit * 0.8 + newLimit * 0.2;
+}
@@ -0,0 +1,125 @@
+﻿#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <asio.hpp>
+
+// Запрос отклонен из-за перегрузки - клиенту отдается 503 с Retry-After
+class OverloadError : public std::runtime_error {
+public:
+    OverloadError() : std::runtime_error("Server is overloaded") {}
+};
+
+// Контроль допуска запросов по классам маршрутов. Для каждого класса:
+//   - лимит одновременно выполняемых запросов, который подстраивается
+//     по задержке (градиентный лимитер: растет, пока время ответа близко
+//     к базовому, и уменьшается, когда запросы начинают ждать);
+//   - ограниченная очередь ожидания со сроком: обычно queueTimeout, а если
+//     за последний interval очередь ни разу не опустела быстрее target
+//     (как в CoDel), новые запросы ждут не дольше target;
+//   - при переполненной очереди или истекшем сроке - OverloadError.
+// Так при всплесках лишние запросы сразу получают отказ, а задержка
+// допущенных не растет вместе с очередью.
+class AdmissionControl {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class RouteClass { Auth, Read, Write };
+    static constexpr size_t routeClassCount = 3;
+
+    struct Config {
+        size_t initialLimit = 16;
+        size_t minLimit = 2;
+        size_t maxLimit = 256;
+        size_t maxQueue = 256;
+        std::chrono::milliseconds queueTimeout{ 100 };
+        std::chrono::milliseconds target{ 5 };      // допустимая задержка в очереди
+        std::chrono::milliseconds interval{ 100 };  // окно оценки перегрузки
+    };
+
+    struct ClassStats {
+        std::string name;
+        double limit = 0;
+        size_t inFlight = 0;
+        size_t queued = 0;
+        bool overloaded = false;
+        uint64_t admitted = 0;
+        uint64_t rejected = 0;      // очередь переполнена
+        uint64_t timedOut = 0;      // истек срок ожидания в очереди
+        double avgQueueMs = 0;
+        double shortLatencyMs = 0;
+        double longLatencyMs = 0;
+    };
+
+    // Разрешение на выполнение запроса, освобождает слот в деструкторе
+    class Permit {
+    public:
+        Permit() = default;
+        Permit(Permit&& other) noexcept;
+        Permit& operator=(Permit&& other) noexcept;
+        ~Permit();
+
+    private:
+        friend class AdmissionControl;
+        Permit(AdmissionControl* owner, RouteClass routeClass);
+
+        AdmissionControl* owner = nullptr;
+        RouteClass routeClass = RouteClass::Read;
+        Clock::time_point started;
+    };
+
+    AdmissionControl(const Config& auth, const Config& read, const Config& write);
+
+    AdmissionControl(const AdmissionControl&) = delete;
+    AdmissionControl& operator=(const AdmissionControl&) = delete;
+
+    // Ожидание свободного слота. Бросает OverloadError при отказе
+    asio::awaitable<Permit> admit(RouteClass routeClass);
+
+    std::vector<ClassStats> stats() const;
+
+private:
+    struct Waiter {
+        explicit Waiter(const asio::any_io_executor& ex) : timer(ex) {}
+
+        asio::steady_timer timer;
+        Clock::time_point enqueued;
+        bool admitted = false;      // под мьютексом
+    };
+
+    struct ClassState {
+        std::string name;
+        Config config;
+        double limit = 0;
+        size_t inFlight = 0;
+        std::deque<std::shared_ptr<Waiter>> queue;
+
+        // Градиентный лимитер: быстрая и медленная средние задержки
+        double shortLatencyMs = 0;
+        double longLatencyMs = 0;
+
+        // CoDel: минимальное время в очереди за текущий интервал
+        Clock::time_point intervalStart;
+        Clock::duration intervalMinDelay = Clock::duration::max();
+        bool overloaded = false;
+
+        uint64_t admitted = 0;
+        uint64_t rejected = 0;
+        uint64_t timedOut = 0;
+        Clock::duration totalQueueDelay{};
+    };
+
+    mutable std::mutex m;
+    std::array<ClassState, routeClassCount> classes;
+
+    void release(RouteClass routeClass, Clock::duration latency);
+    void recordQueueDelay(ClassState& state, Clock::duration delay, Clock::time_point now);
+    void updateLimit(ClassState& state, Clock::duration latency);
+};
@@ -0,0 +1,135 @@
+﻿#include "AsyncDatabase.h"
+
+using namespace std;
+using Queue = DbExecutor::Queue;
+
+// Методы не корутины, а возвращают awaitable из run(): аргументы принимаются
+// по значению и переносятся в задачу пула, кадр корутины для них не нужен
+
+asio::awaitable<int> AsyncDatabase::registerUser(string name, string login, string password) {
+    return run(Queue::Write, [name = move(name), login = move(login), password = move(password)](Database& db) {
+        return db.registerUser(name, login, password);
+        });
+}
+
+asio::awaitable<optional<User>> AsyncDatabase::loginUser(string login, string password) {
+    return run(Queue::Read, [login = move(login), password = move(password)](Database& db) {
+        User user;
+        return db.loginUser(login, password, user) ? optional<User>(user) : nullopt;
+        });
+}
+
+asio::awaitable<optional<UserInfo>> AsyncDatabase::getUserById(int userId) {
+    return run(Queue::Read, [userId](Database& db) {
+        UserInfo user;
+        return db.getUserById(userId, user) ? optional<UserInfo>(user) : nullopt;
+        });
+}
+
+asio::awaitable<vector<UserInfo>> AsyncDatabase::getUsersByIds(vector<int> userIds) {
+    return run(Queue::Read, [userIds = move(userIds)](Database& db) {
+        return db.getUsersByIds(userIds);
+        });
+}
+
+asio::awaitable<vector<UserSearchResult>> AsyncDatabase::searchUsers(string searchQuery) {
+    return run(Queue::Read, [searchQuery = move(searchQuery)](Database& db) {
+        return db.searchUsers(searchQuery);
+        });
+}
+
+asio::awaitable<int> AsyncDatabase::createChat(string name, bool isGroup, int createdBy, vector<int> participants) {
+    return run(Queue::Write, [name = move(name), isGroup, createdBy, participants = move(participants)](Database& db) {
+        return db.createChat(name, isGroup, createdBy, participants);
+        });
+}
+
+asio::awaitable<vector<Chat>> AsyncDatabase::getUserChats(int userId) {
+    return run(Queue::Read, [userId](Database& db) {
+        return db.getUserChats(userId);
+        });
+}
+
+asio::awaitable<int> AsyncDatabase::addContact(int userId1, int userId2) {
+    return run(Queue::Write, [userId1, userId2](Database& db) {
+        return db.addContact(userId1, userId2);
+        });
+}
+
+asio::awaitable<int> AsyncDatabase::insertContact(int userId1, int userId2) {
+    return run(Queue::Write, [userId1, userId2](Database& db) {
+        return db.insertContact(userId1, userId2);
+        });
+}
+
+asio::awaitable<vector<pair<int, string>>> AsyncDatabase::getUserContacts(int userId) {
+    return run(Queue::Read, [userId](Database& db) {
+        return db.getUserContacts(userId);
+        });
+}
+
+asio::awaitable<int> AsyncDatabase::sendMessage(int userId, int chatId, string message, int replyId, int resendId) {
+    return run(Queue::Write, [userId, chatId, message = move(message), replyId, resendId](Database& db) {
+        return db.sendMessage(userId, chatId, message, replyId, resendId);
+        });
+}
+
+asio::awaitable<vector<Message>> AsyncDatabase::getChatMessages(int chatId) {
+    return run(Queue::Read, [chatId](Database& db) {
+        return db.getChatMessages(chatId);
+        });
+}
+
+asio::awaitable<bool> AsyncDatabase::editMessage(int messageId, string newMessage, int userId) {
+    return run(Queue::Write, [messageId, newMessage = move(newMessage), userId](Database& db) {
+        return db.editMessage(messageId, newMessage, userId);
+        });
+}
+
+asio::awaitable<bool> AsyncDatabase::deleteMessage(int messageId, int userId) {
+    return run(Queue::Write, [messageId, userId](Database& db) {
+        return db.deleteMessage(messageId, userId);
+        });
+}
+
+asio::awaitable<int> AsyncDatabase::getMessageChatId(int messageId) {
+    return run(Queue::Read, [messageId](Database& db) {
+        return db.getMessageChatId(messageId);
+        });
+}
+
+asio::awaitable<vector<Message>> AsyncDatabase::getMessagesByIds(vector<int> messageIds) {
+    return run(Queue::Read, [messageIds = move(messageIds)](Database& db) {
+        return db.getMessagesByIds(messageIds);
+        });
+}
+
+asio::awaitable<vector<Message>> AsyncDatabase::getChatMessagesAfter(int chatId, int afterId, int limit) {
+    return run(Queue::Read, [chatId, afterId, limit](Database& db) {
+        return db.getChatMessagesAfter(chatId, afterId, limit);
+        });
+}
+
+asio::awaitable<int> AsyncDatabase::createChannel(string name, int createdBy) {
+    return run(Queue::Write, [name = move(name), createdBy](Database& db) {
+        return db.createChannel(name, createdBy);
+        });
+}
+
+asio::awaitable<int> AsyncDatabase::addChannelAdmin(int chatId, int userId) {
+    return run(Queue::Write, [chatId, userId](Database& db) {
+        return db.addChannelAdmin(chatId, userId);
+        });
+}
+
+asio::awaitable<int> AsyncDatabase::addChannelSubscriber(int chatId, int userId) {
+    return run(Queue::Write, [chatId, userId](Database& db) {
+        return db.addChannelSubscriber(chatId, userId);
+        });
+}
+
+asio::awaitable<bool> AsyncDatabase::removeChannelSubscriber(int chatId, int userId) {
+    return run(Queue::Write, [chatId, userId](Database& db) {
+        return db.removeChannelSubscriber(chatId, userId);
+        });
+}
@@ -0,0 +1,95 @@
+﻿#pragma once
+
+#include <exception>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <asio.hpp>
+
+#include "Database.h"
+#include "DbExecutor.h"
+
+// Очередь DbExecutor переполнена - запрос стоит повторить позже
+class DbBusyError : public std::runtime_error {
+public:
+    DbBusyError() : std::runtime_error("Database queue is full") {}
+};
+
+// Методы Database в виде awaitable-операций asio поверх DbExecutor.
+// Работа с SQLite выполняется в потоках пула, а корутина продолжается
+// на своем исполнителе (для обработчиков Crow - поток соединения).
+class AsyncDatabase {
+public:
+    explicit AsyncDatabase(DbExecutor& executor) : executor(executor) {}
+
+    // Произвольная работа с базой в одной задаче пула (несколько запросов подряд)
+    template <typename Work, typename CompletionToken = asio::use_awaitable_t<>>
+    auto run(DbExecutor::Queue queue, Work work, CompletionToken&& token = {}) {
+        using Result = std::invoke_result_t<Work&, Database&>;
+        static_assert(std::is_default_constructible_v<Result>, "result must be default constructible");
+
+        return asio::async_initiate<CompletionToken, void(std::exception_ptr, Result)>(
+            [this, queue](auto handler, Work work) {
+                using Handler = decltype(handler);
+
+                // std::function требует копируемости, поэтому обработчик - в shared_ptr
+                auto ex = asio::prefer(asio::get_associated_executor(handler),
+                    asio::execution::outstanding_work.tracked);
+                auto shared = std::make_shared<Handler>(std::move(handler));
+
+                bool accepted = executor.submit(queue, [ex, shared, work = std::move(work)](Database& db) mutable {
+                    std::exception_ptr error;
+                    Result result{};
+                    try {
+                        result = work(db);
+                    }
+                    catch (...) {
+                        error = std::current_exception();
+                    }
+                    asio::post(ex, [shared, error, result = std::move(result)]() mutable {
+                        (*shared)(error, std::move(result));
+                    });
+                });
+
+                if (!accepted) {
+                    asio::post(ex, [shared]() {
+                        (*shared)(std::make_exception_ptr(DbBusyError()), Result{});
+                    });
+                }
+            },
+            token, std::move(work));
+    }
+
+    asio::awaitable<int> registerUser(std::string name, std::string login, std::string password);
+    asio::awaitable<std::optional<User>> loginUser(std::string login, std::string password);
+    asio::awaitable<std::optional<UserInfo>> getUserById(int userId);
+    asio::awaitable<std::vector<UserInfo>> getUsersByIds(std::vector<int> userIds);
+    asio::awaitable<std::vector<UserSearchResult>> searchUsers(std::string searchQuery);
+
+    asio::awaitable<int> createChat(std::string name, bool isGroup, int createdBy, std::vector<int> participants);
+    asio::awaitable<std::vector<Chat>> getUserChats(int userId);
+
+    asio::awaitable<int> addContact(int userId1, int userId2);
+    asio::awaitable<int> insertContact(int userId1, int userId2);
+    asio::awaitable<std::vector<std::pair<int, std::string>>> getUserContacts(int userId);
+
+    asio::awaitable<int> sendMessage(int userId, int chatId, std::string message, int replyId = 0, int resendId = 0);
+    asio::awaitable<std::vector<Message>> getChatMessages(int chatId);
+    asio::awaitable<bool> editMessage(int messageId, std::string newMessage, int userId);
+    asio::awaitable<bool> deleteMessage(int messageId, int userId);
+    asio::awaitable<int> getMessageChatId(int messageId);
+    asio::awaitable<std::vector<Message>> getMessagesByIds(std::vector<int> messageIds);
+    asio::awaitable<std::vector<Message>> getChatMessagesAfter(int chatId, int afterId, int limit);
+
+    asio::awaitable<int> createChannel(std::string name, int createdBy);
+    asio::awaitable<int> addChannelAdmin(int chatId, int userId);
+    asio::awaitable<int> addChannelSubscriber(int chatId, int userId);
+    asio::awaitable<bool> removeChannelSubscriber(int chatId, int userId);
+
+private:
+    DbExecutor& executor;
+};
@@ -0,0 +1,36 @@
+﻿#pragma once
+
+#include <functional>
+#include <utility>
+#include <crow.h>
+
+#include "CrowPrivateAccess.h"
+
+// Завершение асинхронного ответа Crow.
+//
+// В Crow 1.2 после того как обработчик вернул управление, соединение удерживается
+// только обработчиком завершения внутри самого response. При res.end() Crow
+// сбрасывает этот обработчик прямо во время его вызова, и соединение удаляется
+// посреди записи ответа. Поэтому перед end() берем копию обработчика: она
+// держит соединение живым до конца вызова. Публичного способа удержать
+// соединение в Crow 1.2.0 нет (см. CrowPrivateAccess.h о версии).
+namespace crow_private {
+
+struct CompleteHandlerTag {
+    using type = std::function<void()> crow::response::*;
+};
+
+CompleteHandlerTag::type member(CompleteHandlerTag);
+
+template struct Access<CompleteHandlerTag, &crow::response::complete_request_handler_>;
+
+} // namespace crow_private
+
+// Вызывать в потоке соединения (через asio::post на req.io_service)
+inline void completeAsync(crow::response& res, crow::response&& result) {
+    using namespace crow_private;
+    std::function<void()> keepAlive = res.*member(CompleteHandlerTag{});
+
+    res = std::move(result);
+    res.end();
+}
@@ -0,0 +1,436 @@
+﻿#include "Batch.h"
+
+#include <cctype>
+#include <exception>
+#include <stdexcept>
+
+#include "MsgPack.h"
+#include "WireFormat.h"
+
+using namespace std;
+
+namespace {
+
+vector<string> pathSegments(const string& path) {
+    string clean = path.substr(0, path.find('?'));
+    vector<string> segments;
+    size_t pos = 0;
+    while (pos < clean.size()) {
+        size_t end = clean.find('/', pos);
+        if (end == string::npos) {
+            end = clean.size();
+        }
+        if (end > pos) {
+            segments.push_back(clean.substr(pos, end - pos));
+        }
+        pos = end + 1;
+    }
+    return segments;
+}
+
+bool parseId(const string& segment, int& id) {
+    if (segment.empty() || segment.size() > 9) {
+        return false;
+    }
+    id = 0;
+    for (char c : segment) {
+        if (!isdigit(static_cast<unsigned char>(c))) {
+            return false;
+        }
+        id = id * 10 + (c - '0');
+    }
+    return true;
+}
+
+// Тип операции по методу и пути; false - маршрут в пакете не поддерживается
+bool matchOp(const string& method, const string& path, BatchOp& op) {
+    auto s = pathSegments(path);
+    size_t n = s.size();
+
+    if (method == "GET") {
+        if (n == 2 && s[0] == "chats" && parseId(s[1], op.id)) {
+            op.type = BatchOpType::GetChats;
+        }
+        else if (n == 3 && s[0] == "chats" && s[2] == "messages" && parseId(s[1], op.id)) {
+            op.type = BatchOpType::GetMessages;
+        }
+        else if (n == 2 && s[0] == "contacts" && parseId(s[1], op.id)) {
+            op.type = BatchOpType::GetContacts;
+        }
+        else if (n == 3 && s[0] == "users" && s[1] == "search") {
+            op.type = BatchOpType::SearchUsers;
+            op.text = s[2];
+        }
+        else if (n == 2 && s[0] == "users" && parseId(s[1], op.id)) {
+            op.type = BatchOpType::GetUser;
+        }
+        else {
+            return false;
+        }
+    }
+    else if (method == "POST") {
+        if (n == 1 && s[0] == "chats") {
+            op.type = BatchOpType::CreateChat;
+        }
+        else if (n == 1 && s[0] == "contacts") {
+            op.type = BatchOpType::AddContact;
+        }
+        else if (n == 1 && s[0] == "messages") {
+            op.type = BatchOpType::SendMessage;
+        }
+        else if (n == 2 && s[0] == "messages" && s[1] == "forward") {
+            op.type = BatchOpType::ForwardMessage;
+        }
+        else {
+            return false;
+        }
+    }
+    else if ((method == "PUT" || method == "DELETE") && n == 2 && s[0] == "messages" && parseId(s[1], op.id)) {
+        op.type = method == "PUT" ? BatchOpType::EditMessage : BatchOpType::DeleteMessage;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// Поля тела записи - те же, что у отдельного маршрута
+void readWriteBody(const RequestBody& body, BatchOp& op) {
+    switch (op.type) {
+    case BatchOpType::CreateChat:
+        op.text = body.s("name");
+        op.isGroup = body.b("isGroup");
+        op.userId = static_cast<int>(body.i("createdBy"));
+        op.participants = body.ints("participants");
+        break;
+    case BatchOpType::AddContact:
+        op.userId = static_cast<int>(body.i("userId1"));
+        op.otherUserId = static_cast<int>(body.i("userId2"));
+        break;
+    case BatchOpType::SendMessage:
+        op.userId = static_cast<int>(body.i("userId"));
+        op.chatId = static_cast<int>(body.i("chatId"));
+        op.text = body.s("message");
+        op.replyId = body.has("replyId") ? static_cast<int>(body.i("replyId")) : 0;
+        op.resendId = body.has("resendId") ? static_cast<int>(body.i("resendId")) : 0;
+        break;
+    case BatchOpType::EditMessage:
+        op.text = body.s("message");
+        op.userId = static_cast<int>(body.i("userId"));
+        break;
+    case BatchOpType::DeleteMessage:
+        op.userId = static_cast<int>(body.i("userId"));
+        break;
+    case BatchOpType::ForwardMessage:
+        op.id = static_cast<int>(body.i("originalMessageId"));
+        op.chatId = static_cast<int>(body.i("targetChatId"));
+        op.userId = static_cast<int>(body.i("userId"));
+        break;
+    default:
+        break;
+    }
+}
+
+BatchOp parseOp(const string& method, const string& path, const RequestBody* body) {
+    BatchOp op;
+    if (!matchOp(method, path, op)) {
+        op.errorStatus = 404;
+        op.error = "Unsupported operation: " + method + " " + path;
+        return op;
+    }
+    if (!isBatchWrite(op.type)) {
+        return op;
+    }
+
+    if (!body || !*body) {
+        op.errorStatus = 400;
+        op.error = "Invalid operation body";
+        return op;
+    }
+    try {
+        readWriteBody(*body, op);
+    }
+    catch (const exception& e) {
+        op.errorStatus = 400;
+        op.error = string("Invalid operation body: ") + e.what();
+    }
+    return op;
+}
+
+bool parseJsonBatch(const string& data, BatchRequest& batch, string& error) {
+    auto json = crow::json::load(data);
+    if (!json || json.t() != crow::json::type::Object || !json.has("ops") ||
+        json["ops"].t() != crow::json::type::List) {
+        error = "Expected {\"ops\": [...]}";
+        return false;
+    }
+    if (json["ops"].size() > maxBatchOps) {
+        error = "Too many operations (max " + to_string(maxBatchOps) + ")";
+        return false;
+    }
+
+    try {
+        batch.atomic = json.has("atomic") && json["atomic"].b();
+        for (const auto& item : json["ops"]) {
+            string method = item.has("method") ? string(item["method"].s()) : "";
+            string path = item.has("path") ? string(item["path"].s()) : "";
+            if (item.has("body")) {
+                RequestBody body(item["body"]);
+                batch.ops.push_back(parseOp(method, path, &body));
+            }
+            else {
+                batch.ops.push_back(parseOp(method, path, nullptr));
+            }
+        }
+    }
+    catch (const exception& e) {
+        error = e.what();
+        return false;
+    }
+    return true;
+}
+
+bool parseMsgPackOp(msgpack::Reader& reader, BatchRequest& batch) {
+    size_t fields = 0;
+    if (!reader.map(fields)) {
+        return false;
+    }
+
+    string_view method;
+    string_view path;
+    string_view bodyBytes;
+    for (size_t i = 0; i < fields; i++) {
+        string_view key;
+        if (!reader.str(key)) {
+            return false;
+        }
+        bool ok = key == "method" ? reader.str(method)
+            : key == "path" ? reader.str(path)
+            : key == "body" ? reader.value(bodyBytes)
+            : reader.skip();
+        if (!ok) {
+            return false;
+        }
+    }
+
+    if (bodyBytes.empty()) {
+        batch.ops.push_back(parseOp(string(method), string(path), nullptr));
+    }
+    else {
+        RequestBody body(bodyBytes);
+        batch.ops.push_back(parseOp(string(method), string(path), &body));
+    }
+    return true;
+}
+
+bool parseMsgPackBatch(const string& data, BatchRequest& batch, string& error) {
+    error = "Expected {\"ops\": [...]}";
+    msgpack::Reader reader(data);
+    size_t fields = 0;
+    if (!reader.map(fields)) {
+        return false;
+    }
+
+    bool hasOps = false;
+    for (size_t i = 0; i < fields; i++) {
+        string_view key;
+        if (!reader.str(key)) {
+            return false;
+        }
+        if (key == "atomic") {
+            if (!reader.boolean(batch.atomic)) {
+                return false;
+            }
+        }
+        else if (key == "ops") {
+            size_t count = 0;
+            if (!reader.array(count)) {
+                return false;
+            }
+            if (count > maxBatchOps) {
+                error = "Too many operations (max " + to_string(maxBatchOps) + ")";
+                return false;
+            }
+            for (size_t n = 0; n < count; n++) {
+                if (!parseMsgPackOp(reader, batch)) {
+                    return false;
+                }
+            }
+            hasOps = true;
+        }
+        else if (!reader.skip()) {
+            return false;
+        }
+    }
+    return hasOps && reader.atEnd();
+}
+
+BatchWriteResult failed(int status, string error) {
+    BatchWriteResult result;
+    result.status = status;
+    result.error = move(error);
+    return result;
+}
+
+BatchWriteResult created(int id) {
+    BatchWriteResult result;
+    result.id = id;
+    result.hasId = true;
+    return result;
+}
+
+// editMessage/deleteMessage успешны и без измененных строк, поэтому
+// сообщение и автор проверяются заранее: иначе атомарный пакет не откатится
+BatchWriteResult checkAuthor(Database& db, const BatchOp& op, int& chatId) {
+    int authorId;
+    string text;
+    chatId = db.getMessageChatId(op.id);
+    if (chatId == -1 || !db.getMessageInfo(op.id, authorId, text)) {
+        return failed(404, "Message not found");
+    }
+    if (authorId != op.userId) {
+        return failed(403, "Access denied");
+    }
+    return BatchWriteResult{};
+}
+
+BatchWriteResult executeWrite(Database& db, const BatchOp& op) {
+    if (op.errorStatus != 0) {
+        return failed(op.errorStatus, op.error);
+    }
+
+    switch (op.type) {
+    case BatchOpType::CreateChat: {
+        int chatId = db.createChat(op.text, op.isGroup, op.userId, op.participants);
+        return chatId == -1 ? failed(400, "Failed to create chat") : created(chatId);
+    }
+    case BatchOpType::AddContact: {
+        int result = db.addContact(op.userId, op.otherUserId);
+        switch (result) {
+        case -1: return failed(400, "Cannot add yourself as contact");
+        case -2: return failed(400, "Contact already exists");
+        case -3: return failed(404, "User not found");
+        case -4: return failed(500, "Database error");
+        default: return result > 0 ? created(result) : failed(500, "Unknown error");
+        }
+    }
+    case BatchOpType::SendMessage: {
+        int messageId = db.sendMessage(op.userId, op.chatId, op.text, op.replyId, op.resendId);
+        if (messageId == -1) {
+            return failed(400, "Failed to send message");
+        }
+        auto result = created(messageId);
+        result.changedChatId = op.chatId;
+        return result;
+    }
+    case BatchOpType::EditMessage:
+    case BatchOpType::DeleteMessage: {
+        int chatId;
+        BatchWriteResult result = checkAuthor(db, op, chatId);
+        if (result.status != 200) {
+            return result;
+        }
+        bool done = op.type == BatchOpType::EditMessage
+            ? db.editMessage(op.id, op.text, op.userId)
+            : db.deleteMessage(op.id, op.userId);
+        if (!done) {
+            return failed(500, "Database error");
+        }
+        result.changedChatId = chatId;
+        return result;
+    }
+    case BatchOpType::ForwardMessage: {
+        int originalUserId;
+        string originalMsg;
+        if (!db.getMessageInfo(op.id, originalUserId, originalMsg)) {
+            return failed(404, "Original message not found");
+        }
+        int messageId = db.sendMessage(op.userId, op.chatId, "[Forwarded] " + originalMsg, 0, originalUserId);
+        if (messageId == -1) {
+            return failed(400, "Failed to forward message");
+        }
+        auto result = created(messageId);
+        result.changedChatId = op.chatId;
+        return result;
+    }
+    default:
+        return failed(400, "Not a write operation");
+    }
+}
+
+}
+
+bool isBatchWrite(BatchOpType type) {
+    switch (type) {
+    case BatchOpType::CreateChat:
+    case BatchOpType::AddContact:
+    case BatchOpType::SendMessage:
+    case BatchOpType::EditMessage:
+    case BatchOpType::DeleteMessage:
+    case BatchOpType::ForwardMessage:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool BatchRequest::hasWrites() const {
+    for (const auto& op : ops) {
+        if (isBatchWrite(op.type) && op.errorStatus == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parseBatch(const crow::request& req, BatchRequest& batch, string& error) {
+    return isMsgPackBody(req)
+        ? parseMsgPackBatch(req.body, batch, error)
+        : parseJsonBatch(req.body, batch, error);
+}
+
+vector<BatchWriteResult> executeBatchWrites(Database& db, const vector<BatchOp>& ops, bool atomic) {
+    vector<BatchWriteResult> results;
+    bool hasWrites = false;
+    for (const auto& op : ops) {
+        hasWrites = hasWrites || (isBatchWrite(op.type) && op.errorStatus == 0);
+    }
+
+    if (hasWrites && !db.beginTransaction()) {
+        throw runtime_error("Failed to begin transaction");
+    }
+
+    bool anyFailed = false;
+    try {
+        for (const auto& op : ops) {
+            if (isBatchWrite(op.type)) {
+                results.push_back(executeWrite(db, op));
+                anyFailed = anyFailed || results.back().status != 200;
+            }
+        }
+    }
+    catch (...) {
+        if (hasWrites) {
+            db.rollbackTransaction();
+        }
+        throw;
+    }
+
+    if (!hasWrites) {
+        return results;
+    }
+
+    if (atomic && anyFailed) {
+        db.rollbackTransaction();
+        for (auto& result : results) {
+            if (result.status == 200) {
+                result = failed(409, "Rolled back: another operation in the batch failed");
+            }
+        }
+    }
+    else if (!db.commitTransaction()) {
+        db.rollbackTransaction();
+        throw runtime_error("Failed to commit batch");
+    }
+    return results;
+}
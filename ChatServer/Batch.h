@@ -0,0 +1,64 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+#include <crow.h>
+
+#include "Database.h"
+
+// Пакет операций POST /batch. Тело (JSON или MessagePack):
+//   {"ops": [{"method": "GET", "path": "/chats/1"},
+//            {"method": "POST", "path": "/messages", "body": {...}}, ...],
+//    "atomic": false}
+// Операции - те же маршруты, что и по отдельности (кроме авторизации,
+// ожидания сообщений и метрик). Записи выполняются первыми, по порядку,
+// в одной транзакции; затем чтения - параллельно, так что они видят
+// записи пакета. С "atomic": true ошибка любой записи откатывает все.
+enum class BatchOpType {
+    GetChats, GetContacts, GetUser, SearchUsers, GetMessages,
+    CreateChat, AddContact, SendMessage, EditMessage, DeleteMessage, ForwardMessage
+};
+
+bool isBatchWrite(BatchOpType type);
+
+struct BatchOp {
+    BatchOpType type = BatchOpType::GetChats;
+    int id = 0;                     // id из пути: пользователь, чат или сообщение
+    int userId = 0;
+    int otherUserId = 0;            // второй пользователь контакта
+    int chatId = 0;
+    int replyId = 0;
+    int resendId = 0;
+    bool isGroup = false;
+    std::string text;               // сообщение, название чата или строка поиска
+    std::vector<int> participants;
+
+    // Операцию не удалось разобрать: ответ на нее - эта ошибка
+    int errorStatus = 0;
+    std::string error;
+};
+
+struct BatchRequest {
+    std::vector<BatchOp> ops;
+    bool atomic = false;
+
+    bool hasWrites() const;
+};
+
+// Итог записи, выполненной в потоке базы
+struct BatchWriteResult {
+    int status = 200;
+    int id = 0;                     // id созданной записи, 0 - ответ без id
+    bool hasId = false;
+    std::string error;
+    int changedChatId = 0;          // чат, сообщения которого изменились
+};
+
+constexpr size_t maxBatchOps = 64;
+
+// false - тело не разобрано или операций больше maxBatchOps
+bool parseBatch(const crow::request& req, BatchRequest& batch, std::string& error);
+
+// Все записи пакета по порядку в одной транзакции. Результаты - по одному
+// на каждую операцию-запись, в том же порядке
+std::vector<BatchWriteResult> executeBatchWrites(Database& db, const std::vector<BatchOp>& ops, bool atomic);
@@ -0,0 +1,151 @@
+﻿#include "BulkMessages.h"
+
+#include <cctype>
+#include <exception>
+#include <stdexcept>
+
+#include "MsgPack.h"
+#include "WireFormat.h"
+
+using namespace std;
+
+namespace {
+
+bool isNdjson(const crow::request& req) {
+    const string& type = req.get_header_value("Content-Type");
+    return type.find("ndjson") != string::npos || type.find("jsonl") != string::npos;
+}
+
+// Формат send_date: 19 символов, цифры на своих местах
+bool validSendDate(const string& value) {
+    const char* pattern = "0000-00-00 00:00:00";
+    if (value.size() != 19) {
+        return false;
+    }
+    for (size_t i = 0; i < value.size(); i++) {
+        bool digit = isdigit(static_cast<unsigned char>(value[i])) != 0;
+        if (pattern[i] == '0' ? !digit : value[i] != pattern[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Номер сообщения в ошибке - с единицы, как строка NDJSON
+bool readMessage(const RequestBody& body, size_t index, vector<NewMessage>& messages, string& error) {
+    if (!body) {
+        error = "Message " + to_string(index + 1) + ": expected an object";
+        return false;
+    }
+    if (messages.size() >= maxBulkMessages) {
+        error = "Too many messages (max " + to_string(maxBulkMessages) + ")";
+        return false;
+    }
+
+    NewMessage msg;
+    try {
+        msg.userId = static_cast<int>(body.i("userId"));
+        msg.msg = body.s("message");
+        msg.replyId = body.has("replyId") ? static_cast<int>(body.i("replyId")) : 0;
+        msg.resendId = body.has("resendId") ? static_cast<int>(body.i("resendId")) : 0;
+        msg.sendDate = body.has("sendDate") ? body.s("sendDate") : "";
+    }
+    catch (const exception& e) {
+        error = "Message " + to_string(index + 1) + ": " + e.what();
+        return false;
+    }
+    if (msg.userId <= 0) {
+        error = "Message " + to_string(index + 1) + ": invalid userId";
+        return false;
+    }
+    if (!msg.sendDate.empty() && !validSendDate(msg.sendDate)) {
+        error = "Message " + to_string(index + 1) + ": sendDate must be YYYY-MM-DD HH:MM:SS";
+        return false;
+    }
+    messages.push_back(move(msg));
+    return true;
+}
+
+bool parseJsonArray(const string& data, vector<NewMessage>& messages, string& error) {
+    auto json = crow::json::load(data);
+    if (!json || json.t() != crow::json::type::List) {
+        error = "Expected a JSON array of messages";
+        return false;
+    }
+    messages.reserve(min(json.size(), maxBulkMessages));
+    size_t index = 0;
+    for (const auto& item : json) {
+        if (!readMessage(RequestBody(item), index++, messages, error)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parseNdjson(const string& data, vector<NewMessage>& messages, string& error) {
+    size_t index = 0;
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t end = data.find('\n', pos);
+        if (end == string::npos) {
+            end = data.size();
+        }
+        size_t lineEnd = end;
+        if (lineEnd > pos && data[lineEnd - 1] == '\r') {
+            lineEnd--;
+        }
+
+        // Пустые строки (в том числе последняя) пропускаются
+        if (lineEnd > pos) {
+            auto json = crow::json::load(data.data() + pos, lineEnd - pos);
+            if (!json) {
+                error = "Line " + to_string(index + 1) + ": invalid JSON";
+                return false;
+            }
+            if (!readMessage(RequestBody(json), index, messages, error)) {
+                return false;
+            }
+        }
+        index++;
+        pos = end + 1;
+    }
+    return true;
+}
+
+bool parseMsgPackArray(const string& data, vector<NewMessage>& messages, string& error) {
+    msgpack::Reader reader(data);
+    size_t count = 0;
+    if (!reader.array(count)) {
+        error = "Expected a MessagePack array of messages";
+        return false;
+    }
+    messages.reserve(min(count, maxBulkMessages));
+    for (size_t n = 0; n < count; n++) {
+        string_view item;
+        if (!reader.value(item)) {
+            error = "Invalid MessagePack";
+            return false;
+        }
+        if (!readMessage(RequestBody(item), n, messages, error)) {
+            return false;
+        }
+    }
+    if (!reader.atEnd()) {
+        error = "Invalid MessagePack";
+        return false;
+    }
+    return true;
+}
+
+}
+
+bool parseBulkMessages(const crow::request& req, vector<NewMessage>& messages, string& error) {
+    bool ok = isMsgPackBody(req) ? parseMsgPackArray(req.body, messages, error)
+        : isNdjson(req) ? parseNdjson(req.body, messages, error)
+        : parseJsonArray(req.body, messages, error);
+    if (ok && messages.empty()) {
+        error = "No messages";
+        return false;
+    }
+    return ok;
+}
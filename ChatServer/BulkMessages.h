@@ -0,0 +1,18 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+#include <crow.h>
+
+#include "Database.h"
+
+// Тело POST /chats/<id>/messages:bulk - список сообщений одного чата:
+//   JSON-массив [{"userId", "message", "replyId", "resendId", "sendDate"}, ...],
+//   NDJSON (Content-Type: application/x-ndjson) - по объекту в строке,
+//   MessagePack - массив тех же объектов.
+// replyId, resendId и sendDate необязательны; sendDate - "YYYY-MM-DD HH:MM:SS"
+// в UTC, как send_date в базе (импорт истории), без него - время вставки
+constexpr size_t maxBulkMessages = 100000;
+
+// false - тело не разобрано или сообщений больше maxBulkMessages
+bool parseBulkMessages(const crow::request& req, std::vector<NewMessage>& messages, std::string& error);
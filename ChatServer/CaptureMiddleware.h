@@ -0,0 +1,50 @@
+﻿#pragma once
+
+#include <chrono>
+#include <memory>
+#include <crow.h>
+
+#include "TrafficLog.h"
+
+// Middleware записи трафика: включается только если задан writer
+// (ChatServer запускается с --capture=<файл>)
+struct CaptureMiddleware {
+    struct context {
+        std::chrono::steady_clock::time_point started;
+    };
+
+    // Заголовки, без которых повтор запроса получит другой ответ:
+    // формат тела, формат и сжатие ответа, ключ идемпотентности
+    static constexpr const char* capturedHeaders[] = { "Content-Type", "Accept", "Accept-Encoding", "Idempotency-Key" };
+
+    std::unique_ptr<TrafficLogWriter> writer;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+    void before_handle(crow::request& /*req*/, crow::response& /*res*/, context& ctx) {
+        ctx.started = std::chrono::steady_clock::now();
+    }
+
+    void after_handle(crow::request& req, crow::response& res, context& ctx) {
+        if (!writer) {
+            return;
+        }
+
+        using std::chrono::duration_cast;
+        using std::chrono::microseconds;
+
+        CapturedRequest request;
+        request.startUs = duration_cast<microseconds>(ctx.started - origin).count();
+        request.durationUs = duration_cast<microseconds>(std::chrono::steady_clock::now() - ctx.started).count();
+        request.status = res.code;
+        request.method = crow::method_name(req.method);
+        request.url = req.raw_url;
+        request.body = req.body;
+        for (const char* name : capturedHeaders) {
+            const std::string& value = req.get_header_value(name);
+            if (!value.empty()) {
+                request.headers.emplace_back(name, value);
+            }
+        }
+        writer->record(std::move(request));
+    }
+};
@@ -0,0 +1,241 @@
+﻿#include "Channels.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+void lowerThreadPriority() {
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#elif defined(__linux__)
+    // SCHED_BATCH: проснувшийся поток рассылки не вытесняет поток, который
+    // сейчас отвечает клиенту. nice в Linux задается для отдельного потока
+    sched_param param{};
+    pthread_setschedparam(pthread_self(), SCHED_BATCH, &param);
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 10);
+#endif
+}
+
+}
+
+Channels::Channels(Delivery& delivery, const Config& config)
+    : delivery(delivery), config(config), work(asio::make_work_guard(context)) {
+    this->config.threads = max<size_t>(1, config.threads);
+    this->config.batchSize = max<size_t>(1, config.batchSize);
+    for (size_t i = 0; i < this->config.threads; i++) {
+        workers.emplace_back([this]() {
+            lowerThreadPriority();
+            context.run();
+            });
+    }
+}
+
+Channels::~Channels() {
+    // Начатые рассылки дорабатывают до конца
+    work.reset();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void Channels::load(const vector<ChannelMembers>& all) {
+    unique_lock<shared_mutex> lock(m);
+    for (const auto& item : all) {
+        auto& channel = channels[item.chatId];
+        channel.name = item.name;
+        channel.createdBy = item.createdBy;
+        channel.admins = item.admins;
+        sort(channel.admins.begin(), channel.admins.end());
+        for (int userId : item.subscribers) {
+            channel.subscribers->add(static_cast<uint32_t>(userId));
+        }
+    }
+}
+
+void Channels::add(int chatId, string name, int createdBy) {
+    unique_lock<shared_mutex> lock(m);
+    auto& channel = channels[chatId];
+    channel.name = move(name);
+    channel.createdBy = createdBy;
+    channel.admins = { createdBy };
+}
+
+bool Channels::isChannel(int chatId) const {
+    shared_lock<shared_mutex> lock(m);
+    return channels.count(chatId) > 0;
+}
+
+bool Channels::canPost(int chatId, int userId) const {
+    shared_lock<shared_mutex> lock(m);
+    auto it = channels.find(chatId);
+    return it == channels.end() || binary_search(it->second.admins.begin(), it->second.admins.end(), userId);
+}
+
+bool Channels::isSubscribed(int chatId, int userId) const {
+    shared_lock<shared_mutex> lock(m);
+    auto it = channels.find(chatId);
+    return it != channels.end() && it->second.subscribers->contains(static_cast<uint32_t>(userId));
+}
+
+bool Channels::addAdmin(int chatId, int userId) {
+    unique_lock<shared_mutex> lock(m);
+    auto it = channels.find(chatId);
+    if (it == channels.end()) {
+        return false;
+    }
+    auto& admins = it->second.admins;
+    auto pos = lower_bound(admins.begin(), admins.end(), userId);
+    if (pos != admins.end() && *pos == userId) {
+        return false;
+    }
+    admins.insert(pos, userId);
+    return true;
+}
+
+bool Channels::subscribe(int chatId, int userId) {
+    unique_lock<shared_mutex> lock(m);
+    auto it = channels.find(chatId);
+    if (it == channels.end()) {
+        return false;
+    }
+    auto& subscribers = it->second.subscribers;
+    if (subscribers->contains(static_cast<uint32_t>(userId))) {
+        return false;
+    }
+    // Снимок держит рассылка: меняем копию, рассылка дочитает старую карту
+    if (subscribers.use_count() > 1) {
+        subscribers = make_shared<RoaringBitmap>(*subscribers);
+        snapshotCopies.fetch_add(1, memory_order_relaxed);
+    }
+    return subscribers->add(static_cast<uint32_t>(userId));
+}
+
+bool Channels::unsubscribe(int chatId, int userId) {
+    unique_lock<shared_mutex> lock(m);
+    auto it = channels.find(chatId);
+    if (it == channels.end()) {
+        return false;
+    }
+    auto& subscribers = it->second.subscribers;
+    if (!subscribers->contains(static_cast<uint32_t>(userId))) {
+        return false;
+    }
+    if (subscribers.use_count() > 1) {
+        subscribers = make_shared<RoaringBitmap>(*subscribers);
+        snapshotCopies.fetch_add(1, memory_order_relaxed);
+    }
+    return subscribers->remove(static_cast<uint32_t>(userId));
+}
+
+optional<Channels::Info> Channels::info(int chatId) const {
+    shared_lock<shared_mutex> lock(m);
+    auto it = channels.find(chatId);
+    if (it == channels.end()) {
+        return nullopt;
+    }
+    const auto& channel = it->second;
+    return Info{ channel.name, channel.createdBy, channel.admins, channel.subscribers->cardinality() };
+}
+
+bool Channels::post(int chatId, int messageId, function<void()> publish) {
+    auto job = make_shared<Job>();
+    {
+        shared_lock<shared_mutex> lock(m);
+        auto it = channels.find(chatId);
+        if (it == channels.end()) {
+            return false;
+        }
+        job->subscribers = it->second.subscribers;
+    }
+    job->chatId = chatId;
+    job->messageId = messageId;
+    job->started = Clock::now();
+    job->publish = move(publish);
+
+    posts.fetch_add(1, memory_order_relaxed);
+    inFlight.fetch_add(1, memory_order_relaxed);
+    asio::post(context, [this, job]() { split(job); });
+    return true;
+}
+
+void Channels::split(const shared_ptr<Job>& job) {
+    if (job->publish) {
+        job->publish();
+    }
+
+    vector<int> batch;
+    batch.reserve(config.batchSize);
+    job->subscribers->forEach([&](uint32_t userId) {
+        batch.push_back(static_cast<int>(userId));
+        if (batch.size() == config.batchSize) {
+            dispatch(job, move(batch));
+            batch.clear();
+            batch.reserve(config.batchSize);
+        }
+        });
+    if (!batch.empty()) {
+        dispatch(job, move(batch));
+    }
+    finish(*job);
+}
+
+void Channels::dispatch(const shared_ptr<Job>& job, vector<int> batch) {
+    job->pending.fetch_add(1, memory_order_relaxed);
+    asio::post(context, [this, job, batch = move(batch)]() {
+        delivery.deliver(job->chatId, job->messageId, batch);
+        batches.fetch_add(1, memory_order_relaxed);
+        deliveries.fetch_add(batch.size(), memory_order_relaxed);
+        finish(*job);
+        });
+}
+
+void Channels::finish(Job& job) {
+    if (job.pending.fetch_sub(1, memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    uint64_t elapsed = static_cast<uint64_t>(
+        chrono::duration_cast<chrono::microseconds>(Clock::now() - job.started).count());
+    fanOutMicros.fetch_add(elapsed, memory_order_relaxed);
+    uint64_t peak = maxFanOutMicros.load(memory_order_relaxed);
+    while (elapsed > peak && !maxFanOutMicros.compare_exchange_weak(peak, elapsed, memory_order_relaxed)) {
+    }
+    completed.fetch_add(1, memory_order_relaxed);
+    inFlight.fetch_sub(1, memory_order_relaxed);
+}
+
+Channels::Stats Channels::stats() const {
+    Stats s;
+    s.config = config;
+    {
+        shared_lock<shared_mutex> lock(m);
+        s.channels = channels.size();
+        for (const auto& [chatId, channel] : channels) {
+            s.subscribers += channel.subscribers->cardinality();
+            s.bitmapBytes += channel.subscribers->sizeInBytes();
+        }
+    }
+    s.posts = posts.load(memory_order_relaxed);
+    s.batches = batches.load(memory_order_relaxed);
+    s.deliveries = deliveries.load(memory_order_relaxed);
+    s.inFlight = inFlight.load(memory_order_relaxed);
+    s.snapshotCopies = snapshotCopies.load(memory_order_relaxed);
+    uint64_t done = completed.load(memory_order_relaxed);
+    if (done > 0) {
+        s.avgFanOutMs = fanOutMicros.load(memory_order_relaxed) / 1000.0 / done;
+    }
+    s.maxFanOutMs = maxFanOutMicros.load(memory_order_relaxed) / 1000.0;
+    return s;
+}
@@ -0,0 +1,130 @@
+﻿#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <asio.hpp>
+
+#include "Database.h"
+#include "Delivery.h"
+#include "RoaringBitmap.h"
+
+// Каналы: чаты только для чтения, в которые пишут администраторы.
+// Подписчики хранятся в памяти битовой картой (RoaringBitmap), а не
+// строками user_chats: канал на 100 тыс. подписчиков занимает десятки КБ.
+//
+// Публикация раскладывается во входящие подписчиков (Delivery::deliver)
+// в собственном пуле потоков: один обход карты режет подписчиков на пачки
+// по batchSize, пачки выполняются параллельно. Автор получает ответ сразу,
+// а потоки Crow и базы рассылкой не заняты, поэтому остальные чаты ее не ждут.
+// Потоки рассылки работают с пониженным приоритетом: на занятой машине
+// планировщик не вытесняет ими потоки Crow, отвечающие автору и другим чатам.
+// Рассылка читает снимок подписчиков: подписка во время рассылки копирует
+// карту (copy-on-write) вместо ожидания. Пачки соседних публикаций канала
+// могут прийти во входящие в разном порядке - лента сортирует сообщения по id
+class Channels {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Config {
+        size_t threads = 2;
+        size_t batchSize = 2048;        // подписчиков в одной задаче рассылки
+    };
+
+    struct Info {
+        std::string name;
+        int createdBy = 0;
+        std::vector<int> admins;
+        uint64_t subscribers = 0;
+    };
+
+    struct Stats {
+        size_t channels = 0;
+        uint64_t subscribers = 0;
+        size_t bitmapBytes = 0;
+        uint64_t posts = 0;
+        uint64_t batches = 0;
+        uint64_t deliveries = 0;
+        uint64_t inFlight = 0;          // публикаций, рассылка которых не закончена
+        uint64_t snapshotCopies = 0;    // копий карты из-за подписки во время рассылки
+        double avgFanOutMs = 0;         // от публикации до последней пачки
+        double maxFanOutMs = 0;
+        Config config;
+    };
+
+    Channels(Delivery& delivery, const Config& config);
+    ~Channels();
+
+    Channels(const Channels&) = delete;
+    Channels& operator=(const Channels&) = delete;
+
+    // Каналы из базы (при запуске)
+    void load(const std::vector<ChannelMembers>& channels);
+    void add(int chatId, std::string name, int createdBy);
+
+    bool isChannel(int chatId) const;
+    // false - chatId канал, а userId не его администратор
+    bool canPost(int chatId, int userId) const;
+    bool isSubscribed(int chatId, int userId) const;
+
+    // false - канала нет или ничего не изменилось
+    bool addAdmin(int chatId, int userId);
+    bool subscribe(int chatId, int userId);
+    bool unsubscribe(int chatId, int userId);
+
+    std::optional<Info> info(int chatId) const;
+
+    // Рассылка новой публикации канала. publish (WebSocket) выполняется
+    // в пуле перед раскладкой во входящие. false - chatId не канал
+    bool post(int chatId, int messageId, std::function<void()> publish);
+
+    Stats stats() const;
+
+private:
+    struct Channel {
+        std::string name;
+        int createdBy = 0;
+        std::vector<int> admins;        // по возрастанию
+        std::shared_ptr<RoaringBitmap> subscribers = std::make_shared<RoaringBitmap>();
+    };
+
+    // Рассылка одной публикации: завершается, когда отработала последняя пачка
+    struct Job {
+        int chatId;
+        int messageId;
+        Clock::time_point started;
+        std::shared_ptr<const RoaringBitmap> subscribers;
+        std::function<void()> publish;
+        std::atomic<size_t> pending{ 1 };
+    };
+
+    Delivery& delivery;
+    Config config;
+    asio::io_context context;
+    asio::executor_work_guard<asio::io_context::executor_type> work;
+    std::vector<std::thread> workers;
+
+    mutable std::shared_mutex m;
+    std::unordered_map<int, Channel> channels;
+
+    std::atomic<uint64_t> posts{ 0 };
+    std::atomic<uint64_t> batches{ 0 };
+    std::atomic<uint64_t> deliveries{ 0 };
+    std::atomic<uint64_t> inFlight{ 0 };
+    std::atomic<uint64_t> completed{ 0 };
+    std::atomic<uint64_t> fanOutMicros{ 0 };
+    std::atomic<uint64_t> maxFanOutMicros{ 0 };
+    std::atomic<uint64_t> snapshotCopies{ 0 };
+
+    void split(const std::shared_ptr<Job>& job);
+    void dispatch(const std::shared_ptr<Job>& job, std::vector<int> batch);
+    void finish(Job& job);
+};
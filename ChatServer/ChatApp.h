@@ -0,0 +1,30 @@
+﻿#pragma once
+
+#include <crow.h>
+
+#include "CaptureMiddleware.h"
+
+using ChatApp = crow::App<CaptureMiddleware>;
+
+// Crow пишет заголовки ответа и тело отдельными буферами, а asio отправляет
+// за один writev не больше 16 буферов. Ответ с keep-alive не помещается,
+// уходит двумя сегментами, и второй ждет отложенного ACK клиента (~40 мс)
+// из-за алгоритма Нейгла. Crow вызывает start() адаптера сразу после accept,
+// поэтому TCP_NODELAY включается там для каждого принятого сокета
+struct NoDelaySocketAdaptor : crow::SocketAdaptor {
+    using SocketAdaptor::SocketAdaptor;
+
+    template<typename F>
+    void start(F f) {
+        asio::error_code ec;
+        socket().set_option(asio::ip::tcp::no_delay(true), ec);
+        f(asio::error_code());
+    }
+};
+
+// HTTP-сервер приложения; ChatServer создает его сам вместо App::run,
+// чтобы подставить адаптер сокетов
+using ChatHttpServer = crow::Server<ChatApp, NoDelaySocketAdaptor, CaptureMiddleware>;
+
+// WebSocket-соединения приложения (без TLS)
+using ChatWebSocket = crow::websocket::Connection<crow::SocketAdaptor, ChatApp>;
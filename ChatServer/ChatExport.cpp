@@ -0,0 +1,462 @@
+﻿#include "ChatExport.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <crow.h>
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+const char* const exportCsvHeader = "id,chatId,userId,message,replyId,resendId,sendDate\r\n";
+
+namespace {
+
+// Поле CSV: в кавычках, если в нем есть разделитель, кавычка или перевод строки
+void appendCsvField(string& out, const string& value) {
+    if (value.find_first_of(",\"\r\n") == string::npos) {
+        out += value;
+        return;
+    }
+    out += '"';
+    for (char c : value) {
+        if (c == '"') {
+            out += '"';
+        }
+        out += c;
+    }
+    out += '"';
+}
+
+string disposition(const string& fileName) {
+    return "attachment; filename=\"" + fileName + "\"";
+}
+
+// Начало ответа, который пишется в сокет напрямую (см. ExportServer)
+string responseHead(const char* status, const vector<pair<string, string>>& headers) {
+    string head = string("HTTP/1.1 ") + status + "\r\n";
+    for (const auto& [name, value] : headers) {
+        head += name + ": " + value + "\r\n";
+    }
+    head += "Connection: close\r\n\r\n";
+    return head;
+}
+
+void closeSocket(asio::ip::tcp::socket& socket) {
+    asio::error_code ignored;
+    socket.shutdown(asio::ip::tcp::socket::shutdown_both, ignored);
+    socket.close(ignored);
+}
+
+// Диапазон байт из заголовка Range: "bytes=a-b", "bytes=a-" или "bytes=-n".
+// false - заголовок не разобран или диапазонов несколько (тогда отдается весь файл);
+// satisfiable - диапазон пересекается с файлом
+bool parseRange(const string& header, uint64_t size, uint64_t& first, uint64_t& last, bool& satisfiable) {
+    const string prefix = "bytes=";
+    if (header.compare(0, prefix.size(), prefix) != 0 || header.find(',') != string::npos) {
+        return false;
+    }
+    string spec = header.substr(prefix.size());
+    size_t dash = spec.find('-');
+    if (dash == string::npos) {
+        return false;
+    }
+    string from = spec.substr(0, dash);
+    string to = spec.substr(dash + 1);
+    auto digits = [](const string& s) {
+        return !s.empty() && s.size() <= 19 && all_of(s.begin(), s.end(), [](char c) { return c >= '0' && c <= '9'; });
+    };
+
+    satisfiable = true;
+    if (from.empty()) {
+        // Последние n байт
+        if (!digits(to)) {
+            return false;
+        }
+        uint64_t suffix = stoull(to);
+        if (suffix == 0 || size == 0) {
+            satisfiable = false;
+            return true;
+        }
+        first = size - min(suffix, size);
+        last = size - 1;
+        return true;
+    }
+
+    if (!digits(from) || (!to.empty() && !digits(to))) {
+        return false;
+    }
+    first = stoull(from);
+    last = to.empty() ? size - 1 : min<uint64_t>(stoull(to), size - 1);
+    if (!to.empty() && stoull(to) < first) {
+        return false;
+    }
+    satisfiable = first < size;
+    return true;
+}
+
+#ifdef __linux__
+struct FileDescriptor {
+    int fd = -1;
+    explicit FileDescriptor(int fd) : fd(fd) {}
+    ~FileDescriptor() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+};
+#endif
+
+}
+
+bool parseExportFormat(const char* text, ExportFormat& format) {
+    if (!text || strcmp(text, "ndjson") == 0) {
+        format = ExportFormat::Ndjson;
+        return true;
+    }
+    if (strcmp(text, "csv") == 0) {
+        format = ExportFormat::Csv;
+        return true;
+    }
+    return false;
+}
+
+const char* exportExtension(ExportFormat format) {
+    return format == ExportFormat::Csv ? "csv" : "ndjson";
+}
+
+const char* exportContentType(ExportFormat format) {
+    return format == ExportFormat::Csv ? "text/csv; charset=utf-8" : "application/x-ndjson";
+}
+
+void appendExportRows(string& out, ExportFormat format, const vector<Message>& messages) {
+    for (const auto& msg : messages) {
+        if (format == ExportFormat::Csv) {
+            out += to_string(msg.id);
+            out += ',';
+            out += to_string(msg.chatId);
+            out += ',';
+            out += to_string(msg.userId);
+            out += ',';
+            appendCsvField(out, msg.msg);
+            out += ',';
+            out += to_string(msg.replyId);
+            out += ',';
+            out += to_string(msg.resendId);
+            out += ',';
+            appendCsvField(out, msg.sendDate);
+            out += "\r\n";
+            continue;
+        }
+
+        out += "{\"id\":";
+        out += to_string(msg.id);
+        out += ",\"chatId\":";
+        out += to_string(msg.chatId);
+        out += ",\"userId\":";
+        out += to_string(msg.userId);
+        out += ",\"message\":\"";
+        crow::json::escape(msg.msg, out);
+        out += "\",\"replyId\":";
+        out += to_string(msg.replyId);
+        out += ",\"resendId\":";
+        out += to_string(msg.resendId);
+        out += ",\"sendDate\":\"";
+        crow::json::escape(msg.sendDate, out);
+        out += "\"}\n";
+    }
+}
+
+ChatExport::ChatExport(AsyncDatabase& db, const Config& config) : db(db), config(config) {
+}
+
+bool ChatExport::tryStart() {
+    uint64_t active = activeStreams.load(memory_order_relaxed);
+    while (active < config.maxStreams) {
+        if (activeStreams.compare_exchange_weak(active, active + 1, memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ChatExport::finish() {
+    activeStreams.fetch_sub(1, memory_order_relaxed);
+}
+
+asio::awaitable<ChatExport::Page> ChatExport::readPage(int chatId, ExportFormat format, int afterId) {
+    return db.run(DbExecutor::Queue::Read, [chatId, format, afterId, limit = config.pageSize](Database& db) {
+        Page page;
+        auto messages = db.getChatMessagesAfter(chatId, afterId, static_cast<int>(limit));
+        appendExportRows(page.text, format, messages);
+        page.messages = messages.size();
+        page.lastId = messages.empty() ? afterId : messages.back().id;
+        return page;
+        });
+}
+
+asio::awaitable<ChatExport::Page> ChatExport::writePage(shared_ptr<FILE> file, int chatId, ExportFormat format, int afterId) {
+    return db.run(DbExecutor::Queue::Read, [file, chatId, format, afterId, limit = config.pageSize](Database& db) {
+        Page page;
+        auto messages = db.getChatMessagesAfter(chatId, afterId, static_cast<int>(limit));
+        string text;
+        appendExportRows(text, format, messages);
+        if (fwrite(text.data(), 1, text.size(), file.get()) != text.size()) {
+            throw runtime_error("Failed to write export archive");
+        }
+        page.messages = messages.size();
+        page.lastId = messages.empty() ? afterId : messages.back().id;
+        return page;
+        });
+}
+
+asio::awaitable<void> ChatExport::stream(Socket& socket, int chatId, ExportFormat format, int afterId) {
+    streams.fetch_add(1, memory_order_relaxed);
+    try {
+        string fileName = "chat-" + to_string(chatId) + "." + exportExtension(format);
+        string head = responseHead("200 OK", {
+            { "Content-Type", exportContentType(format) },
+            { "Content-Disposition", disposition(fileName) },
+            { "Cache-Control", "no-store" },
+            { "Transfer-Encoding", "chunked" },
+        });
+        // Заголовок CSV - только в начале выгрузки, не при продолжении
+        if (format == ExportFormat::Csv && afterId == 0) {
+            size_t size = strlen(exportCsvHeader);
+            char length[32];
+            snprintf(length, sizeof(length), "%zx\r\n", size);
+            head += length;
+            head += exportCsvHeader;
+            head += "\r\n";
+        }
+        co_await asio::async_write(socket, asio::buffer(head), asio::use_awaitable);
+
+        while (true) {
+            auto page = co_await readPage(chatId, format, afterId);
+            if (page.messages == 0) {
+                break;
+            }
+
+            char length[32];
+            snprintf(length, sizeof(length), "%zx\r\n", page.text.size());
+            array<asio::const_buffer, 3> chunk = {
+                asio::buffer(length, strlen(length)),
+                asio::buffer(page.text),
+                asio::buffer("\r\n", 2),
+            };
+            co_await asio::async_write(socket, chunk, asio::use_awaitable);
+
+            streamedMessages.fetch_add(page.messages, memory_order_relaxed);
+            streamedBytes.fetch_add(page.text.size(), memory_order_relaxed);
+            afterId = page.lastId;
+            if (page.messages < config.pageSize) {
+                break;
+            }
+        }
+        co_await asio::async_write(socket, asio::buffer("0\r\n\r\n", 5), asio::use_awaitable);
+    }
+    catch (const exception&) {
+        aborted.fetch_add(1, memory_order_relaxed);
+    }
+    closeSocket(socket);
+}
+
+string ChatExport::archiveId(int chatId, ExportFormat format) const {
+    return "chat-" + to_string(chatId) + "." + exportExtension(format);
+}
+
+string ChatExport::archivePath(int chatId, ExportFormat format) const {
+    return (filesystem::path(config.directory) / archiveId(chatId, format)).string();
+}
+
+asio::awaitable<ChatExport::Archive> ChatExport::buildArchive(int chatId, ExportFormat format) {
+    Archive archive;
+    archive.id = archiveId(chatId, format);
+    archive.path = archivePath(chatId, format);
+    filesystem::create_directories(config.directory);
+
+    // Одновременные сборки одного архива пишут каждая в свой временный файл
+    string temporary = archive.path + "." + to_string(chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+    shared_ptr<FILE> file(fopen(temporary.c_str(), "wb"), [](FILE* f) {
+        if (f) {
+            fclose(f);
+        }
+        });
+    if (!file) {
+        throw runtime_error("Cannot create " + temporary);
+    }
+
+    try {
+        if (format == ExportFormat::Csv) {
+            fputs(exportCsvHeader, file.get());
+        }
+        int afterId = 0;
+        while (true) {
+            auto page = co_await writePage(file, chatId, format, afterId);
+            archive.messages += page.messages;
+            afterId = page.lastId;
+            if (page.messages < config.pageSize) {
+                break;
+            }
+        }
+        archive.lastId = afterId;
+        if (fflush(file.get()) != 0) {
+            throw runtime_error("Failed to write export archive");
+        }
+    }
+    catch (...) {
+        file.reset();
+        error_code ignored;
+        filesystem::remove(temporary, ignored);
+        throw;
+    }
+
+    file.reset();
+    filesystem::rename(temporary, archive.path);
+    archive.size = filesystem::file_size(archive.path);
+    archivesBuilt.fetch_add(1, memory_order_relaxed);
+    co_return archive;
+}
+
+asio::awaitable<void> ChatExport::sendArchive(Socket& socket, string path, ExportFormat format,
+    string range, string ifRange) {
+    archiveRequests.fetch_add(1, memory_order_relaxed);
+    try {
+        uint64_t size = filesystem::file_size(path);
+        auto modified = static_cast<uint64_t>(filesystem::last_write_time(path).time_since_epoch().count());
+        string etag = "\"" + to_string(size) + "-" + to_string(modified) + "\"";
+
+        uint64_t first = 0;
+        uint64_t last = size == 0 ? 0 : size - 1;
+        bool satisfiable = true;
+        // Range действует, только если архив не менялся (If-Range с ETag)
+        bool partial = !range.empty() && (ifRange.empty() || ifRange == etag) &&
+            parseRange(range, size, first, last, satisfiable);
+
+        vector<pair<string, string>> headers = {
+            { "Content-Type", exportContentType(format) },
+            { "Content-Disposition", disposition(filesystem::path(path).filename().string()) },
+            { "Accept-Ranges", "bytes" },
+            { "ETag", etag },
+        };
+        if (partial && !satisfiable) {
+            headers.push_back({ "Content-Range", "bytes */" + to_string(size) });
+            headers.push_back({ "Content-Length", "0" });
+            string head = responseHead("416 Range Not Satisfiable", headers);
+            co_await asio::async_write(socket, asio::buffer(head), asio::use_awaitable);
+        }
+        else {
+            uint64_t length = size == 0 ? 0 : last - first + 1;
+            if (partial) {
+                headers.push_back({ "Content-Range",
+                    "bytes " + to_string(first) + "-" + to_string(last) + "/" + to_string(size) });
+            }
+            headers.push_back({ "Content-Length", to_string(length) });
+            string head = responseHead(partial ? "206 Partial Content" : "200 OK", headers);
+            co_await asio::async_write(socket, asio::buffer(head), asio::use_awaitable);
+            co_await sendFileRange(socket, path, first, length);
+        }
+    }
+    catch (const exception&) {
+        aborted.fetch_add(1, memory_order_relaxed);
+    }
+    closeSocket(socket);
+}
+
+asio::awaitable<void> ChatExport::reject(Socket& socket, int status, string message,
+    vector<pair<string, string>> headers) {
+    const char* reason = status == 400 ? "Bad Request" :
+        status == 404 ? "Not Found" :
+        status == 405 ? "Method Not Allowed" :
+        status == 429 ? "Too Many Requests" :
+        status == 503 ? "Service Unavailable" : "Internal Server Error";
+    string body = "{\"error\":\"";
+    crow::json::escape(message, body);
+    body += "\"}";
+    headers.push_back({ "Content-Type", "application/json" });
+    headers.push_back({ "Content-Length", to_string(body.size()) });
+    string response = responseHead((to_string(status) + " " + reason).c_str(), headers) + body;
+    try {
+        co_await asio::async_write(socket, asio::buffer(response), asio::use_awaitable);
+    }
+    catch (const exception&) {
+    }
+    closeSocket(socket);
+}
+
+asio::awaitable<void> ChatExport::sendFileRange(Socket& socket, const string& path, uint64_t offset, uint64_t length) {
+#ifdef __linux__
+    // sendfile копирует из кэша страниц прямо в сокет. Сокет неблокирующий:
+    // когда буфер отправки полон, ждем готовности к записи, не занимая поток
+    FileDescriptor file(::open(path.c_str(), O_RDONLY));
+    if (file.fd < 0) {
+        throw runtime_error("Cannot open " + path);
+    }
+    socket.native_non_blocking(true);
+    off_t position = static_cast<off_t>(offset);
+    while (length > 0) {
+        ssize_t sent = ::sendfile(socket.native_handle(), file.fd, &position,
+            static_cast<size_t>(min<uint64_t>(length, 1 << 20)));
+        if (sent > 0) {
+            length -= static_cast<uint64_t>(sent);
+            archiveBytesSent.fetch_add(static_cast<uint64_t>(sent), memory_order_relaxed);
+        }
+        else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            co_await socket.async_wait(Socket::wait_write, asio::use_awaitable);
+        }
+        else if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        else {
+            // Ошибка сокета или файл стал короче заголовка Content-Length
+            throw runtime_error("sendfile failed");
+        }
+    }
+#else
+    ifstream file(path, ios::binary);
+    if (!file) {
+        throw runtime_error("Cannot open " + path);
+    }
+    file.seekg(static_cast<streamoff>(offset));
+    vector<char> buffer(64 * 1024);
+    while (length > 0) {
+        file.read(buffer.data(), static_cast<streamsize>(min<uint64_t>(length, buffer.size())));
+        size_t read = static_cast<size_t>(file.gcount());
+        if (read == 0) {
+            throw runtime_error("Export archive is shorter than expected");
+        }
+        co_await asio::async_write(socket, asio::buffer(buffer.data(), read), asio::use_awaitable);
+        length -= read;
+        archiveBytesSent.fetch_add(read, memory_order_relaxed);
+    }
+#endif
+}
+
+ChatExport::Stats ChatExport::stats() const {
+    Stats s;
+    s.config = config;
+    s.activeStreams = activeStreams.load(memory_order_relaxed);
+    s.streams = streams.load(memory_order_relaxed);
+    s.streamedMessages = streamedMessages.load(memory_order_relaxed);
+    s.streamedBytes = streamedBytes.load(memory_order_relaxed);
+    s.aborted = aborted.load(memory_order_relaxed);
+    s.archivesBuilt = archivesBuilt.load(memory_order_relaxed);
+    s.archiveRequests = archiveRequests.load(memory_order_relaxed);
+    s.archiveBytesSent = archiveBytesSent.load(memory_order_relaxed);
+#ifdef __linux__
+    s.sendfile = true;
+#endif
+    return s;
+}
@@ -0,0 +1,124 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include <asio.hpp>
+
+#include "AsyncDatabase.h"
+#include "Database.h"
+
+// Выгрузка истории чата (GET /chats/<id>/export) для архивов и проверок.
+//
+// Потоковая выгрузка читает сообщения страницами по возрастанию id
+// (getChatMessagesAfter) и пишет каждую страницу кусочком chunked-ответа,
+// когда предыдущий уже ушел в сокет: в памяти - одна страница, сколько бы
+// ни было сообщений, и медленный клиент не накапливает буфер. Каждая
+// страница - короткое чтение в потоке пула базы, так что выгрузка не держит
+// соединение чтения и снимок WAL все время. Прерванную выгрузку продолжают
+// с ?afterId=<последний полученный id>.
+//
+// Архив - файл той же выгрузки в каталоге directory, созданный заранее
+// (POST .../export/archive). Он отдается через sendfile (Linux) без копирования
+// в память процесса, с поддержкой Range для докачки больших файлов.
+//
+// Ответы пишутся в сокет напрямую, поэтому их отдает отдельный порт
+// (ExportServer), а не соединения Crow.
+enum class ExportFormat { Ndjson, Csv };
+
+bool parseExportFormat(const char* text, ExportFormat& format);
+const char* exportExtension(ExportFormat format);
+const char* exportContentType(ExportFormat format);
+
+// NDJSON: {"id", "chatId", "userId", "message", "replyId", "resendId", "sendDate"} в строке.
+// CSV (RFC 4180): строка заголовка exportCsvHeader, затем те же поля
+void appendExportRows(std::string& out, ExportFormat format, const std::vector<Message>& messages);
+extern const char* const exportCsvHeader;
+
+class ChatExport {
+public:
+    using Socket = asio::ip::tcp::socket;
+
+    struct Config {
+        std::string directory = "exports";
+        size_t pageSize = 2000;         // сообщений в одном кусочке ответа
+        size_t maxStreams = 8;          // одновременных выгрузок и отдач архивов
+    };
+
+    struct Archive {
+        std::string id;                 // имя файла архива, без каталога
+        std::string path;
+        uint64_t size = 0;
+        uint64_t messages = 0;
+        int lastId = 0;
+    };
+
+    struct Stats {
+        uint64_t activeStreams = 0;
+        uint64_t streams = 0;           // потоковых выгрузок начато
+        uint64_t streamedMessages = 0;
+        uint64_t streamedBytes = 0;
+        uint64_t aborted = 0;           // клиент закрыл соединение до конца ответа
+        uint64_t archivesBuilt = 0;
+        uint64_t archiveRequests = 0;
+        uint64_t archiveBytesSent = 0;
+        bool sendfile = false;
+        Config config;
+    };
+
+    ChatExport(AsyncDatabase& db, const Config& config);
+
+    ChatExport(const ChatExport&) = delete;
+    ChatExport& operator=(const ChatExport&) = delete;
+
+    // Место для еще одной выгрузки; false - их уже maxStreams. Освобождается finish()
+    bool tryStart();
+    void finish();
+
+    // Весь ответ (заголовки и тело) в сокет, после него сокет закрывается.
+    // Обрыв соединения клиентом не исключение: выгрузка считается прерванной
+    asio::awaitable<void> stream(Socket& socket, int chatId, ExportFormat format, int afterId);
+
+    // Файл архива: пишется во временный и переименовывается, когда готов
+    asio::awaitable<Archive> buildArchive(int chatId, ExportFormat format);
+    std::string archiveId(int chatId, ExportFormat format) const;
+    std::string archivePath(int chatId, ExportFormat format) const;
+
+    // Ответ с файлом архива. range и ifRange - заголовки Range и If-Range запроса
+    asio::awaitable<void> sendArchive(Socket& socket, std::string path, ExportFormat format,
+        std::string range, std::string ifRange);
+
+    // Ответ-ошибка {"error": message} и закрытие сокета
+    asio::awaitable<void> reject(Socket& socket, int status, std::string message,
+        std::vector<std::pair<std::string, std::string>> headers = {});
+
+    Stats stats() const;
+
+private:
+    AsyncDatabase& db;
+    Config config;
+
+    std::atomic<uint64_t> activeStreams{ 0 };
+    std::atomic<uint64_t> streams{ 0 };
+    std::atomic<uint64_t> streamedMessages{ 0 };
+    std::atomic<uint64_t> streamedBytes{ 0 };
+    std::atomic<uint64_t> aborted{ 0 };
+    std::atomic<uint64_t> archivesBuilt{ 0 };
+    std::atomic<uint64_t> archiveRequests{ 0 };
+    std::atomic<uint64_t> archiveBytesSent{ 0 };
+
+    // Страница выгрузки в потоке пула базы: текст строк, число сообщений и последний id
+    struct Page {
+        std::string text;
+        size_t messages = 0;
+        int lastId = 0;
+    };
+    asio::awaitable<Page> readPage(int chatId, ExportFormat format, int afterId);
+    // То же, но текст страницы дописывается в файл архива там же, в потоке пула
+    asio::awaitable<Page> writePage(std::shared_ptr<std::FILE> file, int chatId, ExportFormat format, int afterId);
+
+    asio::awaitable<void> sendFileRange(Socket& socket, const std::string& path, uint64_t offset, uint64_t length);
+};
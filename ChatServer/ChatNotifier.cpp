@@ -0,0 +1,82 @@
+﻿#include "ChatNotifier.h"
+
+#include <algorithm>
+
+using namespace std;
+
+ChatNotifier::Subscription::~Subscription() {
+    notifier.remove(this);
+}
+
+asio::awaitable<bool> ChatNotifier::Subscription::wait(chrono::milliseconds timeout) {
+    // Отмена таймера выполняется в том же исполнителе, поэтому между проверкой
+    // флага и началом ожидания уведомление потеряться не может
+    if (notified) {
+        co_return true;
+    }
+
+    timer.expires_after(timeout);
+    co_await timer.async_wait(asio::as_tuple(asio::use_awaitable));
+    co_return notified.load();
+}
+
+asio::awaitable<shared_ptr<ChatNotifier::Subscription>> ChatNotifier::subscribe(int chatId) {
+    auto subscription = make_shared<Subscription>(*this, chatId, co_await asio::this_coro::executor);
+
+    lock_guard<mutex> lock(m);
+    subscribers[chatId].push_back(subscription.get());
+    total++;
+    co_return subscription;
+}
+
+void ChatNotifier::notify(int chatId) {
+    // Ссылки на подписки отпускаются вне блокировки: последняя ссылка
+    // вызывает деструктор, который сам захватывает мьютекс
+    vector<shared_ptr<Subscription>> woken;
+    {
+        lock_guard<mutex> lock(m);
+        auto it = subscribers.find(chatId);
+        if (it == subscribers.end()) {
+            return;
+        }
+
+        for (auto* subscription : it->second) {
+            // Подписка может уже удаляться в своем потоке - тогда пропускаем
+            auto alive = subscription->weak_from_this().lock();
+            if (alive) {
+                alive->notified = true;
+                woken.push_back(move(alive));
+            }
+        }
+    }
+
+    for (auto& subscription : woken) {
+        asio::post(subscription->timer.get_executor(), [subscription]() {
+            subscription->timer.cancel();
+        });
+    }
+}
+
+size_t ChatNotifier::waiting() const {
+    lock_guard<mutex> lock(m);
+    return total;
+}
+
+void ChatNotifier::remove(Subscription* subscription) {
+    lock_guard<mutex> lock(m);
+    auto it = subscribers.find(subscription->chatId);
+    if (it == subscribers.end()) {
+        return;
+    }
+
+    auto& list = it->second;
+    auto pos = find(list.begin(), list.end(), subscription);
+    if (pos != list.end()) {
+        *pos = list.back();
+        list.pop_back();
+        total--;
+    }
+    if (list.empty()) {
+        subscribers.erase(it);
+    }
+}
@@ -0,0 +1,48 @@
+﻿#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <asio.hpp>
+
+// Уведомления о новых сообщениях для корутин-обработчиков (long polling).
+// Подписка ждет на таймере в своем исполнителе; notify() из любого потока
+// помечает подписку и отменяет ее таймер через post в этот исполнитель.
+class ChatNotifier {
+public:
+    class Subscription : public std::enable_shared_from_this<Subscription> {
+    public:
+        Subscription(ChatNotifier& notifier, int chatId, const asio::any_io_executor& ex)
+            : notifier(notifier), chatId(chatId), timer(ex) {}
+        ~Subscription();
+
+        // Ожидание уведомления не дольше timeout. true - уведомление пришло
+        asio::awaitable<bool> wait(std::chrono::milliseconds timeout);
+
+    private:
+        friend class ChatNotifier;
+
+        ChatNotifier& notifier;
+        int chatId;
+        asio::steady_timer timer;
+        std::atomic<bool> notified{ false };
+    };
+
+    // Подписываться нужно до чтения из базы, чтобы не пропустить сообщение,
+    // пришедшее между чтением и ожиданием
+    asio::awaitable<std::shared_ptr<Subscription>> subscribe(int chatId);
+
+    void notify(int chatId);
+
+    size_t waiting() const;
+
+private:
+    mutable std::mutex m;
+    std::unordered_map<int, std::vector<Subscription*>> subscribers;
+    size_t total = 0;
+
+    void remove(Subscription* subscription);
+};
@@ -2,951 +2,2377 @@
 #include <string>
 #include <memory>
 #include <vector>
-#include <functional>
+#include <optional>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <ctime>
+#include <cerrno>
+#include <filesystem>
+#include <limits>
 #include <crow.h>
-#include <sqlite3.h>
+#include <asio/experimental/parallel_group.hpp>
+
+#include "Database.h"
+#include "DatabaseBackup.h"
+#include "DatabaseMaintenance.h"
+#include "DbExecutor.h"
+#include "ExportServer.h"
+#include "Delivery.h"
+#include "Membership.h"
+#include "AsyncDatabase.h"
+#include "AdmissionControl.h"
+#include "Batch.h"
+#include "BulkMessages.h"
+#include "ChatApp.h"
+#include "Channels.h"
+#include "ChatExport.h"
+#include "ChatNotifier.h"
+#include "FanOut.h"
+#include "IdempotencyKeys.h"
+#include "ResponseCache.h"
+#include "ResponseCompression.h"
+#include "RouteRateLimits.h"
+#include "Simd.h"
+#include "SingleFlight.h"
+#include "SocialGraph.h"
+#include "UserCache.h"
+#include "WebSocketPush.h"
+#include "WireFormat.h"
+#include "CoroutineHandler.h"
 
 using namespace std;
 
-// Структуры данных
-struct User {
-    int id;
-    string name;
-    string login;
-    string password;
+// Параметры запуска сервера
+struct ServerConfig {
+    int port = 18080;
+    string dbPath = "chat.db";
+    string capturePath;
+    size_t dbReadThreads = 4;
+    size_t dbQueueCapacity = 1024;
+    bool admissionControl = true;
+    bool rateLimit = true;
+    bool compression = true;
+    size_t compressionThreads = 2;
+    size_t compressionMinSize = 1024;
+    size_t responseCacheBytes = 64 * 1024 * 1024;
+    UserCache::Config userCache;
+    IdempotencyKeys::Config idempotency;
+    OutboundQueue::Config pushQueue;
+    Membership::Config membership;
+    Delivery::Config delivery;
+    Channels::Config channels;
+    ChatExport::Config exports;
+    ExportServer::Config exportServer; // порт 0 - port + 1
+    DatabaseBackup::Config backup;
+    bool maintenance = true;
+    bool convertAutoVacuum = false;
+    DatabaseMaintenance::Config dbMaintenance;
+    string adminToken;              // пусто - /admin/* отключены
 };
 
-// Структура для информации о пользователе
-struct UserInfo {
-    int id;
-    string name;
-    string login;
-};
+class ChatServer {
+private:
+    // Порядок важен: корутины в io_context Crow держат подписки notifier
+    // и разрешения admission, а задачи пула отправляют результаты в io_context
+    ChatNotifier notifier;
+    FanOut fanOut;
+    unique_ptr<AdmissionControl> admission;
+    RouteRateLimits rateLimits;
+    ResourceVersions chatVersions;
+    unique_ptr<ResponseCache> responseCache;
+    SingleFlight flights;
+    ChatApp app;
+    // Middleware и сервер HTTP; сервер создается в run()
+    tuple<CaptureMiddleware> middlewares;
+    unique_ptr<ChatHttpServer> httpServer;
+    // Как и Crow, io_context выгрузок получает результаты пула базы,
+    // поэтому живет дольше dbExecutor; остановлен он раньше (~ChatServer)
+    unique_ptr<ExportServer> exportServer;
+    // Соединения базы сбрасывают записи кэша профилей и версии чатов
+    // участников (userChanged), поток записи сохраняет ключи идемпотентности
+    // и сообщает размер WAL обслуживанию, поэтому кэш, участники, ключи
+    // и обслуживание живут дольше них
+    unique_ptr<UserCache> userCache;
+    unique_ptr<Membership> membership;
+    unique_ptr<IdempotencyKeys> idempotency;
+    unique_ptr<DatabaseMaintenance> maintenance;
+    unique_ptr<DbExecutor> dbExecutor;
+    unique_ptr<AsyncDatabase> db;
+    unique_ptr<ResponseCompressor> compressor;
+    unique_ptr<SocialGraph> socialGraph;
+    unique_ptr<Delivery> delivery;
+    unique_ptr<Channels> channels;
+    unique_ptr<ChatExport> exporter;
+    unique_ptr<DatabaseBackup> backup;
+    string adminToken;
+    OutboundQueue::Config pushQueue;
+
+    // Время запуска в ETag: версии чатов после перезапуска начинаются заново
+    string etagEpoch = to_string(chrono::duration_cast<chrono::milliseconds>(
+        chrono::system_clock::now().time_since_epoch()).count());
+
+    // Максимальное время ожидания новых сообщений
+    static constexpr long maxWaitMs = 60000;
+
+    // Максимум сообщений в ответе long polling
+    static constexpr int maxWaitMessages = 500;
+
+    // Максимум id в GET /users?ids=
+    static constexpr size_t maxUserIds = 500;
 
-// Структура для поиска пользователей
-struct UserSearchResult {
-    int id;
-    string name;
-    string login;
-};
+public:
+    ChatServer(const ServerConfig& config = ServerConfig()) {
+        string dbPath = config.dbPath;
+        userCache = make_unique<UserCache>(config.userCache);
+        idempotency = make_unique<IdempotencyKeys>(config.idempotency);
+        if (config.maintenance) {
+            maintenance = make_unique<DatabaseMaintenance>(dbPath, config.dbMaintenance);
+        }
+        dbExecutor = make_unique<DbExecutor>(
+            [dbPath, this]() {
+                auto db = make_unique<Database>(dbPath);
+                db->onRowsCommitted("users", [this](int64_t rowid) { userChanged(static_cast<int>(rowid)); });
+                if (maintenance) {
+                    db->onWalCommit([this](int frames) { maintenance->walCommitted(frames); });
+                }
+                return db;
+            },
+            config.dbReadThreads, config.dbQueueCapacity);
+        db = make_unique<AsyncDatabase>(*dbExecutor);
+        if (maintenance) {
+            maintenance->start([this]() {
+                return DatabaseMaintenance::Activity{
+                    dbExecutor->pending(DbExecutor::Queue::Read), dbExecutor->pending(DbExecutor::Queue::Write) };
+                });
+        }
+        if (config.admissionControl) {
+            admission = makeAdmissionControl();
+        }
+        rateLimits.enabled = config.rateLimit;
+        if (config.compression) {
+            ResponseCompressor::Config compression;
+            compression.threads = config.compressionThreads;
+            compression.minSize = config.compressionMinSize;
+            compressor = make_unique<ResponseCompressor>(compression);
+        }
+        responseCache = make_unique<ResponseCache>(config.responseCacheBytes);
+        pushQueue = config.pushQueue;
+        membership = make_unique<Membership>(config.membership);
+        socialGraph = make_unique<SocialGraph>();
+        delivery = make_unique<Delivery>(config.delivery, *membership);
+        channels = make_unique<Channels>(*delivery, config.channels);
+        exporter = make_unique<ChatExport>(*db, config.exports);
+        exportServer = make_unique<ExportServer>(*exporter, config.exportServer,
+            [this, &stream = rateLimits.route("GET /chats/<id>/export", 5),
+            &archive = rateLimits.route("GET /chats/<id>/export/archive", 2)](
+                const crow::request& req, ExportServer::Target target, uint32_t& retryAfterMs) {
+                return rateLimits.consume(req, target == ExportServer::Target::Archive ? archive : stream, 0, retryAfterMs);
+            },
+            [this](int chatId) { return chatExists(chatId); });
+        backup = make_unique<DatabaseBackup>(dbPath, config.backup, [this]() {
+            return dbExecutor->pending(DbExecutor::Queue::Write) > 0;
+            });
+        adminToken = config.adminToken;
+        loadMembership();
+        setupRoutes();
+    }
 
-struct Chat {
-    int id;
-    string name;
-    bool isGroup;
-    int createdBy;
-    string createdAt;
-};
+    // Поток обслуживания опрашивает очереди dbExecutor, а живет дольше него
+    ~ChatServer() {
+        exportServer->stop();
+        if (maintenance) {
+            maintenance->stop();
+        }
+    }
 
-struct Message {
-    int id;
-    int userId;
-    int chatId;
-    string msg;
-    int replyId; // 0 если нет reply
-    string sendDate;
-    int resendId; // 0 если нет пересылки
-};
+    // Запись всех запросов в бинарный журнал для последующего воспроизведения
+    void enableCapture(const string& path) {
+        auto& capture = get<CaptureMiddleware>(middlewares);
+        capture.origin = chrono::steady_clock::now();
+        capture.writer = make_unique<TrafficLogWriter>(path);
+        cout << "Capturing traffic to " << path << endl;
+    }
 
-struct Contact {
-    int id;
-    int userId1;
-    int userId2;
-};
+    void run(int port = 18080) {
+        cout << "Chat Server running on port " << port << endl;
+        exportServer->start();
+        cout << "Chat exports on port " << exportServer->port() << endl;
+
+        // То же, что App::run, но с адаптером NoDelaySocketAdaptor
+        app.multithreaded();
+#ifndef CROW_DISABLE_STATIC_DIR
+        app.add_blueprint();
+        app.add_static_dir();
+#endif
+        app.validate();
+        httpServer = make_unique<ChatHttpServer>(&app, app.bindaddr(), static_cast<uint16_t>(port),
+            string("Crow/") + crow::VERSION, &middlewares, app.concurrency());
+        for (int signal : app.signals()) {
+            httpServer->signal_add(signal);
+        }
+        httpServer->run();
+    }
 
-class Database {
 private:
-    sqlite3* db;
+    using RouteClass = AdmissionControl::RouteClass;
+
+    struct MembershipRows {
+        vector<ChatMembers> chats;
+        vector<ChannelMembers> channels;
+        vector<pair<int, string>> users;
+        vector<Contact> contacts;
+    };
+
+    // Участники чатов, подписчики каналов и граф контактов - при запуске
+    void loadMembership() {
+        promise<MembershipRows> rows;
+        dbExecutor->submit(DbExecutor::Queue::Read, [&rows](Database& db) {
+            try {
+                rows.set_value({ db.getAllChatMembers(), db.getAllChannels(), db.getAllUserNames(), db.getAllContacts() });
+            }
+            catch (...) {
+                rows.set_exception(current_exception());
+            }
+            });
+        auto loaded = rows.get_future().get();
+        membership->load(loaded.chats);
+        delivery->load(loaded.chats);
+        channels->load(loaded.channels);
+        socialGraph->load(loaded.users, loaded.contacts);
+    }
 
-    // Хелпер функция для выполнения SQL запросов
-    bool executeSQL(const string& sql,
-        const vector<pair<int, string>>& params = {},
-        function<void(sqlite3_stmt*)> callback = nullptr) {
-        sqlite3_stmt* stmt;
+    // Лимиты по классам маршрутов. Записи идут через единственного писателя
+    // SQLite, поэтому держать много одновременных записей бессмысленно
+    static unique_ptr<AdmissionControl> makeAdmissionControl() {
+        AdmissionControl::Config auth;
+        auth.initialLimit = 8;
+        auth.maxLimit = 64;
+        auth.maxQueue = 128;
+
+        AdmissionControl::Config read;
+        read.initialLimit = 32;
+        read.minLimit = 4;
+        read.maxLimit = 512;
+        read.maxQueue = 512;
+
+        AdmissionControl::Config write;
+        write.initialLimit = 8;
+        write.minLimit = 1;
+        write.maxLimit = 64;
+        write.maxQueue = 256;
+
+        return make_unique<AdmissionControl>(auth, read, write);
+    }
 
-        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-            cerr << "SQL error: " << sqlite3_errmsg(db) << endl;
-            return false;
+    // Обработчик-корутина: работа с базой через co_await db->...,
+    // поток Crow на время ожидания освобождается. Ответ сжимается,
+    // если клиент это принимает (см. ResponseCompressor::encode)
+    template <typename Handler>
+    void handle(const crow::request& req, crow::response& res, Handler handler) {
+        auto encoding = acceptedEncoding(req);
+        if (encoding == ContentEncoding::Identity) {
+            return spawnHandler(req, res, move(handler), &ChatServer::errorResponse);
+        }
+
+        spawnHandler(req, res, [this, encoding, handler = move(handler)]() -> asio::awaitable<crow::response> {
+            co_return co_await compressor->encode(encoding, co_await handler());
+            }, &ChatServer::errorResponse);
+    }
+
+    // То же с контролем допуска: сначала ждем слот своего класса маршрутов
+    template <typename Handler>
+    void handle(const crow::request& req, crow::response& res, RouteClass routeClass, Handler handler) {
+        if (!admission) {
+            return handle(req, res, move(handler));
         }
 
-        // Биндим параметры
-        for (size_t i = 0; i < params.size(); i++) {
-            int index = i + 1;
-            int type = params[i].first;
-            const string& value = params[i].second;
+        handle(req, res, [this, routeClass, handler = move(handler)]() -> asio::awaitable<crow::response> {
+            auto permit = co_await admission->admit(routeClass);
+            co_return co_await handler();
+            });
+    }
 
-            if (type == SQLITE_INTEGER) {
-                sqlite3_bind_int(stmt, index, stoi(value));
-            }
-            else if (type == SQLITE_TEXT) {
-                sqlite3_bind_text(stmt, index, value.c_str(), -1, SQLITE_TRANSIENT);
-            }
+    ContentEncoding acceptedEncoding(const crow::request& req) const {
+        if (!compressor) {
+            return ContentEncoding::Identity;
         }
+        return negotiateEncoding(req.get_header_value("Accept-Encoding"));
+    }
 
-        bool result = true;
-        if (callback) {
-            while (sqlite3_step(stmt) == SQLITE_ROW) {
-                callback(stmt);
-            }
+    static bool etagMatches(const crow::request& req, const string& etag) {
+        const auto& header = req.get_header_value("If-None-Match");
+        return header == "*" || header.find(etag) != string::npos;
+    }
+
+    static string messagesCacheKey(WireFormat format, int chatId) {
+        return "messages/" + to_string(chatId) + (format == WireFormat::MsgPack ? "-b" : "");
+    }
+
+    // Ключ одновременной загрузки: ресурс, его версия и кодирование
+    static string flightKey(const string& cacheKey, uint64_t version, ContentEncoding encoding) {
+        return cacheKey + "@" + to_string(version) + "/" + encodingName(encoding);
+    }
+
+    // Тело страницы сообщений без сжатия: из кэша или из базы. Одновременные
+    // промахи по одной версии (все участники группы перечитывают чат после
+    // нового сообщения) выполняют один запрос к базе
+    asio::awaitable<ResponseCache::Body> messagesBody(WireFormat format, int chatId, uint64_t version) {
+        string key = messagesCacheKey(format, chatId);
+        auto body = responseCache->get(key, version, ContentEncoding::Identity);
+        if (!body) {
+            body = co_await flights.run(flightKey(key, version, ContentEncoding::Identity),
+                loadMessagesBody(format, chatId, version));
         }
-        else {
-            result = sqlite3_step(stmt) == SQLITE_DONE;
+        co_return body;
+    }
+
+    // Страница вместе с профилями авторов: отправители и авторы пересланных
+    // сообщений собираются без повторов и читаются одним запросом (кэш профилей,
+    // промахи - одним IN), а не по запросу на сообщение
+    asio::awaitable<ResponseCache::Body> loadMessagesBody(WireFormat format, int chatId, uint64_t version) {
+        auto messages = co_await db->getChatMessages(chatId);
+        vector<int> authorIds;
+        authorIds.reserve(messages.size());
+        for (const auto& msg : messages) {
+            authorIds.push_back(msg.userId);
+            if (msg.resendId > 0) {
+                authorIds.push_back(msg.resendId);
+            }
         }
+        auto authors = co_await cachedUsers(move(authorIds));
+        auto body = make_shared<const string>(messagesResponse(format, messages, &authors).body);
+        responseCache->put(messagesCacheKey(format, chatId), version, ContentEncoding::Identity, body);
+        co_return body;
+    }
 
-        sqlite3_finalize(stmt);
-        return result;
+    asio::awaitable<ResponseCache::Body> compressMessagesBody(WireFormat format, int chatId, uint64_t version,
+        ContentEncoding encoding, ResponseCache::Body body) {
+        auto compressed = co_await compressor->compress(move(body), encoding);
+        responseCache->put(messagesCacheKey(format, chatId), version, encoding, compressed);
+        co_return compressed;
     }
 
-public:
-    Database(const string& dbPath = "chat.db") {
-        if (sqlite3_open(dbPath.c_str(), &db) != SQLITE_OK) {
-            throw runtime_error("Can't open database: " + string(sqlite3_errmsg(db)));
-        }
-        createTables();
-    }
-
-    ~Database() {
-        if (db) {
-            sqlite3_close(db);
-        }
-    }
-
-    void createTables() {
-        const char* tables[] = {
-            R"(
-                CREATE TABLE IF NOT EXISTS users (
-                    id INTEGER PRIMARY KEY AUTOINCREMENT,
-                    name TEXT NOT NULL,
-                    login TEXT UNIQUE NOT NULL,
-                    password TEXT NOT NULL
-                )
-            )",
-            R"(
-                CREATE TABLE IF NOT EXISTS chats (
-                    id INTEGER PRIMARY KEY AUTOINCREMENT,
-                    name TEXT,
-                    is_group INTEGER DEFAULT 0,
-                    created_by INTEGER,
-                    created_at DATETIME DEFAULT CURRENT_TIMESTAMP
-                )
-            )",
-            R"(
-                CREATE TABLE IF NOT EXISTS messages (
-                    id INTEGER PRIMARY KEY AUTOINCREMENT,
-                    user_id INTEGER NOT NULL,
-                    chat_id INTEGER NOT NULL,
-                    msg TEXT NOT NULL,
-                    reply_id INTEGER DEFAULT 0,
-                    send_date DATETIME DEFAULT CURRENT_TIMESTAMP,
-                    resend_id INTEGER DEFAULT 0
-                )
-            )",
-            R"(
-                CREATE TABLE IF NOT EXISTS contacts (
-                    id INTEGER PRIMARY KEY AUTOINCREMENT,
-                    user_id1 INTEGER NOT NULL,
-                    user_id2 INTEGER NOT NULL,
-                    CHECK (user_id1 != user_id2)
-                )
-            )",
-            R"(
-                CREATE TABLE IF NOT EXISTS user_chats (
-                    user_id INTEGER NOT NULL,
-                    chat_id INTEGER NOT NULL,
-                    PRIMARY KEY (user_id, chat_id)
-                )
-            )"
-        };
-
-        for (const char* table : tables) {
-            char* errMsg = nullptr;
-            if (sqlite3_exec(db, table, nullptr, nullptr, &errMsg) != SQLITE_OK) {
-                string error = "SQL error: " + string(errMsg);
-                sqlite3_free(errMsg);
-                cerr << error << endl;
-            }
-        }
-    }
-
-    // Регистрация пользователя
-    int registerUser(const string& name, const string& login, const string& password) {
-        string hashedPassword = to_string(hash<string>{}(password));
-        string sql = "INSERT INTO users (name, login, password) VALUES (?, ?, ?)";
-
-        vector<pair<int, string>> params = {
-            {SQLITE_TEXT, name},
-            {SQLITE_TEXT, login},
-            {SQLITE_TEXT, hashedPassword}
-        };
-
-        if (!executeSQL(sql, params)) {
-            return -1;
-        }
-
-        return sqlite3_last_insert_rowid(db);
-    }
-
-    // Авторизация пользователя
-    bool loginUser(const string& login, const string& password, User& user) {
-        string sql = "SELECT id, name, login, password FROM users WHERE login = ?";
-        vector<pair<int, string>> params = { {SQLITE_TEXT, login} };
-
-        bool found = false;
-        auto callback = [&](sqlite3_stmt* stmt) {
-            string storedHash = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
-            string inputHash = to_string(hash<string>{}(password));
-
-            if (inputHash == storedHash) {
-                user.id = sqlite3_column_int(stmt, 0);
-                user.name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-                user.login = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-                found = true;
+    // Сообщения чата с ETag по версии чата. Тело текущей версии берется
+    // из кэша вместе со сжатым вариантом; при промахе запрос к базе
+    // и сжатие выполняются один раз, следующие запросы отдаются из кэша
+    asio::awaitable<crow::response> cachedMessages(const crow::request& req, int chatId) {
+        auto format = responseFormat(req);
+        const char* suffix = format == WireFormat::MsgPack ? "-b" : "";
+        uint64_t version = chatVersions.get(chatId);
+        string etag = "\"m" + to_string(chatId) + "-" + etagEpoch + "-" + to_string(version) + suffix + "\"";
+
+        crow::response response;
+        response.set_header("ETag", etag);
+        response.set_header("Vary", "Accept, Accept-Encoding");
+        if (etagMatches(req, etag)) {
+            response.code = 304;
+            co_return response;
+        }
+
+        auto encoding = acceptedEncoding(req);
+        string key = messagesCacheKey(format, chatId);
+        auto body = encoding != ContentEncoding::Identity ? responseCache->get(key, version, encoding) : nullptr;
+        if (!body) {
+            body = co_await messagesBody(format, chatId, version);
+
+            if (encoding != ContentEncoding::Identity && body->size() >= compressor->minSize()) {
+                body = co_await flights.run(flightKey(key, version, encoding),
+                    compressMessagesBody(format, chatId, version, encoding, body));
+            }
+            else {
+                encoding = ContentEncoding::Identity;
             }
-            };
+        }
 
-        executeSQL(sql, params, callback);
-        return found;
-    }
-
-    // Получение пользователя по ID
-    bool getUserById(int userId, UserInfo& user) {
-        string sql = "SELECT id, name, login FROM users WHERE id = ?";
-        vector<pair<int, string>> params = { {SQLITE_INTEGER, to_string(userId)} };
-
-        bool found = false;
-        auto callback = [&](sqlite3_stmt* stmt) {
-            user.id = sqlite3_column_int(stmt, 0);
-            user.name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-            user.login = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-            found = true;
-            };
-
-        executeSQL(sql, params, callback);
-        return found;
+        // Ответ уже сжат, handle() не будет сжимать его повторно
+        response.code = 200;
+        response.body = *body;
+        response.set_header("Content-Type", contentType(format));
+        if (encoding != ContentEncoding::Identity) {
+            response.set_header("Content-Encoding", encodingName(encoding));
+        }
+        co_return response;
     }
 
-    // Поиск пользователей
-    vector<UserSearchResult> searchUsers(const string& searchQuery) {
-        vector<UserSearchResult> result;
-
-        string sql = "SELECT id, name, login FROM users WHERE (login LIKE ? OR name LIKE ?) AND id > 0";
-        vector<pair<int, string>> params = {
-            {SQLITE_TEXT, "%" + searchQuery + "%"},
-            {SQLITE_TEXT, "%" + searchQuery + "%"}
-        };
+    // Запись в потоке записи; с ключом - не более одного раза на ключ
+    // (см. IdempotencyKeys). Повтор, найденный в памяти, не доходит до базы
+    asio::awaitable<IdempotencyKeys::Result> writeOnce(optional<IdempotencyKeys::Key> key,
+        function<int(Database&)> write) {
+        IdempotencyKeys::Result result;
+        if (!key) {
+            result.id = co_await db->run(DbExecutor::Queue::Write, move(write));
+            co_return result;
+        }
+        if (auto found = idempotency->find(*key)) {
+            co_return *found;
+        }
+        result = co_await runIdempotent(*key, move(write));
+        if (result.id > 0) {
+            idempotency->remember(*key, result.id);
+        }
+        co_return result;
+    }
 
-        auto callback = [&](sqlite3_stmt* stmt) {
-            UserSearchResult user;
-            user.id = sqlite3_column_int(stmt, 0);
-            user.name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-            user.login = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-            result.push_back(user);
-            };
+    asio::awaitable<IdempotencyKeys::Result> runIdempotent(IdempotencyKeys::Key key, function<int(Database&)> write) {
+        return db->run(DbExecutor::Queue::Write, [this, key = move(key), write = move(write)](Database& db) {
+            return idempotency->write(db, key, write);
+            });
+    }
 
-        executeSQL(sql, params, callback);
-        return result;
+    // Первый отправитель пакета, который не участник чата; 0 - все участники.
+    // Участники читаются из одного снимка, каждый отправитель проверяется один раз
+    int bulkNonMember(int chatId, const vector<NewMessage>& messages) const {
+        auto members = membership->members(chatId);
+        vector<int> senders;
+        for (const auto& msg : messages) {
+            senders.push_back(msg.userId);
+        }
+        sort(senders.begin(), senders.end());
+        senders.erase(unique(senders.begin(), senders.end()), senders.end());
+        for (int userId : senders) {
+            if (!members->contains(static_cast<uint32_t>(userId))) {
+                return userId;
+            }
+        }
+        return 0;
     }
 
-    // Создание чата
-    int createChat(const string& name, bool isGroup, int createdBy, const vector<int>& participants) {
-        string sql = "INSERT INTO chats (name, is_group, created_by) VALUES (?, ?, ?)";
+    // id вставленных сообщений: first..second; {0, 0} - ошибка
+    asio::awaitable<pair<int, int>> insertBulk(int chatId, vector<NewMessage> messages) {
+        return db->run(DbExecutor::Queue::Write, [chatId, messages = move(messages)](Database& db) {
+            pair<int, int> range{ 0, 0 };
+            if (!db.insertMessages(chatId, messages, range.first, range.second)) {
+                range = { 0, 0 };
+            }
+            return range;
+            });
+    }
 
-        vector<pair<int, string>> params = {
-            {SQLITE_TEXT, name},
-            {SQLITE_INTEGER, isGroup ? "1" : "0"},
-            {SQLITE_INTEGER, to_string(createdBy)}
-        };
+    // Профиль изменился: сбросить его в кэше и устаревшие страницы чатов,
+    // в которых он есть в таблице авторов. Вызывается из потока базы
+    void userChanged(int userId) {
+        userCache->invalidate(userId);
+        if (membership) {
+            for (int chatId : membership->chats(userId)) {
+                chatVersions.bump(chatId);
+            }
+        }
+    }
 
-        if (!executeSQL(sql, params)) {
-            return -1;
+    // Профиль пользователя из кэша; при промахе - из базы с заполнением кэша
+    asio::awaitable<optional<UserInfo>> cachedUser(int userId) {
+        if (auto user = userCache->get(userId)) {
+            co_return user;
         }
+        uint64_t stamp = userCache->stamp();
+        auto user = co_await db->getUserById(userId);
+        if (user) {
+            userCache->put(*user, stamp);
+        }
+        co_return user;
+    }
 
-        int chatId = sqlite3_last_insert_rowid(db);
+    // Профили по списку id, по возрастанию id: промахи - одним запросом к базе
+    asio::awaitable<vector<UserInfo>> cachedUsers(vector<int> userIds) {
+        sort(userIds.begin(), userIds.end());
+        userIds.erase(unique(userIds.begin(), userIds.end()), userIds.end());
+
+        vector<int> missing;
+        auto users = userCache->getMany(userIds, missing);
+        if (!missing.empty()) {
+            uint64_t stamp = userCache->stamp();
+            auto loaded = co_await db->getUsersByIds(move(missing));
+            for (auto& user : loaded) {
+                userCache->put(user, stamp);
+                users.push_back(move(user));
+            }
+            sort(users.begin(), users.end(), [](const UserInfo& a, const UserInfo& b) { return a.id < b.id; });
+        }
+        co_return users;
+    }
 
-        // Добавляем всех участников
-        for (int userId : participants) {
-            addUserToChat(userId, chatId);
+    // Список id через запятую: ?ids=1,2,3
+    static bool parseIdList(const char* text, vector<int>& ids) {
+        if (!text || !*text) {
+            return false;
         }
+        string list(text);
+        size_t pos = 0;
+        while (pos <= list.size()) {
+            size_t end = min(list.find(',', pos), list.size());
+            char* parsedEnd = nullptr;
+            long id = strtol(list.c_str() + pos, &parsedEnd, 10);
+            if (parsedEnd != list.c_str() + end || end == pos || id <= 0 || id > numeric_limits<int>::max()) {
+                return false;
+            }
+            ids.push_back(static_cast<int>(id));
+            pos = end + 1;
+        }
+        return true;
+    }
 
-        // Добавляем создателя
-        addUserToChat(createdBy, chatId);
+    // Неотрицательный числовой параметр запроса; без параметра - fallback,
+    // false - значение не число или не помещается в long
+    static bool queryNumber(const crow::request& req, const char* name, long fallback, long& value) {
+        const char* text = req.url_params.get(name);
+        if (!text) {
+            value = fallback;
+            return true;
+        }
+        char* parsedEnd = nullptr;
+        errno = 0;
+        value = strtol(text, &parsedEnd, 10);
+        return parsedEnd != text && *parsedEnd == '\0' && errno == 0 && value >= 0;
+    }
 
-        return chatId;
+    static crow::response invalidParameter(const crow::request& req, const char* name) {
+        crow::json::wvalue error;
+        error["error"] = string("Parameter '") + name + "' must be a non-negative integer";
+        return reply(req, 400, error);
     }
 
-    // Добавление пользователя в чат
-    bool addUserToChat(int userId, int chatId) {
-        string sql = "INSERT OR IGNORE INTO user_chats (user_id, chat_id) VALUES (?, ?)";
+    asio::awaitable<Delivery::Updates> readUpdates(Delivery::Pending pending, size_t limit) {
+        return db->run(DbExecutor::Queue::Read, [this, pending = move(pending), limit](Database& db) mutable {
+            return delivery->read(db, move(pending), limit);
+            });
+    }
 
-        vector<pair<int, string>> params = {
-            {SQLITE_INTEGER, to_string(userId)},
-            {SQLITE_INTEGER, to_string(chatId)}
-        };
+    // Подписка WebSocket-соединения, хранится в userdata соединения
+    struct PushSession {
+        int chatId;
+        WireFormat format;
+        shared_ptr<WebSocketSubscriber> subscriber;
+    };
+
+    // Ответ на одну операцию пакета
+    struct BatchResult {
+        int status = 200;
+        string body;
+    };
+
+    static BatchResult batchResult(crow::response response) {
+        return { response.code, move(response.body) };
+    }
 
-        return executeSQL(sql, params);
+    static BatchResult batchError(WireFormat format, int status, const string& message) {
+        crow::json::wvalue error;
+        error["error"] = message;
+        return batchResult(reply(format, status, error));
     }
 
-    // Добавление контакта
-    int addContact(int userId1, int userId2) {
-        if (userId1 == userId2) {
-            return -1; // Нельзя добавить самого себя
+    static BatchResult batchWriteResult(WireFormat format, const BatchWriteResult& result) {
+        if (result.status != 200) {
+            return batchError(format, result.status, result.error);
         }
+        crow::json::wvalue response;
+        if (result.hasId) {
+            response["id"] = result.id;
+        }
+        response["status"] = "success";
+        return batchResult(reply(format, 200, response));
+    }
+
+    // Записи пакета одной задачей в очереди записи
+    asio::awaitable<vector<BatchWriteResult>> runBatchWrites(shared_ptr<const BatchRequest> batch) {
+        return db->run(DbExecutor::Queue::Write, [batch](Database& db) {
+            return executeBatchWrites(db, batch->ops, batch->atomic);
+            });
+    }
 
-        // Проверяем существование пользователей
-        UserInfo user1, user2;
-        bool user1Exists = getUserById(userId1, user1);
-        bool user2Exists = getUserById(userId2, user2);
+    asio::awaitable<BatchResult> runBatchRead(WireFormat format, BatchOp op) {
+        switch (op.type) {
+        case BatchOpType::GetChats:
+            co_return batchResult(chatsResponse(format, co_await db->getUserChats(op.id)));
+        case BatchOpType::GetContacts:
+            co_return batchResult(contactsResponse(format, socialGraph->contacts(op.id)));
+        case BatchOpType::SearchUsers:
+            co_return batchResult(usersResponse(format, co_await db->searchUsers(op.text)));
+        case BatchOpType::GetMessages: {
+            auto body = co_await messagesBody(format, op.id, chatVersions.get(op.id));
+            co_return BatchResult{ 200, *body };
+        }
+        case BatchOpType::GetUser: {
+            auto user = co_await cachedUser(op.id);
+            if (!user) {
+                co_return batchError(format, 404, "User not found");
+            }
+            crow::json::wvalue response;
+            response["id"] = user->id;
+            response["name"] = user->name;
+            response["login"] = user->login;
+            response["status"] = "success";
+            co_return batchResult(reply(format, 200, response));
+        }
+        default:
+            co_return batchError(format, 400, "Not a read operation");
+        }
+    }
 
-        if (!user1Exists || !user2Exists) {
-            return -3; // Один из пользователей не найден
+    // Сначала все записи (одна транзакция), затем чтения параллельно.
+    // Ошибка одной операции не прерывает остальные
+    asio::awaitable<crow::response> runBatch(WireFormat format, shared_ptr<const BatchRequest> batch) {
+        const auto& ops = batch->ops;
+        vector<BatchResult> results(ops.size());
+
+        bool hasWriteOps = any_of(ops.begin(), ops.end(), [](const BatchOp& op) { return isBatchWrite(op.type); });
+        if (hasWriteOps) {
+            auto writes = co_await runBatchWrites(batch);
+            size_t w = 0;
+            for (size_t i = 0; i < ops.size(); i++) {
+                if (!isBatchWrite(ops[i].type)) {
+                    continue;
+                }
+                const auto& write = writes[w++];
+                if (write.status == 200 && ops[i].type == BatchOpType::AddContact) {
+                    socialGraph->add(ops[i].userId, ops[i].otherUserId);
+                }
+                if (write.status == 200 && ops[i].type == BatchOpType::CreateChat) {
+                    auto members = ops[i].participants;
+                    members.push_back(ops[i].userId);
+                    membership->addChat(write.id, members);
+                    delivery->addChat(write.id, ops[i].isGroup);
+                }
+                if (write.changedChatId > 0) {
+                    chatVersions.bump(write.changedChatId);
+                    notifier.notify(write.changedChatId);
+                    if (write.hasId) {
+                        deliverChanged(write.changedChatId, write.id);
+                    }
+                    else {
+                        pushChanged(write.changedChatId);
+                    }
+                }
+                results[i] = batchWriteResult(format, write);
+            }
         }
 
-        // Проверяем, существует ли уже контакт
-        string checkSql = R"(
-            SELECT id FROM contacts 
-            WHERE (user_id1 = ? AND user_id2 = ?) OR (user_id1 = ? AND user_id2 = ?)
-        )";
+        using ReadOp = decltype(asio::co_spawn(declval<asio::any_io_executor>(),
+            declval<asio::awaitable<BatchResult>>(), asio::deferred));
+        vector<ReadOp> reads;
+        vector<size_t> readIndex;
+        auto ex = co_await asio::this_coro::executor;
+        for (size_t i = 0; i < ops.size(); i++) {
+            if (isBatchWrite(ops[i].type)) {
+                continue;
+            }
+            if (ops[i].errorStatus != 0) {
+                results[i] = batchError(format, ops[i].errorStatus, ops[i].error);
+                continue;
+            }
+            reads.push_back(asio::co_spawn(ex, runBatchRead(format, ops[i]), asio::deferred));
+            readIndex.push_back(i);
+        }
 
-        vector<pair<int, string>> checkParams = {
-            {SQLITE_INTEGER, to_string(userId1)},
-            {SQLITE_INTEGER, to_string(userId2)},
-            {SQLITE_INTEGER, to_string(userId2)},
-            {SQLITE_INTEGER, to_string(userId1)}
-        };
+        if (!reads.empty()) {
+            auto [order, errors, values] = co_await asio::experimental::make_parallel_group(move(reads))
+                .async_wait(asio::experimental::wait_for_all(), asio::use_awaitable);
+            for (size_t k = 0; k < readIndex.size(); k++) {
+                if (errors[k]) {
+                    auto error = errorResponse(errors[k]);
+                    results[readIndex[k]] = batchError(format, error.code,
+                        error.code == 503 ? "Server is busy, try again later" : "Internal error");
+                }
+                else {
+                    results[readIndex[k]] = move(values[k]);
+                }
+            }
+        }
 
-        bool exists = false;
-        auto checkCallback = [&](sqlite3_stmt* stmt) {
-            exists = true;
-            };
+        co_return batchResponse(format, results);
+    }
 
-        executeSQL(checkSql, checkParams, checkCallback);
+    // {"status": "success", "results": [{"status": <код>, "body": <ответ операции>}, ...]}.
+    // Тела операций уже закодированы и вставляются как есть
+    static crow::response batchResponse(WireFormat format, const vector<BatchResult>& results) {
+        string out;
+        size_t bodyBytes = 0;
+        for (const auto& result : results) {
+            bodyBytes += result.body.size();
+        }
+        out.reserve(64 + results.size() * 32 + bodyBytes);
+
+        if (format == WireFormat::MsgPack) {
+            msgpack::Writer writer(out);
+            writer.map(2);
+            writer.str("status");
+            writer.str("success");
+            writer.str("results");
+            writer.array(results.size());
+            for (const auto& result : results) {
+                writer.map(2);
+                writer.str("status");
+                writer.integer(result.status);
+                writer.str("body");
+                writer.raw(result.body);
+            }
+            return msgpackResponse(200, move(out));
+        }
 
-        if (exists) {
-            return -2; // Контакт уже существует
+        out += "{\"status\":\"success\",\"results\":[";
+        for (size_t i = 0; i < results.size(); i++) {
+            if (i > 0) {
+                out += ',';
+            }
+            out += "{\"status\":";
+            out += to_string(results[i].status);
+            out += ",\"body\":";
+            out += results[i].body;
+            out += '}';
         }
+        out += "]}";
+
+        crow::response response(200);
+        response.body = move(out);
+        response.set_header("Content-Type", contentType(WireFormat::Json));
+        return response;
+    }
 
-        string sql = "INSERT INTO contacts (user_id1, user_id2) VALUES (?, ?)";
-        vector<pair<int, string>> params = {
-            {SQLITE_INTEGER, to_string(userId1)},
-            {SQLITE_INTEGER, to_string(userId2)}
-        };
+    static crow::response busyResponse() {
+        crow::json::wvalue body;
+        body["error"] = "Server is busy, try again later";
+        crow::response response(503, body);
+        response.set_header("Retry-After", "1");
+        return response;
+    }
 
-        if (!executeSQL(sql, params)) {
-            return -4; // Ошибка базы данных
+    static crow::response errorResponse(exception_ptr error) {
+        crow::json::wvalue body;
+        try {
+            rethrow_exception(error);
+        }
+        catch (const OverloadError&) {
+            return busyResponse();
+        }
+        catch (const DbBusyError&) {
+            return busyResponse();
+        }
+        catch (const exception& e) {
+            body["error"] = string("Error: ") + e.what();
         }
+        return crow::response(500, body);
+    }
 
-        return sqlite3_last_insert_rowid(db);
+    static crow::response invalidBody(const crow::request& req) {
+        return crow::response(400, isMsgPackBody(req) ? "Invalid MessagePack" : "Invalid JSON");
     }
 
-    // Получение чатов пользователя
-    vector<Chat> getUserChats(int userId) {
-        vector<Chat> result;
+    // Пользователь записи для ограничения частоты - поле тела, от имени которого
+    // обработчик выполняет запись; 0 - поля нет (ответит сам обработчик)
+    static int bodyUserId(const RequestBody& body, const char* key) {
+        if (!body || !body.has(key)) {
+            return 0;
+        }
+        try {
+            return static_cast<int>(body.i(key));
+        }
+        catch (const exception&) {
+            return 0;
+        }
+    }
 
-        string sql = R"(
-            SELECT c.id, c.name, c.is_group, c.created_by, c.created_at
-            FROM chats c
-            JOIN user_chats uc ON c.id = uc.chat_id
-            WHERE uc.user_id = ?
-            ORDER BY c.created_at DESC
-        )";
+    // Сравнение токена за время, не зависящее от места первого расхождения
+    static bool tokenMatches(const string& given, const string& expected) {
+        unsigned char diff = given.size() == expected.size() ? 0 : 1;
+        for (size_t i = 0; i < given.size(); i++) {
+            diff |= static_cast<unsigned char>(given[i] ^ expected[i % max<size_t>(expected.size(), 1)]);
+        }
+        return diff == 0 && !expected.empty();
+    }
 
-        vector<pair<int, string>> params = { {SQLITE_INTEGER, to_string(userId)} };
+    // /metrics/* показывают внутреннее состояние сервера, поэтому при заданном
+    // --admin-token требуют тот же X-Admin-Token, что и /admin/*
+    optional<crow::response> metricsDenied(const crow::request& req) const {
+        if (adminToken.empty() || tokenMatches(req.get_header_value("X-Admin-Token"), adminToken)) {
+            return nullopt;
+        }
+        crow::json::wvalue response;
+        response["error"] = "Invalid admin token";
+        return crow::response(403, response);
+    }
 
-        auto callback = [&](sqlite3_stmt* stmt) {
-            Chat chat;
-            chat.id = sqlite3_column_int(stmt, 0);
-            chat.name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-            chat.isGroup = sqlite3_column_int(stmt, 2) == 1;
-            chat.createdBy = sqlite3_column_int(stmt, 3);
-            chat.createdAt = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
-            result.push_back(chat);
-            };
+    // Пользователи, от имени которых выполняются записи пакета, без повторов
+    static vector<int> batchWriters(const BatchRequest& batch) {
+        vector<int> userIds;
+        for (const auto& op : batch.ops) {
+            if (isBatchWrite(op.type) && op.errorStatus == 0) {
+                userIds.push_back(op.userId);
+            }
+        }
+        sort(userIds.begin(), userIds.end());
+        userIds.erase(unique(userIds.begin(), userIds.end()), userIds.end());
+        return userIds;
+    }
 
-        executeSQL(sql, params, callback);
-        return result;
+    // Заголовок Idempotency-Key записи от userId; false - значение недопустимо.
+    // С ключом сохраняется SHA-1 тела запроса
+    static bool idempotencyKey(const crow::request& req, int userId, const char* route,
+        optional<IdempotencyKeys::Key>& key) {
+        string value = req.get_header_value("Idempotency-Key");
+        if (value.empty()) {
+            return true;
+        }
+        if (!IdempotencyKeys::validKey(value)) {
+            return false;
+        }
+        sha1::SHA1 sha;
+        sha.processBytes(req.body.data(), req.body.size());
+        uint8_t digest[20];
+        sha.getDigestBytes(digest);
+        static const char hex[] = "0123456789abcdef";
+        string bodyHash;
+        for (uint8_t byte : digest) {
+            bodyHash += hex[byte >> 4];
+            bodyHash += hex[byte & 0xF];
+        }
+        key = IdempotencyKeys::Key{ userId, route, move(value), move(bodyHash) };
+        return true;
     }
 
-    // Получение контактов пользователя
-    vector<pair<int, string>> getUserContacts(int userId) {
-        vector<pair<int, string>> result;
+    // 422 здесь был бы точнее, но Crow 1.2 не знает этот код и отвечает 500
+    static crow::response idempotencyConflict(const crow::request& req) {
+        crow::json::wvalue error;
+        error["error"] = "Idempotency-Key was already used with a different request body";
+        return reply(req, 409, error);
+    }
 
-        string sql = R"(
-            SELECT 
-                CASE 
-                    WHEN c.user_id1 = ? THEN c.user_id2
-                    ELSE c.user_id1
-                END as other_user_id,
-                u.name
-            FROM contacts c
-            JOIN users u ON (c.user_id1 = u.id OR c.user_id2 = u.id) AND u.id != ?
-            WHERE (c.user_id1 = ? OR c.user_id2 = ?)
-        )";
+    static crow::response invalidIdempotencyKey(const crow::request& req) {
+        crow::json::wvalue error;
+        error["error"] = "Idempotency-Key must be 1-" + to_string(IdempotencyKeys::maxKeyLength) +
+            " printable ASCII characters";
+        return reply(req, 400, error);
+    }
 
-        vector<pair<int, string>> params = {
-            {SQLITE_INTEGER, to_string(userId)},
-            {SQLITE_INTEGER, to_string(userId)},
-            {SQLITE_INTEGER, to_string(userId)},
-            {SQLITE_INTEGER, to_string(userId)}
-        };
+    // Выгрузки отдает отдельный порт (ExportServer): тот же путь на нем
+    crow::response exportRedirect(const crow::request& req) const {
+        string host = req.get_header_value("Host");
+        host = !host.empty() && host[0] == '[' ? host.substr(0, host.find(']') + 1) : host.substr(0, host.find(':'));
+        crow::response res(307);
+        res.set_header("Location", "http://" + (host.empty() ? string("localhost") : host) + ":" +
+            to_string(exportServer->port()) + req.raw_url);
+        return res;
+    }
 
-        auto callback = [&](sqlite3_stmt* stmt) {
-            int otherUserId = sqlite3_column_int(stmt, 0);
-            string name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-            result.push_back({ otherUserId, name });
-            };
+    static crow::response exportError(const crow::request& req, int code, const char* message) {
+        crow::json::wvalue error;
+        error["error"] = message;
+        return reply(req, code, error);
+    }
 
-        executeSQL(sql, params, callback);
-        return result;
+    // Чат или канал с участниками в памяти
+    bool chatExists(int chatId) const {
+        return membership->memberCount(chatId) > 0 || channels->isChannel(chatId);
     }
 
-    // Отправка сообщения
-    int sendMessage(int userId, int chatId, const string& message, int replyId = 0, int resendId = 0) {
-        string sql = "INSERT INTO messages (user_id, chat_id, msg, reply_id, resend_id) VALUES (?, ?, ?, ?, ?)";
+    // Ответ на запись: {"id", "status"}; повтор по ключу помечается заголовком
+    static crow::response createdResponse(const crow::request& req, const IdempotencyKeys::Result& result) {
+        crow::json::wvalue response;
+        response["id"] = result.id;
+        response["status"] = "success";
+        auto res = reply(req, 200, response);
+        if (result.replayed) {
+            res.set_header("Idempotent-Replayed", "true");
+        }
+        return res;
+    }
 
-        vector<pair<int, string>> params = {
-            {SQLITE_INTEGER, to_string(userId)},
-            {SQLITE_INTEGER, to_string(chatId)},
-            {SQLITE_TEXT, message},
-            {SQLITE_INTEGER, to_string(replyId)},
-            {SQLITE_INTEGER, to_string(resendId)}
-        };
+    // Время в формате send_date (CURRENT_TIMESTAMP SQLite, UTC)
+    static string sqlTimestampNow() {
+        time_t now = time(nullptr);
+        tm parts{};
+#ifdef _WIN32
+        gmtime_s(&parts, &now);
+#else
+        gmtime_r(&now, &parts);
+#endif
+        char buffer[20];
+        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &parts);
+        return buffer;
+    }
 
-        if (!executeSQL(sql, params)) {
-            return -1;
+    static Frame eventFrame(WireFormat format, crow::json::wvalue& event) {
+        if (format == WireFormat::Json) {
+            return make_shared<const string>(event.dump());
         }
+        return make_shared<const string>(move(reply(format, 200, event).body));
+    }
+
+    // Новое сообщение подписчикам чата: кадр сериализуется один раз на формат
+    void pushMessage(const Message& msg) {
+        fanOut.publish(msg.chatId, [&msg](WireFormat format) {
+            crow::json::wvalue event;
+            event["type"] = "message";
+            event["chatId"] = msg.chatId;
+            event["message"]["id"] = msg.id;
+            event["message"]["userId"] = msg.userId;
+            event["message"]["message"] = msg.msg;
+            event["message"]["replyId"] = msg.replyId;
+            event["message"]["sendDate"] = msg.sendDate;
+            event["message"]["resendId"] = msg.resendId;
+            return eventFrame(format, event);
+            });
+    }
+
+    // Сообщения чата изменились (правка, удаление, пересылка, пакет):
+    // клиент перечитывает страницу
+    void pushChanged(int chatId) {
+        fanOut.publish(chatId, [chatId](WireFormat format) {
+            crow::json::wvalue event;
+            event["type"] = "changed";
+            event["chatId"] = chatId;
+            return eventFrame(format, event);
+            });
+    }
 
-        return sqlite3_last_insert_rowid(db);
+    // Новое сообщение - в ленты обновлений и подписчикам WebSocket.
+    // Публикация канала рассылается в пуле Channels, ответ автору ее не ждет
+    void deliverMessage(const Message& msg) {
+        if (!channels->post(msg.chatId, msg.id, [this, msg]() { pushMessage(msg); })) {
+            delivery->onMessage(msg.chatId, msg.id);
+            pushMessage(msg);
+        }
     }
 
-    // Получение сообщений чата
-    vector<Message> getChatMessages(int chatId) {
-        vector<Message> result;
+    // То же для сообщений, после которых подписчики перечитывают страницу (пересылка, пакет)
+    void deliverChanged(int chatId, int messageId) {
+        if (!channels->post(chatId, messageId, [this, chatId]() { pushChanged(chatId); })) {
+            delivery->onMessage(chatId, messageId);
+            pushChanged(chatId);
+        }
+    }
 
-        string sql = R"(
-            SELECT id, user_id, msg, reply_id, send_date, resend_id
-            FROM messages
-            WHERE chat_id = ?
-            ORDER BY send_date ASC
-        )";
+    static crow::response channelPostDenied(const crow::request& req) {
+        crow::json::wvalue error;
+        error["error"] = "Only channel admins can post";
+        return reply(req, 403, error);
+    }
 
-        vector<pair<int, string>> params = { {SQLITE_INTEGER, to_string(chatId)} };
+    // Публикации в каналы не от администраторов отклоняются до выполнения пакета
+    void restrictChannelPosts(BatchRequest& batch) const {
+        for (auto& op : batch.ops) {
+            bool post = op.type == BatchOpType::SendMessage || op.type == BatchOpType::ForwardMessage;
+            if (post && op.errorStatus == 0 && !channels->canPost(op.chatId, op.userId)) {
+                op.errorStatus = 403;
+                op.error = "Only channel admins can post";
+            }
+        }
+    }
 
-        auto callback = [&](sqlite3_stmt* stmt) {
-            Message msg;
-            msg.id = sqlite3_column_int(stmt, 0);
-            msg.userId = sqlite3_column_int(stmt, 1);
-            msg.msg = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-            msg.replyId = sqlite3_column_int(stmt, 3);
-            msg.sendDate = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
-            msg.resendId = sqlite3_column_int(stmt, 5);
-            msg.chatId = chatId;
-            result.push_back(msg);
-            };
-
-        executeSQL(sql, params, callback);
-        return result;
-    }
-
-    // Редактирование сообщения
-    bool editMessage(int messageId, const string& newMessage, int userId) {
-        string sql = "UPDATE messages SET msg = ? WHERE id = ? AND user_id = ?";
-
-        vector<pair<int, string>> params = {
-            {SQLITE_TEXT, newMessage},
-            {SQLITE_INTEGER, to_string(messageId)},
-            {SQLITE_INTEGER, to_string(userId)}
-        };
+    static crow::response channelNotFound(const crow::request& req) {
+        crow::json::wvalue error;
+        error["error"] = "Channel not found";
+        return reply(req, 404, error);
+    }
 
-        return executeSQL(sql, params);
+    // Ошибка addChannelSubscriber/addChannelAdmin: 0 - пользователя нет, -1 - ошибка базы
+    static crow::response channelUserError(const crow::request& req, int result) {
+        crow::json::wvalue error;
+        error["error"] = result == 0 ? "User not found" : "Database error";
+        return reply(req, result == 0 ? 404 : 500, error);
     }
 
-    // Удаление сообщения
-    bool deleteMessage(int messageId, int userId) {
-        string sql = "DELETE FROM messages WHERE id = ? AND user_id = ?";
+    // users - таблица авторов страницы (см. wire::encodeMessages)
+    static crow::response messagesResponse(WireFormat format, const vector<Message>& messages,
+        const vector<UserInfo>* users = nullptr) {
+        if (format == WireFormat::MsgPack) {
+            string body;
+            wire::encodeMessages(body, messages, users);
+            return msgpackResponse(200, move(body));
+        }
+
+        crow::json::wvalue response;
+        response["status"] = "success";
+
+        crow::json::wvalue::list messageList;
+        for (const auto& msg : messages) {
+            crow::json::wvalue msgJson;
+            msgJson["id"] = msg.id;
+            msgJson["userId"] = msg.userId;
+            msgJson["message"] = msg.msg;
+            msgJson["replyId"] = msg.replyId;
+            msgJson["sendDate"] = msg.sendDate;
+            msgJson["resendId"] = msg.resendId;
+            messageList.push_back(msgJson);
+        }
+        response["messages"] = move(messageList);
+
+        if (users) {
+            crow::json::wvalue::list userList;
+            for (const auto& user : *users) {
+                crow::json::wvalue userJson;
+                userJson["id"] = user.id;
+                userJson["name"] = user.name;
+                userJson["login"] = user.login;
+                userList.push_back(move(userJson));
+            }
+            response["users"] = move(userList);
+        }
+
+        return crow::response(200, response);
+    }
 
-        vector<pair<int, string>> params = {
-            {SQLITE_INTEGER, to_string(messageId)},
-            {SQLITE_INTEGER, to_string(userId)}
-        };
+    crow::response updatesResponse(WireFormat format, const Delivery::Updates& updates) {
+        crow::json::wvalue response;
+        response["status"] = "success";
+
+        crow::json::wvalue::list messageList;
+        for (const auto& msg : updates.messages) {
+            crow::json::wvalue msgJson;
+            msgJson["id"] = msg.id;
+            msgJson["chatId"] = msg.chatId;
+            msgJson["userId"] = msg.userId;
+            msgJson["message"] = msg.msg;
+            msgJson["replyId"] = msg.replyId;
+            msgJson["sendDate"] = msg.sendDate;
+            msgJson["resendId"] = msg.resendId;
+            messageList.push_back(move(msgJson));
+        }
+        response["messages"] = move(messageList);
+        response["cursor"] = delivery->formatCursor(updates.cursor);
+        response["reset"] = updates.reset;
+        response["more"] = updates.more;
+        return reply(format, 200, response);
+    }
 
-        return executeSQL(sql, params);
-    }
-
-    // Получение информации о сообщении
-    bool getMessageInfo(int messageId, int& userId, string& msg) {
-        string sql = "SELECT user_id, msg FROM messages WHERE id = ?";
-        vector<pair<int, string>> params = { {SQLITE_INTEGER, to_string(messageId)} };
+    static crow::response chatsResponse(WireFormat format, const vector<Chat>& chats) {
+        if (format == WireFormat::MsgPack) {
+            string body;
+            wire::encodeChats(body, chats);
+            return msgpackResponse(200, move(body));
+        }
 
-        bool found = false;
-        auto callback = [&](sqlite3_stmt* stmt) {
-            userId = sqlite3_column_int(stmt, 0);
-            msg = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-            found = true;
-            };
+        crow::json::wvalue response;
+        response["status"] = "success";
+
+        crow::json::wvalue::list chatList;
+        for (const auto& chat : chats) {
+            crow::json::wvalue chatJson;
+            chatJson["id"] = chat.id;
+            chatJson["name"] = chat.name;
+            chatJson["isGroup"] = chat.isGroup;
+            chatJson["createdBy"] = chat.createdBy;
+            chatJson["createdAt"] = chat.createdAt;
+            chatList.push_back(chatJson);
+        }
+        response["chats"] = move(chatList);
 
-        executeSQL(sql, params, callback);
-        return found;
+        return crow::response(200, response);
     }
-};
 
-class ChatServer {
-private:
-    crow::SimpleApp app;
-    unique_ptr<Database> db;
+    static crow::response contactsResponse(WireFormat format, const vector<pair<int, string>>& contacts) {
+        if (format == WireFormat::MsgPack) {
+            string body;
+            wire::encodeContacts(body, contacts);
+            return msgpackResponse(200, move(body));
+        }
 
-public:
-    ChatServer() : db(make_unique<Database>()) {
-        setupRoutes();
+        crow::json::wvalue response;
+        response["status"] = "success";
+
+        crow::json::wvalue::list contactList;
+        for (const auto& contact : contacts) {
+            crow::json::wvalue contactJson;
+            contactJson["userId"] = contact.first;
+            contactJson["name"] = contact.second;
+            contactList.push_back(contactJson);
+        }
+        response["contacts"] = move(contactList);
+
+        return crow::response(200, response);
     }
 
-    void run(int port = 18080) {
-        cout << "Chat Server running on port " << port << endl;
-        app.port(port).multithreaded().run();
+    static crow::response usersResponse(WireFormat format, const vector<UserSearchResult>& users) {
+        if (format == WireFormat::MsgPack) {
+            string body;
+            wire::encodeUsers(body, users);
+            return msgpackResponse(200, move(body));
+        }
+
+        crow::json::wvalue response;
+        response["status"] = "success";
+
+        crow::json::wvalue::list usersList;
+        for (const auto& user : users) {
+            crow::json::wvalue userJson;
+            userJson["id"] = user.id;
+            userJson["name"] = user.name;
+            userJson["login"] = user.login;
+            usersList.push_back(userJson);
+        }
+        response["users"] = move(usersList);
+
+        return crow::response(200, response);
     }
 
-private:
     void setupRoutes() {
         // Регистрация
         CROW_ROUTE(app, "/auth/register").methods("POST"_method)
-            ([this](const crow::request& req) {
-            try {
-                auto json_body = crow::json::load(req.body);
-                if (!json_body) {
-                    return crow::response(400, "Invalid JSON");
+            ([this, &limit = rateLimits.route("POST /auth/register", 5)](const crow::request& req, crow::response& res) {
+            if (!rateLimits.admit(req, res, limit)) {
+                return;
+            }
+            handle(req, res, RouteClass::Auth, [this, &req]() -> asio::awaitable<crow::response> {
+                RequestBody body(req);
+                if (!body) {
+                    co_return invalidBody(req);
                 }
 
-                string name = json_body["name"].s();
-                string login = json_body["login"].s();
-                string password = json_body["password"].s();
+                string name = body.s("name");
+                string login = body.s("login");
+                string password = body.s("password");
 
-                int userId = db->registerUser(name, login, password);
+                int userId = co_await db->registerUser(name, login, password);
                 if (userId == -1) {
                     crow::json::wvalue error;
                     error["error"] = "Registration failed (user may already exist)";
-                    return crow::response(400, error);
+                    co_return reply(req, 400, error);
                 }
+                socialGraph->addUser(userId, name);
 
                 crow::json::wvalue response;
                 response["id"] = userId;
                 response["status"] = "success";
-                return crow::response(200, response);
-            }
-            catch (const exception& e) {
-                crow::json::wvalue error;
-                error["error"] = string("Error: ") + e.what();
-                return crow::response(500, error);
-            }
+                co_return reply(req, 200, response);
+                });
                 });
 
         // Авторизация
         CROW_ROUTE(app, "/auth/login").methods("POST"_method)
-            ([this](const crow::request& req) {
-            try {
-                auto json_body = crow::json::load(req.body);
-                if (!json_body) {
-                    return crow::response(400, "Invalid JSON");
+            ([this, &limit = rateLimits.route("POST /auth/login", 2)](const crow::request& req, crow::response& res) {
+            if (!rateLimits.admit(req, res, limit)) {
+                return;
+            }
+            handle(req, res, RouteClass::Auth, [this, &req]() -> asio::awaitable<crow::response> {
+                RequestBody body(req);
+                if (!body) {
+                    co_return invalidBody(req);
                 }
 
-                string login = json_body["login"].s();
-                string password = json_body["password"].s();
+                string login = body.s("login");
+                string password = body.s("password");
 
-                User user;
-                if (db->loginUser(login, password, user)) {
+                auto user = co_await db->loginUser(login, password);
+                if (user) {
                     crow::json::wvalue response;
-                    response["id"] = user.id;
-                    response["name"] = user.name;
-                    response["login"] = user.login;
+                    response["id"] = user->id;
+                    response["name"] = user->name;
+                    response["login"] = user->login;
                     response["status"] = "success";
-                    return crow::response(200, response);
+                    co_return reply(req, 200, response);
                 }
 
                 crow::json::wvalue error;
                 error["error"] = "Invalid credentials";
-                return crow::response(401, error);
-            }
-            catch (const exception& e) {
-                crow::json::wvalue error;
-                error["error"] = string("Error: ") + e.what();
-                return crow::response(500, error);
-            }
+                co_return reply(req, 401, error);
+                });
                 });
 
         // Получение чатов пользователя
         CROW_ROUTE(app, "/chats/<int>").methods("GET"_method)
-            ([this](int userId) {
-            try {
-                auto chats = db->getUserChats(userId);
-
-                crow::json::wvalue response;
-                response["status"] = "success";
-
-                crow::json::wvalue::list chatList;
-                for (const auto& chat : chats) {
-                    crow::json::wvalue chatJson;
-                    chatJson["id"] = chat.id;
-                    chatJson["name"] = chat.name;
-                    chatJson["isGroup"] = chat.isGroup;
-                    chatJson["createdBy"] = chat.createdBy;
-                    chatJson["createdAt"] = chat.createdAt;
-                    chatList.push_back(chatJson);
-                }
-                response["chats"] = move(chatList);
-
-                return crow::response(200, response);
-            }
-            catch (const exception& e) {
-                crow::json::wvalue error;
-                error["error"] = string("Error: ") + e.what();
-                return crow::response(500, error);
+            ([this, &limit = rateLimits.route("GET /chats/<id>", 1)](const crow::request& req, crow::response& res, int userId) {
+            if (!rateLimits.admit(req, res, limit, userId)) {
+                return;
             }
+            handle(req, res, RouteClass::Read, [this, &req, userId]() -> asio::awaitable<crow::response> {
+                co_return chatsResponse(responseFormat(req), co_await db->getUserChats(userId));
+                });
                 });
 
         // Создание чата
         CROW_ROUTE(app, "/chats").methods("POST"_method)
-            ([this](const crow::request& req) {
-            try {
-                auto json_body = crow::json::load(req.body);
-                if (!json_body) {
-                    return crow::response(400, "Invalid JSON");
-                }
-
-                string name = json_body["name"].s();
-                bool isGroup = json_body["isGroup"].b();
-                int createdBy = static_cast<int>(json_body["createdBy"].i());
-
-                vector<int> participants;
-                if (json_body.has("participants")) {
-                    auto participants_array = json_body["participants"];
-                    if (participants_array.t() == crow::json::type::List) {
-                        for (size_t i = 0; i < participants_array.size(); i++) {
-                            participants.push_back(static_cast<int>(participants_array[i].i()));
-                        }
-                    }
+            ([this, &limit = rateLimits.route("POST /chats", 3)](const crow::request& req, crow::response& res) {
+            RequestBody body(req);
+            if (!rateLimits.admit(req, res, limit, bodyUserId(body, "createdBy"))) {
+                return;
+            }
+            handle(req, res, RouteClass::Write, [this, &req, body = move(body)]() -> asio::awaitable<crow::response> {
+                if (!body) {
+                    co_return invalidBody(req);
                 }
 
-                int chatId = db->createChat(name, isGroup, createdBy, participants);
-                if (chatId == -1) {
+                string name = body.s("name");
+                bool isGroup = body.b("isGroup");
+                int createdBy = static_cast<int>(body.i("createdBy"));
+
+                vector<int> participants = body.ints("participants");
+
+                optional<IdempotencyKeys::Key> key;
+                if (!idempotencyKey(req, createdBy, "POST /chats", key)) {
+                    co_return invalidIdempotencyKey(req);
+                }
+
+                function<int(Database&)> create = [name, isGroup, createdBy, participants](Database& db) {
+                    return db.createChat(name, isGroup, createdBy, participants);
+                    };
+                auto result = co_await writeOnce(move(key), move(create));
+                if (result.conflict) {
+                    co_return idempotencyConflict(req);
+                }
+                if (result.id == -1) {
                     crow::json::wvalue error;
                     error["error"] = "Failed to create chat";
-                    return crow::response(400, error);
+                    co_return reply(req, 400, error);
+                }
+                if (!result.replayed) {
+                    participants.push_back(createdBy);
+                    membership->addChat(result.id, participants);
+                    delivery->addChat(result.id, isGroup);
                 }
 
-                crow::json::wvalue response;
-                response["id"] = chatId;
-                response["status"] = "success";
-                return crow::response(200, response);
-            }
-            catch (const exception& e) {
-                crow::json::wvalue error;
-                error["error"] = string("Error: ") + e.what();
-                return crow::response(500, error);
-            }
+                co_return createdResponse(req, result);
+                });
                 });
 
         // Добавление контакта
         CROW_ROUTE(app, "/contacts").methods("POST"_method)
-            ([this](const crow::request& req) {
-            try {
-                auto json_body = crow::json::load(req.body);
-                if (!json_body) {
+            ([this, &limit = rateLimits.route("POST /contacts", 2)](const crow::request& req, crow::response& res) {
+            RequestBody body(req);
+            if (!rateLimits.admit(req, res, limit, bodyUserId(body, "userId1"))) {
+                return;
+            }
+            handle(req, res, RouteClass::Write, [this, &req, body = move(body)]() -> asio::awaitable<crow::response> {
+                if (!body) {
                     crow::json::wvalue error;
                     error["error"] = "Invalid JSON";
-                    return crow::response(400, error);
+                    co_return reply(req, 400, error);
                 }
 
-                int userId1 = static_cast<int>(json_body["userId1"].i());
-                int userId2 = static_cast<int>(json_body["userId2"].i());
+                int userId1 = static_cast<int>(body.i("userId1"));
+                int userId2 = static_cast<int>(body.i("userId2"));
 
-                int result = db->addContact(userId1, userId2);
+                // Проверки - в памяти (SocialGraph), в базу - только вставка
+                int result = socialGraph->reserve(userId1, userId2);
+                if (result == 0) {
+                    try {
+                        result = co_await db->insertContact(userId1, userId2);
+                    }
+                    catch (...) {
+                        socialGraph->release(userId1, userId2);
+                        throw;
+                    }
+                    if (result < 0) {
+                        socialGraph->release(userId1, userId2);
+                    }
+                }
 
                 crow::json::wvalue response;
                 if (result == -1) {
                     response["error"] = "Cannot add yourself as contact";
-                    return crow::response(400, response);
+                    co_return reply(req, 400, response);
                 }
                 else if (result == -2) {
                     response["error"] = "Contact already exists";
-                    return crow::response(400, response);
+                    co_return reply(req, 400, response);
                 }
                 else if (result == -3) {
                     response["error"] = "User not found";
-                    return crow::response(404, response);
+                    co_return reply(req, 404, response);
                 }
                 else if (result == -4) {
                     response["error"] = "Database error";
-                    return crow::response(500, response);
+                    co_return reply(req, 500, response);
                 }
                 else if (result > 0) {
                     response["id"] = result;
                     response["status"] = "success";
-                    return crow::response(200, response);
+                    co_return reply(req, 200, response);
                 }
                 else {
                     response["error"] = "Unknown error";
-                    return crow::response(500, response);
+                    co_return reply(req, 500, response);
                 }
-            }
-            catch (const exception& e) {
-                crow::json::wvalue error;
-                error["error"] = string("Error: ") + e.what();
-                return crow::response(500, error);
-            }
+                });
                 });
 
         // Получение контактов
         CROW_ROUTE(app, "/contacts/<int>").methods("GET"_method)
-            ([this](int userId) {
-            try {
-                auto contacts = db->getUserContacts(userId);
-
-                crow::json::wvalue response;
-                response["status"] = "success";
-
-                crow::json::wvalue::list contactList;
-                for (const auto& contact : contacts) {
-                    crow::json::wvalue contactJson;
-                    contactJson["userId"] = contact.first;
-                    contactJson["name"] = contact.second;
-                    contactList.push_back(contactJson);
-                }
-                response["contacts"] = move(contactList);
-
-                return crow::response(200, response);
+            ([this, &limit = rateLimits.route("GET /contacts/<id>", 1)](const crow::request& req, crow::response& res, int userId) {
+            if (!rateLimits.admit(req, res, limit, userId)) {
+                return;
             }
-            catch (const exception& e) {
-                crow::json::wvalue error;
-                error["error"] = string("Error: ") + e.what();
-                return crow::response(500, error);
+            handle(req, res, RouteClass::Read, [this, &req, userId]() -> asio::awaitable<crow::response> {
+                co_return contactsResponse(responseFormat(req), socialGraph->contacts(userId));
+                });
+                });
+
+        // Общие контакты двух пользователей
+        CROW_ROUTE(app, "/contacts/<int>/mutual/<int>").methods("GET"_method)
+            ([this, &limit = rateLimits.route("GET /contacts/<id>/mutual/<id>", 1)](const crow::request& req, crow::response& res, int userId1, int userId2) {
+            if (!rateLimits.admit(req, res, limit, userId1)) {
+                return;
             }
+            handle(req, res, RouteClass::Read, [this, &req, userId1, userId2]() -> asio::awaitable<crow::response> {
+                co_return contactsResponse(responseFormat(req), socialGraph->mutual(userId1, userId2));
+                });
                 });
 
         // Поиск пользователей
         CROW_ROUTE(app, "/users/search/<string>").methods("GET"_method)
-            ([this](const string& searchQuery) {
-            try {
-                auto users = db->searchUsers(searchQuery);
+            ([this, &limit = rateLimits.route("GET /users/search/<query>", 5)](const crow::request& req, crow::response& res, const string& searchQuery) {
+            if (!rateLimits.admit(req, res, limit)) {
+                return;
+            }
+            handle(req, res, RouteClass::Read, [this, &req, searchQuery]() -> asio::awaitable<crow::response> {
+                co_return usersResponse(responseFormat(req), co_await db->searchUsers(searchQuery));
+                });
+                });
 
+        // Лента обновлений пользователя по всем его чатам (см. Delivery).
+        // ?cursor=<курсор из прошлого ответа>&limit=<сообщений, до 1000>.
+        // Без курсора лента начинается с текущего момента
+        CROW_ROUTE(app, "/users/<int>/updates").methods("GET"_method)
+            ([this, &limit = rateLimits.route("GET /users/<id>/updates", 1)](const crow::request& req, crow::response& res, int userId) {
+            if (!rateLimits.admit(req, res, limit, userId)) {
+                return;
+            }
+            handle(req, res, RouteClass::Read, [this, &req, userId]() -> asio::awaitable<crow::response> {
+                Delivery::Cursor cursor;
+                const char* text = req.url_params.get("cursor");
+                if (text && !Delivery::parseCursor(text, cursor)) {
+                    crow::json::wvalue error;
+                    error["error"] = "Invalid cursor";
+                    co_return reply(req, 400, error);
+                }
+                long limit = 0;
+                if (!queryNumber(req, "limit", 200, limit)) {
+                    co_return invalidParameter(req, "limit");
+                }
+                limit = clamp(limit, 1L, 1000L);
+
+                membership->touch(userId);
+                auto pending = delivery->pending(userId, cursor, static_cast<size_t>(limit));
+                Delivery::Updates updates;
+                if (pending.empty()) {
+                    updates.cursor = move(pending.cursor);
+                    updates.reset = pending.reset;
+                    updates.more = pending.more;
+                }
+                else {
+                    updates = co_await readUpdates(move(pending), static_cast<size_t>(limit));
+                }
+                co_return updatesResponse(responseFormat(req), updates);
+                });
+                });
+
+        // Общие чаты двух пользователей
+        CROW_ROUTE(app, "/users/<int>/common-chats/<int>").methods("GET"_method)
+            ([this, &limit = rateLimits.route("GET /users/<id>/common-chats/<id>", 1)](const crow::request& req, crow::response& res, int userId1, int userId2) {
+            if (!rateLimits.admit(req, res, limit, userId1)) {
+                return;
+            }
+            handle(req, res, RouteClass::Read, [this, &req, userId1, userId2]() -> asio::awaitable<crow::response> {
                 crow::json::wvalue response;
+                response["chatIds"] = membership->commonChats(userId1, userId2);
                 response["status"] = "success";
+                co_return reply(req, 200, response);
+                });
+                });
 
-                crow::json::wvalue::list usersList;
-                for (const auto& user : users) {
-                    crow::json::wvalue userJson;
-                    userJson["id"] = user.id;
-                    userJson["name"] = user.name;
-                    userJson["login"] = user.login;
-                    usersList.push_back(userJson);
+        // Пользователи по списку id: ?ids=1,2,3 (до maxUserIds), по возрастанию id.
+        // Отсутствующие пропускаются
+        CROW_ROUTE(app, "/users").methods("GET"_method)
+            ([this, &limit = rateLimits.route("GET /users", 2)](const crow::request& req, crow::response& res) {
+            if (!rateLimits.admit(req, res, limit)) {
+                return;
+            }
+            handle(req, res, RouteClass::Read, [this, &req]() -> asio::awaitable<crow::response> {
+                vector<int> userIds;
+                if (!parseIdList(req.url_params.get("ids"), userIds) || userIds.size() > maxUserIds) {
+                    crow::json::wvalue error;
+                    error["error"] = "Expected ?ids=<id>,<id>,... (at most " + to_string(maxUserIds) + ")";
+                    co_return reply(req, 400, error);
                 }
-                response["users"] = move(usersList);
 
-                return crow::response(200, response);
-            }
-            catch (const exception& e) {
-                crow::json::wvalue error;
-                error["error"] = string("Error: ") + e.what();
-                return crow::response(500, error);
-            }
+                vector<UserSearchResult> users;
+                for (auto& user : co_await cachedUsers(move(userIds))) {
+                    users.push_back({ user.id, move(user.name), move(user.login) });
+                }
+                co_return usersResponse(responseFormat(req), users);
+                });
                 });
 
         // Получение пользователя по ID
         CROW_ROUTE(app, "/users/<int>").methods("GET"_method)
-            ([this](int userId) {
-            try {
-                UserInfo user;
-                bool found = db->getUserById(userId, user);
+            ([this, &limit = rateLimits.route("GET /users/<id>", 1)](const crow::request& req, crow::response& res, int userId) {
+            if (!rateLimits.admit(req, res, limit)) {
+                return;
+            }
+            handle(req, res, RouteClass::Read, [this, &req, userId]() -> asio::awaitable<crow::response> {
+                auto user = co_await cachedUser(userId);
 
-                if (found) {
+                if (user && responseFormat(req) == WireFormat::MsgPack) {
+                    string body;
+                    wire::encodeUser(body, *user);
+                    co_return msgpackResponse(200, move(body));
+                }
+                if (user) {
                     crow::json::wvalue response;
-                    response["id"] = user.id;
-                    response["name"] = user.name;
-                    response["login"] = user.login;
+                    response["id"] = user->id;
+                    response["name"] = user->name;
+                    response["login"] = user->login;
                     response["status"] = "success";
-                    return crow::response(200, response);
+                    co_return reply(req, 200, response);
                 }
                 else {
                     crow::json::wvalue error;
                     error["error"] = "User not found";
-                    return crow::response(404, error);
+                    co_return reply(req, 404, error);
                 }
+                });
+                });
+
+        // Участники чата; ?online=1 - только те, кто в сети (см. Membership)
+        CROW_ROUTE(app, "/chats/<int>/members").methods("GET"_method)
+            ([this, &limit = rateLimits.route("GET /chats/<id>/members", 1)](const crow::request& req, crow::response& res, int chatId) {
+            if (!rateLimits.admit(req, res, limit)) {
+                return;
             }
-            catch (const exception& e) {
-                crow::json::wvalue error;
-                error["error"] = string("Error: ") + e.what();
-                return crow::response(500, error);
-            }
+            handle(req, res, RouteClass::Read, [this, &req, chatId]() -> asio::awaitable<crow::response> {
+                const char* online = req.url_params.get("online");
+                auto members = membership->members(chatId);
+                crow::json::wvalue response;
+                response["chatId"] = chatId;
+                response["count"] = members->cardinality();
+                if (online && string(online) == "1") {
+                    response["userIds"] = membership->onlineMembers(chatId);
+                }
+                else {
+                    response["userIds"] = members->toVector();
+                }
+                response["status"] = "success";
+                co_return reply(req, 200, response);
+                });
                 });
 
         // Получение сообщений чата
         CROW_ROUTE(app, "/chats/<int>/messages").methods("GET"_method)
-            ([this](int chatId) {
-            try {
-                auto messages = db->getChatMessages(chatId);
-
-                crow::json::wvalue response;
-                response["status"] = "success";
+            ([this, &limit = rateLimits.route("GET /chats/<id>/messages", 2)](const crow::request& req, crow::response& res, int chatId) {
+            if (!rateLimits.admit(req, res, limit)) {
+                return;
+            }
+            handle(req, res, RouteClass::Read, [this, &req, chatId]() -> asio::awaitable<crow::response> {
+                co_return co_await cachedMessages(req, chatId);
+                });
+                });
 
-                crow::json::wvalue::list messageList;
-                for (const auto& msg : messages) {
-                    crow::json::wvalue msgJson;
-                    msgJson["id"] = msg.id;
-                    msgJson["userId"] = msg.userId;
-                    msgJson["message"] = msg.msg;
-                    msgJson["replyId"] = msg.replyId;
-                    msgJson["sendDate"] = msg.sendDate;
-                    msgJson["resendId"] = msg.resendId;
-                    messageList.push_back(msgJson);
+        // Ожидание новых сообщений чата (long polling).
+        // ?after=<id последнего известного сообщения>&timeout=<мс>
+        // Без контроля допуска: запрос почти все время спит и слот не занимает
+        CROW_ROUTE(app, "/chats/<int>/messages/wait").methods("GET"_method)
+            ([this, &limit = rateLimits.route("GET /chats/<id>/messages/wait", 1)](const crow::request& req, crow::response& res, int chatId) {
+            if (!rateLimits.admit(req, res, limit)) {
+                return;
+            }
+            handle(req, res, [this, &req, chatId]() -> asio::awaitable<crow::response> {
+                long afterId = 0;
+                if (!queryNumber(req, "after", 0, afterId) || afterId > numeric_limits<int>::max()) {
+                    co_return invalidParameter(req, "after");
+                }
+                long timeoutMs = 0;
+                if (!queryNumber(req, "timeout", 25000, timeoutMs)) {
+                    co_return invalidParameter(req, "timeout");
+                }
+                timeoutMs = min(timeoutMs, maxWaitMs);
+
+                auto subscription = co_await notifier.subscribe(chatId);
+                auto messages = co_await db->getChatMessagesAfter(chatId, static_cast<int>(afterId), maxWaitMessages);
+                if (messages.empty()) {
+                    bool notified = co_await subscription->wait(chrono::milliseconds(timeoutMs));
+                    if (notified) {
+                        messages = co_await db->getChatMessagesAfter(chatId, static_cast<int>(afterId), maxWaitMessages);
+                    }
                 }
-                response["messages"] = move(messageList);
 
-                return crow::response(200, response);
+                co_return messagesResponse(responseFormat(req), messages);
+                });
+                });
+
+        // Рассылка событий чата через WebSocket: {"type": "message", "chatId", "message": {...}}
+        // для новых сообщений, {"type": "changed", "chatId"} - когда страницу
+        // нужно перечитать, {"type": "gap", "dropped"} - если клиент не успевал
+        // и часть кадров выброшена. ?format=msgpack - бинарные кадры MessagePack
+        CROW_WEBSOCKET_ROUTE(app, "/chats/<int>/ws")
+            .onaccept([this, &limit = rateLimits.route("GET /chats/<id>/ws", 1)](const crow::request& req, void** userdata) {
+            uint32_t retryAfterMs = 0;
+            if (!rateLimits.consume(req, limit, 0, retryAfterMs)) {
+                return false;
             }
-            catch (const exception& e) {
-                crow::json::wvalue error;
-                error["error"] = string("Error: ") + e.what();
-                return crow::response(500, error);
+            // Путь уже сопоставлен с шаблоном: после "/chats/" идет id
+            long chatId = strtol(req.url.c_str() + 7, nullptr, 10);
+            if (chatId <= 0) {
+                return false;
+            }
+            const char* format = req.url_params.get("format");
+            bool msgpack = (format && string(format) == "msgpack") || responseFormat(req) == WireFormat::MsgPack;
+            *userdata = new PushSession{ static_cast<int>(chatId), msgpack ? WireFormat::MsgPack : WireFormat::Json, nullptr };
+            return true;
+                })
+            .onopen([this](crow::websocket::connection& conn) {
+            auto* session = static_cast<PushSession*>(conn.userdata());
+            session->subscriber = make_shared<WebSocketSubscriber>(conn, session->format, pushQueue);
+            fanOut.subscribe(session->chatId, session->subscriber);
+                })
+            .onclose([this](crow::websocket::connection& conn, const string& /*reason*/) {
+            // Crow может вызвать onclose повторно
+            auto* session = static_cast<PushSession*>(conn.userdata());
+            if (!session) {
+                return;
             }
+            if (session->subscriber) {
+                fanOut.unsubscribe(session->chatId, session->subscriber.get());
+                session->subscriber->closed();
+            }
+            delete session;
+            conn.userdata(nullptr);
+                })
+            .onmessage([](crow::websocket::connection& /*conn*/, const string& /*data*/, bool /*binary*/) {
                 });
 
         // Отправка сообщения
         CROW_ROUTE(app, "/messages").methods("POST"_method)
-            ([this](const crow::request& req) {
-            try {
-                auto json_body = crow::json::load(req.body);
-                if (!json_body) {
-                    return crow::response(400, "Invalid JSON");
+            ([this, &limit = rateLimits.route("POST /messages", 1)](const crow::request& req, crow::response& res) {
+            RequestBody body(req);
+            if (!rateLimits.admit(req, res, limit, bodyUserId(body, "userId"))) {
+                return;
+            }
+            handle(req, res, RouteClass::Write, [this, &req, body = move(body)]() -> asio::awaitable<crow::response> {
+                if (!body) {
+                    co_return invalidBody(req);
                 }
 
-                int userId = static_cast<int>(json_body["userId"].i());
-                int chatId = static_cast<int>(json_body["chatId"].i());
-                string message = json_body["message"].s();
+                int userId = static_cast<int>(body.i("userId"));
+                int chatId = static_cast<int>(body.i("chatId"));
+                string message = body.s("message");
 
                 int replyId = 0;
                 int resendId = 0;
 
-                if (json_body.has("replyId")) {
-                    replyId = static_cast<int>(json_body["replyId"].i());
+                if (body.has("replyId")) {
+                    replyId = static_cast<int>(body.i("replyId"));
                 }
 
-                if (json_body.has("resendId")) {
-                    resendId = static_cast<int>(json_body["resendId"].i());
+                if (body.has("resendId")) {
+                    resendId = static_cast<int>(body.i("resendId"));
                 }
 
-                int messageId = db->sendMessage(userId, chatId, message, replyId, resendId);
-                if (messageId == -1) {
+                optional<IdempotencyKeys::Key> key;
+                if (!idempotencyKey(req, userId, "POST /messages", key)) {
+                    co_return invalidIdempotencyKey(req);
+                }
+                if (!channels->canPost(chatId, userId)) {
+                    co_return channelPostDenied(req);
+                }
+                membership->touch(userId);
+
+                function<int(Database&)> send = [userId, chatId, message, replyId, resendId](Database& db) {
+                    return db.sendMessage(userId, chatId, message, replyId, resendId);
+                    };
+                auto result = co_await writeOnce(move(key), move(send));
+                if (result.conflict) {
+                    co_return idempotencyConflict(req);
+                }
+                if (result.id == -1) {
                     crow::json::wvalue error;
                     error["error"] = "Failed to send message";
-                    return crow::response(400, error);
+                    co_return reply(req, 400, error);
+                }
+                // Повтор: сообщение уже разослано при первой записи
+                if (!result.replayed) {
+                    chatVersions.bump(chatId);
+                    notifier.notify(chatId);
+                    deliverMessage(Message{ result.id, userId, chatId, message, replyId, sqlTimestampNow(), resendId });
+                }
+
+                co_return createdResponse(req, result);
+                });
+                });
+
+        // Пакетная загрузка сообщений в чат (боты, импорт истории): участие
+        // отправителей проверяется один раз на пакет, вставка - одной транзакцией
+        CROW_ROUTE(app, "/chats/<int>/messages:bulk").methods("POST"_method)
+            ([this, &limit = rateLimits.route("POST /chats/<id>/messages:bulk", 10)](const crow::request& req, crow::response& res, int chatId) {
+            if (!rateLimits.admit(req, res, limit)) {
+                return;
+            }
+            handle(req, res, RouteClass::Write, [this, &req, chatId]() -> asio::awaitable<crow::response> {
+                vector<NewMessage> messages;
+                string parseError;
+                if (!parseBulkMessages(req, messages, parseError)) {
+                    crow::json::wvalue error;
+                    error["error"] = parseError;
+                    co_return reply(req, 400, error);
+                }
+
+                // Рассылка каждого сообщения канала всем подписчикам не для пакетов
+                if (channels->isChannel(chatId)) {
+                    crow::json::wvalue error;
+                    error["error"] = "Bulk posting to channels is not supported";
+                    co_return reply(req, 400, error);
+                }
+                if (int userId = bulkNonMember(chatId, messages)) {
+                    crow::json::wvalue error;
+                    error["error"] = "User " + to_string(userId) + " is not a member of the chat";
+                    co_return reply(req, 403, error);
+                }
+
+                auto range = co_await insertBulk(chatId, move(messages));
+                if (range.first <= 0) {
+                    crow::json::wvalue error;
+                    error["error"] = "Failed to insert messages";
+                    co_return reply(req, 400, error);
                 }
+                chatVersions.bump(chatId);
+                notifier.notify(chatId);
+                delivery->onMessages(chatId, range.first, range.second);
+                pushChanged(chatId);
 
                 crow::json::wvalue response;
-                response["id"] = messageId;
+                response["firstId"] = range.first;
+                response["lastId"] = range.second;
+                response["count"] = range.second - range.first + 1;
                 response["status"] = "success";
-                return crow::response(200, response);
+                co_return reply(req, 200, response);
+                });
+                });
+
+        // Выгрузка всей истории чата: ?format=ndjson|csv&afterId=<id>.
+        // Ответ пишется в сокет кусочками по мере чтения (см. ChatExport),
+        // поэтому его отдает порт выгрузок (ExportServer)
+        CROW_ROUTE(app, "/chats/<int>/export").methods("GET"_method)
+            ([this, &limit = rateLimits.route("GET /chats/<id>/export (redirect)", 1)](const crow::request& req, crow::response& res, int /*chatId*/) {
+            if (!rateLimits.admit(req, res, limit)) {
+                return;
             }
-            catch (const exception& e) {
-                crow::json::wvalue error;
-                error["error"] = string("Error: ") + e.what();
-                return crow::response(500, error);
+            res = exportRedirect(req);
+            res.end();
+                });
+
+        // Архив выгрузки: собрать заново (POST) и скачать с докачкой (GET, Range)
+        CROW_ROUTE(app, "/chats/<int>/export/archive").methods("POST"_method)
+            ([this, &limit = rateLimits.route("POST /chats/<id>/export/archive", 10)](const crow::request& req, crow::response& res, int chatId) {
+            if (!rateLimits.admit(req, res, limit)) {
+                return;
             }
+            handle(req, res, RouteClass::Write, [this, &req, chatId]() -> asio::awaitable<crow::response> {
+                ExportFormat format;
+                if (!parseExportFormat(req.url_params.get("format"), format)) {
+                    co_return exportError(req, 400, "format must be ndjson or csv");
+                }
+                if (!chatExists(chatId)) {
+                    co_return exportError(req, 404, "Chat not found");
+                }
+
+                auto archive = co_await exporter->buildArchive(chatId, format);
+                crow::json::wvalue response;
+                response["archiveId"] = archive.id;
+                response["url"] = "/chats/" + to_string(chatId) + "/export/archive?format=" + exportExtension(format);
+                response["size"] = archive.size;
+                response["messages"] = archive.messages;
+                response["lastId"] = archive.lastId;
+                response["status"] = "success";
+                co_return reply(req, 200, response);
+                });
+                });
+
+        CROW_ROUTE(app, "/chats/<int>/export/archive").methods("GET"_method)
+            ([this, &limit = rateLimits.route("GET /chats/<id>/export/archive (redirect)", 1)](const crow::request& req, crow::response& res, int /*chatId*/) {
+            if (!rateLimits.admit(req, res, limit)) {
+                return;
+            }
+            res = exportRedirect(req);
+            res.end();
                 });
 
         // Редактирование сообщения
         CROW_ROUTE(app, "/messages/<int>").methods("PUT"_method)
-            ([this](const crow::request& req, int messageId) {
-            try {
-                auto json_body = crow::json::load(req.body);
-                if (!json_body) {
-                    return crow::response(400, "Invalid JSON");
+            ([this, &limit = rateLimits.route("PUT /messages/<id>", 1)](const crow::request& req, crow::response& res, int messageId) {
+            RequestBody body(req);
+            if (!rateLimits.admit(req, res, limit, bodyUserId(body, "userId"))) {
+                return;
+            }
+            handle(req, res, RouteClass::Write, [this, &req, body = move(body), messageId]() -> asio::awaitable<crow::response> {
+                if (!body) {
+                    co_return invalidBody(req);
                 }
 
-                string newMessage = json_body["message"].s();
-                int userId = static_cast<int>(json_body["userId"].i());
+                string newMessage = body.s("message");
+                int userId = static_cast<int>(body.i("userId"));
 
-                bool success = db->editMessage(messageId, newMessage, userId);
+                bool success = co_await db->editMessage(messageId, newMessage, userId);
 
                 crow::json::wvalue response;
                 if (success) {
+                    // Сообщение не переходит между чатами, его чат можно прочитать отдельно
+                    int chatId = co_await db->getMessageChatId(messageId);
+                    chatVersions.bump(chatId);
+                    pushChanged(chatId);
                     response["status"] = "success";
-                    return crow::response(200, response);
+                    co_return reply(req, 200, response);
                 }
                 else {
                     response["error"] = "Message not found or access denied";
-                    return crow::response(403, response);
+                    co_return reply(req, 403, response);
                 }
-            }
-            catch (const exception& e) {
-                crow::json::wvalue error;
-                error["error"] = string("Error: ") + e.what();
-                return crow::response(500, error);
-            }
+                });
                 });
 
         // Удаление сообщения
         CROW_ROUTE(app, "/messages/<int>").methods("DELETE"_method)
-            ([this](const crow::request& req, int messageId) {
-            try {
-                auto json_body = crow::json::load(req.body);
-                if (!json_body) {
-                    return crow::response(400, "Invalid JSON");
+            ([this, &limit = rateLimits.route("DELETE /messages/<id>", 1)](const crow::request& req, crow::response& res, int messageId) {
+            RequestBody body(req);
+            if (!rateLimits.admit(req, res, limit, bodyUserId(body, "userId"))) {
+                return;
+            }
+            handle(req, res, RouteClass::Write, [this, &req, body = move(body), messageId]() -> asio::awaitable<crow::response> {
+                if (!body) {
+                    co_return invalidBody(req);
                 }
 
-                int userId = static_cast<int>(json_body["userId"].i());
+                int userId = static_cast<int>(body.i("userId"));
 
-                bool success = db->deleteMessage(messageId, userId);
+                int chatId = co_await db->getMessageChatId(messageId);
+                bool success = co_await db->deleteMessage(messageId, userId);
 
                 crow::json::wvalue response;
                 if (success) {
+                    chatVersions.bump(chatId);
+                    pushChanged(chatId);
                     response["status"] = "success";
-                    return crow::response(200, response);
+                    co_return reply(req, 200, response);
                 }
                 else {
                     response["error"] = "Message not found or access denied";
-                    return crow::response(403, response);
+                    co_return reply(req, 403, response);
                 }
-            }
-            catch (const exception& e) {
-                crow::json::wvalue error;
-                error["error"] = string("Error: ") + e.what();
-                return crow::response(500, error);
-            }
+                });
                 });
 
         // Пересылка сообщения
         CROW_ROUTE(app, "/messages/forward").methods("POST"_method)
-            ([this](const crow::request& req) {
-            try {
-                auto json_body = crow::json::load(req.body);
-                if (!json_body) {
-                    return crow::response(400, "Invalid JSON");
+            ([this, &limit = rateLimits.route("POST /messages/forward", 2)](const crow::request& req, crow::response& res) {
+            RequestBody body(req);
+            if (!rateLimits.admit(req, res, limit, bodyUserId(body, "userId"))) {
+                return;
+            }
+            handle(req, res, RouteClass::Write, [this, &req, body = move(body)]() -> asio::awaitable<crow::response> {
+                if (!body) {
+                    co_return invalidBody(req);
                 }
 
-                int originalMsgId = static_cast<int>(json_body["originalMessageId"].i());
-                int targetChatId = static_cast<int>(json_body["targetChatId"].i());
-                int userId = static_cast<int>(json_body["userId"].i());
+                int originalMsgId = static_cast<int>(body.i("originalMessageId"));
+                int targetChatId = static_cast<int>(body.i("targetChatId"));
+                int userId = static_cast<int>(body.i("userId"));
+
+                optional<IdempotencyKeys::Key> key;
+                if (!idempotencyKey(req, userId, "POST /messages/forward", key)) {
+                    co_return invalidIdempotencyKey(req);
+                }
+                if (!channels->canPost(targetChatId, userId)) {
+                    co_return channelPostDenied(req);
+                }
+
+                // Чтение оригинала и отправка - одной задачей в очереди записи;
+                // -2 - оригинала нет
+                function<int(Database&)> forward = [originalMsgId, targetChatId, userId](Database& db) {
+                    // Получаем информацию о пересылаемом сообщении
+                    int originalUserId;
+                    string originalMsg;
+                    if (!db.getMessageInfo(originalMsgId, originalUserId, originalMsg)) {
+                        return -2;
+                    }
+
+                    // Отправляем пересланное сообщение
+                    string forwardedMsg = "[Forwarded] " + originalMsg;
+                    return db.sendMessage(userId, targetChatId, forwardedMsg, 0, originalUserId);
+                    };
+                auto result = co_await writeOnce(move(key), move(forward));
+                if (result.conflict) {
+                    co_return idempotencyConflict(req);
+                }
 
-                // Получаем информацию о пересылаемом сообщении
-                int originalUserId;
-                string originalMsg;
-                if (!db->getMessageInfo(originalMsgId, originalUserId, originalMsg)) {
+                if (result.id == -2) {
                     crow::json::wvalue error;
                     error["error"] = "Original message not found";
-                    return crow::response(404, error);
+                    co_return reply(req, 404, error);
+                }
+                if (result.id != -1 && !result.replayed) {
+                    chatVersions.bump(targetChatId);
+                    notifier.notify(targetChatId);
+                    deliverChanged(targetChatId, result.id);
+                }
+
+                co_return createdResponse(req, result);
+                });
+                });
+
+        // Создание канала (см. Channels): пишут только администраторы,
+        // создатель - первый из них
+        CROW_ROUTE(app, "/channels").methods("POST"_method)
+            ([this, &limit = rateLimits.route("POST /channels", 3)](const crow::request& req, crow::response& res) {
+            RequestBody body(req);
+            if (!rateLimits.admit(req, res, limit, bodyUserId(body, "createdBy"))) {
+                return;
+            }
+            handle(req, res, RouteClass::Write, [this, &req, body = move(body)]() -> asio::awaitable<crow::response> {
+                if (!body) {
+                    co_return invalidBody(req);
                 }
 
-                // Отправляем пересланное сообщение
-                string forwardedMsg = "[Forwarded] " + originalMsg;
-                int messageId = db->sendMessage(userId, targetChatId, forwardedMsg, 0, originalUserId);
+                string name = body.s("name");
+                int createdBy = static_cast<int>(body.i("createdBy"));
+
+                int chatId = co_await db->createChannel(name, createdBy);
+                if (chatId == -1) {
+                    crow::json::wvalue error;
+                    error["error"] = "Failed to create channel";
+                    co_return reply(req, 400, error);
+                }
+                channels->add(chatId, name, createdBy);
 
                 crow::json::wvalue response;
-                response["id"] = messageId;
+                response["id"] = chatId;
                 response["status"] = "success";
-                return crow::response(200, response);
+                co_return reply(req, 200, response);
+                });
+                });
+
+        // Канал: название, администраторы, число подписчиков.
+        // Публикации читаются как сообщения чата: GET /chats/<id>/messages
+        CROW_ROUTE(app, "/channels/<int>").methods("GET"_method)
+            ([this, &limit = rateLimits.route("GET /channels/<id>", 1)](const crow::request& req, crow::response& res, int chatId) {
+            if (!rateLimits.admit(req, res, limit)) {
+                return;
             }
-            catch (const exception& e) {
-                crow::json::wvalue error;
-                error["error"] = string("Error: ") + e.what();
-                return crow::response(500, error);
+            handle(req, res, RouteClass::Read, [this, &req, chatId]() -> asio::awaitable<crow::response> {
+                auto info = channels->info(chatId);
+                if (!info) {
+                    co_return channelNotFound(req);
+                }
+
+                crow::json::wvalue response;
+                response["id"] = chatId;
+                response["name"] = info->name;
+                response["createdBy"] = info->createdBy;
+                response["admins"] = info->admins;
+                response["subscribers"] = info->subscribers;
+                response["status"] = "success";
+                co_return reply(req, 200, response);
+                });
+                });
+
+        // Подписка на канал
+        CROW_ROUTE(app, "/channels/<int>/subscribers").methods("POST"_method)
+            ([this, &limit = rateLimits.route("POST /channels/<id>/subscribers", 1)](const crow::request& req, crow::response& res, int chatId) {
+            RequestBody body(req);
+            if (!rateLimits.admit(req, res, limit, bodyUserId(body, "userId"))) {
+                return;
+            }
+            handle(req, res, RouteClass::Write, [this, &req, body = move(body), chatId]() -> asio::awaitable<crow::response> {
+                if (!body) {
+                    co_return invalidBody(req);
+                }
+                int userId = static_cast<int>(body.i("userId"));
+
+                if (!channels->isChannel(chatId)) {
+                    co_return channelNotFound(req);
+                }
+                if (!channels->isSubscribed(chatId, userId)) {
+                    int result = co_await db->addChannelSubscriber(chatId, userId);
+                    if (result != 1) {
+                        co_return channelUserError(req, result);
+                    }
+                    channels->subscribe(chatId, userId);
+                }
+
+                crow::json::wvalue response;
+                response["status"] = "success";
+                co_return reply(req, 200, response);
+                });
+                });
+
+        // Отписка от канала
+        CROW_ROUTE(app, "/channels/<int>/subscribers").methods("DELETE"_method)
+            ([this, &limit = rateLimits.route("DELETE /channels/<id>/subscribers", 1)](const crow::request& req, crow::response& res, int chatId) {
+            RequestBody body(req);
+            if (!rateLimits.admit(req, res, limit, bodyUserId(body, "userId"))) {
+                return;
+            }
+            handle(req, res, RouteClass::Write, [this, &req, body = move(body), chatId]() -> asio::awaitable<crow::response> {
+                if (!body) {
+                    co_return invalidBody(req);
+                }
+                int userId = static_cast<int>(body.i("userId"));
+
+                if (!channels->isChannel(chatId)) {
+                    co_return channelNotFound(req);
+                }
+                if (channels->isSubscribed(chatId, userId)) {
+                    if (!co_await db->removeChannelSubscriber(chatId, userId)) {
+                        co_return channelUserError(req, -1);
+                    }
+                    channels->unsubscribe(chatId, userId);
+                }
+
+                crow::json::wvalue response;
+                response["status"] = "success";
+                co_return reply(req, 200, response);
+                });
+                });
+
+        // Новый администратор канала; добавляет один из текущих
+        CROW_ROUTE(app, "/channels/<int>/admins").methods("POST"_method)
+            ([this, &limit = rateLimits.route("POST /channels/<id>/admins", 2)](const crow::request& req, crow::response& res, int chatId) {
+            RequestBody body(req);
+            if (!rateLimits.admit(req, res, limit, bodyUserId(body, "addedBy"))) {
+                return;
+            }
+            handle(req, res, RouteClass::Write, [this, &req, body = move(body), chatId]() -> asio::awaitable<crow::response> {
+                if (!body) {
+                    co_return invalidBody(req);
+                }
+                int userId = static_cast<int>(body.i("userId"));
+                int addedBy = static_cast<int>(body.i("addedBy"));
+
+                if (!channels->isChannel(chatId)) {
+                    co_return channelNotFound(req);
+                }
+                if (!channels->canPost(chatId, addedBy)) {
+                    crow::json::wvalue error;
+                    error["error"] = "Only channel admins can add admins";
+                    co_return reply(req, 403, error);
+                }
+
+                int result = co_await db->addChannelAdmin(chatId, userId);
+                if (result != 1) {
+                    co_return channelUserError(req, result);
+                }
+                channels->addAdmin(chatId, userId);
+
+                crow::json::wvalue response;
+                response["status"] = "success";
+                co_return reply(req, 200, response);
+                });
+                });
+
+        // Пакет операций (см. Batch.h). Разбор тела - до контроля допуска,
+        // чтобы пакет только из чтений шел по классу чтения
+        CROW_ROUTE(app, "/batch").methods("POST"_method)
+            ([this, &limit = rateLimits.route("POST /batch", 5)](const crow::request& req, crow::response& res) {
+            auto batch = make_shared<BatchRequest>();
+            auto error = make_shared<string>();
+            bool parsed = parseBatch(req, *batch, *error);
+            if (parsed) {
+                restrictChannelPosts(*batch);
+            }
+            if (!rateLimits.admit(req, res, limit, parsed ? batchWriters(*batch) : vector<int>())) {
+                return;
+            }
+            auto routeClass = parsed && batch->hasWrites() ? RouteClass::Write : RouteClass::Read;
+
+            handle(req, res, routeClass, [this, &req, batch, parsed, error]() -> asio::awaitable<crow::response> {
+                if (!parsed) {
+                    crow::json::wvalue response;
+                    response["error"] = *error;
+                    co_return reply(req, 400, response);
+                }
+                co_return co_await runBatch(responseFormat(req), batch);
+                });
+                });
+
+        // Метрики очередей базы данных
+        CROW_ROUTE(app, "/metrics/db").methods("GET"_method)
+            ([this](const crow::request& req) {
+            if (auto denied = metricsDenied(req)) {
+                return move(*denied);
+            }
+            crow::json::wvalue response;
+            crow::json::wvalue::list queues;
+            for (const auto& stats : dbExecutor->stats()) {
+                crow::json::wvalue queue;
+                queue["name"] = stats.name;
+                queue["threads"] = stats.threads;
+                queue["capacity"] = stats.capacity;
+                queue["depth"] = stats.depth;
+                queue["peakDepth"] = stats.peakDepth;
+                queue["active"] = stats.active;
+                queue["submitted"] = stats.submitted;
+                queue["rejected"] = stats.rejected;
+                queue["completed"] = stats.completed;
+                queue["avgWaitMs"] = stats.avgWaitMs;
+                queue["avgRunMs"] = stats.avgRunMs;
+                queues.push_back(move(queue));
+            }
+            response["queues"] = move(queues);
+            response["waitingForMessages"] = notifier.waiting();
+            response["status"] = "success";
+            return crow::response(200, response);
+                });
+
+        // Метрики контроля допуска
+        CROW_ROUTE(app, "/metrics/admission").methods("GET"_method)
+            ([this](const crow::request& req) {
+            if (auto denied = metricsDenied(req)) {
+                return move(*denied);
+            }
+            crow::json::wvalue response;
+            crow::json::wvalue::list classes;
+            if (admission) {
+                for (const auto& stats : admission->stats()) {
+                    crow::json::wvalue routeClass;
+                    routeClass["name"] = stats.name;
+                    routeClass["limit"] = stats.limit;
+                    routeClass["inFlight"] = stats.inFlight;
+                    routeClass["queued"] = stats.queued;
+                    routeClass["overloaded"] = stats.overloaded;
+                    routeClass["admitted"] = stats.admitted;
+                    routeClass["rejected"] = stats.rejected;
+                    routeClass["timedOut"] = stats.timedOut;
+                    routeClass["avgQueueMs"] = stats.avgQueueMs;
+                    routeClass["shortLatencyMs"] = stats.shortLatencyMs;
+                    routeClass["longLatencyMs"] = stats.longLatencyMs;
+                    classes.push_back(move(routeClass));
+                }
+            }
+            response["enabled"] = admission != nullptr;
+            response["classes"] = move(classes);
+            response["status"] = "success";
+            return crow::response(200, response);
+                });
+
+        // Метрики ограничения частоты запросов
+        CROW_ROUTE(app, "/metrics/ratelimit").methods("GET"_method)
+            ([this](const crow::request& req) {
+            if (auto denied = metricsDenied(req)) {
+                return move(*denied);
+            }
+            crow::json::wvalue response;
+            crow::json::wvalue::list routes;
+            uint64_t throttled = 0;
+            for (const auto& stats : rateLimits.stats()) {
+                crow::json::wvalue route;
+                route["route"] = stats.name;
+                route["cost"] = stats.cost;
+                route["allowed"] = stats.allowed;
+                route["throttledByUser"] = stats.throttledByUser;
+                route["throttledByIp"] = stats.throttledByIp;
+                throttled += stats.throttledByUser + stats.throttledByIp;
+                routes.push_back(move(route));
+            }
+            response["enabled"] = rateLimits.enabled;
+            response["routes"] = move(routes);
+            response["throttled"] = throttled;
+            response["activeUsers"] = rateLimits.perUser->activeKeys();
+            response["activeIps"] = rateLimits.perIp->activeKeys();
+            response["tableFull"] = rateLimits.perUser->tableFull() + rateLimits.perIp->tableFull();
+            response["status"] = "success";
+            return crow::response(200, response);
+                });
+
+        // Метрики сжатия ответов и кэша тел
+        CROW_ROUTE(app, "/metrics/compression").methods("GET"_method)
+            ([this](const crow::request& req) {
+            if (auto denied = metricsDenied(req)) {
+                return move(*denied);
+            }
+            crow::json::wvalue response;
+            response["enabled"] = compressor != nullptr;
+            if (compressor) {
+                auto stats = compressor->stats();
+                response["compressed"] = stats.compressed;
+                response["skipped"] = stats.skipped;
+                response["bytesIn"] = stats.bytesIn;
+                response["bytesOut"] = stats.bytesOut;
+                response["ratio"] = stats.bytesIn > 0 ? static_cast<double>(stats.bytesOut) / stats.bytesIn : 1.0;
+                response["avgCompressMs"] = stats.avgCompressMs;
+            }
+
+            auto cacheStats = responseCache->stats();
+            crow::json::wvalue cache;
+            cache["entries"] = cacheStats.entries;
+            cache["bytes"] = cacheStats.bytes;
+            cache["maxBytes"] = cacheStats.maxBytes;
+            cache["hits"] = cacheStats.hits;
+            cache["misses"] = cacheStats.misses;
+            cache["evictions"] = cacheStats.evictions;
+            response["cache"] = move(cache);
+
+            auto flightStats = flights.stats();
+            crow::json::wvalue coalescing;
+            coalescing["leaders"] = flightStats.leaders;
+            coalescing["joined"] = flightStats.joined;
+            coalescing["inFlight"] = flightStats.inFlight;
+            response["coalescing"] = move(coalescing);
+            response["status"] = "success";
+            return crow::response(200, response);
+                });
+
+        // Стратегии доставки в ленту обновлений и их измеренная стоимость
+        CROW_ROUTE(app, "/metrics/delivery").methods("GET"_method)
+            ([this](const crow::request& req) {
+            if (auto denied = metricsDenied(req)) {
+                return move(*denied);
+            }
+            auto stats = delivery->stats();
+            crow::json::wvalue response;
+            const char* names[] = { "push", "pull" };
+            for (size_t i = 0; i < stats.strategies.size(); i++) {
+                const auto& strategy = stats.strategies[i];
+                crow::json::wvalue item;
+                item["chats"] = strategy.chats;
+                item["messages"] = strategy.messages;
+                item["deliveries"] = strategy.deliveries;
+                item["avgFanOutUs"] = strategy.avgFanOutUs;
+                item["reads"] = strategy.reads;
+                item["readMessages"] = strategy.readMessages;
+                item["avgReadMs"] = strategy.avgReadMs;
+                response[names[i]] = move(item);
+            }
+            response["switches"] = stats.switches;
+            response["resets"] = stats.resets;
+            response["pushMaxMembers"] = stats.config.pushMaxMembers;
+            response["pushMaxRate"] = stats.config.pushMaxRate;
+            response["inboxSize"] = stats.config.inboxSize;
+            response["status"] = "success";
+            return crow::response(200, response);
+                });
+
+        // Каналы: подписчики, размер битовых карт и рассылка публикаций
+        CROW_ROUTE(app, "/metrics/channels").methods("GET"_method)
+            ([this](const crow::request& req) {
+            if (auto denied = metricsDenied(req)) {
+                return move(*denied);
+            }
+            auto stats = channels->stats();
+            crow::json::wvalue response;
+            response["channels"] = stats.channels;
+            response["subscribers"] = stats.subscribers;
+            response["bitmapBytes"] = stats.bitmapBytes;
+            response["posts"] = stats.posts;
+            response["batches"] = stats.batches;
+            response["deliveries"] = stats.deliveries;
+            response["inFlight"] = stats.inFlight;
+            response["snapshotCopies"] = stats.snapshotCopies;
+            response["avgFanOutMs"] = stats.avgFanOutMs;
+            response["maxFanOutMs"] = stats.maxFanOutMs;
+            response["threads"] = stats.config.threads;
+            response["batchSize"] = stats.config.batchSize;
+            response["status"] = "success";
+            return crow::response(200, response);
+                });
+
+        // Кэш профилей пользователей
+        CROW_ROUTE(app, "/metrics/users").methods("GET"_method)
+            ([this](const crow::request& req) {
+            if (auto denied = metricsDenied(req)) {
+                return move(*denied);
+            }
+            auto stats = userCache->stats();
+            crow::json::wvalue response;
+            response["entries"] = stats.entries;
+            response["capacity"] = stats.config.capacity;
+            response["shards"] = stats.config.shards;
+            response["hits"] = stats.hits;
+            response["misses"] = stats.misses;
+            response["evictions"] = stats.evictions;
+            response["invalidations"] = stats.invalidations;
+            response["staleFills"] = stats.staleFills;
+            response["status"] = "success";
+            return crow::response(200, response);
+                });
+
+        // Ключи идемпотентности записей
+        CROW_ROUTE(app, "/metrics/idempotency").methods("GET"_method)
+            ([this](const crow::request& req) {
+            if (auto denied = metricsDenied(req)) {
+                return move(*denied);
+            }
+            auto stats = idempotency->stats();
+            crow::json::wvalue response;
+            response["entries"] = stats.entries;
+            response["capacity"] = stats.config.capacity;
+            response["ttlSeconds"] = stats.config.ttl.count();
+            response["memoryHits"] = stats.memoryHits;
+            response["databaseHits"] = stats.databaseHits;
+            response["conflicts"] = stats.conflicts;
+            response["writes"] = stats.writes;
+            response["evictions"] = stats.evictions;
+            response["pruned"] = stats.pruned;
+            response["status"] = "success";
+            return crow::response(200, response);
+                });
+
+        // Запуск резервной копии базы без остановки сервера; ход - /metrics/backup
+        CROW_ROUTE(app, "/admin/backup").methods("POST"_method)
+            ([this, &limit = rateLimits.route("POST /admin/backup", 10)](const crow::request& req, crow::response& res) {
+            if (!rateLimits.admit(req, res, limit)) {
+                return;
+            }
+            crow::json::wvalue response;
+            if (adminToken.empty()) {
+                response["error"] = "Admin API is disabled; start the server with --admin-token";
+                res = crow::response(403, response);
+            }
+            else if (!tokenMatches(req.get_header_value("X-Admin-Token"), adminToken)) {
+                response["error"] = "Invalid admin token";
+                res = crow::response(403, response);
+            }
+            else if (!backup->start()) {
+                response["error"] = "Backup is already running";
+                res = crow::response(409, response);
             }
+            else {
+                response["status"] = "started";
+                res = crow::response(202, response);
+            }
+            res.end();
+                });
+
+        // Выгрузки истории чатов
+        CROW_ROUTE(app, "/metrics/export").methods("GET"_method)
+            ([this](const crow::request& req) {
+            if (auto denied = metricsDenied(req)) {
+                return move(*denied);
+            }
+            auto stats = exporter->stats();
+            crow::json::wvalue response;
+            response["activeStreams"] = stats.activeStreams;
+            response["maxStreams"] = stats.config.maxStreams;
+            response["pageSize"] = stats.config.pageSize;
+            response["streams"] = stats.streams;
+            response["streamedMessages"] = stats.streamedMessages;
+            response["streamedBytes"] = stats.streamedBytes;
+            response["aborted"] = stats.aborted;
+            response["archivesBuilt"] = stats.archivesBuilt;
+            response["archiveRequests"] = stats.archiveRequests;
+            response["archiveBytesSent"] = stats.archiveBytesSent;
+            response["sendfile"] = stats.sendfile;
+            response["status"] = "success";
+            return crow::response(200, response);
+                });
+
+        // Резервная копия базы: ход текущей (или последней) копии
+        CROW_ROUTE(app, "/metrics/backup").methods("GET"_method)
+            ([this](const crow::request& req) {
+            if (auto denied = metricsDenied(req)) {
+                return move(*denied);
+            }
+            auto progress = backup->progress();
+            crow::json::wvalue response;
+            response["state"] = DatabaseBackup::stateName(progress.state);
+            response["path"] = progress.path;
+            response["pagesTotal"] = progress.pagesTotal;
+            response["pagesDone"] = progress.pagesDone;
+            response["percent"] = progress.pagesTotal > 0 ? 100.0 * progress.pagesDone / progress.pagesTotal : 0.0;
+            response["bytes"] = static_cast<uint64_t>(progress.pagesDone) * progress.pageSize;
+            response["seconds"] = progress.seconds;
+            response["bytesPerSecond"] = progress.bytesPerSecond;
+            response["steps"] = progress.steps;
+            response["deferredSteps"] = progress.deferred;
+            response["restarts"] = progress.restarts;
+            response["error"] = progress.error;
+            response["completed"] = progress.completed;
+            response["failed"] = progress.failed;
+            response["pagesPerStep"] = progress.config.pagesPerStep;
+            response["pauseMs"] = progress.config.pause.count();
+            response["intervalSeconds"] = progress.config.interval.count();
+            response["status"] = "success";
+            return crow::response(200, response);
+                });
+
+        // Контрольные точки WAL и возврат свободных страниц
+        CROW_ROUTE(app, "/metrics/maintenance").methods("GET"_method)
+            ([this](const crow::request& req) {
+            if (auto denied = metricsDenied(req)) {
+                return move(*denied);
+            }
+            crow::json::wvalue response;
+            response["enabled"] = maintenance != nullptr;
+            if (maintenance) {
+                auto stats = maintenance->stats();
+                response["walBytes"] = stats.walBytes;
+                response["walFrames"] = stats.walFrames;
+                response["passiveCheckpoints"] = stats.passiveCheckpoints;
+                response["truncateCheckpoints"] = stats.truncateCheckpoints;
+                response["busyCheckpoints"] = stats.busyCheckpoints;
+                response["partialCheckpoints"] = stats.partialCheckpoints;
+                response["framesCheckpointed"] = stats.framesCheckpointed;
+                response["lastCheckpointMs"] = stats.lastCheckpointMs;
+                response["avgCheckpointMs"] = stats.avgCheckpointMs;
+                response["maxCheckpointMs"] = stats.maxCheckpointMs;
+                response["pageCount"] = stats.pageCount;
+                response["freelistPages"] = stats.freelistPages;
+                response["incrementalVacuum"] = stats.incrementalVacuum;
+                response["vacuumRuns"] = stats.vacuumRuns;
+                response["pagesVacuumed"] = stats.pagesVacuumed;
+                response["checkpointFrames"] = stats.config.checkpointFrames;
+                response["truncateBytes"] = stats.config.truncateBytes;
+                response["vacuumPages"] = stats.config.vacuumPages;
+            }
+            response["status"] = "success";
+            return crow::response(200, response);
+                });
+
+        // Граф контактов в памяти
+        CROW_ROUTE(app, "/metrics/contacts").methods("GET"_method)
+            ([this](const crow::request& req) {
+            if (auto denied = metricsDenied(req)) {
+                return move(*denied);
+            }
+            auto stats = socialGraph->stats();
+            crow::json::wvalue response;
+            response["users"] = stats.users;
+            response["contacts"] = stats.contacts;
+            response["adjacencyBytes"] = stats.adjacencyBytes;
+            response["bloomBytes"] = stats.bloomBytes;
+            response["checks"] = stats.checks;
+            response["bloomNegatives"] = stats.bloomNegatives;
+            response["mutualQueries"] = stats.mutualQueries;
+            response["simd"] = simd::enabled();
+            response["status"] = "success";
+            return crow::response(200, response);
+                });
+
+        // Участники чатов в памяти и присутствие
+        CROW_ROUTE(app, "/metrics/membership").methods("GET"_method)
+            ([this](const crow::request& req) {
+            if (auto denied = metricsDenied(req)) {
+                return move(*denied);
+            }
+            auto stats = membership->stats();
+            crow::json::wvalue response;
+            response["chats"] = stats.chats;
+            response["users"] = stats.users;
+            response["memberships"] = stats.memberships;
+            response["online"] = stats.online;
+            response["bitmapBytes"] = stats.bitmapBytes;
+            response["setOps"] = stats.setOps;
+            response["simd"] = stats.simd;
+            response["simdSupported"] = stats.simdSupported;
+            response["presenceWindowSeconds"] = stats.config.presenceWindow.count();
+            response["status"] = "success";
+            return crow::response(200, response);
+                });
+
+        // Статистика рассылки через WebSocket
+        CROW_ROUTE(app, "/metrics/push").methods("GET"_method)
+            ([this](const crow::request& req) {
+            if (auto denied = metricsDenied(req)) {
+                return move(*denied);
+            }
+            auto stats = fanOut.stats();
+            crow::json::wvalue response;
+            response["subscribers"] = stats.subscribers;
+            response["published"] = stats.published;
+            response["encoded"] = stats.encoded;
+            response["enqueued"] = stats.enqueued;
+            response["dropped"] = stats.dropped;
+            response["disconnected"] = stats.disconnected;
+            response["queueFrames"] = pushQueue.maxFrames;
+            response["queueBytes"] = pushQueue.maxBytes;
+            response["policy"] = pushQueue.policy == SlowConsumerPolicy::Disconnect ? "disconnect" : "drop";
+            response["status"] = "success";
+            return crow::response(200, response);
                 });
 
         // Проверка работы сервера
@@ -956,14 +2382,177 @@ private:
     }
 };
 
-int main() {
+static void printUsage(ostream& out) {
+    out << "Usage: ChatServer [--port=18080] [--db=chat.db] [--capture=traffic.bin]\n"
+        "  [--db-readers=4] [--db-queue=1024] [--no-admission] [--no-rate-limit]\n"
+        "  [--no-compression] [--compress-threads=2] [--compress-min=1024] [--response-cache-mb=64]\n"
+        "  [--push-queue=N] [--push-queue-kb=N] [--slow-consumer=disconnect|drop]\n"
+        "  [--push-max-members=N] [--push-max-rate=N] [--inbox-size=N]\n"
+        "  [--channel-threads=N] [--channel-batch=N] [--user-cache=N]\n"
+        "  [--idempotency-keys=N] [--idempotency-ttl=SECONDS]\n"
+        "  [--export-dir=DIR] [--export-streams=N] [--export-port=PORT+1]\n"
+        "  [--no-maintenance] [--checkpoint-frames=N] [--wal-truncate-mb=N] [--vacuum-pages=N]\n"
+        "  [--convert-auto-vacuum]   one-time VACUUM of an existing database into\n"
+        "                            auto_vacuum=INCREMENTAL, needed for --vacuum-pages\n"
+        "  [--backup-dir=DIR] [--backup-interval=SECONDS] [--backup-step-pages=N]\n"
+        "  [--backup-pause-ms=N] [--backup-keep=N]\n"
+        "  [--admin-token=TOKEN]     enables /admin/* and protects /metrics/*\n"
+        "  [--presence-window=SECONDS] [--no-simd]" << endl;
+}
+
+int main(int argc, char** argv) {
     try {
-        ChatServer server;
-        server.run(18080);
+        ServerConfig config;
+
+        for (int i = 1; i < argc; i++) {
+            string arg = argv[i];
+            if (arg == "--help") {
+                printUsage(cout);
+                return 0;
+            }
+            else if (arg.rfind("--port=", 0) == 0) {
+                config.port = stoi(arg.substr(7));
+            }
+            else if (arg.rfind("--db=", 0) == 0) {
+                config.dbPath = arg.substr(5);
+            }
+            else if (arg.rfind("--capture=", 0) == 0) {
+                config.capturePath = arg.substr(10);
+            }
+            else if (arg.rfind("--db-readers=", 0) == 0) {
+                config.dbReadThreads = stoul(arg.substr(13));
+            }
+            else if (arg.rfind("--db-queue=", 0) == 0) {
+                config.dbQueueCapacity = stoul(arg.substr(11));
+            }
+            else if (arg == "--no-admission") {
+                config.admissionControl = false;
+            }
+            else if (arg == "--no-rate-limit") {
+                config.rateLimit = false;
+            }
+            else if (arg == "--no-compression") {
+                config.compression = false;
+            }
+            else if (arg.rfind("--compress-threads=", 0) == 0) {
+                config.compressionThreads = stoul(arg.substr(19));
+            }
+            else if (arg.rfind("--compress-min=", 0) == 0) {
+                config.compressionMinSize = stoul(arg.substr(15));
+            }
+            else if (arg.rfind("--response-cache-mb=", 0) == 0) {
+                config.responseCacheBytes = stoul(arg.substr(20)) * 1024 * 1024;
+            }
+            else if (arg.rfind("--push-queue=", 0) == 0) {
+                config.pushQueue.maxFrames = stoul(arg.substr(13));
+            }
+            else if (arg.rfind("--push-queue-kb=", 0) == 0) {
+                config.pushQueue.maxBytes = stoul(arg.substr(16)) * 1024;
+            }
+            else if (arg == "--slow-consumer=disconnect") {
+                config.pushQueue.policy = SlowConsumerPolicy::Disconnect;
+            }
+            else if (arg == "--slow-consumer=drop") {
+                config.pushQueue.policy = SlowConsumerPolicy::DropOldest;
+            }
+            else if (arg.rfind("--push-max-members=", 0) == 0) {
+                config.delivery.pushMaxMembers = stoul(arg.substr(19));
+            }
+            else if (arg.rfind("--push-max-rate=", 0) == 0) {
+                config.delivery.pushMaxRate = stod(arg.substr(16));
+            }
+            else if (arg.rfind("--inbox-size=", 0) == 0) {
+                config.delivery.inboxSize = stoul(arg.substr(13));
+            }
+            else if (arg.rfind("--channel-threads=", 0) == 0) {
+                config.channels.threads = stoul(arg.substr(18));
+            }
+            else if (arg.rfind("--channel-batch=", 0) == 0) {
+                config.channels.batchSize = stoul(arg.substr(16));
+            }
+            else if (arg.rfind("--user-cache=", 0) == 0) {
+                config.userCache.capacity = stoul(arg.substr(13));
+            }
+            else if (arg.rfind("--idempotency-keys=", 0) == 0) {
+                config.idempotency.capacity = stoul(arg.substr(19));
+            }
+            else if (arg.rfind("--idempotency-ttl=", 0) == 0) {
+                config.idempotency.ttl = chrono::seconds(stol(arg.substr(18)));
+            }
+            else if (arg.rfind("--export-dir=", 0) == 0) {
+                config.exports.directory = arg.substr(13);
+            }
+            else if (arg.rfind("--export-streams=", 0) == 0) {
+                config.exports.maxStreams = stoul(arg.substr(17));
+            }
+            else if (arg.rfind("--export-port=", 0) == 0) {
+                config.exportServer.port = stoi(arg.substr(14));
+            }
+            else if (arg == "--no-maintenance") {
+                config.maintenance = false;
+            }
+            else if (arg.rfind("--checkpoint-frames=", 0) == 0) {
+                config.dbMaintenance.checkpointFrames = stoi(arg.substr(20));
+            }
+            else if (arg.rfind("--wal-truncate-mb=", 0) == 0) {
+                config.dbMaintenance.truncateBytes = stoull(arg.substr(18)) * 1024 * 1024;
+            }
+            else if (arg.rfind("--vacuum-pages=", 0) == 0) {
+                config.dbMaintenance.vacuumPages = stoi(arg.substr(15));
+            }
+            else if (arg == "--convert-auto-vacuum") {
+                config.convertAutoVacuum = true;
+            }
+            else if (arg.rfind("--backup-dir=", 0) == 0) {
+                config.backup.directory = arg.substr(13);
+            }
+            else if (arg.rfind("--backup-interval=", 0) == 0) {
+                config.backup.interval = chrono::seconds(stol(arg.substr(18)));
+            }
+            else if (arg.rfind("--backup-step-pages=", 0) == 0) {
+                config.backup.pagesPerStep = stoi(arg.substr(20));
+            }
+            else if (arg.rfind("--backup-pause-ms=", 0) == 0) {
+                config.backup.pause = chrono::milliseconds(stol(arg.substr(18)));
+            }
+            else if (arg.rfind("--backup-keep=", 0) == 0) {
+                config.backup.keep = stoul(arg.substr(14));
+            }
+            else if (arg.rfind("--admin-token=", 0) == 0) {
+                config.adminToken = arg.substr(14);
+            }
+            else if (arg.rfind("--presence-window=", 0) == 0) {
+                config.membership.presenceWindow = chrono::seconds(stol(arg.substr(18)));
+            }
+            else if (arg == "--no-simd") {
+                simd::enable(false);
+            }
+            // Опечатка в имени флага не должна молча запускать сервер с другой конфигурацией
+            else {
+                cerr << "Unknown argument: " << arg << endl;
+                printUsage(cerr);
+                return 1;
+            }
+        }
+
+        if (config.exportServer.port == 0) {
+            config.exportServer.port = config.port + 1;
+        }
+
+        if (config.convertAutoVacuum) {
+            cout << "Converting " << config.dbPath << " to auto_vacuum=INCREMENTAL (VACUUM)..." << endl;
+            DatabaseMaintenance::convertToIncrementalVacuum(config.dbPath);
+        }
+
+        ChatServer server(config);
+        if (!config.capturePath.empty()) {
+            server.enableCapture(config.capturePath);
+        }
+        server.run(config.port);
     }
     catch (const exception& e) {
         cerr << "Server error: " << e.what() << endl;
         return 1;
     }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,27 @@
+﻿#pragma once
+
+#include <exception>
+#include <utility>
+#include <asio.hpp>
+#include <crow.h>
+
+#include "AsyncResponse.h"
+
+// Запуск обработчика Crow в виде корутины asio::awaitable<crow::response>.
+// Корутина выполняется на io_context соединения, поэтому ожидание базы,
+// таймеров и уведомлений не занимает поток: на нескольких потоках Crow
+// одновременно живут тысячи запросов.
+//
+// handler - вызываемый объект без аргументов; asio хранит его до завершения
+// корутины, так что захваченные по значению переменные остаются валидны.
+// onError(exception_ptr) превращает исключение из корутины в ответ.
+template <typename Handler, typename OnError>
+void spawnHandler(const crow::request& req, crow::response& res, Handler handler, OnError onError) {
+    asio::co_spawn(*req.io_service, std::move(handler),
+        [&res, onError = std::move(onError)](std::exception_ptr error, crow::response result) mutable {
+            if (error) {
+                result = onError(error);
+            }
+            completeAsync(res, std::move(result));
+        });
+}
@@ -0,0 +1,22 @@
+﻿#pragma once
+
+// Доступ к приватным полям Crow, без которых не обойти ошибки библиотеки.
+// При явном инстанцировании шаблона проверка доступа не делается, поэтому
+// указатель на поле можно передать шаблону Access, а наружу он попадает
+// через friend-функцию member(Tag). Для каждого поля нужен свой Tag
+// с типом указателя и объявление member(Tag) в этом пространстве имен.
+//
+// Поля и обходимое поведение относятся к Crow 1.2.0, версия закреплена
+// в vcpkg.json (overrides). Переименованное поле даст ошибку компиляции,
+// но исправленную в библиотеке ошибку никто не заметит - при обновлении
+// Crow пересмотреть AsyncResponse.h и WebSocketPush.cpp.
+namespace crow_private {
+
+template <typename Tag, typename Tag::type Member>
+struct Access {
+    friend typename Tag::type member(Tag) {
+        return Member;
+    }
+};
+
+} // namespace crow_private
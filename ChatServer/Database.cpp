@@ -0,0 +1,896 @@
+﻿#include "Database.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace std;
+
+bool Database::executeSQL(const string& sql,
+    const vector<pair<int, string>>& params,
+    function<void(sqlite3_stmt*)> callback) {
+    sqlite3_stmt* stmt;
+
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        cerr << "SQL error: " << sqlite3_errmsg(db) << endl;
+        return false;
+    }
+
+    // Биндим параметры
+    for (size_t i = 0; i < params.size(); i++) {
+        int index = i + 1;
+        int type = params[i].first;
+        const string& value = params[i].second;
+
+        if (type == SQLITE_INTEGER) {
+            sqlite3_bind_int(stmt, index, stoi(value));
+        }
+        else if (type == SQLITE_TEXT) {
+            sqlite3_bind_text(stmt, index, value.c_str(), -1, SQLITE_TRANSIENT);
+        }
+    }
+
+    bool result = true;
+    if (callback) {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            callback(stmt);
+        }
+    }
+    else {
+        result = sqlite3_step(stmt) == SQLITE_DONE;
+    }
+
+    sqlite3_finalize(stmt);
+
+    // Вне транзакции изменения уже зафиксированы (автокоммит, COMMIT или ROLLBACK)
+    if (!uncommittedChanges.empty() && sqlite3_get_autocommit(db)) {
+        notifyCommitted();
+    }
+    return result;
+}
+
+void Database::onRowsCommitted(string table, function<void(int64_t)> handler) {
+    watchedTable = move(table);
+    rowChangeHandler = move(handler);
+    sqlite3_update_hook(db, rowChangeHandler ? &Database::updateHook : nullptr, this);
+}
+
+void Database::updateHook(void* self, int /*operation*/, const char* /*database*/, const char* table, sqlite3_int64 rowid) {
+    auto* database = static_cast<Database*>(self);
+    if (database->watchedTable == table) {
+        database->uncommittedChanges.push_back(rowid);
+    }
+}
+
+void Database::onWalCommit(function<void(int)> handler) {
+    walCommitHandler = move(handler);
+    if (walCommitHandler) {
+        sqlite3_wal_hook(db, &Database::walHook, this);
+    }
+    else {
+        sqlite3_wal_autocheckpoint(db, 1000);
+    }
+}
+
+int Database::walHook(void* self, sqlite3* /*db*/, const char* /*database*/, int frames) {
+    static_cast<Database*>(self)->walCommitHandler(frames);
+    return SQLITE_OK;
+}
+
+// После ROLLBACK строки не изменились, но лишнее уведомление безвредно
+void Database::notifyCommitted() {
+    auto changes = move(uncommittedChanges);
+    uncommittedChanges.clear();
+    for (int64_t rowid : changes) {
+        rowChangeHandler(rowid);
+    }
+}
+
+Database::Database(const string& dbPath) {
+    if (sqlite3_open(dbPath.c_str(), &db) != SQLITE_OK) {
+        throw runtime_error("Can't open database: " + string(sqlite3_errmsg(db)));
+    }
+
+    // К одной базе открыто несколько соединений (см. DbExecutor):
+    // WAL позволяет читать параллельно с записью, а при блокировке ждем, а не падаем
+    sqlite3_busy_timeout(db, 5000);
+    // Действует только для новой базы: освобожденные страницы возвращаются
+    // постепенно (PRAGMA incremental_vacuum, см. DatabaseMaintenance)
+    sqlite3_exec(db, "PRAGMA auto_vacuum=INCREMENTAL", nullptr, nullptr, nullptr);
+    sqlite3_exec(db, "PRAGMA journal_mode=WAL", nullptr, nullptr, nullptr);
+    // Осознанное ослабление долговечности против исходного FULL: в WAL с NORMAL
+    // fsync делается только при checkpoint, а не на каждый COMMIT. База при
+    // этом не портится, падение процесса ничего не теряет (WAL уже в кэше ОС),
+    // но сбой ОС или питания может откатить транзакции после последнего
+    // checkpoint - сообщения, на которые клиент уже получил 200. Цена FULL -
+    // fsync на каждую запись в единственном потоке записи (у нас на диске
+    // ~5 раз меньше коммитов в секунду)
+    sqlite3_exec(db, "PRAGMA synchronous=NORMAL", nullptr, nullptr, nullptr);
+
+    createTables();
+}
+
+Database::~Database() {
+    if (db) {
+        sqlite3_close(db);
+    }
+}
+
+void Database::createTables() {
+    const char* tables[] = {
+        R"(
+            CREATE TABLE IF NOT EXISTS users (
+                id INTEGER PRIMARY KEY AUTOINCREMENT,
+                name TEXT NOT NULL,
+                login TEXT UNIQUE NOT NULL,
+                password TEXT NOT NULL
+            )
+        )",
+        R"(
+            CREATE TABLE IF NOT EXISTS chats (
+                id INTEGER PRIMARY KEY AUTOINCREMENT,
+                name TEXT,
+                is_group INTEGER DEFAULT 0,
+                created_by INTEGER,
+                created_at DATETIME DEFAULT CURRENT_TIMESTAMP
+            )
+        )",
+        R"(
+            CREATE TABLE IF NOT EXISTS messages (
+                id INTEGER PRIMARY KEY AUTOINCREMENT,
+                user_id INTEGER NOT NULL,
+                chat_id INTEGER NOT NULL,
+                msg TEXT NOT NULL,
+                reply_id INTEGER DEFAULT 0,
+                send_date DATETIME DEFAULT CURRENT_TIMESTAMP,
+                resend_id INTEGER DEFAULT 0
+            )
+        )",
+        R"(
+            CREATE TABLE IF NOT EXISTS contacts (
+                id INTEGER PRIMARY KEY AUTOINCREMENT,
+                user_id1 INTEGER NOT NULL,
+                user_id2 INTEGER NOT NULL,
+                CHECK (user_id1 != user_id2)
+            )
+        )",
+        R"(
+            CREATE TABLE IF NOT EXISTS user_chats (
+                user_id INTEGER NOT NULL,
+                chat_id INTEGER NOT NULL,
+                PRIMARY KEY (user_id, chat_id)
+            )
+        )",
+        // Каналы: чаты, в которые пишут только администраторы.
+        // Подписчики - отдельно от user_chats, в памяти они хранятся битовыми картами
+        R"(
+            CREATE TABLE IF NOT EXISTS channels (
+                chat_id INTEGER PRIMARY KEY
+            )
+        )",
+        R"(
+            CREATE TABLE IF NOT EXISTS channel_admins (
+                chat_id INTEGER NOT NULL,
+                user_id INTEGER NOT NULL,
+                PRIMARY KEY (chat_id, user_id)
+            ) WITHOUT ROWID
+        )",
+        R"(
+            CREATE TABLE IF NOT EXISTS channel_subscribers (
+                chat_id INTEGER NOT NULL,
+                user_id INTEGER NOT NULL,
+                PRIMARY KEY (chat_id, user_id)
+            ) WITHOUT ROWID
+        )",
+        // Дочитывание чата от курсора (getChatMessagesAfter)
+        R"(
+            CREATE INDEX IF NOT EXISTS idx_messages_chat_id ON messages (chat_id, id)
+        )",
+        // Ключи повторяемых записей: первичный ключ не дает записать
+        // результат дважды, body_hash - тело первой записи, created_at -
+        // для срока действия и удаления устаревших
+        R"(
+            CREATE TABLE IF NOT EXISTS idempotency_keys (
+                user_id INTEGER NOT NULL,
+                route TEXT NOT NULL,
+                key TEXT NOT NULL,
+                result_id INTEGER NOT NULL,
+                body_hash TEXT NOT NULL,
+                created_at DATETIME DEFAULT CURRENT_TIMESTAMP,
+                PRIMARY KEY (user_id, route, key)
+            ) WITHOUT ROWID
+        )",
+        R"(
+            CREATE INDEX IF NOT EXISTS idx_idempotency_keys_created_at ON idempotency_keys (created_at)
+        )"
+    };
+
+    for (const char* table : tables) {
+        char* errMsg = nullptr;
+        if (sqlite3_exec(db, table, nullptr, nullptr, &errMsg) != SQLITE_OK) {
+            string error = "SQL error: " + string(errMsg);
+            sqlite3_free(errMsg);
+            cerr << error << endl;
+        }
+    }
+}
+
+// Транзакции
+bool Database::beginTransaction() {
+    return executeSQL("BEGIN IMMEDIATE");
+}
+
+bool Database::commitTransaction() {
+    return executeSQL("COMMIT");
+}
+
+bool Database::rollbackTransaction() {
+    return executeSQL("ROLLBACK");
+}
+
+// Регистрация пользователя
+int Database::registerUser(const string& name, const string& login, const string& password) {
+    string hashedPassword = to_string(hash<string>{}(password));
+    string sql = "INSERT INTO users (name, login, password) VALUES (?, ?, ?)";
+
+    vector<pair<int, string>> params = {
+        {SQLITE_TEXT, name},
+        {SQLITE_TEXT, login},
+        {SQLITE_TEXT, hashedPassword}
+    };
+
+    if (!executeSQL(sql, params)) {
+        return -1;
+    }
+
+    return sqlite3_last_insert_rowid(db);
+}
+
+// Авторизация пользователя
+bool Database::loginUser(const string& login, const string& password, User& user) {
+    string sql = "SELECT id, name, login, password FROM users WHERE login = ?";
+    vector<pair<int, string>> params = { {SQLITE_TEXT, login} };
+
+    bool found = false;
+    auto callback = [&](sqlite3_stmt* stmt) {
+        string storedHash = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
+        string inputHash = to_string(hash<string>{}(password));
+
+        if (inputHash == storedHash) {
+            user.id = sqlite3_column_int(stmt, 0);
+            user.name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+            user.login = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+            found = true;
+        }
+        };
+
+    executeSQL(sql, params, callback);
+    return found;
+}
+
+// Получение пользователя по ID
+bool Database::getUserById(int userId, UserInfo& user) {
+    string sql = "SELECT id, name, login FROM users WHERE id = ?";
+    vector<pair<int, string>> params = { {SQLITE_INTEGER, to_string(userId)} };
+
+    bool found = false;
+    auto callback = [&](sqlite3_stmt* stmt) {
+        user.id = sqlite3_column_int(stmt, 0);
+        user.name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        user.login = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+        found = true;
+        };
+
+    executeSQL(sql, params, callback);
+    return found;
+}
+
+vector<UserInfo> Database::getUsersByIds(const vector<int>& userIds) {
+    vector<UserInfo> result;
+    if (userIds.empty()) {
+        return result;
+    }
+
+    string sql = "SELECT id, name, login FROM users WHERE id IN (";
+    vector<pair<int, string>> params;
+    params.reserve(userIds.size());
+    for (size_t i = 0; i < userIds.size(); i++) {
+        sql += i == 0 ? "?" : ", ?";
+        params.push_back({ SQLITE_INTEGER, to_string(userIds[i]) });
+    }
+    sql += ")";
+
+    auto callback = [&](sqlite3_stmt* stmt) {
+        result.push_back({ sqlite3_column_int(stmt, 0),
+            reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)),
+            reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2)) });
+        };
+
+    executeSQL(sql, params, callback);
+    return result;
+}
+
+// Поиск пользователей
+vector<UserSearchResult> Database::searchUsers(const string& searchQuery) {
+    vector<UserSearchResult> result;
+
+    string sql = "SELECT id, name, login FROM users WHERE (login LIKE ? OR name LIKE ?) AND id > 0";
+    vector<pair<int, string>> params = {
+        {SQLITE_TEXT, "%" + searchQuery + "%"},
+        {SQLITE_TEXT, "%" + searchQuery + "%"}
+    };
+
+    auto callback = [&](sqlite3_stmt* stmt) {
+        UserSearchResult user;
+        user.id = sqlite3_column_int(stmt, 0);
+        user.name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        user.login = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+        result.push_back(user);
+        };
+
+    executeSQL(sql, params, callback);
+    return result;
+}
+
+// Создание чата
+int Database::createChat(const string& name, bool isGroup, int createdBy, const vector<int>& participants) {
+    string sql = "INSERT INTO chats (name, is_group, created_by) VALUES (?, ?, ?)";
+
+    vector<pair<int, string>> params = {
+        {SQLITE_TEXT, name},
+        {SQLITE_INTEGER, isGroup ? "1" : "0"},
+        {SQLITE_INTEGER, to_string(createdBy)}
+    };
+
+    if (!executeSQL(sql, params)) {
+        return -1;
+    }
+
+    int chatId = sqlite3_last_insert_rowid(db);
+
+    // Добавляем всех участников
+    for (int userId : participants) {
+        addUserToChat(userId, chatId);
+    }
+
+    // Добавляем создателя
+    addUserToChat(createdBy, chatId);
+
+    return chatId;
+}
+
+// Добавление пользователя в чат
+bool Database::addUserToChat(int userId, int chatId) {
+    string sql = "INSERT OR IGNORE INTO user_chats (user_id, chat_id) VALUES (?, ?)";
+
+    vector<pair<int, string>> params = {
+        {SQLITE_INTEGER, to_string(userId)},
+        {SQLITE_INTEGER, to_string(chatId)}
+    };
+
+    return executeSQL(sql, params);
+}
+
+// Добавление контакта
+int Database::addContact(int userId1, int userId2) {
+    if (userId1 == userId2) {
+        return -1; // Нельзя добавить самого себя
+    }
+
+    // Проверяем существование пользователей
+    UserInfo user1, user2;
+    bool user1Exists = getUserById(userId1, user1);
+    bool user2Exists = getUserById(userId2, user2);
+
+    if (!user1Exists || !user2Exists) {
+        return -3; // Один из пользователей не найден
+    }
+
+    // Проверяем, существует ли уже контакт
+    string checkSql = R"(
+        SELECT id FROM contacts 
+        WHERE (user_id1 = ? AND user_id2 = ?) OR (user_id1 = ? AND user_id2 = ?)
+    )";
+
+    vector<pair<int, string>> checkParams = {
+        {SQLITE_INTEGER, to_string(userId1)},
+        {SQLITE_INTEGER, to_string(userId2)},
+        {SQLITE_INTEGER, to_string(userId2)},
+        {SQLITE_INTEGER, to_string(userId1)}
+    };
+
+    bool exists = false;
+    auto checkCallback = [&](sqlite3_stmt* stmt) {
+        exists = true;
+        };
+
+    executeSQL(checkSql, checkParams, checkCallback);
+
+    if (exists) {
+        return -2; // Контакт уже существует
+    }
+
+    return insertContact(userId1, userId2);
+}
+
+int Database::insertContact(int userId1, int userId2) {
+    string sql = "INSERT INTO contacts (user_id1, user_id2) VALUES (?, ?)";
+    vector<pair<int, string>> params = {
+        {SQLITE_INTEGER, to_string(userId1)},
+        {SQLITE_INTEGER, to_string(userId2)}
+    };
+
+    if (!executeSQL(sql, params)) {
+        return -4; // Ошибка базы данных
+    }
+
+    return static_cast<int>(sqlite3_last_insert_rowid(db));
+}
+
+// Получение чатов пользователя
+vector<Chat> Database::getUserChats(int userId) {
+    vector<Chat> result;
+
+    string sql = R"(
+        SELECT c.id, c.name, c.is_group, c.created_by, c.created_at
+        FROM chats c
+        JOIN user_chats uc ON c.id = uc.chat_id
+        WHERE uc.user_id = ?
+        ORDER BY c.created_at DESC
+    )";
+
+    vector<pair<int, string>> params = { {SQLITE_INTEGER, to_string(userId)} };
+
+    auto callback = [&](sqlite3_stmt* stmt) {
+        Chat chat;
+        chat.id = sqlite3_column_int(stmt, 0);
+        chat.name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        chat.isGroup = sqlite3_column_int(stmt, 2) == 1;
+        chat.createdBy = sqlite3_column_int(stmt, 3);
+        chat.createdAt = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
+        result.push_back(chat);
+        };
+
+    executeSQL(sql, params, callback);
+    return result;
+}
+
+// Получение контактов пользователя
+vector<pair<int, string>> Database::getUserContacts(int userId) {
+    vector<pair<int, string>> result;
+
+    string sql = R"(
+        SELECT 
+            CASE 
+                WHEN c.user_id1 = ? THEN c.user_id2
+                ELSE c.user_id1
+            END as other_user_id,
+            u.name
+        FROM contacts c
+        JOIN users u ON (c.user_id1 = u.id OR c.user_id2 = u.id) AND u.id != ?
+        WHERE (c.user_id1 = ? OR c.user_id2 = ?)
+    )";
+
+    vector<pair<int, string>> params = {
+        {SQLITE_INTEGER, to_string(userId)},
+        {SQLITE_INTEGER, to_string(userId)},
+        {SQLITE_INTEGER, to_string(userId)},
+        {SQLITE_INTEGER, to_string(userId)}
+    };
+
+    auto callback = [&](sqlite3_stmt* stmt) {
+        int otherUserId = sqlite3_column_int(stmt, 0);
+        string name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        result.push_back({ otherUserId, name });
+        };
+
+    executeSQL(sql, params, callback);
+    return result;
+}
+
+// Отправка сообщения
+int Database::sendMessage(int userId, int chatId, const string& message, int replyId, int resendId) {
+    string sql = "INSERT INTO messages (user_id, chat_id, msg, reply_id, resend_id) VALUES (?, ?, ?, ?, ?)";
+
+    vector<pair<int, string>> params = {
+        {SQLITE_INTEGER, to_string(userId)},
+        {SQLITE_INTEGER, to_string(chatId)},
+        {SQLITE_TEXT, message},
+        {SQLITE_INTEGER, to_string(replyId)},
+        {SQLITE_INTEGER, to_string(resendId)}
+    };
+
+    if (!executeSQL(sql, params)) {
+        return -1;
+    }
+
+    return sqlite3_last_insert_rowid(db);
+}
+
+// Пакетная вставка сообщений
+bool Database::insertMessages(int chatId, const vector<NewMessage>& messages, int& firstId, int& lastId) {
+    if (messages.empty() || !beginTransaction()) {
+        return false;
+    }
+
+    // AUTOINCREMENT в одной транзакции единственного писателя выдает id подряд
+    const char* sql = R"(
+        INSERT INTO messages (user_id, chat_id, msg, reply_id, resend_id, send_date)
+        VALUES (?, ?, ?, ?, ?, COALESCE(?, CURRENT_TIMESTAMP))
+    )";
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        cerr << "SQL error: " << sqlite3_errmsg(db) << endl;
+        rollbackTransaction();
+        return false;
+    }
+
+    bool ok = true;
+    sqlite3_bind_int(stmt, 2, chatId);
+    for (size_t i = 0; i < messages.size() && ok; i++) {
+        const auto& msg = messages[i];
+        sqlite3_bind_int(stmt, 1, msg.userId);
+        sqlite3_bind_text(stmt, 3, msg.msg.data(), static_cast<int>(msg.msg.size()), SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 4, msg.replyId);
+        sqlite3_bind_int(stmt, 5, msg.resendId);
+        if (msg.sendDate.empty()) {
+            sqlite3_bind_null(stmt, 6);
+        }
+        else {
+            sqlite3_bind_text(stmt, 6, msg.sendDate.data(), static_cast<int>(msg.sendDate.size()), SQLITE_STATIC);
+        }
+
+        ok = sqlite3_step(stmt) == SQLITE_DONE;
+        if (!ok) {
+            cerr << "SQL error: " << sqlite3_errmsg(db) << endl;
+        }
+        else if (i == 0) {
+            firstId = static_cast<int>(sqlite3_last_insert_rowid(db));
+        }
+        sqlite3_reset(stmt);
+    }
+    lastId = static_cast<int>(sqlite3_last_insert_rowid(db));
+    sqlite3_finalize(stmt);
+
+    if (!ok || !commitTransaction()) {
+        rollbackTransaction();
+        return false;
+    }
+    return true;
+}
+
+// Получение сообщений чата
+vector<Message> Database::getChatMessages(int chatId) {
+    vector<Message> result;
+
+    string sql = R"(
+        SELECT id, user_id, msg, reply_id, send_date, resend_id
+        FROM messages
+        WHERE chat_id = ?
+        ORDER BY send_date ASC
+    )";
+
+    vector<pair<int, string>> params = { {SQLITE_INTEGER, to_string(chatId)} };
+
+    auto callback = [&](sqlite3_stmt* stmt) {
+        Message msg;
+        msg.id = sqlite3_column_int(stmt, 0);
+        msg.userId = sqlite3_column_int(stmt, 1);
+        msg.msg = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+        msg.replyId = sqlite3_column_int(stmt, 3);
+        msg.sendDate = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
+        msg.resendId = sqlite3_column_int(stmt, 5);
+        msg.chatId = chatId;
+        result.push_back(msg);
+        };
+
+    executeSQL(sql, params, callback);
+    return result;
+}
+
+// Редактирование сообщения
+bool Database::editMessage(int messageId, const string& newMessage, int userId) {
+    string sql = "UPDATE messages SET msg = ? WHERE id = ? AND user_id = ?";
+
+    vector<pair<int, string>> params = {
+        {SQLITE_TEXT, newMessage},
+        {SQLITE_INTEGER, to_string(messageId)},
+        {SQLITE_INTEGER, to_string(userId)}
+    };
+
+    return executeSQL(sql, params);
+}
+
+// Удаление сообщения
+bool Database::deleteMessage(int messageId, int userId) {
+    string sql = "DELETE FROM messages WHERE id = ? AND user_id = ?";
+
+    vector<pair<int, string>> params = {
+        {SQLITE_INTEGER, to_string(messageId)},
+        {SQLITE_INTEGER, to_string(userId)}
+    };
+
+    return executeSQL(sql, params);
+}
+
+// Получение информации о сообщении
+bool Database::getMessageInfo(int messageId, int& userId, string& msg) {
+    string sql = "SELECT user_id, msg FROM messages WHERE id = ?";
+    vector<pair<int, string>> params = { {SQLITE_INTEGER, to_string(messageId)} };
+
+    bool found = false;
+    auto callback = [&](sqlite3_stmt* stmt) {
+        userId = sqlite3_column_int(stmt, 0);
+        msg = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        found = true;
+        };
+
+    executeSQL(sql, params, callback);
+    return found;
+}
+
+// Получение чата сообщения
+int Database::getMessageChatId(int messageId) {
+    string sql = "SELECT chat_id FROM messages WHERE id = ?";
+    vector<pair<int, string>> params = { {SQLITE_INTEGER, to_string(messageId)} };
+
+    int chatId = -1;
+    auto callback = [&](sqlite3_stmt* stmt) {
+        chatId = sqlite3_column_int(stmt, 0);
+        };
+
+    executeSQL(sql, params, callback);
+    return chatId;
+}
+
+// Участники всех чатов
+vector<ChatMembers> Database::getAllChatMembers() {
+    vector<ChatMembers> result;
+
+    string sql = R"(
+        SELECT c.id, c.is_group, uc.user_id,
+               (SELECT MAX(m.id) FROM messages m WHERE m.chat_id = c.id)
+        FROM chats c
+        JOIN user_chats uc ON c.id = uc.chat_id
+        ORDER BY c.id, uc.user_id
+    )";
+
+    auto callback = [&](sqlite3_stmt* stmt) {
+        int chatId = sqlite3_column_int(stmt, 0);
+        if (result.empty() || result.back().chatId != chatId) {
+            result.push_back({ chatId, sqlite3_column_int(stmt, 1) != 0, sqlite3_column_int(stmt, 3), {} });
+        }
+        result.back().userIds.push_back(sqlite3_column_int(stmt, 2));
+        };
+
+    executeSQL(sql, {}, callback);
+    return result;
+}
+
+// Чтение строки messages в порядке колонок id, user_id, chat_id, msg, reply_id, send_date, resend_id
+static Message readMessage(sqlite3_stmt* stmt) {
+    Message msg;
+    msg.id = sqlite3_column_int(stmt, 0);
+    msg.userId = sqlite3_column_int(stmt, 1);
+    msg.chatId = sqlite3_column_int(stmt, 2);
+    msg.msg = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
+    msg.replyId = sqlite3_column_int(stmt, 4);
+    msg.sendDate = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
+    msg.resendId = sqlite3_column_int(stmt, 6);
+    return msg;
+}
+
+// Сообщения по списку id
+vector<Message> Database::getMessagesByIds(const vector<int>& messageIds) {
+    vector<Message> result;
+    if (messageIds.empty()) {
+        return result;
+    }
+
+    string sql = "SELECT id, user_id, chat_id, msg, reply_id, send_date, resend_id FROM messages WHERE id IN (";
+    vector<pair<int, string>> params;
+    params.reserve(messageIds.size());
+    for (size_t i = 0; i < messageIds.size(); i++) {
+        sql += i == 0 ? "?" : ", ?";
+        params.push_back({ SQLITE_INTEGER, to_string(messageIds[i]) });
+    }
+    sql += ") ORDER BY id";
+
+    auto callback = [&](sqlite3_stmt* stmt) {
+        result.push_back(readMessage(stmt));
+        };
+
+    executeSQL(sql, params, callback);
+    return result;
+}
+
+// Новые сообщения чата после afterId
+vector<Message> Database::getChatMessagesAfter(int chatId, int afterId, int limit) {
+    vector<Message> result;
+
+    string sql = R"(
+        SELECT id, user_id, chat_id, msg, reply_id, send_date, resend_id
+        FROM messages
+        WHERE chat_id = ? AND id > ?
+        ORDER BY id ASC
+        LIMIT ?
+    )";
+
+    vector<pair<int, string>> params = {
+        {SQLITE_INTEGER, to_string(chatId)},
+        {SQLITE_INTEGER, to_string(afterId)},
+        {SQLITE_INTEGER, to_string(limit)}
+    };
+
+    auto callback = [&](sqlite3_stmt* stmt) {
+        result.push_back(readMessage(stmt));
+        };
+
+    executeSQL(sql, params, callback);
+    return result;
+}
+
+// Создание канала
+int Database::createChannel(const string& name, int createdBy) {
+    if (!beginTransaction()) {
+        return -1;
+    }
+
+    vector<pair<int, string>> params = {
+        {SQLITE_TEXT, name},
+        {SQLITE_INTEGER, to_string(createdBy)}
+    };
+    if (!executeSQL("INSERT INTO chats (name, is_group, created_by) VALUES (?, 1, ?)", params)) {
+        rollbackTransaction();
+        return -1;
+    }
+    int chatId = sqlite3_last_insert_rowid(db);
+
+    bool created = executeSQL("INSERT INTO channels (chat_id) VALUES (?)", { {SQLITE_INTEGER, to_string(chatId)} }) &&
+        addChannelAdmin(chatId, createdBy) == 1;
+    if (!created || !commitTransaction()) {
+        rollbackTransaction();
+        return -1;
+    }
+    return chatId;
+}
+
+// Добавление существующего пользователя в channel_admins или channel_subscribers
+int Database::addChannelUser(const string& table, int chatId, int userId) {
+    bool exists = false;
+    auto callback = [&](sqlite3_stmt*) {
+        exists = true;
+        };
+    if (!executeSQL("SELECT 1 FROM users WHERE id = ?", { {SQLITE_INTEGER, to_string(userId)} }, callback)) {
+        return -1;
+    }
+    if (!exists) {
+        return 0;
+    }
+
+    string sql = "INSERT OR IGNORE INTO " + table + " (chat_id, user_id) VALUES (?, ?)";
+    vector<pair<int, string>> params = {
+        {SQLITE_INTEGER, to_string(chatId)},
+        {SQLITE_INTEGER, to_string(userId)}
+    };
+    return executeSQL(sql, params) ? 1 : -1;
+}
+
+int Database::addChannelAdmin(int chatId, int userId) {
+    return addChannelUser("channel_admins", chatId, userId);
+}
+
+int Database::addChannelSubscriber(int chatId, int userId) {
+    return addChannelUser("channel_subscribers", chatId, userId);
+}
+
+bool Database::removeChannelSubscriber(int chatId, int userId) {
+    string sql = "DELETE FROM channel_subscribers WHERE chat_id = ? AND user_id = ?";
+
+    vector<pair<int, string>> params = {
+        {SQLITE_INTEGER, to_string(chatId)},
+        {SQLITE_INTEGER, to_string(userId)}
+    };
+
+    return executeSQL(sql, params);
+}
+
+vector<ChannelMembers> Database::getAllChannels() {
+    vector<ChannelMembers> result;
+    unordered_map<int, size_t> index;
+
+    string sql = R"(
+        SELECT c.id, c.name, c.created_by
+        FROM channels ch
+        JOIN chats c ON c.id = ch.chat_id
+        ORDER BY c.id
+    )";
+    executeSQL(sql, {}, [&](sqlite3_stmt* stmt) {
+        const unsigned char* name = sqlite3_column_text(stmt, 1);
+        ChannelMembers channel{ sqlite3_column_int(stmt, 0), name ? reinterpret_cast<const char*>(name) : "",
+            sqlite3_column_int(stmt, 2), {}, {} };
+        index[channel.chatId] = result.size();
+        result.push_back(move(channel));
+        });
+
+    executeSQL("SELECT chat_id, user_id FROM channel_admins ORDER BY chat_id, user_id", {}, [&](sqlite3_stmt* stmt) {
+        auto it = index.find(sqlite3_column_int(stmt, 0));
+        if (it != index.end()) {
+            result[it->second].admins.push_back(sqlite3_column_int(stmt, 1));
+        }
+        });
+
+    executeSQL("SELECT chat_id, user_id FROM channel_subscribers ORDER BY chat_id, user_id", {}, [&](sqlite3_stmt* stmt) {
+        auto it = index.find(sqlite3_column_int(stmt, 0));
+        if (it != index.end()) {
+            result[it->second].subscribers.push_back(sqlite3_column_int(stmt, 1));
+        }
+        });
+    return result;
+}
+
+vector<Contact> Database::getAllContacts() {
+    vector<Contact> result;
+    executeSQL("SELECT id, user_id1, user_id2 FROM contacts", {}, [&](sqlite3_stmt* stmt) {
+        result.push_back({ sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1), sqlite3_column_int(stmt, 2) });
+        });
+    return result;
+}
+
+vector<pair<int, string>> Database::getAllUserNames() {
+    vector<pair<int, string>> result;
+    executeSQL("SELECT id, name FROM users", {}, [&](sqlite3_stmt* stmt) {
+        result.push_back({ sqlite3_column_int(stmt, 0), reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)) });
+        });
+    return result;
+}
+
+// Результат записи с ключом идемпотентности
+int Database::getIdempotentResult(int userId, const string& route, const string& key,
+    int64_t ageSeconds, string& bodyHash) {
+    string sql = R"(
+        SELECT result_id, body_hash FROM idempotency_keys
+        WHERE user_id = ? AND route = ? AND key = ? AND created_at >= datetime('now', ?)
+    )";
+    vector<pair<int, string>> params = {
+        {SQLITE_INTEGER, to_string(userId)},
+        {SQLITE_TEXT, route},
+        {SQLITE_TEXT, key},
+        {SQLITE_TEXT, "-" + to_string(ageSeconds) + " seconds"}
+    };
+
+    int resultId = 0;
+    bodyHash.clear();
+    auto callback = [&](sqlite3_stmt* stmt) {
+        resultId = sqlite3_column_int(stmt, 0);
+        bodyHash = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        };
+
+    executeSQL(sql, params, callback);
+    return resultId;
+}
+
+bool Database::saveIdempotentResult(int userId, const string& route, const string& key,
+    const string& bodyHash, int resultId) {
+    // Устаревший, но еще не удаленный ключ заменяется вместе с created_at
+    string sql = "INSERT OR REPLACE INTO idempotency_keys (user_id, route, key, result_id, body_hash) VALUES (?, ?, ?, ?, ?)";
+    vector<pair<int, string>> params = {
+        {SQLITE_INTEGER, to_string(userId)},
+        {SQLITE_TEXT, route},
+        {SQLITE_TEXT, key},
+        {SQLITE_INTEGER, to_string(resultId)},
+        {SQLITE_TEXT, bodyHash}
+    };
+
+    return executeSQL(sql, params);
+}
+
+int Database::deleteIdempotencyKeys(int64_t ageSeconds) {
+    string sql = "DELETE FROM idempotency_keys WHERE created_at < datetime('now', ?)";
+    vector<pair<int, string>> params = { {SQLITE_TEXT, "-" + to_string(ageSeconds) + " seconds"} };
+
+    if (!executeSQL(sql, params)) {
+        return 0;
+    }
+    return sqlite3_changes(db);
+}
\ No newline at end of file
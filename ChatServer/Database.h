@@ -0,0 +1,219 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+#include <functional>
+#include <sqlite3.h>
+
+// Структуры данных
+struct User {
+    int id;
+    std::string name;
+    std::string login;
+    std::string password;
+};
+
+// Структура для информации о пользователе
+struct UserInfo {
+    int id;
+    std::string name;
+    std::string login;
+};
+
+// Структура для поиска пользователей
+struct UserSearchResult {
+    int id;
+    std::string name;
+    std::string login;
+};
+
+struct Chat {
+    int id;
+    std::string name;
+    bool isGroup;
+    int createdBy;
+    std::string createdAt;
+};
+
+struct Message {
+    int id;
+    int userId;
+    int chatId;
+    std::string msg;
+    int replyId; // 0 если нет reply
+    std::string sendDate;
+    int resendId; // 0 если нет пересылки
+};
+
+// Сообщение пакетной вставки (insertMessages)
+struct NewMessage {
+    int userId = 0;
+    std::string msg;
+    int replyId = 0;
+    int resendId = 0;
+    std::string sendDate;           // пусто - время вставки
+};
+
+// Участники чата
+struct ChatMembers {
+    int chatId;
+    bool isGroup;
+    int lastMessageId;              // 0 - сообщений нет
+    std::vector<int> userIds;
+};
+
+// Канал: администраторы и подписчики
+struct ChannelMembers {
+    int chatId;
+    std::string name;
+    int createdBy;
+    std::vector<int> admins;
+    std::vector<int> subscribers;   // по возрастанию id
+};
+
+struct Contact {
+    int id;
+    int userId1;
+    int userId2;
+};
+
+class Database {
+private:
+    sqlite3* db;
+
+    // Хелпер функция для выполнения SQL запросов
+    bool executeSQL(const std::string& sql,
+        const std::vector<std::pair<int, std::string>>& params = {},
+        std::function<void(sqlite3_stmt*)> callback = nullptr);
+
+    int addChannelUser(const std::string& table, int chatId, int userId);
+
+    std::string watchedTable;
+    std::function<void(int64_t)> rowChangeHandler;
+    std::vector<int64_t> uncommittedChanges;
+
+    static void updateHook(void* self, int operation, const char* database, const char* table, sqlite3_int64 rowid);
+    void notifyCommitted();
+
+    std::function<void(int)> walCommitHandler;
+    static int walHook(void* self, sqlite3* db, const char* database, int frames);
+
+public:
+    Database(const std::string& dbPath = "chat.db");
+    ~Database();
+
+    Database(const Database&) = delete;
+    Database& operator=(const Database&) = delete;
+
+    void createTables();
+
+    // Измененные этим соединением строки таблицы (INSERT, UPDATE, DELETE)
+    // через sqlite3_update_hook. SQLite сообщает о них до фиксации, поэтому
+    // rowid копятся и передаются handler, когда соединение выходит из
+    // транзакции: читатели после этого уже видят новые строки
+    void onRowsCommitted(std::string table, std::function<void(int64_t rowid)> handler);
+
+    // Число кадров в WAL после каждой фиксации этого соединения
+    // (sqlite3_wal_hook). Заменяет автоматическую контрольную точку соединения:
+    // ее делает тот, кто установил handler (см. DatabaseMaintenance)
+    void onWalCommit(std::function<void(int frames)> handler);
+
+    // Транзакции (для пакетной записи)
+    bool beginTransaction();
+    bool commitTransaction();
+    bool rollbackTransaction();
+
+    // Регистрация пользователя
+    int registerUser(const std::string& name, const std::string& login, const std::string& password);
+
+    // Авторизация пользователя
+    bool loginUser(const std::string& login, const std::string& password, User& user);
+
+    // Получение пользователя по ID
+    bool getUserById(int userId, UserInfo& user);
+
+    // Пользователи по списку id одним запросом; отсутствующие пропускаются
+    std::vector<UserInfo> getUsersByIds(const std::vector<int>& userIds);
+
+    // Поиск пользователей
+    std::vector<UserSearchResult> searchUsers(const std::string& searchQuery);
+
+    // Создание чата
+    int createChat(const std::string& name, bool isGroup, int createdBy, const std::vector<int>& participants);
+
+    // Добавление пользователя в чат
+    bool addUserToChat(int userId, int chatId);
+
+    // Добавление контакта
+    int addContact(int userId1, int userId2);
+
+    // Запись контакта без проверок (их делает SocialGraph в памяти): id или -4
+    int insertContact(int userId1, int userId2);
+
+    // Получение чатов пользователя
+    std::vector<Chat> getUserChats(int userId);
+
+    // Получение контактов пользователя
+    std::vector<std::pair<int, std::string>> getUserContacts(int userId);
+
+    // Отправка сообщения
+    int sendMessage(int userId, int chatId, const std::string& message, int replyId = 0, int resendId = 0);
+
+    // Пакет сообщений одного чата: одна транзакция и один подготовленный
+    // запрос на все строки. id идут подряд: firstId..lastId.
+    // false - ничего не вставлено
+    bool insertMessages(int chatId, const std::vector<NewMessage>& messages, int& firstId, int& lastId);
+
+    // Получение сообщений чата
+    std::vector<Message> getChatMessages(int chatId);
+
+    // Редактирование сообщения
+    bool editMessage(int messageId, const std::string& newMessage, int userId);
+
+    // Удаление сообщения
+    bool deleteMessage(int messageId, int userId);
+
+    // Получение информации о сообщении
+    bool getMessageInfo(int messageId, int& userId, std::string& msg);
+
+    // Чат, в котором находится сообщение (-1, если сообщения нет)
+    int getMessageChatId(int messageId);
+
+    // Участники всех чатов (загрузка членства при запуске сервера)
+    std::vector<ChatMembers> getAllChatMembers();
+
+    // Сообщения по списку id, по возрастанию id; отсутствующие пропускаются
+    std::vector<Message> getMessagesByIds(const std::vector<int>& messageIds);
+
+    // Сообщения чата с id больше afterId, по возрастанию id, не больше limit
+    std::vector<Message> getChatMessagesAfter(int chatId, int afterId, int limit);
+
+    // Создание канала: чат, в который пишут только администраторы. Создатель - первый администратор
+    int createChannel(const std::string& name, int createdBy);
+
+    // Администратор или подписчик канала: 1 - добавлен (или уже был), 0 - пользователя нет, -1 - ошибка
+    int addChannelAdmin(int chatId, int userId);
+    int addChannelSubscriber(int chatId, int userId);
+
+    bool removeChannelSubscriber(int chatId, int userId);
+
+    // Все каналы с администраторами и подписчиками (загрузка при запуске сервера)
+    std::vector<ChannelMembers> getAllChannels();
+
+    // Все контакты и имена пользователей (загрузка графа контактов при запуске сервера)
+    std::vector<Contact> getAllContacts();
+    std::vector<std::pair<int, std::string>> getAllUserNames();
+
+    // Ключи Idempotency-Key (см. IdempotencyKeys): id результата первой
+    // записи с ключом не старше ageSeconds или 0, bodyHash - хэш ее тела.
+    // Сохранение - в транзакции самой записи, поверх устаревшего ключа
+    int getIdempotentResult(int userId, const std::string& route, const std::string& key,
+        int64_t ageSeconds, std::string& bodyHash);
+    bool saveIdempotentResult(int userId, const std::string& route, const std::string& key,
+        const std::string& bodyHash, int resultId);
+
+    // Удаление ключей старше ageSeconds; число удаленных
+    int deleteIdempotencyKeys(int64_t ageSeconds);
+};
@@ -0,0 +1,277 @@
+﻿#include "DatabaseBackup.h"
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <ctime>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// Соединение, закрываемое при выходе из области видимости
+struct Connection {
+    sqlite3* db = nullptr;
+
+    ~Connection() {
+        if (db) {
+            sqlite3_close(db);
+        }
+    }
+
+    void open(const string& path, int flags) {
+        if (sqlite3_open_v2(path.c_str(), &db, flags, nullptr) != SQLITE_OK) {
+            throw runtime_error("Can't open " + path + ": " + sqlite3_errmsg(db));
+        }
+        sqlite3_busy_timeout(db, 5000);
+    }
+
+    void exec(const char* sql) {
+        char* errMsg = nullptr;
+        if (sqlite3_exec(db, sql, nullptr, nullptr, &errMsg) != SQLITE_OK) {
+            string error = "SQL error: " + string(errMsg);
+            sqlite3_free(errMsg);
+            throw runtime_error(error);
+        }
+    }
+};
+
+string timestamp() {
+    time_t now = time(nullptr);
+    tm parts{};
+#ifdef _WIN32
+    gmtime_s(&parts, &now);
+#else
+    gmtime_r(&now, &parts);
+#endif
+    char buffer[20];
+    strftime(buffer, sizeof(buffer), "%Y%m%d-%H%M%S", &parts);
+    return buffer;
+}
+
+}
+
+DatabaseBackup::DatabaseBackup(string dbPath, const Config& config, function<bool()> writerBusy)
+    : dbPath(move(dbPath)), config(config), writerBusy(move(writerBusy)) {
+    current.config = config;
+    worker = thread([this]() { run(); });
+}
+
+DatabaseBackup::~DatabaseBackup() {
+    {
+        lock_guard<mutex> lock(m);
+        stopping = true;
+    }
+    cv.notify_all();
+    worker.join();
+}
+
+bool DatabaseBackup::start() {
+    {
+        lock_guard<mutex> lock(m);
+        if (requested || current.state == State::Running) {
+            return false;
+        }
+        requested = true;
+    }
+    cv.notify_all();
+    return true;
+}
+
+DatabaseBackup::Progress DatabaseBackup::progress() const {
+    lock_guard<mutex> lock(m);
+    return current;
+}
+
+const char* DatabaseBackup::stateName(State state) {
+    switch (state) {
+    case State::Running:
+        return "running";
+    case State::Succeeded:
+        return "succeeded";
+    case State::Failed:
+        return "failed";
+    default:
+        return "idle";
+    }
+}
+
+void DatabaseBackup::run() {
+    auto scheduled = Clock::now() + config.interval;
+    unique_lock<mutex> lock(m);
+    while (!stopping) {
+        auto ready = [this]() { return stopping || requested; };
+        if (config.interval.count() > 0) {
+            cv.wait_until(lock, scheduled, ready);
+        }
+        else {
+            cv.wait(lock, ready);
+        }
+        if (stopping) {
+            break;
+        }
+        if (!requested && Clock::now() < scheduled) {
+            continue;
+        }
+
+        requested = false;
+        current.state = State::Running;
+        current.pagesTotal = 0;
+        current.pagesDone = 0;
+        current.seconds = 0;
+        current.bytesPerSecond = 0;
+        current.steps = 0;
+        current.deferred = 0;
+        current.restarts = 0;
+        current.error.clear();
+        lock.unlock();
+
+        string error;
+        try {
+            backup();
+            prune();
+        }
+        catch (const exception& e) {
+            error = e.what();
+            cerr << "Backup failed: " << error << endl;
+        }
+
+        lock.lock();
+        current.state = error.empty() ? State::Succeeded : State::Failed;
+        current.error = error;
+        (error.empty() ? current.completed : current.failed)++;
+        scheduled = Clock::now() + config.interval;
+    }
+}
+
+void DatabaseBackup::backup() {
+    filesystem::create_directories(config.directory);
+    string name = filesystem::path(dbPath).stem().string() + "-" + timestamp() + ".db";
+    string path = (filesystem::path(config.directory) / name).string();
+    string temporary = path + ".tmp";
+    {
+        lock_guard<mutex> lock(m);
+        current.path = path;
+    }
+
+    try {
+        if (!copy(temporary)) {
+            throw runtime_error("Backup interrupted: server is stopping");
+        }
+        filesystem::rename(temporary, path);
+    }
+    catch (...) {
+        error_code ignored;
+        filesystem::remove(temporary, ignored);
+        throw;
+    }
+}
+
+bool DatabaseBackup::copy(const string& temporary) {
+    auto started = Clock::now();
+    Connection source;
+    source.open(dbPath, SQLITE_OPEN_READONLY);
+    Connection target;
+    filesystem::remove(temporary);
+    target.open(temporary, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+
+    sqlite3_backup* handle = sqlite3_backup_init(target.db, "main", source.db, "main");
+    if (!handle) {
+        throw runtime_error(string("sqlite3_backup_init: ") + sqlite3_errmsg(target.db));
+    }
+
+    int pageSize = 0;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(source.db, "PRAGMA page_size", -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            pageSize = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    int result = SQLITE_OK;
+    int restarts = 0;
+    int previousDone = 0;
+    auto deferredSince = Clock::now();
+    while (true) {
+        {
+            lock_guard<mutex> lock(m);
+            if (stopping) {
+                result = SQLITE_INTERRUPT;
+                break;
+            }
+        }
+
+        // Записи не дают закончить по шагам: остаток - одной блокировкой чтения
+        bool finishing = restarts >= config.maxRestarts;
+        if (!finishing && writerBusy && writerBusy() && Clock::now() - deferredSince < config.maxDefer) {
+            {
+                lock_guard<mutex> lock(m);
+                current.deferred++;
+            }
+            this_thread::sleep_for(config.pause);
+            continue;
+        }
+
+        result = sqlite3_backup_step(handle, finishing ? -1 : config.pagesPerStep);
+        int total = sqlite3_backup_pagecount(handle);
+        int done = total - sqlite3_backup_remaining(handle);
+        // Шаг без перезапуска всегда продвигает копию
+        bool restarted = previousDone > 0 && done <= previousDone && result != SQLITE_DONE;
+        restarts += restarted ? 1 : 0;
+        previousDone = done;
+        double seconds = chrono::duration<double>(Clock::now() - started).count();
+        {
+            lock_guard<mutex> lock(m);
+            current.steps++;
+            current.restarts = static_cast<uint64_t>(restarts);
+            current.pageSize = pageSize;
+            current.pagesTotal = total;
+            current.pagesDone = done;
+            current.seconds = seconds;
+            current.bytesPerSecond = seconds > 0 ? static_cast<double>(done) * pageSize / seconds : 0;
+        }
+
+        if (result == SQLITE_DONE) {
+            break;
+        }
+        if (result != SQLITE_OK && result != SQLITE_BUSY && result != SQLITE_LOCKED) {
+            break;
+        }
+        this_thread::sleep_for(config.pause);
+        deferredSince = Clock::now();
+    }
+
+    sqlite3_backup_finish(handle);
+    if (result == SQLITE_INTERRUPT) {
+        return false;
+    }
+    if (result != SQLITE_DONE) {
+        throw runtime_error(string("sqlite3_backup_step: ") + sqlite3_errstr(result));
+    }
+    return true;
+}
+
+void DatabaseBackup::prune() {
+    // Имена с меткой времени упорядочены так же, как сами копии
+    string prefix = filesystem::path(dbPath).stem().string() + "-";
+    vector<filesystem::path> backups;
+    for (const auto& entry : filesystem::directory_iterator(config.directory)) {
+        string name = entry.path().filename().string();
+        if (entry.is_regular_file() && name.rfind(prefix, 0) == 0 && entry.path().extension() == ".db") {
+            backups.push_back(entry.path());
+        }
+    }
+    if (config.keep == 0 || backups.size() <= config.keep) {
+        return;
+    }
+    sort(backups.begin(), backups.end());
+    for (size_t i = 0; i + config.keep < backups.size(); i++) {
+        error_code ignored;
+        filesystem::remove(backups[i], ignored);
+    }
+}
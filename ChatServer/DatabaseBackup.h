@@ -0,0 +1,90 @@
+﻿#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Резервная копия базы без остановки сервера (sqlite3_backup).
+//
+// Копирование идет в отдельном потоке со своим соединением, по pagesPerStep
+// страниц за шаг с паузой между шагами. Общей читающей транзакции нет:
+// каждый шаг берет и отпускает свою блокировку чтения, так что копия не
+// держит снимок WAL и checkpoint (DatabaseMaintenance) продвигается между
+// шагами. Запись сервера между шагами заставляет sqlite3_backup начать
+// заново; после maxRestarts перезапусков остаток копируется одним шагом
+// без пауз - WAL удерживается только на время этого шага.
+// Читатель не мешает писателю, но делит с ним диск, поэтому, пока у
+// писателя есть задачи (writerBusy), шаг откладывается - не дольше maxDefer
+// подряд, чтобы под постоянной нагрузкой копия все же закончилась.
+//
+// Копия пишется во временный файл в directory и переименовывается в
+// <имя базы>-YYYYMMDD-HHMMSS.db (UTC), когда готова. Хранятся keep последних.
+class DatabaseBackup {
+public:
+    struct Config {
+        std::string directory = "backups";
+        int pagesPerStep = 256;
+        std::chrono::milliseconds pause{ 10 };      // между шагами
+        std::chrono::milliseconds maxDefer{ 1000 }; // дольше шаг не откладывается
+        int maxRestarts = 3;                        // затем остаток - одним шагом
+        std::chrono::seconds interval{ 0 };         // копия по расписанию; 0 - только по запросу
+        size_t keep = 7;
+    };
+
+    enum class State { Idle, Running, Succeeded, Failed };
+
+    struct Progress {
+        State state = State::Idle;
+        std::string path;               // текущая или последняя копия
+        int pagesTotal = 0;
+        int pagesDone = 0;
+        int pageSize = 0;
+        double seconds = 0;
+        double bytesPerSecond = 0;
+        uint64_t steps = 0;
+        uint64_t deferred = 0;          // шагов, отложенных из-за писателя
+        uint64_t restarts = 0;          // копия начиналась заново из-за записей
+        std::string error;
+        uint64_t completed = 0;         // успешных копий с запуска
+        uint64_t failed = 0;
+        Config config;
+    };
+
+    // writerBusy - есть ли сейчас работа у писателя базы
+    DatabaseBackup(std::string dbPath, const Config& config, std::function<bool()> writerBusy);
+    ~DatabaseBackup();
+
+    DatabaseBackup(const DatabaseBackup&) = delete;
+    DatabaseBackup& operator=(const DatabaseBackup&) = delete;
+
+    // Запустить копию сейчас; false - копия уже идет
+    bool start();
+
+    Progress progress() const;
+
+    static const char* stateName(State state);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    std::string dbPath;
+    Config config;
+    std::function<bool()> writerBusy;
+
+    mutable std::mutex m;
+    std::condition_variable cv;
+    bool requested = false;
+    bool stopping = false;
+    Progress current;
+    std::thread worker;
+
+    void run();
+    void backup();
+    // false - прервано остановкой сервера
+    bool copy(const std::string& temporary);
+    void prune();
+};
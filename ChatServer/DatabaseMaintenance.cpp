@@ -0,0 +1,217 @@
+﻿#include "DatabaseMaintenance.h"
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+int64_t pragmaValue(sqlite3* db, const char* sql) {
+    int64_t value = 0;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            value = sqlite3_column_int64(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    return value;
+}
+
+uint64_t fileSize(const string& path) {
+    error_code ec;
+    auto size = filesystem::file_size(path, ec);
+    return ec ? 0 : size;
+}
+
+}
+
+DatabaseMaintenance::DatabaseMaintenance(string dbPath, const Config& config)
+    : dbPath(move(dbPath)), config(config) {
+    current.config = config;
+}
+
+DatabaseMaintenance::~DatabaseMaintenance() {
+    stop();
+}
+
+void DatabaseMaintenance::start(function<Activity()> activity) {
+    this->activity = move(activity);
+    worker = thread([this]() { run(); });
+}
+
+void DatabaseMaintenance::stop() {
+    {
+        lock_guard<mutex> lock(m);
+        stopping = true;
+    }
+    cv.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void DatabaseMaintenance::walCommitted(int frames) {
+    int previous = walFrames.exchange(frames, memory_order_relaxed);
+    // Будим поток сразу, когда порог только что перейден
+    int done = checkpointedFrames.load(memory_order_relaxed);
+    if (previous - done < config.checkpointFrames && frames - done >= config.checkpointFrames) {
+        {
+            lock_guard<mutex> lock(m);
+            wake = true;
+        }
+        cv.notify_one();
+    }
+}
+
+DatabaseMaintenance::Stats DatabaseMaintenance::stats() const {
+    lock_guard<mutex> lock(m);
+    Stats s = current;
+    s.walFrames = max(0, walFrames.load(memory_order_relaxed) - checkpointedFrames.load(memory_order_relaxed));
+    return s;
+}
+
+void DatabaseMaintenance::convertToIncrementalVacuum(const string& dbPath) {
+    sqlite3* db;
+    if (sqlite3_open(dbPath.c_str(), &db) != SQLITE_OK) {
+        string error = sqlite3_errmsg(db);
+        sqlite3_close(db);
+        throw runtime_error("Can't open database: " + error);
+    }
+    char* errMsg = nullptr;
+    int result = sqlite3_exec(db, "PRAGMA auto_vacuum=INCREMENTAL; VACUUM;", nullptr, nullptr, &errMsg);
+    string error = errMsg ? errMsg : "";
+    sqlite3_free(errMsg);
+    sqlite3_close(db);
+    if (result != SQLITE_OK) {
+        throw runtime_error("VACUUM failed: " + error);
+    }
+}
+
+void DatabaseMaintenance::run() {
+    sqlite3* db;
+    if (sqlite3_open(dbPath.c_str(), &db) != SQLITE_OK) {
+        cerr << "Maintenance: can't open database: " << sqlite3_errmsg(db) << endl;
+        sqlite3_close(db);
+        return;
+    }
+    sqlite3_busy_timeout(db, static_cast<int>(config.busyTimeout.count()));
+    // PRAGMA auto_vacuum в конструкторе Database действует только на новые базы
+    bool incremental = pragmaValue(db, "PRAGMA auto_vacuum") == 2;
+    if (!incremental) {
+        cerr << "Maintenance: " << dbPath << " is not in auto_vacuum=INCREMENTAL mode, "
+            "freed pages will not be returned; restart once with --convert-auto-vacuum" << endl;
+    }
+    string walPath = dbPath + "-wal";
+    optional<Clock::time_point> quietSince;
+    // После TRUNCATE, не дождавшегося читателей, следующий - не раньше чем через 10 тиков:
+    // пока TRUNCATE ждет, новые записи стоят
+    Clock::time_point truncateAfter;
+
+    unique_lock<mutex> lock(m);
+    while (!stopping) {
+        cv.wait_for(lock, config.interval, [this]() { return stopping || wake; });
+        if (stopping) {
+            break;
+        }
+        wake = false;
+        lock.unlock();
+
+        Activity load = activity ? activity() : Activity{};
+        auto now = Clock::now();
+        if (load.reads > 0 || load.writes > 0) {
+            quietSince.reset();
+        }
+        else if (!quietSince) {
+            quietSince = now;
+        }
+
+        // Кадры, которые писатель добавил после прошлой контрольной точки.
+        // Меньше перенесенных - WAL начался заново
+        int frames = walFrames.load(memory_order_relaxed);
+        int before = checkpointedFrames.load(memory_order_relaxed);
+        if (frames < before) {
+            before = 0;
+            checkpointedFrames.store(0, memory_order_relaxed);
+        }
+        uint64_t walBytes = fileSize(walPath);
+        int mode = -1;
+        if (walBytes >= config.truncateBytes && load.reads == 0 && now >= truncateAfter) {
+            mode = SQLITE_CHECKPOINT_TRUNCATE;
+        }
+        else if (frames - before >= config.checkpointFrames) {
+            mode = SQLITE_CHECKPOINT_PASSIVE;
+        }
+
+        int logFrames = 0;
+        int doneFrames = 0;
+        int result = SQLITE_OK;
+        chrono::duration<double, milli> elapsed{ 0 };
+        if (mode != -1) {
+            auto started = Clock::now();
+            result = sqlite3_wal_checkpoint_v2(db, "main", mode, &logFrames, &doneFrames);
+            elapsed = Clock::now() - started;
+            if (result != SQLITE_OK) {
+                truncateAfter = Clock::now() + config.interval * 10;
+            }
+            else if (mode == SQLITE_CHECKPOINT_TRUNCATE) {
+                walFrames.store(0, memory_order_relaxed);
+                checkpointedFrames.store(0, memory_order_relaxed);
+            }
+            else {
+                checkpointedFrames.store(doneFrames, memory_order_relaxed);
+            }
+        }
+
+        // Свободные страницы - только в тишине и только в пределах бюджета
+        int64_t freePages = pragmaValue(db, "PRAGMA freelist_count");
+        int64_t vacuumed = 0;
+        if (incremental && freePages > 0 && quietSince && now - *quietSince >= config.quietPeriod) {
+            string sql = "PRAGMA incremental_vacuum(" + to_string(config.vacuumPages) + ")";
+            if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK) {
+                int64_t remaining = pragmaValue(db, "PRAGMA freelist_count");
+                vacuumed = freePages - remaining;
+                freePages = remaining;
+            }
+        }
+        int64_t pageCount = pragmaValue(db, "PRAGMA page_count");
+        walBytes = fileSize(walPath);
+
+        lock.lock();
+        if (mode != -1) {
+            if (result != SQLITE_OK) {
+                current.busyCheckpoints++;
+            }
+            else {
+                (mode == SQLITE_CHECKPOINT_TRUNCATE ? current.truncateCheckpoints : current.passiveCheckpoints)++;
+                if (doneFrames < logFrames) {
+                    current.partialCheckpoints++;
+                }
+                // TRUNCATE обнуляет счетчики WAL: перенесено все, о чем сообщил писатель
+                int moved = mode == SQLITE_CHECKPOINT_TRUNCATE ? frames - before : doneFrames - before;
+                current.framesCheckpointed += static_cast<uint64_t>(max(0, moved));
+                checkpointTime += elapsed;
+                uint64_t checkpoints = current.passiveCheckpoints + current.truncateCheckpoints;
+                current.lastCheckpointMs = elapsed.count();
+                current.avgCheckpointMs = checkpointTime.count() / checkpoints;
+                current.maxCheckpointMs = max(current.maxCheckpointMs, elapsed.count());
+            }
+        }
+        if (vacuumed > 0) {
+            current.vacuumRuns++;
+            current.pagesVacuumed += static_cast<uint64_t>(vacuumed);
+        }
+        current.walBytes = walBytes;
+        current.freelistPages = freePages;
+        current.pageCount = pageCount;
+        current.incrementalVacuum = incremental;
+    }
+    lock.unlock();
+    sqlite3_close(db);
+}
@@ -0,0 +1,101 @@
+﻿#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Фоновое обслуживание базы: контрольные точки WAL и постепенный возврат
+// свободных страниц.
+//
+// Писатель сообщает число кадров в WAL после каждой фиксации (walCommitted,
+// см. Database::onWalCommit), поэтому сам контрольных точек не делает и
+// фиксация не ждет переноса страниц. Когда непереписанных кадров набирается
+// checkpointFrames, поток обслуживания делает PASSIVE: переносит все, что
+// не нужно открытым читателям, никого не блокируя. Файл WAL после этого
+// переиспользуется с начала, но на диске остается прежнего размера; если он
+// больше truncateBytes и читателей нет, делается TRUNCATE (ждет не дольше
+// busyTimeout, иначе откладывается).
+//
+// deleteMessage оставляет свободные страницы. В базе с auto_vacuum=INCREMENTAL
+// (новые базы; старые - convertToIncrementalVacuum) после quietPeriod без
+// запросов они возвращаются порциями по vacuumPages за тик.
+class DatabaseMaintenance {
+public:
+    struct Config {
+        std::chrono::milliseconds interval{ 1000 };
+        int checkpointFrames = 1000;
+        uint64_t truncateBytes = 64 * 1024 * 1024;
+        std::chrono::milliseconds busyTimeout{ 100 };
+        std::chrono::milliseconds quietPeriod{ 2000 };
+        int vacuumPages = 256;
+    };
+
+    // Нагрузка на базу сейчас: задачи в очередях чтения и записи
+    struct Activity {
+        size_t reads = 0;
+        size_t writes = 0;
+    };
+
+    struct Stats {
+        uint64_t walBytes = 0;
+        int walFrames = 0;              // кадров после последней контрольной точки
+        uint64_t passiveCheckpoints = 0;
+        uint64_t truncateCheckpoints = 0;
+        uint64_t busyCheckpoints = 0;   // TRUNCATE, не дождавшиеся читателей или писателя
+        uint64_t partialCheckpoints = 0; // перенесено не все: читатель держит старый снимок
+        uint64_t framesCheckpointed = 0;
+        double lastCheckpointMs = 0;
+        double avgCheckpointMs = 0;
+        double maxCheckpointMs = 0;
+        int64_t pageCount = 0;
+        int64_t freelistPages = 0;
+        bool incrementalVacuum = false;
+        uint64_t vacuumRuns = 0;
+        uint64_t pagesVacuumed = 0;
+        Config config;
+    };
+
+    DatabaseMaintenance(std::string dbPath, const Config& config);
+    ~DatabaseMaintenance();
+
+    DatabaseMaintenance(const DatabaseMaintenance&) = delete;
+    DatabaseMaintenance& operator=(const DatabaseMaintenance&) = delete;
+
+    // Поток обслуживания. activity вызывается из него до stop()
+    void start(std::function<Activity()> activity);
+    void stop();
+
+    // Из потока писателя после фиксации
+    void walCommitted(int frames);
+
+    Stats stats() const;
+
+    // Перевод существующей базы в auto_vacuum=INCREMENTAL: полный VACUUM,
+    // только пока сервер не запущен
+    static void convertToIncrementalVacuum(const std::string& dbPath);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    std::string dbPath;
+    Config config;
+    std::function<Activity()> activity;
+
+    std::atomic<int> walFrames{ 0 };
+    std::atomic<int> checkpointedFrames{ 0 };   // кадров WAL, уже перенесенных в базу
+    std::chrono::duration<double, std::milli> checkpointTime{ 0 };
+
+    mutable std::mutex m;
+    std::condition_variable cv;
+    bool stopping = false;
+    bool wake = false;                  // набралось checkpointFrames кадров
+    Stats current;
+    std::thread worker;
+
+    void run();
+};
@@ -0,0 +1,144 @@
+﻿#include "DbExecutor.h"
+
+#include <iostream>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+class DbExecutor::WorkQueue {
+public:
+    WorkQueue(string name, const DatabaseFactory& factory, size_t threads, size_t capacity)
+        : name(move(name)), capacity(capacity) {
+        // Соединения открываются последовательно, до запуска потоков
+        vector<unique_ptr<Database>> connections;
+        for (size_t i = 0; i < threads; i++) {
+            connections.push_back(factory());
+        }
+        for (auto& connection : connections) {
+            workers.emplace_back([this, db = move(connection)]() { run(*db); });
+        }
+    }
+
+    ~WorkQueue() {
+        {
+            lock_guard<mutex> lock(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    bool submit(Task task) {
+        {
+            lock_guard<mutex> lock(m);
+            if (stopping || tasks.size() >= capacity) {
+                rejected++;
+                return false;
+            }
+            tasks.push_back({ move(task), Clock::now() });
+            submitted++;
+            peakDepth = max(peakDepth, tasks.size());
+        }
+        cv.notify_one();
+        return true;
+    }
+
+    size_t pending() const {
+        lock_guard<mutex> lock(m);
+        return tasks.size() + active;
+    }
+
+    QueueStats stats() const {
+        lock_guard<mutex> lock(m);
+        QueueStats s;
+        s.name = name;
+        s.threads = workers.size();
+        s.capacity = capacity;
+        s.depth = tasks.size();
+        s.peakDepth = peakDepth;
+        s.active = active;
+        s.submitted = submitted;
+        s.rejected = rejected;
+        s.completed = completed;
+        if (completed > 0) {
+            s.avgWaitMs = chrono::duration<double, milli>(totalWait).count() / completed;
+            s.avgRunMs = chrono::duration<double, milli>(totalRun).count() / completed;
+        }
+        return s;
+    }
+
+private:
+    struct Item {
+        Task task;
+        Clock::time_point enqueued;
+    };
+
+    string name;
+    size_t capacity;
+    vector<thread> workers;
+
+    mutable mutex m;
+    condition_variable cv;
+    deque<Item> tasks;
+    bool stopping = false;
+
+    size_t peakDepth = 0;
+    size_t active = 0;
+    uint64_t submitted = 0;
+    uint64_t rejected = 0;
+    uint64_t completed = 0;
+    Clock::duration totalWait{};
+    Clock::duration totalRun{};
+
+    void run(Database& db) {
+        while (true) {
+            Item item;
+            {
+                unique_lock<mutex> lock(m);
+                cv.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty()) {
+                    return;
+                }
+                item = move(tasks.front());
+                tasks.pop_front();
+                active++;
+            }
+
+            auto started = Clock::now();
+            try {
+                item.task(db);
+            }
+            catch (const exception& e) {
+                cerr << "DB task error: " << e.what() << endl;
+            }
+            auto finished = Clock::now();
+
+            lock_guard<mutex> lock(m);
+            active--;
+            completed++;
+            totalWait += started - item.enqueued;
+            totalRun += finished - started;
+        }
+    }
+};
+
+DbExecutor::DbExecutor(DatabaseFactory factory, size_t readThreads, size_t queueCapacity)
+    : reads(make_unique<WorkQueue>("read", factory, max<size_t>(1, readThreads), queueCapacity)),
+    writes(make_unique<WorkQueue>("write", factory, 1, queueCapacity)) {
+}
+
+DbExecutor::~DbExecutor() = default;
+
+bool DbExecutor::submit(Queue queue, Task task) {
+    return (queue == Queue::Read ? reads : writes)->submit(move(task));
+}
+
+size_t DbExecutor::pending(Queue queue) const {
+    return (queue == Queue::Read ? reads : writes)->pending();
+}
+
+vector<DbExecutor::QueueStats> DbExecutor::stats() const {
+    return { reads->stats(), writes->stats() };
+}
@@ -0,0 +1,61 @@
+﻿#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Database.h"
+
+// Пул потоков для работы с SQLite, чтобы запросы к базе не блокировали
+// потоки ввода-вывода Crow. Две очереди с ограниченной длиной:
+//   Read  - несколько потоков, у каждого свое соединение (параллельное чтение в WAL);
+//   Write - один поток и одно соединение (SQLite допускает одного писателя).
+// При переполнении очереди submit() возвращает false, задача не выполняется.
+class DbExecutor {
+public:
+    enum class Queue { Read, Write };
+
+    using Task = std::function<void(Database&)>;
+    using DatabaseFactory = std::function<std::unique_ptr<Database>()>;
+
+    struct QueueStats {
+        std::string name;
+        size_t threads = 0;
+        size_t capacity = 0;
+        size_t depth = 0;
+        size_t peakDepth = 0;
+        size_t active = 0;
+        uint64_t submitted = 0;
+        uint64_t rejected = 0;
+        uint64_t completed = 0;
+        double avgWaitMs = 0;   // среднее время ожидания в очереди
+        double avgRunMs = 0;    // среднее время выполнения
+    };
+
+    DbExecutor(DatabaseFactory factory, size_t readThreads, size_t queueCapacity);
+    ~DbExecutor();
+
+    DbExecutor(const DbExecutor&) = delete;
+    DbExecutor& operator=(const DbExecutor&) = delete;
+
+    bool submit(Queue queue, Task task);
+
+    std::vector<QueueStats> stats() const;
+
+    // Задач в очереди и выполняющихся сейчас - без копирования статистики
+    size_t pending(Queue queue) const;
+
+private:
+    class WorkQueue;
+
+    std::unique_ptr<WorkQueue> reads;
+    std::unique_ptr<WorkQueue> writes;
+};
@@ -0,0 +1,358 @@
+﻿#include "Delivery.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+using namespace std;
+
+namespace {
+
+size_t index(DeliveryStrategy strategy) {
+    return static_cast<size_t>(strategy);
+}
+
+uint64_t micros(Delivery::Clock::duration elapsed) {
+    return static_cast<uint64_t>(chrono::duration_cast<chrono::microseconds>(elapsed).count());
+}
+
+bool parseInt(const string& text, long long& value) {
+    if (text.empty()) {
+        return false;
+    }
+    char* end = nullptr;
+    value = strtoll(text.c_str(), &end, 10);
+    return *end == '\0' && value >= 0;
+}
+
+}
+
+Delivery::Delivery(const Config& config, const Membership& membership)
+    : config(config),
+    membership(membership),
+    epoch(to_string(chrono::duration_cast<chrono::milliseconds>(
+        chrono::system_clock::now().time_since_epoch()).count())) {
+}
+
+void Delivery::load(const vector<ChatMembers>& all) {
+    unique_lock<shared_mutex> lock(chatsMutex);
+    for (const auto& chat : all) {
+        addChatLocked(chat.chatId, chat.isGroup);
+        // Курсоры после перезапуска начинаются с последнего сообщения
+        auto& state = chats[chat.chatId];
+        state.headId = chat.lastMessageId;
+        state.pullFrom = chat.lastMessageId;
+    }
+}
+
+void Delivery::addChat(int chatId, bool isGroup) {
+    unique_lock<shared_mutex> lock(chatsMutex);
+    addChatLocked(chatId, isGroup);
+}
+
+void Delivery::addChatLocked(int chatId, bool isGroup) {
+    auto& state = chats[chatId];
+    state.isGroup = isGroup;
+    state.memberCount = membership.memberCount(chatId);
+    state.strategy = choose(state);
+}
+
+DeliveryStrategy Delivery::choose(const ChatState& state) const {
+    if (!state.isGroup) {
+        return DeliveryStrategy::Push;
+    }
+
+    double members = static_cast<double>(state.memberCount);
+    double deliveries = members * state.rate;
+    if (state.strategy == DeliveryStrategy::Push) {
+        bool large = members > config.pushMaxMembers || deliveries > config.pushMaxRate;
+        return large ? DeliveryStrategy::Pull : DeliveryStrategy::Push;
+    }
+    bool small = members <= config.pushMaxMembers / 2.0 && deliveries < config.pushMaxRate / 2;
+    return small ? DeliveryStrategy::Push : DeliveryStrategy::Pull;
+}
+
+DeliveryStrategy Delivery::onMessage(int chatId, int messageId) {
+    auto started = Clock::now();
+    DeliveryStrategy strategy = DeliveryStrategy::Push;
+    {
+        unique_lock<shared_mutex> lock(chatsMutex);
+        auto it = chats.find(chatId);
+        if (it == chats.end()) {
+            // У чата нет участников - доставлять некому
+            return strategy;
+        }
+
+        auto& state = it->second;
+        double seconds = state.lastMessage == Clock::time_point{}
+            ? rateWindowSeconds
+            : chrono::duration<double>(started - state.lastMessage).count();
+        state.rate = state.rate * exp(-seconds / rateWindowSeconds) + 1.0 / rateWindowSeconds;
+        state.lastMessage = started;
+
+        auto next = choose(state);
+        if (next != state.strategy) {
+            if (next == DeliveryStrategy::Pull) {
+                state.pullFrom = state.headId;
+                state.pullUntil = 0;
+            }
+            else {
+                state.pullUntil = state.headId;
+            }
+            state.strategy = next;
+            switches.fetch_add(1, memory_order_relaxed);
+        }
+        state.headId = max(state.headId, messageId);
+
+        strategy = state.strategy;
+    }
+
+    auto& counter = counters[index(strategy)];
+    counter.messages.fetch_add(1, memory_order_relaxed);
+    if (strategy == DeliveryStrategy::Pull) {
+        return strategy;
+    }
+
+    auto members = membership.members(chatId)->toVector();
+    deliver(chatId, messageId, members);
+    counter.deliveries.fetch_add(members.size(), memory_order_relaxed);
+    counter.fanOutMicros.fetch_add(micros(Clock::now() - started), memory_order_relaxed);
+    return strategy;
+}
+
+void Delivery::onMessages(int chatId, int firstId, int lastId) {
+    int from = firstId;
+    if (static_cast<size_t>(lastId - firstId) >= config.inboxSize) {
+        from = lastId - static_cast<int>(config.inboxSize) + 1;
+    }
+    for (int messageId = from; messageId <= lastId; messageId++) {
+        onMessage(chatId, messageId);
+    }
+}
+
+void Delivery::deliver(int chatId, int messageId, const vector<int>& userIds) {
+    array<vector<int>, inboxShards> byShard;
+    for (int userId : userIds) {
+        byShard[static_cast<size_t>(userId) % inboxShards].push_back(userId);
+    }
+
+    for (size_t i = 0; i < inboxShards; i++) {
+        if (byShard[i].empty()) {
+            continue;
+        }
+        lock_guard<mutex> lock(shards[i].m);
+        for (int userId : byShard[i]) {
+            auto& inbox = shards[i].inboxes[userId];
+            inbox.entries.push_back({ inbox.nextSeq++, chatId, messageId });
+            if (inbox.entries.size() > config.inboxSize) {
+                inbox.entries.pop_front();
+            }
+        }
+    }
+}
+
+DeliveryStrategy Delivery::strategy(int chatId) const {
+    shared_lock<shared_mutex> lock(chatsMutex);
+    auto it = chats.find(chatId);
+    return it != chats.end() ? it->second.strategy : DeliveryStrategy::Push;
+}
+
+Delivery::Pending Delivery::pending(int userId, const Cursor& cursor, size_t limit) {
+    Pending result;
+    result.cursor.epoch = epoch;
+
+    // Первый запрос или курсор прошлого запуска сервера: лента начинается с текущего момента
+    bool fresh = cursor.epoch != epoch;
+    if (fresh && !cursor.epoch.empty()) {
+        result.reset = true;
+    }
+
+    {
+        auto& s = shard(userId);
+        lock_guard<mutex> lock(s.m);
+        auto it = s.inboxes.find(userId);
+        uint64_t last = it != s.inboxes.end() ? it->second.nextSeq - 1 : 0;
+        result.cursor.seq = last;
+
+        if (!fresh) {
+            bool lost = cursor.seq > last ||
+                (it != s.inboxes.end() && !it->second.entries.empty() && cursor.seq + 1 < it->second.entries.front().seq);
+            if (lost) {
+                // Входящие переполнились, пока клиент не читал
+                result.reset = true;
+            }
+            else if (it != s.inboxes.end()) {
+                result.cursor.seq = cursor.seq;
+                for (const auto& entry : it->second.entries) {
+                    if (entry.seq <= cursor.seq) {
+                        continue;
+                    }
+                    if (result.messageIds.size() >= limit) {
+                        result.more = true;
+                        break;
+                    }
+                    result.messageIds.push_back(entry.messageId);
+                    result.cursor.seq = entry.seq;
+                }
+            }
+        }
+    }
+
+    if (result.reset) {
+        resets.fetch_add(1, memory_order_relaxed);
+    }
+
+    auto userChats = membership.chats(userId);
+    shared_lock<shared_mutex> lock(chatsMutex);
+    for (int chatId : userChats) {
+        auto it = chats.find(chatId);
+        if (it == chats.end()) {
+            // Чат только что создан и еще не добавлен сюда
+            continue;
+        }
+        const auto& state = it->second;
+        auto known = result.reset || fresh ? cursor.chats.end() : cursor.chats.find(chatId);
+        bool hasCursor = known != cursor.chats.end();
+
+        if (state.strategy == DeliveryStrategy::Pull) {
+            int from = result.reset || fresh ? state.headId : hasCursor ? known->second : state.pullFrom;
+            if (state.headId > from) {
+                result.pulls.push_back({ chatId, from, state.headId });
+            }
+            result.cursor.chats[chatId] = from;
+        }
+        else if (hasCursor && state.pullUntil > known->second) {
+            // Чат вернулся на Push: дочитываем то, что было отдано через Pull
+            result.pulls.push_back({ chatId, known->second, state.pullUntil });
+            result.cursor.chats[chatId] = known->second;
+        }
+    }
+    return result;
+}
+
+Delivery::Updates Delivery::read(Database& db, Pending pending, size_t limit) {
+    Updates updates;
+    updates.cursor = move(pending.cursor);
+    updates.reset = pending.reset;
+    updates.more = pending.more;
+
+    if (!pending.messageIds.empty()) {
+        auto started = Clock::now();
+        updates.messages = db.getMessagesByIds(pending.messageIds);
+        recordRead(DeliveryStrategy::Push, 1, updates.messages.size(), Clock::now() - started);
+    }
+
+    size_t pulled = 0;
+    auto started = Clock::now();
+    for (const auto& range : pending.pulls) {
+        if (updates.messages.size() >= limit) {
+            updates.more = true;
+            break;
+        }
+        size_t room = limit - updates.messages.size();
+        auto messages = db.getChatMessagesAfter(range.chatId, range.afterId, static_cast<int>(room));
+
+        int lastId = range.afterId;
+        for (auto& msg : messages) {
+            if (msg.id > range.untilId) {
+                break;
+            }
+            lastId = msg.id;
+            updates.messages.push_back(move(msg));
+        }
+        if (messages.size() < room || lastId == range.untilId) {
+            // Диапазон прочитан целиком
+            lastId = range.untilId;
+        }
+        else {
+            updates.more = true;
+        }
+        updates.cursor.chats[range.chatId] = lastId;
+        pulled += messages.size();
+    }
+    if (!pending.pulls.empty()) {
+        recordRead(DeliveryStrategy::Pull, pending.pulls.size(), pulled, Clock::now() - started);
+    }
+
+    sort(updates.messages.begin(), updates.messages.end(),
+        [](const Message& a, const Message& b) { return a.id < b.id; });
+    updates.messages.erase(unique(updates.messages.begin(), updates.messages.end(),
+        [](const Message& a, const Message& b) { return a.id == b.id; }), updates.messages.end());
+    return updates;
+}
+
+void Delivery::recordRead(DeliveryStrategy strategy, size_t queries, size_t messages, Clock::duration elapsed) {
+    auto& counter = counters[index(strategy)];
+    counter.reads.fetch_add(queries, memory_order_relaxed);
+    counter.readMessages.fetch_add(messages, memory_order_relaxed);
+    counter.readMicros.fetch_add(micros(elapsed), memory_order_relaxed);
+}
+
+string Delivery::formatCursor(const Cursor& cursor) const {
+    string text = cursor.epoch + "." + to_string(cursor.seq);
+    for (const auto& [chatId, lastId] : cursor.chats) {
+        text += "." + to_string(chatId) + ":" + to_string(lastId);
+    }
+    return text;
+}
+
+bool Delivery::parseCursor(const string& text, Cursor& cursor) {
+    vector<string> parts;
+    size_t pos = 0;
+    while (true) {
+        size_t end = text.find('.', pos);
+        parts.push_back(text.substr(pos, end == string::npos ? string::npos : end - pos));
+        if (end == string::npos) {
+            break;
+        }
+        pos = end + 1;
+    }
+
+    long long value = 0;
+    if (parts.size() < 2 || !parseInt(parts[0], value) || !parseInt(parts[1], value)) {
+        return false;
+    }
+    cursor.epoch = parts[0];
+    cursor.seq = static_cast<uint64_t>(value);
+
+    for (size_t i = 2; i < parts.size(); i++) {
+        size_t colon = parts[i].find(':');
+        long long chatId = 0;
+        long long lastId = 0;
+        if (colon == string::npos || !parseInt(parts[i].substr(0, colon), chatId) ||
+            !parseInt(parts[i].substr(colon + 1), lastId)) {
+            return false;
+        }
+        cursor.chats[static_cast<int>(chatId)] = static_cast<int>(lastId);
+    }
+    return true;
+}
+
+Delivery::Stats Delivery::stats() const {
+    Stats s;
+    s.config = config;
+    s.switches = switches.load(memory_order_relaxed);
+    s.resets = resets.load(memory_order_relaxed);
+    {
+        shared_lock<shared_mutex> lock(chatsMutex);
+        for (const auto& [chatId, state] : chats) {
+            s.strategies[index(state.strategy)].chats++;
+        }
+    }
+
+    for (size_t i = 0; i < counters.size(); i++) {
+        const auto& counter = counters[i];
+        auto& out = s.strategies[i];
+        out.messages = counter.messages.load(memory_order_relaxed);
+        out.deliveries = counter.deliveries.load(memory_order_relaxed);
+        out.reads = counter.reads.load(memory_order_relaxed);
+        out.readMessages = counter.readMessages.load(memory_order_relaxed);
+        if (out.messages > 0) {
+            out.avgFanOutUs = static_cast<double>(counter.fanOutMicros.load(memory_order_relaxed)) / out.messages;
+        }
+        if (out.reads > 0) {
+            out.avgReadMs = counter.readMicros.load(memory_order_relaxed) / 1000.0 / out.reads;
+        }
+    }
+    return s;
+}
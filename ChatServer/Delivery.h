@@ -0,0 +1,187 @@
+﻿#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Database.h"
+#include "Membership.h"
+
+// Стратегия доставки новых сообщений чата в ленту обновлений пользователя
+enum class DeliveryStrategy {
+    Push,   // при записи: указатель на сообщение во входящие каждого участника
+    Pull    // при чтении: пользователь дочитывает чат от своего курсора
+};
+
+// Лента обновлений пользователя (GET /users/<id>/updates) по всем его чатам.
+//
+// Для небольших чатов сообщение при отправке раскладывается указателями
+// (chatId, messageId) во входящие участников - чтение ленты стоит одного
+// запроса по списку id. Для больших групп это N операций на каждое
+// сообщение, поэтому такие чаты только запоминают последний id, а
+// пользователь при чтении дочитывает их от курсора, который хранит клиент.
+//
+// Чат переходит на Pull, если это группа и участников больше pushMaxMembers
+// или доставок в секунду (участники × частота сообщений) больше pushMaxRate;
+// обратно - когда оба значения опустятся ниже порога вдвое (гистерезис).
+// Сообщения, разложенные до перехода, остаются во входящих; после обратного
+// перехода клиенты с курсором в чате дочитывают его до последнего
+// сообщения, отданного через Pull. Повторы клиент отбрасывает по id.
+// Участники чатов и чаты пользователя берутся из Membership.
+class Delivery {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Config {
+        size_t pushMaxMembers = 256;
+        double pushMaxRate = 5000;
+        size_t inboxSize = 1024;        // указателей во входящих одного пользователя
+    };
+
+    // Позиция клиента в ленте: номер во входящих и последние прочитанные
+    // сообщения чатов, которые дочитываются при чтении
+    struct Cursor {
+        std::string epoch;
+        uint64_t seq = 0;
+        std::unordered_map<int, int> chats;
+    };
+
+    struct PullRange {
+        int chatId;
+        int afterId;
+        int untilId;                    // включительно
+    };
+
+    // Что пользователю нужно прочитать после курсора
+    struct Pending {
+        std::vector<int> messageIds;    // из входящих, в порядке доставки
+        std::vector<PullRange> pulls;
+        Cursor cursor;                  // курсор после чтения всего перечисленного
+        bool reset = false;             // курсор недействителен: клиент перечитывает чаты
+        bool more = false;              // прочитано не все: клиенту стоит запросить еще раз
+
+        bool empty() const { return messageIds.empty() && pulls.empty(); }
+    };
+
+    struct Updates {
+        std::vector<Message> messages;  // по возрастанию id, без повторов
+        Cursor cursor;
+        bool reset = false;
+        bool more = false;
+    };
+
+    struct StrategyStats {
+        size_t chats = 0;
+        uint64_t messages = 0;
+        uint64_t deliveries = 0;        // указателей во входящих (Push)
+        double avgFanOutUs = 0;         // время раскладки одного сообщения (Push)
+        uint64_t reads = 0;             // чтений ленты с этой частью (Push - по id, Pull - диапазонов)
+        uint64_t readMessages = 0;
+        double avgReadMs = 0;
+    };
+
+    struct Stats {
+        std::array<StrategyStats, 2> strategies;
+        uint64_t switches = 0;
+        uint64_t resets = 0;
+        Config config;
+    };
+
+    Delivery(const Config& config, const Membership& membership);
+
+    Delivery(const Delivery&) = delete;
+    Delivery& operator=(const Delivery&) = delete;
+
+    // Все чаты (при запуске). Участники должны быть уже в Membership
+    void load(const std::vector<ChatMembers>& chats);
+    void addChat(int chatId, bool isGroup);
+
+    DeliveryStrategy onMessage(int chatId, int messageId);
+
+    // Сообщения firstId..lastId подряд (пакетная вставка). Во входящие
+    // раскладываются только последние inboxSize: более ранние все равно
+    // были бы вытеснены, а клиент с курсором до них перечитает чаты
+    void onMessages(int chatId, int firstId, int lastId);
+
+    // Указатель на сообщение во входящие перечисленных пользователей (рассылка
+    // каналов, см. Channels). Блокировка каждого шарда входящих берется один раз
+    void deliver(int chatId, int messageId, const std::vector<int>& userIds);
+    DeliveryStrategy strategy(int chatId) const;
+
+    // Что прочитать: под блокировками, без обращения к базе
+    Pending pending(int userId, const Cursor& cursor, size_t limit);
+
+    // Чтение сообщений из базы (в потоке пула DbExecutor)
+    Updates read(Database& db, Pending pending, size_t limit);
+
+    std::string formatCursor(const Cursor& cursor) const;
+    static bool parseCursor(const std::string& text, Cursor& cursor);
+
+    Stats stats() const;
+
+private:
+    struct ChatState {
+        bool isGroup = false;
+        uint64_t memberCount = 0;
+        DeliveryStrategy strategy = DeliveryStrategy::Push;
+        double rate = 0;                // сообщений в секунду, экспоненциальное среднее
+        Clock::time_point lastMessage;
+        int headId = 0;
+        int pullFrom = 0;               // сообщения до него включительно - во входящих
+        int pullUntil = 0;              // последнее сообщение, отданное через Pull; 0 - Pull идет сейчас
+    };
+
+    struct InboxEntry {
+        uint64_t seq;
+        int chatId;
+        int messageId;
+    };
+
+    struct Inbox {
+        uint64_t nextSeq = 1;
+        std::deque<InboxEntry> entries;
+    };
+
+    static constexpr size_t inboxShards = 16;
+
+    struct InboxShard {
+        std::mutex m;
+        std::unordered_map<int, Inbox> inboxes;
+    };
+
+    Config config;
+    const Membership& membership;
+    std::string epoch;
+
+    mutable std::shared_mutex chatsMutex;
+    std::unordered_map<int, ChatState> chats;
+
+    std::array<InboxShard, inboxShards> shards;
+
+    struct Counters {
+        std::atomic<uint64_t> messages{ 0 };
+        std::atomic<uint64_t> deliveries{ 0 };
+        std::atomic<uint64_t> fanOutMicros{ 0 };
+        std::atomic<uint64_t> reads{ 0 };
+        std::atomic<uint64_t> readMessages{ 0 };
+        std::atomic<uint64_t> readMicros{ 0 };
+    };
+    std::array<Counters, 2> counters;
+    std::atomic<uint64_t> switches{ 0 };
+    std::atomic<uint64_t> resets{ 0 };
+
+    // Окно усреднения частоты сообщений чата
+    static constexpr double rateWindowSeconds = 10;
+
+    DeliveryStrategy choose(const ChatState& state) const;
+    void recordRead(DeliveryStrategy strategy, size_t queries, size_t messages, Clock::duration elapsed);
+    InboxShard& shard(int userId) { return shards[static_cast<size_t>(userId) % inboxShards]; }
+    void addChatLocked(int chatId, bool isGroup);
+};
@@ -0,0 +1,233 @@
+﻿#include "ExportServer.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+
+using namespace std;
+
+namespace {
+
+string trim(const string& text) {
+    size_t first = text.find_first_not_of(" \t");
+    if (first == string::npos) {
+        return {};
+    }
+    size_t last = text.find_last_not_of(" \t");
+    return text.substr(first, last - first + 1);
+}
+
+// Строка запроса и заголовки; false - запрос не похож на HTTP/1.x
+bool parseRequest(const string& head, string& method, crow::request& req) {
+    size_t lineEnd = head.find("\r\n");
+    string line = head.substr(0, lineEnd);
+    size_t firstSpace = line.find(' ');
+    size_t lastSpace = line.rfind(' ');
+    if (firstSpace == string::npos || lastSpace == firstSpace ||
+        line.compare(lastSpace + 1, 7, "HTTP/1.") != 0) {
+        return false;
+    }
+    method = line.substr(0, firstSpace);
+    string target = line.substr(firstSpace + 1, lastSpace - firstSpace - 1);
+    if (target.empty() || target[0] != '/') {
+        return false;
+    }
+    req.raw_url = target;
+    req.url = target.substr(0, target.find('?'));
+    req.url_params = crow::query_string(target);
+
+    size_t pos = lineEnd + 2;
+    while (pos < head.size()) {
+        size_t end = head.find("\r\n", pos);
+        if (end == string::npos || end == pos) {
+            break;
+        }
+        size_t colon = head.find(':', pos);
+        if (colon == string::npos || colon > end) {
+            return false;
+        }
+        req.add_header(head.substr(pos, colon - pos), trim(head.substr(colon + 1, end - colon - 1)));
+        pos = end + 2;
+    }
+    return true;
+}
+
+// /chats/<id>/export или /chats/<id>/export/archive
+bool parsePath(const string& url, int& chatId, ExportServer::Target& target) {
+    const string prefix = "/chats/";
+    if (url.compare(0, prefix.size(), prefix) != 0) {
+        return false;
+    }
+    char* parsedEnd = nullptr;
+    errno = 0;
+    long id = strtol(url.c_str() + prefix.size(), &parsedEnd, 10);
+    if (parsedEnd == url.c_str() + prefix.size() || errno != 0 || id <= 0 || id > numeric_limits<int>::max()) {
+        return false;
+    }
+    string rest(parsedEnd);
+    if (rest == "/export") {
+        target = ExportServer::Target::Stream;
+    }
+    else if (rest == "/export/archive") {
+        target = ExportServer::Target::Archive;
+    }
+    else {
+        return false;
+    }
+    chatId = static_cast<int>(id);
+    return true;
+}
+
+}
+
+ExportServer::ExportServer(ChatExport& exporter, const Config& config, Admit admit, ChatExists chatExists)
+    : exporter(exporter),
+    config(config),
+    admit(move(admit)),
+    chatExists(move(chatExists)),
+    acceptor(io) {
+}
+
+ExportServer::~ExportServer() {
+    stop();
+}
+
+void ExportServer::start() {
+    asio::ip::tcp::endpoint endpoint(asio::ip::make_address(config.bindAddress), static_cast<unsigned short>(config.port));
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+    acceptor.bind(endpoint);
+    acceptor.listen();
+    asio::co_spawn(io, accept(), asio::detached);
+    thread = std::thread([this]() {
+        io.run();
+        });
+}
+
+void ExportServer::stop() {
+    io.stop();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+asio::awaitable<void> ExportServer::accept() {
+    while (true) {
+        asio::error_code ec;
+        Socket socket = co_await acceptor.async_accept(asio::redirect_error(asio::use_awaitable, ec));
+        if (ec == asio::error::operation_aborted) {
+            co_return;
+        }
+        if (ec) {
+            cerr << "Export server accept failed: " << ec.message() << endl;
+            continue;
+        }
+        asio::co_spawn(io, serve(make_shared<Socket>(move(socket))), asio::detached);
+    }
+}
+
+asio::awaitable<void> ExportServer::serve(shared_ptr<Socket> socket) {
+    // Медленный клиент не держит соединение, пока присылает заголовки
+    asio::steady_timer timer(io, config.headerTimeout);
+    timer.async_wait([weak = weak_ptr<Socket>(socket)](const asio::error_code& ec) {
+        auto expired = weak.lock();
+        if (!ec && expired) {
+            asio::error_code ignored;
+            expired->close(ignored);
+        }
+        });
+
+    string head;
+    string remoteIp;
+    try {
+        const string headEnd = "\r\n\r\n";
+        size_t length = co_await asio::async_read_until(*socket,
+            asio::dynamic_buffer(head, config.maxHeaderBytes), headEnd, asio::use_awaitable);
+        timer.cancel();
+        head.resize(length);
+        asio::error_code ignored;
+        remoteIp = socket->remote_endpoint(ignored).address().to_string();
+    }
+    catch (const exception&) {
+        // Соединение закрыто, истекло время или заголовки слишком длинные
+        asio::error_code ignored;
+        socket->close(ignored);
+        co_return;
+    }
+
+    Request request;
+    Rejection rejection;
+    if (!prepare(head, remoteIp, request, rejection) || !exporter.tryStart()) {
+        if (rejection.status == 0) {
+            rejection = { 503, "Too many exports in progress", {} };
+        }
+        co_await exporter.reject(*socket, rejection.status, move(rejection.message), move(rejection.headers));
+        co_return;
+    }
+
+    if (request.target == Target::Archive) {
+        co_await exporter.sendArchive(*socket, request.path, request.format, move(request.range), move(request.ifRange));
+    }
+    else {
+        co_await exporter.stream(*socket, request.chatId, request.format, request.afterId);
+    }
+    exporter.finish();
+}
+
+bool ExportServer::prepare(const string& head, const string& remoteIp, Request& request, Rejection& rejection) {
+    string method;
+    crow::request req;
+    if (!parseRequest(head, method, req)) {
+        rejection = { 400, "Malformed request", {} };
+        return false;
+    }
+    req.remote_ip_address = remoteIp;
+    if (!parsePath(req.url, request.chatId, request.target)) {
+        rejection = { 404, "Not found", {} };
+        return false;
+    }
+    if (method != "GET") {
+        rejection = { 405, "Only GET is supported", { { "Allow", "GET" } } };
+        return false;
+    }
+    uint32_t retryAfterMs = 0;
+    if (admit && !admit(req, request.target, retryAfterMs)) {
+        rejection = { 429, "Too many requests",
+            { { "Retry-After", to_string(max<uint32_t>(1, (retryAfterMs + 999) / 1000)) } } };
+        return false;
+    }
+    if (!parseExportFormat(req.url_params.get("format"), request.format)) {
+        rejection = { 400, "format must be ndjson or csv", {} };
+        return false;
+    }
+
+    if (request.target == Target::Archive) {
+        request.path = exporter.archivePath(request.chatId, request.format);
+        error_code ec;
+        if (!filesystem::is_regular_file(request.path, ec)) {
+            rejection = { 404, "Archive not found", {} };
+            return false;
+        }
+        request.range = req.get_header_value("Range");
+        request.ifRange = req.get_header_value("If-Range");
+        return true;
+    }
+
+    if (const char* text = req.url_params.get("afterId")) {
+        char* parsedEnd = nullptr;
+        errno = 0;
+        long afterId = strtol(text, &parsedEnd, 10);
+        if (parsedEnd == text || *parsedEnd != '\0' || errno != 0 || afterId < 0 || afterId > numeric_limits<int>::max()) {
+            rejection = { 400, "afterId must be a non-negative integer", {} };
+            return false;
+        }
+        request.afterId = static_cast<int>(afterId);
+    }
+    if (chatExists && !chatExists(request.chatId)) {
+        rejection = { 404, "Chat not found", {} };
+        return false;
+    }
+    return true;
+}
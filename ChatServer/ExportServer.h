@@ -0,0 +1,88 @@
+﻿#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <asio.hpp>
+#include <crow.h>
+
+#include "ChatExport.h"
+
+// Отдельный порт выгрузок истории чатов (--export-port, по умолчанию port + 1).
+//
+// Crow 1.2 отдает ответ только целиком из response::body, а статический файл -
+// целиком и без Range, поэтому потоковая выгрузка и докачка архивов идут через
+// свой слушающий сокет: соединения принимает этот сервер, и ChatExport пишет
+// в них сам. На каждое соединение - один запрос GET (Connection: close),
+// заголовки не больше maxHeaderBytes и не дольше headerTimeout:
+//   GET /chats/<id>/export?format=ndjson|csv&afterId=<id>
+//   GET /chats/<id>/export/archive?format=ndjson|csv    (Range, If-Range)
+// Те же пути основного порта отвечают 307 сюда. Частоту ограничивает admit
+// (те же лимиты по IP, что у маршрутов Crow); журнал трафика (--capture)
+// и сжатие ответов Crow к этому порту не применяются.
+class ExportServer {
+public:
+    struct Config {
+        std::string bindAddress = "0.0.0.0";
+        int port = 0;
+        size_t maxHeaderBytes = 8192;
+        std::chrono::seconds headerTimeout{ 10 };
+    };
+
+    enum class Target { Stream, Archive };
+
+    // Допуск запроса; false - ответить 429, повторить через retryAfterMs
+    using Admit = std::function<bool(const crow::request& req, Target target, uint32_t& retryAfterMs)>;
+    using ChatExists = std::function<bool(int chatId)>;
+
+    ExportServer(ChatExport& exporter, const Config& config, Admit admit, ChatExists chatExists);
+    ~ExportServer();
+
+    ExportServer(const ExportServer&) = delete;
+    ExportServer& operator=(const ExportServer&) = delete;
+
+    // Открывает порт (занят - исключение) и запускает поток
+    void start();
+    void stop();
+
+    int port() const { return config.port; }
+
+private:
+    using Socket = asio::ip::tcp::socket;
+
+    ChatExport& exporter;
+    Config config;
+    Admit admit;
+    ChatExists chatExists;
+
+    asio::io_context io;
+    asio::ip::tcp::acceptor acceptor;
+    std::thread thread;
+
+    // Разобранный запрос выгрузки
+    struct Request {
+        Target target = Target::Stream;
+        int chatId = 0;
+        ExportFormat format = ExportFormat::Ndjson;
+        int afterId = 0;
+        std::string path;
+        std::string range;
+        std::string ifRange;
+    };
+
+    struct Rejection {
+        int status = 0;
+        std::string message;
+        std::vector<std::pair<std::string, std::string>> headers;
+    };
+
+    asio::awaitable<void> accept();
+    asio::awaitable<void> serve(std::shared_ptr<Socket> socket);
+    // Запрос по заголовкам; false - ответить rejection
+    bool prepare(const std::string& head, const std::string& remoteIp, Request& request, Rejection& rejection);
+};
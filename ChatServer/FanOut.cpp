@@ -0,0 +1,118 @@
+﻿#include "FanOut.h"
+
+#include <algorithm>
+#include <array>
+
+using namespace std;
+
+OutboundQueue::PushResult OutboundQueue::push(const Frame& frame, size_t& droppedFrames) {
+    droppedFrames = 0;
+    lock_guard<mutex> lock(m);
+    if (overflowed) {
+        return PushResult::Closed;
+    }
+
+    auto full = [&]() {
+        return !frames.empty() && (frames.size() >= config.maxFrames || bytes + frame->size() > config.maxBytes);
+    };
+    if (full() && config.policy == SlowConsumerPolicy::Disconnect) {
+        // Очередь больше не нужна: соединение будет закрыто
+        overflowed = true;
+        frames.clear();
+        bytes = 0;
+        return PushResult::Overflow;
+    }
+
+    while (full()) {
+        bytes -= frames.front()->size();
+        frames.pop_front();
+        droppedFrames++;
+    }
+    dropped += droppedFrames;
+    frames.push_back(frame);
+    bytes += frame->size();
+    return PushResult::Queued;
+}
+
+vector<Frame> OutboundQueue::take(uint64_t& droppedSince) {
+    lock_guard<mutex> lock(m);
+    vector<Frame> result(make_move_iterator(frames.begin()), make_move_iterator(frames.end()));
+    frames.clear();
+    bytes = 0;
+    droppedSince = dropped;
+    dropped = 0;
+    return result;
+}
+
+void FanOut::subscribe(int chatId, shared_ptr<Subscriber> subscriber) {
+    lock_guard<mutex> lock(m);
+    chats[chatId].push_back(move(subscriber));
+    total++;
+}
+
+void FanOut::unsubscribe(int chatId, const Subscriber* subscriber) {
+    lock_guard<mutex> lock(m);
+    auto it = chats.find(chatId);
+    if (it == chats.end()) {
+        return;
+    }
+
+    auto& list = it->second;
+    auto pos = find_if(list.begin(), list.end(), [subscriber](const auto& s) { return s.get() == subscriber; });
+    if (pos != list.end()) {
+        *pos = move(list.back());
+        list.pop_back();
+        total--;
+    }
+    if (list.empty()) {
+        chats.erase(it);
+    }
+}
+
+void FanOut::publish(int chatId, const Encoder& encode) {
+    published.fetch_add(1, memory_order_relaxed);
+
+    lock_guard<mutex> lock(m);
+    auto it = chats.find(chatId);
+    if (it == chats.end()) {
+        return;
+    }
+
+    // Кадр каждого формата создается при первом подписчике этого формата
+    array<Frame, 2> frames;
+    for (const auto& subscriber : it->second) {
+        auto& frame = frames[static_cast<size_t>(subscriber->format())];
+        if (!frame) {
+            frame = encode(subscriber->format());
+            encoded.fetch_add(1, memory_order_relaxed);
+        }
+
+        size_t droppedFrames = 0;
+        auto result = subscriber->queue().push(frame, droppedFrames);
+        if (result == OutboundQueue::PushResult::Overflow) {
+            disconnected.fetch_add(1, memory_order_relaxed);
+            subscriber->overflow();
+            continue;
+        }
+        if (result == OutboundQueue::PushResult::Closed) {
+            continue;
+        }
+        dropped.fetch_add(droppedFrames, memory_order_relaxed);
+        enqueued.fetch_add(1, memory_order_relaxed);
+        subscriber->wake();
+    }
+}
+
+FanOut::Stats FanOut::stats() const {
+    Stats s;
+    {
+        lock_guard<mutex> lock(m);
+        s.subscribers = total;
+    }
+    s.published = published.load(memory_order_relaxed);
+    s.encoded = encoded.load(memory_order_relaxed);
+    s.enqueued = enqueued.load(memory_order_relaxed);
+    s.dropped = dropped.load(memory_order_relaxed);
+    s.disconnected = disconnected.load(memory_order_relaxed);
+    return s;
+}
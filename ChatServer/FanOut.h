@@ -0,0 +1,109 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "WireFormat.h"
+
+// Готовый кадр рассылки. Сериализуется один раз на формат и дальше
+// передается во все очереди подписчиков только по ссылке
+using Frame = std::shared_ptr<const std::string>;
+
+// Что делать с подписчиком, очередь которого переполнена
+enum class SlowConsumerPolicy {
+    DropOldest,     // выбросить старые кадры, клиенту уйдет уведомление о пропуске
+    Disconnect      // закрыть соединение, клиент переподключится и перечитает чат
+};
+
+// Исходящая очередь одного подписчика, ограниченная по числу кадров и байтам
+class OutboundQueue {
+public:
+    struct Config {
+        size_t maxFrames = 256;
+        size_t maxBytes = 1024 * 1024;
+        SlowConsumerPolicy policy = SlowConsumerPolicy::DropOldest;
+    };
+
+    enum class PushResult { Queued, Overflow, Closed };
+
+    explicit OutboundQueue(const Config& config) : config(config) {}
+
+    // Queued - кадр добавлен (droppedFrames - сколько старых выброшено ради него);
+    // Overflow - кадр не добавлен, подписчика нужно отключить;
+    // Closed - подписчик уже отключается, кадры больше не принимаются
+    PushResult push(const Frame& frame, size_t& droppedFrames);
+
+    // Все накопленные кадры; dropped - сколько кадров выброшено с прошлого вызова
+    std::vector<Frame> take(uint64_t& dropped);
+
+private:
+    Config config;
+    std::mutex m;
+    std::deque<Frame> frames;
+    size_t bytes = 0;
+    uint64_t dropped = 0;
+    bool overflowed = false;
+};
+
+// Рассылка кадров подписчикам чатов. Транспорт (WebSocket) реализует
+// Subscriber: wake() и overflow() вызываются из потока публикации и должны
+// только передать работу в поток соединения
+class FanOut {
+public:
+    class Subscriber {
+    public:
+        Subscriber(WireFormat format, const OutboundQueue::Config& config)
+            : outbound(config), wireFormat(format) {}
+        virtual ~Subscriber() = default;
+
+        WireFormat format() const { return wireFormat; }
+        OutboundQueue& queue() { return outbound; }
+
+        // В очереди появились кадры
+        virtual void wake() = 0;
+        // Очередь переполнена при политике Disconnect
+        virtual void overflow() = 0;
+
+    private:
+        OutboundQueue outbound;
+        WireFormat wireFormat;
+    };
+
+    struct Stats {
+        size_t subscribers = 0;
+        uint64_t published = 0;         // события
+        uint64_t encoded = 0;           // сериализованные кадры
+        uint64_t enqueued = 0;          // ссылки на кадры в очередях
+        uint64_t dropped = 0;
+        uint64_t disconnected = 0;
+    };
+
+    using Encoder = std::function<Frame(WireFormat)>;
+
+    void subscribe(int chatId, std::shared_ptr<Subscriber> subscriber);
+    void unsubscribe(int chatId, const Subscriber* subscriber);
+
+    // encode вызывается не больше одного раза на формат и только
+    // если у чата есть подписчики в этом формате
+    void publish(int chatId, const Encoder& encode);
+
+    Stats stats() const;
+
+private:
+    mutable std::mutex m;
+    std::unordered_map<int, std::vector<std::shared_ptr<Subscriber>>> chats;
+    size_t total = 0;
+
+    std::atomic<uint64_t> published{ 0 };
+    std::atomic<uint64_t> encoded{ 0 };
+    std::atomic<uint64_t> enqueued{ 0 };
+    std::atomic<uint64_t> dropped{ 0 };
+    std::atomic<uint64_t> disconnected{ 0 };
+};
@@ -0,0 +1,125 @@
+﻿#include "IdempotencyKeys.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+IdempotencyKeys::IdempotencyKeys(const Config& config) : config(config) {
+}
+
+bool IdempotencyKeys::validKey(const string& value) {
+    if (value.empty() || value.size() > maxKeyLength) {
+        return false;
+    }
+    for (char c : value) {
+        if (c < 0x21 || c > 0x7e) {
+            return false;
+        }
+    }
+    return true;
+}
+
+string IdempotencyKeys::name(const Key& key) {
+    return to_string(key.userId) + " " + key.route + " " + key.key;
+}
+
+optional<IdempotencyKeys::Result> IdempotencyKeys::find(const Key& key) {
+    lock_guard<mutex> lock(m);
+    auto it = index.find(name(key));
+    if (it == index.end()) {
+        return nullopt;
+    }
+    if (chrono::steady_clock::now() - it->second->createdAt > config.ttl) {
+        lru.erase(it->second);
+        index.erase(it);
+        return nullopt;
+    }
+    lru.splice(lru.begin(), lru, it->second);
+    Result result;
+    if (it->second->bodyHash != key.bodyHash) {
+        result.conflict = true;
+        conflicts.fetch_add(1, memory_order_relaxed);
+        return result;
+    }
+    result.id = it->second->id;
+    result.replayed = true;
+    memoryHits.fetch_add(1, memory_order_relaxed);
+    return result;
+}
+
+void IdempotencyKeys::remember(const Key& key, int id) {
+    string entryName = name(key);
+    lock_guard<mutex> lock(m);
+    auto it = index.find(entryName);
+    if (it != index.end()) {
+        lru.splice(lru.begin(), lru, it->second);
+        return;
+    }
+    lru.push_front(Entry{ entryName, key.bodyHash, id, chrono::steady_clock::now() });
+    index[move(entryName)] = lru.begin();
+    if (lru.size() > config.capacity) {
+        index.erase(lru.back().name);
+        lru.pop_back();
+        evictions.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+IdempotencyKeys::Result IdempotencyKeys::write(Database& db, const Key& key, const function<int(Database&)>& write) {
+    // Устаревшие ключи удаляются до проверки, чтобы не найти ключ старше ttl
+    if (++savesSincePrune >= config.pruneEvery) {
+        savesSincePrune = 0;
+        pruned.fetch_add(db.deleteIdempotencyKeys(config.ttl.count()), memory_order_relaxed);
+    }
+
+    Result result;
+    if (!db.beginTransaction()) {
+        throw runtime_error("Failed to begin transaction");
+    }
+    try {
+        string bodyHash;
+        result.id = db.getIdempotentResult(key.userId, key.route, key.key, config.ttl.count(), bodyHash);
+        if (result.id > 0 && bodyHash != key.bodyHash) {
+            result.id = 0;
+            result.conflict = true;
+            conflicts.fetch_add(1, memory_order_relaxed);
+        }
+        else if (result.id > 0) {
+            result.replayed = true;
+            databaseHits.fetch_add(1, memory_order_relaxed);
+        }
+        else {
+            result.id = write(db);
+            if (result.id > 0 && !db.saveIdempotentResult(key.userId, key.route, key.key, key.bodyHash, result.id)) {
+                throw runtime_error("Failed to save idempotency key");
+            }
+        }
+    }
+    catch (...) {
+        db.rollbackTransaction();
+        throw;
+    }
+
+    // Неудачная запись ничего не изменила: ключ не сохраняется, повтор выполнит ее заново
+    if (!db.commitTransaction()) {
+        db.rollbackTransaction();
+        throw runtime_error("Failed to commit idempotent write");
+    }
+    if (!result.replayed && result.id > 0) {
+        writes.fetch_add(1, memory_order_relaxed);
+    }
+    return result;
+}
+
+IdempotencyKeys::Stats IdempotencyKeys::stats() const {
+    Stats s;
+    s.config = config;
+    s.memoryHits = memoryHits.load(memory_order_relaxed);
+    s.databaseHits = databaseHits.load(memory_order_relaxed);
+    s.conflicts = conflicts.load(memory_order_relaxed);
+    s.writes = writes.load(memory_order_relaxed);
+    s.evictions = evictions.load(memory_order_relaxed);
+    s.pruned = pruned.load(memory_order_relaxed);
+    lock_guard<mutex> lock(m);
+    s.entries = lru.size();
+    return s;
+}
@@ -0,0 +1,103 @@
+﻿#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "Database.h"
+
+// Повторяемые записи (заголовок Idempotency-Key): клиент на плохой сети
+// повторяет POST с тем же ключом, а сервер возвращает результат первой
+// записи вместо второй вставки.
+//
+// Ключ действует для пары (пользователь, маршрут). Результат - id созданной
+// записи. Вместе с ключом хранится хэш тела запроса: тот же ключ с другим
+// телом - ошибка клиента (conflict, 409), а не повтор. Источник истины - таблица idempotency_keys: ключ сохраняется в той
+// же транзакции, что и запись, а единственный поток записи проверяет его
+// перед записью, так что и одновременные повторы не создают дубликат.
+// Перед очередью записи ключ ищется в ограниченной LRU-таблице в памяти.
+// Ключи старше ttl не действуют (и в памяти, и в базе) и периодически
+// удаляются из базы
+class IdempotencyKeys {
+public:
+    struct Config {
+        size_t capacity = 100000;
+        std::chrono::seconds ttl{ 24 * 3600 };
+        size_t pruneEvery = 1000;       // удаление устаревших - раз в столько сохранений
+    };
+
+    struct Key {
+        int userId = 0;
+        std::string route;
+        std::string key;
+        std::string bodyHash;
+    };
+
+    struct Result {
+        int id = 0;                     // id записи; <= 0 - запись не удалась, ключ не сохранен
+        bool replayed = false;          // повтор: id первой записи с этим ключом
+        bool conflict = false;          // ключ уже использован с другим телом, записи нет
+    };
+
+    struct Stats {
+        size_t entries = 0;
+        uint64_t memoryHits = 0;
+        uint64_t databaseHits = 0;
+        uint64_t conflicts = 0;
+        uint64_t writes = 0;
+        uint64_t evictions = 0;
+        uint64_t pruned = 0;
+        Config config;
+    };
+
+    static constexpr size_t maxKeyLength = 255;
+
+    explicit IdempotencyKeys(const Config& config);
+
+    IdempotencyKeys(const IdempotencyKeys&) = delete;
+    IdempotencyKeys& operator=(const IdempotencyKeys&) = delete;
+
+    // Значение заголовка: 1..maxKeyLength видимых символов ASCII
+    static bool validKey(const std::string& value);
+
+    // Результат из таблицы в памяти: повтор или конфликт
+    std::optional<Result> find(const Key& key);
+
+    // В потоке записи: повтор - id из базы, иначе write и сохранение ключа
+    // в одной транзакции. write возвращает id или <= 0 при ошибке
+    Result write(Database& db, const Key& key, const std::function<int(Database&)>& write);
+
+    void remember(const Key& key, int id);
+
+    Stats stats() const;
+
+private:
+    struct Entry {
+        std::string name;
+        std::string bodyHash;
+        int id = 0;
+        std::chrono::steady_clock::time_point createdAt;
+    };
+
+    Config config;
+    mutable std::mutex m;
+    std::list<Entry> lru;               // в начале - недавно использованные
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+
+    size_t savesSincePrune = 0;         // только в потоке записи
+
+    std::atomic<uint64_t> memoryHits{ 0 };
+    std::atomic<uint64_t> databaseHits{ 0 };
+    std::atomic<uint64_t> conflicts{ 0 };
+    std::atomic<uint64_t> writes{ 0 };
+    std::atomic<uint64_t> evictions{ 0 };
+    std::atomic<uint64_t> pruned{ 0 };
+
+    static std::string name(const Key& key);
+};
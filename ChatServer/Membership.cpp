@@ -0,0 +1,133 @@
+﻿#include "Membership.h"
+
+#include "Simd.h"
+
+using namespace std;
+
+namespace {
+
+const shared_ptr<const RoaringBitmap> noMembers = make_shared<const RoaringBitmap>();
+
+}
+
+Membership::Membership(const Config& config)
+    : config(config) {
+}
+
+void Membership::load(const vector<ChatMembers>& all) {
+    unique_lock<shared_mutex> lock(m);
+    for (const auto& chat : all) {
+        addChatLocked(chat.chatId, chat.userIds);
+    }
+}
+
+void Membership::addChat(int chatId, const vector<int>& members) {
+    unique_lock<shared_mutex> lock(m);
+    addChatLocked(chatId, members);
+}
+
+void Membership::addChatLocked(int chatId, const vector<int>& members) {
+    auto& current = chatMembers[chatId];
+    auto updated = current ? make_shared<RoaringBitmap>(*current) : make_shared<RoaringBitmap>();
+    for (int userId : members) {
+        if (userId > 0 && updated->add(static_cast<uint32_t>(userId))) {
+            userChats[userId].add(static_cast<uint32_t>(chatId));
+        }
+    }
+    current = move(updated);
+}
+
+shared_ptr<const RoaringBitmap> Membership::members(int chatId) const {
+    shared_lock<shared_mutex> lock(m);
+    auto it = chatMembers.find(chatId);
+    return it != chatMembers.end() ? it->second : noMembers;
+}
+
+uint64_t Membership::memberCount(int chatId) const {
+    return members(chatId)->cardinality();
+}
+
+bool Membership::isMember(int chatId, int userId) const {
+    return userId > 0 && members(chatId)->contains(static_cast<uint32_t>(userId));
+}
+
+vector<int> Membership::chats(int userId) const {
+    shared_lock<shared_mutex> lock(m);
+    auto it = userChats.find(userId);
+    return it != userChats.end() ? it->second.toVector() : vector<int>();
+}
+
+void Membership::touch(int userId) {
+    if (userId <= 0) {
+        return;
+    }
+    auto now = Clock::now();
+    lock_guard<mutex> lock(presenceMutex);
+    lastSeen[userId] = now;
+    online.add(static_cast<uint32_t>(userId));
+    sweepLocked(now);
+}
+
+bool Membership::isOnline(int userId) {
+    lock_guard<mutex> lock(presenceMutex);
+    sweepLocked(Clock::now());
+    return userId > 0 && online.contains(static_cast<uint32_t>(userId));
+}
+
+void Membership::sweepLocked(Clock::time_point now) {
+    if (now - lastSweep < chrono::seconds(1)) {
+        return;
+    }
+    lastSweep = now;
+    for (auto it = lastSeen.begin(); it != lastSeen.end();) {
+        if (now - it->second > config.presenceWindow) {
+            online.remove(static_cast<uint32_t>(it->first));
+            it = lastSeen.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+vector<int> Membership::onlineMembers(int chatId) {
+    auto snapshot = members(chatId);
+    setOps.fetch_add(1, memory_order_relaxed);
+    lock_guard<mutex> lock(presenceMutex);
+    sweepLocked(Clock::now());
+    return RoaringBitmap::intersect(*snapshot, online).toVector();
+}
+
+vector<int> Membership::commonChats(int userId1, int userId2) {
+    setOps.fetch_add(1, memory_order_relaxed);
+    shared_lock<shared_mutex> lock(m);
+    auto first = userChats.find(userId1);
+    auto second = userChats.find(userId2);
+    if (first == userChats.end() || second == userChats.end()) {
+        return {};
+    }
+    return RoaringBitmap::intersect(first->second, second->second).toVector();
+}
+
+Membership::Stats Membership::stats() const {
+    Stats s;
+    s.config = config;
+    s.setOps = setOps.load(memory_order_relaxed);
+    s.simd = simd::enabled();
+    s.simdSupported = simd::supported();
+    {
+        shared_lock<shared_mutex> lock(m);
+        s.chats = chatMembers.size();
+        s.users = userChats.size();
+        for (const auto& [chatId, members] : chatMembers) {
+            s.memberships += members->cardinality();
+            s.bitmapBytes += members->sizeInBytes();
+        }
+        for (const auto& [userId, chats] : userChats) {
+            s.bitmapBytes += chats.sizeInBytes();
+        }
+    }
+    lock_guard<mutex> lock(presenceMutex);
+    s.online = online.cardinality();
+    return s;
+}
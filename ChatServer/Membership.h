@@ -0,0 +1,86 @@
+﻿#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "Database.h"
+#include "RoaringBitmap.h"
+
+// Участники чатов в памяти: для каждого чата - битовая карта пользователей,
+// для каждого пользователя - карта его чатов. Строятся из user_chats при
+// запуске и дополняются при создании чатов. Вопросы "кто из участников в
+// сети", "общие чаты двух пользователей", "кому разложить сообщение" - это
+// пересечения карт (RoaringBitmap::intersect), а не запросы к базе.
+//
+// Карты чатов неизменяемы: изменение заменяет карту новой, читатели
+// держат свой снимок (shared_ptr) без блокировок.
+//
+// В сети - пользователи, которые обращались к серверу (touch) не позже
+// presenceWindow назад. Устаревшие отметки убираются не чаще раза в секунду
+class Membership {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Config {
+        std::chrono::seconds presenceWindow{ 60 };
+    };
+
+    struct Stats {
+        size_t chats = 0;
+        size_t users = 0;
+        uint64_t memberships = 0;       // пар (чат, пользователь)
+        uint64_t online = 0;
+        size_t bitmapBytes = 0;
+        uint64_t setOps = 0;            // пересечений карт по запросам
+        bool simd = false;
+        bool simdSupported = false;
+        Config config;
+    };
+
+    explicit Membership(const Config& config);
+
+    Membership(const Membership&) = delete;
+    Membership& operator=(const Membership&) = delete;
+
+    // Участники всех чатов (при запуске)
+    void load(const std::vector<ChatMembers>& chats);
+    void addChat(int chatId, const std::vector<int>& members);
+
+    // Снимок участников; пустая карта, если чата нет
+    std::shared_ptr<const RoaringBitmap> members(int chatId) const;
+    uint64_t memberCount(int chatId) const;
+    bool isMember(int chatId, int userId) const;
+    std::vector<int> chats(int userId) const;
+
+    // Пользователь обратился к серверу
+    void touch(int userId);
+    bool isOnline(int userId);
+
+    std::vector<int> onlineMembers(int chatId);
+    std::vector<int> commonChats(int userId1, int userId2);
+
+    Stats stats() const;
+
+private:
+    Config config;
+
+    mutable std::shared_mutex m;
+    std::unordered_map<int, std::shared_ptr<const RoaringBitmap>> chatMembers;
+    std::unordered_map<int, RoaringBitmap> userChats;
+
+    mutable std::mutex presenceMutex;
+    RoaringBitmap online;
+    std::unordered_map<int, Clock::time_point> lastSeen;
+    Clock::time_point lastSweep;
+
+    std::atomic<uint64_t> setOps{ 0 };
+
+    void addChatLocked(int chatId, const std::vector<int>& members);
+    void sweepLocked(Clock::time_point now);
+};
@@ -0,0 +1,461 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// Минимальный кодек MessagePack без промежуточного дерева значений.
+// Writer дописывает байты в переданную строку (одна аллокация при reserve),
+// Reader читает прямо из буфера запроса и возвращает string_view на строки.
+namespace msgpack {
+
+class Writer {
+public:
+    explicit Writer(std::string& out) : out(out) {}
+
+    void nil() { put(0xc0); }
+    void boolean(bool value) { put(value ? 0xc3 : 0xc2); }
+
+    void integer(int64_t value) {
+        if (value >= 0) {
+            return uinteger(static_cast<uint64_t>(value));
+        }
+        if (value >= -32) {
+            put(static_cast<uint8_t>(value));
+        }
+        else if (value >= INT8_MIN) {
+            put(0xd0);
+            put(static_cast<uint8_t>(value));
+        }
+        else if (value >= INT16_MIN) {
+            put(0xd1);
+            bigEndian(static_cast<uint16_t>(value), 2);
+        }
+        else if (value >= INT32_MIN) {
+            put(0xd2);
+            bigEndian(static_cast<uint32_t>(value), 4);
+        }
+        else {
+            put(0xd3);
+            bigEndian(static_cast<uint64_t>(value), 8);
+        }
+    }
+
+    void uinteger(uint64_t value) {
+        if (value < 128) {
+            put(static_cast<uint8_t>(value));
+        }
+        else if (value <= UINT8_MAX) {
+            put(0xcc);
+            put(static_cast<uint8_t>(value));
+        }
+        else if (value <= UINT16_MAX) {
+            put(0xcd);
+            bigEndian(value, 2);
+        }
+        else if (value <= UINT32_MAX) {
+            put(0xce);
+            bigEndian(value, 4);
+        }
+        else {
+            put(0xcf);
+            bigEndian(value, 8);
+        }
+    }
+
+    void real(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        put(0xcb);
+        bigEndian(bits, 8);
+    }
+
+    void str(std::string_view value) {
+        size_t size = value.size();
+        if (size < 32) {
+            put(static_cast<uint8_t>(0xa0 | size));
+        }
+        else if (size <= UINT8_MAX) {
+            put(0xd9);
+            put(static_cast<uint8_t>(size));
+        }
+        else if (size <= UINT16_MAX) {
+            put(0xda);
+            bigEndian(size, 2);
+        }
+        else {
+            put(0xdb);
+            bigEndian(size, 4);
+        }
+        out.append(value.data(), size);
+    }
+
+    void bin(std::string_view value) {
+        binHeader(value.size());
+        out.append(value.data(), value.size());
+    }
+
+    // Заголовок bin: содержимое дописывается в строку следом
+    void binHeader(size_t size) {
+        if (size <= UINT8_MAX) {
+            put(0xc4);
+            put(static_cast<uint8_t>(size));
+        }
+        else if (size <= UINT16_MAX) {
+            put(0xc5);
+            bigEndian(size, 2);
+        }
+        else {
+            put(0xc6);
+            bigEndian(size, 4);
+        }
+    }
+
+    void array(size_t size) { container(size, 0x90, 0xdc); }
+    void map(size_t size) { container(size, 0x80, 0xde); }
+
+    // Уже закодированное значение
+    void raw(std::string_view bytes) { out.append(bytes.data(), bytes.size()); }
+
+private:
+    std::string& out;
+
+    void put(uint8_t byte) { out.push_back(static_cast<char>(byte)); }
+
+    void bigEndian(uint64_t value, int bytes) {
+        for (int i = bytes - 1; i >= 0; i--) {
+            put(static_cast<uint8_t>(value >> (i * 8)));
+        }
+    }
+
+    // fix-формат до 15 элементов, затем 16 или 32 бита
+    void container(size_t size, uint8_t fix, uint8_t code16) {
+        if (size < 16) {
+            put(static_cast<uint8_t>(fix | size));
+        }
+        else if (size <= UINT16_MAX) {
+            put(code16);
+            bigEndian(size, 2);
+        }
+        else {
+            put(static_cast<uint8_t>(code16 + 1));
+            bigEndian(size, 4);
+        }
+    }
+};
+
+// LEB128: 7 бит на байт, старший бит - продолжение
+inline void writeVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+inline size_t varintSize(uint64_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+inline uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+enum class Type { Nil, Bool, Int, Float, Str, Bin, Array, Map, Ext, Invalid };
+
+// Чтение по месту. Методы возвращают false при несовпадении типа или
+// конце буфера и в этом случае позицию не сдвигают
+class Reader {
+public:
+    Reader() = default;
+    explicit Reader(std::string_view data)
+        : pos(reinterpret_cast<const uint8_t*>(data.data())), end(pos + data.size()) {}
+
+    bool atEnd() const { return pos >= end; }
+
+    Type peek() const {
+        if (pos >= end) {
+            return Type::Invalid;
+        }
+        uint8_t c = *pos;
+        if (c <= 0x7f || c >= 0xe0 || (c >= 0xcc && c <= 0xd3)) {
+            return Type::Int;
+        }
+        if (c >= 0x80 && c <= 0x8f) {
+            return Type::Map;
+        }
+        if (c >= 0x90 && c <= 0x9f) {
+            return Type::Array;
+        }
+        if ((c >= 0xa0 && c <= 0xbf) || (c >= 0xd9 && c <= 0xdb)) {
+            return Type::Str;
+        }
+        switch (c) {
+        case 0xc0: return Type::Nil;
+        case 0xc2: case 0xc3: return Type::Bool;
+        case 0xc4: case 0xc5: case 0xc6: return Type::Bin;
+        case 0xca: case 0xcb: return Type::Float;
+        case 0xdc: case 0xdd: return Type::Array;
+        case 0xde: case 0xdf: return Type::Map;
+        case 0xc7: case 0xc8: case 0xc9:
+        case 0xd4: case 0xd5: case 0xd6: case 0xd7: case 0xd8: return Type::Ext;
+        default: return Type::Invalid;
+        }
+    }
+
+    bool nil() {
+        if (peek() != Type::Nil) {
+            return false;
+        }
+        pos++;
+        return true;
+    }
+
+    bool boolean(bool& value) {
+        if (peek() != Type::Bool) {
+            return false;
+        }
+        value = *pos++ == 0xc3;
+        return true;
+    }
+
+    bool integer(int64_t& value) {
+        if (peek() != Type::Int) {
+            return false;
+        }
+        const uint8_t* start = pos;
+        uint8_t c = *pos++;
+        uint64_t raw = 0;
+        bool ok = true;
+        if (c <= 0x7f) {
+            value = c;
+        }
+        else if (c >= 0xe0) {
+            value = static_cast<int8_t>(c);
+        }
+        else if (c <= 0xcf) {
+            // uint8..uint64; значения больше INT64_MAX не поддерживаются
+            int bytes = 1 << (c - 0xcc);
+            ok = bigEndian(raw, bytes) && raw <= static_cast<uint64_t>(INT64_MAX);
+            value = static_cast<int64_t>(raw);
+        }
+        else {
+            int bytes = 1 << (c - 0xd0);
+            ok = bigEndian(raw, bytes);
+            // Расширение знака
+            int shift = 64 - bytes * 8;
+            value = shift > 0 ? static_cast<int64_t>(raw << shift) >> shift : static_cast<int64_t>(raw);
+        }
+        if (!ok) {
+            pos = start;
+        }
+        return ok;
+    }
+
+    bool real(double& value) {
+        if (peek() == Type::Int) {
+            int64_t i;
+            if (!integer(i)) {
+                return false;
+            }
+            value = static_cast<double>(i);
+            return true;
+        }
+        if (peek() != Type::Float) {
+            return false;
+        }
+        const uint8_t* start = pos;
+        uint64_t raw = 0;
+        if (*pos++ == 0xca) {
+            float f;
+            uint32_t bits;
+            if (!bigEndian(raw, 4)) {
+                pos = start;
+                return false;
+            }
+            bits = static_cast<uint32_t>(raw);
+            std::memcpy(&f, &bits, sizeof(f));
+            value = f;
+        }
+        else {
+            if (!bigEndian(raw, 8)) {
+                pos = start;
+                return false;
+            }
+            std::memcpy(&value, &raw, sizeof(value));
+        }
+        return true;
+    }
+
+    bool str(std::string_view& value) {
+        if (peek() != Type::Str) {
+            return false;
+        }
+        const uint8_t* start = pos;
+        uint8_t c = *pos++;
+        uint64_t size = c & 0x1f;
+        if (c > 0xbf && !bigEndian(size, 1 << (c - 0xd9))) {
+            pos = start;
+            return false;
+        }
+        return bytes(size, value, start);
+    }
+
+    bool bin(std::string_view& value) {
+        if (peek() != Type::Bin) {
+            return false;
+        }
+        const uint8_t* start = pos;
+        uint8_t c = *pos++;
+        uint64_t size = 0;
+        if (!bigEndian(size, 1 << (c - 0xc4))) {
+            pos = start;
+            return false;
+        }
+        return bytes(size, value, start);
+    }
+
+    bool array(size_t& size) { return container(Type::Array, 0x90, 0xdc, size); }
+    bool map(size_t& size) { return container(Type::Map, 0x80, 0xde, size); }
+
+    // Байты следующего значения целиком (для вложенных объектов)
+    bool value(std::string_view& bytes) {
+        const uint8_t* start = pos;
+        if (!skip()) {
+            return false;
+        }
+        bytes = std::string_view(reinterpret_cast<const char*>(start), static_cast<size_t>(pos - start));
+        return true;
+    }
+
+    // Пропуск значения любого типа вместе с вложенными
+    bool skip(int depth = 0) {
+        if (depth > maxDepth) {
+            return false;
+        }
+        const uint8_t* start = pos;
+        std::string_view view;
+        size_t size = 0;
+        int64_t i;
+        double d;
+        bool b;
+        bool ok = false;
+        switch (peek()) {
+        case Type::Nil: ok = nil(); break;
+        case Type::Bool: ok = boolean(b); break;
+        case Type::Int: ok = integer(i); break;
+        case Type::Float: ok = real(d); break;
+        case Type::Str: ok = str(view); break;
+        case Type::Bin: ok = bin(view); break;
+        case Type::Ext: ok = ext(); break;
+        case Type::Array:
+            ok = array(size);
+            for (size_t n = 0; ok && n < size; n++) {
+                ok = skip(depth + 1);
+            }
+            break;
+        case Type::Map:
+            ok = map(size);
+            for (size_t n = 0; ok && n < size * 2; n++) {
+                ok = skip(depth + 1);
+            }
+            break;
+        default:
+            break;
+        }
+        if (!ok) {
+            pos = start;
+        }
+        return ok;
+    }
+
+private:
+    static constexpr int maxDepth = 32;
+
+    const uint8_t* pos = nullptr;
+    const uint8_t* end = nullptr;
+
+    bool bigEndian(uint64_t& value, int count) {
+        if (end - pos < count) {
+            return false;
+        }
+        value = 0;
+        for (int i = 0; i < count; i++) {
+            value = (value << 8) | *pos++;
+        }
+        return true;
+    }
+
+    bool bytes(uint64_t size, std::string_view& value, const uint8_t* start) {
+        if (static_cast<uint64_t>(end - pos) < size) {
+            pos = start;
+            return false;
+        }
+        value = std::string_view(reinterpret_cast<const char*>(pos), static_cast<size_t>(size));
+        pos += size;
+        return true;
+    }
+
+    bool container(Type type, uint8_t fix, uint8_t code16, size_t& size) {
+        if (peek() != type) {
+            return false;
+        }
+        const uint8_t* start = pos;
+        uint8_t c = *pos++;
+        uint64_t value = 0;
+        if ((c & 0xf0) == fix) {
+            value = c & 0x0f;
+        }
+        else if (!bigEndian(value, c == code16 ? 2 : 4)) {
+            pos = start;
+            return false;
+        }
+        size = static_cast<size_t>(value);
+        return true;
+    }
+
+    bool ext() {
+        const uint8_t* start = pos;
+        uint8_t c = *pos++;
+        uint64_t size = 0;
+        bool ok = true;
+        if (c >= 0xd4 && c <= 0xd8) {
+            size = uint64_t(1) << (c - 0xd4);
+        }
+        else {
+            ok = bigEndian(size, 1 << (c - 0xc7));
+        }
+        // Байт типа расширения и данные
+        if (!ok || static_cast<uint64_t>(end - pos) < size + 1) {
+            pos = start;
+            return false;
+        }
+        pos += size + 1;
+        return true;
+    }
+};
+
+inline bool readVarint(std::string_view& data, uint64_t& value) {
+    value = 0;
+    for (size_t i = 0; i < data.size() && i < 10; i++) {
+        uint8_t byte = static_cast<uint8_t>(data[i]);
+        value |= static_cast<uint64_t>(byte & 0x7f) << (7 * i);
+        if ((byte & 0x80) == 0) {
+            data.remove_prefix(i + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace msgpack
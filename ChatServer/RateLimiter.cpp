@@ -0,0 +1,165 @@
+﻿#include "RateLimiter.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+// Состояние ведра: старшие 24 бита - миллитокены, младшие 40 - время в мс
+constexpr int timeBits = 40;
+constexpr uint64_t timeMask = (uint64_t(1) << timeBits) - 1;
+constexpr uint32_t maxCapacity = ((1u << (64 - timeBits)) - 1) / 1000;
+
+uint64_t pack(uint64_t tokensMilli, uint64_t timeMs) {
+    return (tokensMilli << timeBits) | (timeMs & timeMask);
+}
+
+uint64_t tokensOf(uint64_t state) {
+    return state >> timeBits;
+}
+
+uint64_t timeOf(uint64_t state) {
+    return state & timeMask;
+}
+
+// Другой поток мог записать более позднее время - тогда прошло 0 мс
+uint64_t elapsedMs(uint64_t now, uint64_t then) {
+    return now > then ? now - then : 0;
+}
+
+uint64_t mix(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+size_t roundUpPow2(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+}
+
+RateLimiter::RateLimiter(const Config& config)
+    : config(config), origin(chrono::steady_clock::now()) {
+    this->config.capacity = clamp<uint32_t>(config.capacity, 1, maxCapacity);
+    this->config.refillPerSecond = max<uint32_t>(1, config.refillPerSecond);
+    capacityMilli = uint64_t(this->config.capacity) * 1000;
+
+    // Пустое ведро пополняется за capacity / rate секунд
+    idleMs = capacityMilli / this->config.refillPerSecond + 1;
+
+    size_t shards = roundUpPow2(max<size_t>(1, config.shards));
+    size_t perShard = roundUpPow2(max(maxProbe, config.slotsPerShard));
+    shardMask = shards - 1;
+    slotMask = perShard - 1;
+    slots = make_unique<Slot[]>(shards * perShard);
+}
+
+RateLimiter::Result RateLimiter::consume(uint64_t key, uint32_t cost) {
+    Result result;
+    if (cost == 0) {
+        return result;
+    }
+
+    uint64_t now = nowMs();
+    Slot* slot = findSlot(key, now);
+    if (!slot) {
+        tableFullCount.fetch_add(1, memory_order_relaxed);
+        return result;
+    }
+
+    // Запрос дороже всего ведра иначе не прошел бы никогда
+    uint64_t costMilli = min(uint64_t(cost) * 1000, capacityMilli);
+    uint64_t state = slot->state.load(memory_order_relaxed);
+    while (true) {
+        // rate токенов в секунду = rate миллитокенов в миллисекунду.
+        // У только что занятого слота состояние 0 - ведро полное. После
+        // первого запроса состояние не нулевое: время в нем не меньше 1
+        uint64_t refill = elapsedMs(now, timeOf(state)) * config.refillPerSecond;
+        uint64_t tokens = state == 0 ? capacityMilli : min(capacityMilli, tokensOf(state) + refill);
+        uint64_t stamp = max(now, timeOf(state));
+
+        uint64_t next;
+        if (tokens >= costMilli) {
+            next = pack(tokens - costMilli, stamp);
+        }
+        else {
+            result.allowed = false;
+            result.retryAfterMs = static_cast<uint32_t>((costMilli - tokens + config.refillPerSecond - 1) / config.refillPerSecond);
+            next = pack(tokens, stamp);
+        }
+
+        if (slot->state.compare_exchange_weak(state, next, memory_order_relaxed)) {
+            return result;
+        }
+        result = Result();
+    }
+}
+
+size_t RateLimiter::activeKeys() const {
+    uint64_t now = nowMs();
+    size_t count = 0;
+    size_t total = (shardMask + 1) * (slotMask + 1);
+    for (size_t i = 0; i < total; i++) {
+        if (slots[i].key.load(memory_order_relaxed) != 0 && !isIdle(slots[i], now)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+uint64_t RateLimiter::nowMs() const {
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - origin).count();
+    return static_cast<uint64_t>(elapsed) + 1;
+}
+
+bool RateLimiter::isIdle(const Slot& slot, uint64_t now) const {
+    uint64_t state = slot.state.load(memory_order_relaxed);
+    return state != 0 && elapsedMs(now, timeOf(state)) >= idleMs;
+}
+
+RateLimiter::Slot* RateLimiter::findSlot(uint64_t key, uint64_t now) {
+    uint64_t hash = mix(key);
+    Slot* shard = &slots[(hash & shardMask) * (slotMask + 1)];
+    size_t start = static_cast<size_t>(hash >> 32);
+
+    Slot* reclaimable = nullptr;
+    for (size_t i = 0; i < maxProbe; i++) {
+        Slot& slot = shard[(start + i) & slotMask];
+        uint64_t current = slot.key.load(memory_order_acquire);
+        if (current == key) {
+            return &slot;
+        }
+
+        if (current == 0) {
+            // Свободный слот
+            if (slot.key.compare_exchange_strong(current, key, memory_order_acq_rel)) {
+                return &slot;
+            }
+            if (current == key) {
+                return &slot;
+            }
+        }
+        else if (!reclaimable && isIdle(slot, now)) {
+            reclaimable = &slot;
+        }
+    }
+
+    // Ленивое освобождение: простаивающее ведро уже полное, состояние не трогаем
+    if (reclaimable) {
+        uint64_t current = reclaimable->key.load(memory_order_acquire);
+        if (current != 0 && isIdle(*reclaimable, now) &&
+            reclaimable->key.compare_exchange_strong(current, key, memory_order_acq_rel)) {
+            return reclaimable;
+        }
+    }
+    return nullptr;
+}
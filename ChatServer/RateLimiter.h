@@ -0,0 +1,61 @@
+﻿#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Token bucket без блокировок для множества ключей (пользователи, IP).
+// Ведра лежат в шардированной хеш-таблице с открытой адресацией; состояние
+// ведра - одно 64-битное слово (миллитокены и время последнего пополнения
+// в мс), которое меняется CAS-циклом. Размер ведра - до 16000 токенов.
+// Таблица фиксированного размера: ведро, простаивавшее дольше времени полного
+// пополнения, уже полное, поэтому его слот можно без сброса отдать новому ключу. Если свободного
+// слота рядом нет, запрос пропускается (fail-open) и учитывается в tableFull.
+class RateLimiter {
+public:
+    struct Config {
+        uint32_t capacity = 50;         // размер ведра, токенов
+        uint32_t refillPerSecond = 20;  // скорость пополнения
+        size_t shards = 16;
+        size_t slotsPerShard = 4096;
+    };
+
+    struct Result {
+        bool allowed = true;
+        uint32_t retryAfterMs = 0;      // через сколько наберется нужное число токенов
+    };
+
+    explicit RateLimiter(const Config& config);
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    // key != 0; cost - в целых токенах
+    Result consume(uint64_t key, uint32_t cost);
+
+    size_t activeKeys() const;
+    uint64_t tableFull() const { return tableFullCount.load(std::memory_order_relaxed); }
+
+private:
+    struct alignas(16) Slot {
+        std::atomic<uint64_t> key{ 0 };
+        std::atomic<uint64_t> state{ 0 };
+    };
+
+    static constexpr size_t maxProbe = 16;
+
+    Config config;
+    uint64_t capacityMilli;
+    uint64_t idleMs;                    // время полного пополнения пустого ведра
+    std::chrono::steady_clock::time_point origin;
+    size_t shardMask;
+    size_t slotMask;
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<uint64_t> tableFullCount{ 0 };
+
+    uint64_t nowMs() const;
+    bool isIdle(const Slot& slot, uint64_t now) const;
+    Slot* findSlot(uint64_t key, uint64_t now);
+};
@@ -0,0 +1,94 @@
+﻿#include "ResponseCache.h"
+
+using namespace std;
+
+uint64_t ResourceVersions::get(int id) const {
+    lock_guard<mutex> lock(m);
+    auto it = versions.find(id);
+    return it != versions.end() ? it->second : 0;
+}
+
+void ResourceVersions::bump(int id) {
+    lock_guard<mutex> lock(m);
+    versions[id]++;
+}
+
+ResponseCache::Body ResponseCache::get(const string& key, uint64_t version, ContentEncoding encoding) {
+    lock_guard<mutex> lock(m);
+    auto it = index.find(key);
+    if (it == index.end() || it->second->version != version) {
+        misses++;
+        return nullptr;
+    }
+
+    auto& body = it->second->bodies[static_cast<size_t>(encoding)];
+    if (!body) {
+        misses++;
+        return nullptr;
+    }
+    lru.splice(lru.begin(), lru, it->second);
+    hits++;
+    return body;
+}
+
+void ResponseCache::put(const string& key, uint64_t version, ContentEncoding encoding, Body body) {
+    if (!body || body->size() > maxBytes) {
+        return;
+    }
+
+    lock_guard<mutex> lock(m);
+    auto it = index.find(key);
+    if (it == index.end()) {
+        lru.push_front(Entry{ key, version, {}, 0 });
+        it = index.emplace(key, lru.begin()).first;
+    }
+    else {
+        lru.splice(lru.begin(), lru, it->second);
+    }
+
+    auto& entry = *it->second;
+    if (version < entry.version) {
+        return;
+    }
+    if (version > entry.version) {
+        // Новая версия: прежние тела устарели
+        totalBytes -= entry.bytes;
+        entry.bytes = 0;
+        entry.bodies = {};
+        entry.version = version;
+    }
+
+    auto& slot = entry.bodies[static_cast<size_t>(encoding)];
+    if (slot) {
+        totalBytes -= slot->size();
+        entry.bytes -= slot->size();
+    }
+    slot = move(body);
+    totalBytes += slot->size();
+    entry.bytes += slot->size();
+
+    evict();
+}
+
+ResponseCache::Stats ResponseCache::stats() const {
+    lock_guard<mutex> lock(m);
+    Stats s;
+    s.entries = lru.size();
+    s.bytes = totalBytes;
+    s.maxBytes = maxBytes;
+    s.hits = hits;
+    s.misses = misses;
+    s.evictions = evictions;
+    return s;
+}
+
+void ResponseCache::evict() {
+    // Только что записанная запись в начале списка и не вытесняется
+    while (totalBytes > maxBytes && lru.size() > 1) {
+        auto& victim = lru.back();
+        totalBytes -= victim.bytes;
+        index.erase(victim.key);
+        lru.pop_back();
+        evictions++;
+    }
+}
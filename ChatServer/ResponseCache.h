@@ -0,0 +1,73 @@
+﻿#pragma once
+
+#include <array>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "ResponseCompression.h"
+
+// Версии ресурсов (сейчас - сообщений чатов) для ETag и кэша ответов.
+// Версия увеличивается после каждой успешной записи в ресурс
+class ResourceVersions {
+public:
+    uint64_t get(int id) const;
+    void bump(int id);
+
+private:
+    mutable std::mutex m;
+    std::unordered_map<int, uint64_t> versions;
+};
+
+// Кэш готовых тел ответов горячих ресурсов (последняя страница чата):
+// для каждой версии хранится тело без сжатия и сжатые варианты, чтобы
+// повторный запрос не повторял ни запрос к базе, ни сжатие.
+// Вытеснение LRU по суммарному размеру тел
+class ResponseCache {
+public:
+    using Body = std::shared_ptr<const std::string>;
+
+    struct Stats {
+        size_t entries = 0;
+        size_t bytes = 0;
+        size_t maxBytes = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    };
+
+    explicit ResponseCache(size_t maxBytes) : maxBytes(maxBytes) {}
+
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
+
+    // nullptr, если записи нет, она другой версии или нет нужного кодирования
+    Body get(const std::string& key, uint64_t version, ContentEncoding encoding);
+
+    // Запись более старой версии, чем уже лежит в кэше, игнорируется
+    void put(const std::string& key, uint64_t version, ContentEncoding encoding, Body body);
+
+    Stats stats() const;
+
+private:
+    struct Entry {
+        std::string key;
+        uint64_t version = 0;
+        std::array<Body, contentEncodingCount> bodies;
+        size_t bytes = 0;
+    };
+
+    size_t maxBytes;
+    mutable std::mutex m;
+    std::list<Entry> lru;       // в начале - недавно использованные
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    size_t totalBytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+
+    void evict();
+};
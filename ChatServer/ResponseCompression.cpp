@@ -0,0 +1,216 @@
+﻿#include "ResponseCompression.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <stdexcept>
+#include <zlib.h>
+
+#ifdef CHATSERVER_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+string trim(const string& s) {
+    size_t begin = 0;
+    size_t end = s.size();
+    while (begin < end && isspace(static_cast<unsigned char>(s[begin]))) {
+        begin++;
+    }
+    while (end > begin && isspace(static_cast<unsigned char>(s[end - 1]))) {
+        end--;
+    }
+    return s.substr(begin, end - begin);
+}
+
+string lower(string s) {
+    for (auto& c : s) {
+        c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    }
+    return s;
+}
+
+// gzip и deflate отличаются только оберткой потока: windowBits 15 + 16 - gzip
+string deflateBody(const string& data, bool gzip, int level) {
+    z_stream stream{};
+    if (deflateInit2(&stream, level, Z_DEFLATED, gzip ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw runtime_error("deflateInit2 failed");
+    }
+
+    string out;
+    out.resize(deflateBound(&stream, static_cast<uLong>(data.size())) + (gzip ? 18 : 0));
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(out.data());
+    stream.avail_out = static_cast<uInt>(out.size());
+
+    int result = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END) {
+        throw runtime_error("deflate failed");
+    }
+    out.resize(stream.total_out);
+    return out;
+}
+
+}
+
+const char* encodingName(ContentEncoding encoding) {
+    switch (encoding) {
+    case ContentEncoding::Gzip:
+        return "gzip";
+    case ContentEncoding::Deflate:
+        return "deflate";
+    case ContentEncoding::Zstd:
+        return "zstd";
+    default:
+        return "identity";
+    }
+}
+
+ContentEncoding negotiateEncoding(const string& acceptEncoding) {
+    if (acceptEncoding.empty()) {
+        return ContentEncoding::Identity;
+    }
+
+    // q для каждого кодирования; -1 - не упомянуто
+    double quality[contentEncodingCount] = { -1, -1, -1, -1 };
+    double wildcard = -1;
+
+    size_t pos = 0;
+    while (pos <= acceptEncoding.size()) {
+        size_t end = acceptEncoding.find(',', pos);
+        if (end == string::npos) {
+            end = acceptEncoding.size();
+        }
+        string item = acceptEncoding.substr(pos, end - pos);
+        pos = end + 1;
+
+        double q = 1;
+        size_t params = item.find(';');
+        if (params != string::npos) {
+            string param = lower(trim(item.substr(params + 1)));
+            if (param.rfind("q=", 0) == 0) {
+                q = atof(param.c_str() + 2);
+            }
+            item = item.substr(0, params);
+        }
+
+        string name = lower(trim(item));
+        if (name == "gzip" || name == "x-gzip") {
+            quality[static_cast<size_t>(ContentEncoding::Gzip)] = q;
+        }
+        else if (name == "deflate") {
+            quality[static_cast<size_t>(ContentEncoding::Deflate)] = q;
+        }
+        else if (name == "zstd") {
+            quality[static_cast<size_t>(ContentEncoding::Zstd)] = q;
+        }
+        else if (name == "*") {
+            wildcard = q;
+        }
+    }
+
+    ContentEncoding candidates[] = {
+#ifdef CHATSERVER_WITH_ZSTD
+        ContentEncoding::Zstd,
+#endif
+        ContentEncoding::Gzip,
+        ContentEncoding::Deflate,
+    };
+
+    ContentEncoding best = ContentEncoding::Identity;
+    double bestQuality = 0;
+    for (auto candidate : candidates) {
+        double q = quality[static_cast<size_t>(candidate)];
+        if (q < 0) {
+            q = wildcard;
+        }
+        if (q > bestQuality) {
+            best = candidate;
+            bestQuality = q;
+        }
+    }
+    return best;
+}
+
+string compressBody(const string& data, ContentEncoding encoding, int level) {
+    switch (encoding) {
+    case ContentEncoding::Gzip:
+        return deflateBody(data, true, level);
+    case ContentEncoding::Deflate:
+        return deflateBody(data, false, level);
+#ifdef CHATSERVER_WITH_ZSTD
+    case ContentEncoding::Zstd: {
+        string out;
+        out.resize(ZSTD_compressBound(data.size()));
+        size_t size = ZSTD_compress(out.data(), out.size(), data.data(), data.size(), level);
+        if (ZSTD_isError(size)) {
+            throw runtime_error(string("zstd: ") + ZSTD_getErrorName(size));
+        }
+        out.resize(size);
+        return out;
+    }
+#endif
+    default:
+        return data;
+    }
+}
+
+ResponseCompressor::ResponseCompressor(const Config& config)
+    : config(config), pool(max<size_t>(1, config.threads)) {
+}
+
+ResponseCompressor::~ResponseCompressor() {
+    pool.join();
+}
+
+asio::awaitable<shared_ptr<const string>> ResponseCompressor::compress(
+    shared_ptr<const string> data, ContentEncoding encoding) {
+    return asio::co_spawn(pool, compressTask(this, move(data), encoding), asio::use_awaitable);
+}
+
+asio::awaitable<shared_ptr<const string>> ResponseCompressor::compressTask(
+    ResponseCompressor* self, shared_ptr<const string> data, ContentEncoding encoding) {
+    auto started = chrono::steady_clock::now();
+    auto result = make_shared<const string>(compressBody(*data, encoding, self->config.level));
+    auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - started);
+
+    self->compressedCount.fetch_add(1, memory_order_relaxed);
+    self->bytesIn.fetch_add(data->size(), memory_order_relaxed);
+    self->bytesOut.fetch_add(result->size(), memory_order_relaxed);
+    self->compressMicros.fetch_add(static_cast<uint64_t>(elapsed.count()), memory_order_relaxed);
+    co_return result;
+}
+
+asio::awaitable<crow::response> ResponseCompressor::encode(ContentEncoding encoding, crow::response response) {
+    if (encoding == ContentEncoding::Identity || response.code != 200 ||
+        response.body.size() < config.minSize || !response.get_header_value("Content-Encoding").empty()) {
+        countSkipped();
+        co_return response;
+    }
+
+    auto body = make_shared<const string>(move(response.body));
+    auto compressed = co_await compress(move(body), encoding);
+    response.body = *compressed;
+    response.set_header("Content-Encoding", encodingName(encoding));
+    string vary = response.get_header_value("Vary");
+    response.set_header("Vary", vary.empty() ? "Accept-Encoding" : vary + ", Accept-Encoding");
+    co_return response;
+}
+
+ResponseCompressor::Stats ResponseCompressor::stats() const {
+    Stats s;
+    s.compressed = compressedCount.load(memory_order_relaxed);
+    s.skipped = skippedCount.load(memory_order_relaxed);
+    s.bytesIn = bytesIn.load(memory_order_relaxed);
+    s.bytesOut = bytesOut.load(memory_order_relaxed);
+    if (s.compressed > 0) {
+        s.avgCompressMs = compressMicros.load(memory_order_relaxed) / 1000.0 / s.compressed;
+    }
+    return s;
+}
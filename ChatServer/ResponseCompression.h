@@ -0,0 +1,74 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <asio.hpp>
+#include <crow.h>
+
+// Кодирование тела ответа (Content-Encoding)
+enum class ContentEncoding { Identity, Gzip, Deflate, Zstd };
+constexpr size_t contentEncodingCount = 4;
+
+const char* encodingName(ContentEncoding encoding);
+
+// Выбор кодирования по заголовку Accept-Encoding с учетом q-значений.
+// При равных q предпочтение: zstd (если собран), gzip, deflate
+ContentEncoding negotiateEncoding(const std::string& acceptEncoding);
+
+// Сжатие тела целиком. Бросает runtime_error при ошибке библиотеки
+std::string compressBody(const std::string& data, ContentEncoding encoding, int level);
+
+// Сжатие ответов в отдельном пуле потоков, чтобы не занимать потоки
+// ввода-вывода Crow. Мелкие ответы (меньше minSize) отдаются как есть:
+// выигрыш в размере не окупает заголовки и время на сжатие.
+class ResponseCompressor {
+public:
+    struct Config {
+        size_t threads = 2;
+        size_t minSize = 1024;
+        int level = 6;
+    };
+
+    struct Stats {
+        uint64_t compressed = 0;
+        uint64_t skipped = 0;       // меньше порога или клиент не принимает сжатие
+        uint64_t bytesIn = 0;
+        uint64_t bytesOut = 0;
+        double avgCompressMs = 0;
+    };
+
+    explicit ResponseCompressor(const Config& config);
+    ~ResponseCompressor();
+
+    ResponseCompressor(const ResponseCompressor&) = delete;
+    ResponseCompressor& operator=(const ResponseCompressor&) = delete;
+
+    size_t minSize() const { return config.minSize; }
+
+    // Сжатие в пуле; корутина продолжается на своем исполнителе
+    asio::awaitable<std::shared_ptr<const std::string>> compress(
+        std::shared_ptr<const std::string> data, ContentEncoding encoding);
+
+    // Сжатие готового ответа: только 200 без Content-Encoding и не меньше порога.
+    // Добавляет Content-Encoding и Vary: Accept-Encoding
+    asio::awaitable<crow::response> encode(ContentEncoding encoding, crow::response response);
+
+    void countSkipped() { skippedCount.fetch_add(1, std::memory_order_relaxed); }
+
+    Stats stats() const;
+
+private:
+    Config config;
+    asio::thread_pool pool;
+
+    std::atomic<uint64_t> compressedCount{ 0 };
+    std::atomic<uint64_t> skippedCount{ 0 };
+    std::atomic<uint64_t> bytesIn{ 0 };
+    std::atomic<uint64_t> bytesOut{ 0 };
+    std::atomic<uint64_t> compressMicros{ 0 };
+
+    static asio::awaitable<std::shared_ptr<const std::string>> compressTask(
+        ResponseCompressor* self, std::shared_ptr<const std::string> data, ContentEncoding encoding);
+};
@@ -0,0 +1,441 @@
+﻿#include "RoaringBitmap.h"
+
+#include <algorithm>
+#include <bit>
+
+#include "Simd.h"
+
+#ifdef CHATSERVER_X64
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+// Операция над n словами двух карт: результат в out (если не nullptr)
+// и число единиц в нем
+uint64_t andWordsScalar(const uint64_t* a, const uint64_t* b, uint64_t* out, size_t n) {
+    uint64_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t word = a[i] & b[i];
+        if (out) {
+            out[i] = word;
+        }
+        count += popcount(word);
+    }
+    return count;
+}
+
+uint64_t orWordsScalar(const uint64_t* a, const uint64_t* b, uint64_t* out, size_t n) {
+    uint64_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t word = a[i] | b[i];
+        out[i] = word;
+        count += popcount(word);
+    }
+    return count;
+}
+
+#ifdef CHATSERVER_X64
+
+// Число единиц в каждом 64-битном слове: таблица для полубайтов через
+// pshufb и сумма байтов через psadbw (алгоритм Мулы)
+CHATSERVER_TARGET_AVX2 inline __m256i popcount256(__m256i v) {
+    const __m256i lookup = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowMask = _mm256_set1_epi8(0x0f);
+    __m256i low = _mm256_and_si256(v, lowMask);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(v, 4), lowMask);
+    __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, low), _mm256_shuffle_epi8(lookup, high));
+    return _mm256_sad_epu8(bytes, _mm256_setzero_si256());
+}
+
+CHATSERVER_TARGET_AVX2 uint64_t sumLanes(__m256i v) {
+    alignas(32) uint64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), v);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+// n кратно 4
+CHATSERVER_TARGET_AVX2 uint64_t andWordsAvx2(const uint64_t* a, const uint64_t* b, uint64_t* out, size_t n) {
+    __m256i total = _mm256_setzero_si256();
+    for (size_t i = 0; i < n; i += 4) {
+        __m256i word = _mm256_and_si256(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+        if (out) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), word);
+        }
+        total = _mm256_add_epi64(total, popcount256(word));
+    }
+    return sumLanes(total);
+}
+
+CHATSERVER_TARGET_AVX2 uint64_t orWordsAvx2(const uint64_t* a, const uint64_t* b, uint64_t* out, size_t n) {
+    __m256i total = _mm256_setzero_si256();
+    for (size_t i = 0; i < n; i += 4) {
+        __m256i word = _mm256_or_si256(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), word);
+        total = _mm256_add_epi64(total, popcount256(word));
+    }
+    return sumLanes(total);
+}
+
+#endif
+
+uint64_t andWords(const uint64_t* a, const uint64_t* b, uint64_t* out, size_t n) {
+#ifdef CHATSERVER_X64
+    if (simd::enabled()) {
+        return andWordsAvx2(a, b, out, n);
+    }
+#endif
+    return andWordsScalar(a, b, out, n);
+}
+
+uint64_t orWords(const uint64_t* a, const uint64_t* b, uint64_t* out, size_t n) {
+#ifdef CHATSERVER_X64
+    if (simd::enabled()) {
+        return orWordsAvx2(a, b, out, n);
+    }
+#endif
+    return orWordsScalar(a, b, out, n);
+}
+
+// Меньший массив ищется в большем двоичным поиском, если размеры сильно
+// различаются; иначе - слияние
+template <typename Visit>
+void intersectArrays(const vector<uint16_t>& a, const vector<uint16_t>& b, Visit visit) {
+    const auto& small = a.size() <= b.size() ? a : b;
+    const auto& large = a.size() <= b.size() ? b : a;
+
+    if (small.size() * 32 < large.size()) {
+        auto from = large.begin();
+        for (uint16_t value : small) {
+            from = lower_bound(from, large.end(), value);
+            if (from == large.end()) {
+                break;
+            }
+            if (*from == value) {
+                visit(value);
+            }
+        }
+        return;
+    }
+
+    size_t i = 0;
+    size_t j = 0;
+    while (i < small.size() && j < large.size()) {
+        if (small[i] < large[j]) {
+            i++;
+        }
+        else if (large[j] < small[i]) {
+            j++;
+        }
+        else {
+            visit(small[i]);
+            i++;
+            j++;
+        }
+    }
+}
+
+}
+
+bool RoaringBitmap::Container::add(uint16_t low) {
+    if (isBitmap()) {
+        uint64_t& word = bitmap[low >> 6];
+        uint64_t bit = uint64_t(1) << (low & 63);
+        if (word & bit) {
+            return false;
+        }
+        word |= bit;
+        cardinality++;
+        return true;
+    }
+
+    auto it = lower_bound(array.begin(), array.end(), low);
+    if (it != array.end() && *it == low) {
+        return false;
+    }
+    if (array.size() < arrayMax) {
+        array.insert(it, low);
+        cardinality++;
+        return true;
+    }
+
+    // Массив заполнен: дальше битовая карта компактнее
+    toBitmap();
+    return add(low);
+}
+
+bool RoaringBitmap::Container::remove(uint16_t low) {
+    if (!isBitmap()) {
+        auto it = lower_bound(array.begin(), array.end(), low);
+        if (it == array.end() || *it != low) {
+            return false;
+        }
+        array.erase(it);
+        cardinality--;
+        return true;
+    }
+
+    uint64_t& word = bitmap[low >> 6];
+    uint64_t bit = uint64_t(1) << (low & 63);
+    if (!(word & bit)) {
+        return false;
+    }
+    word &= ~bit;
+    cardinality--;
+
+    // Обратно в массив с запасом, чтобы не переключаться на каждом изменении
+    if (cardinality <= arrayMax / 2) {
+        toArray();
+    }
+    return true;
+}
+
+void RoaringBitmap::Container::toBitmap() {
+    if (isBitmap()) {
+        return;
+    }
+    bitmap.assign(bitmapWords, 0);
+    for (uint16_t value : array) {
+        bitmap[value >> 6] |= uint64_t(1) << (value & 63);
+    }
+    vector<uint16_t>().swap(array);
+}
+
+void RoaringBitmap::Container::toArray() {
+    if (!isBitmap()) {
+        return;
+    }
+    array.reserve(cardinality);
+    for (size_t i = 0; i < bitmapWords; i++) {
+        uint64_t w = bitmap[i];
+        while (w != 0) {
+            array.push_back(static_cast<uint16_t>(i * 64 + countr_zero(w)));
+            w &= w - 1;
+        }
+    }
+    vector<uint64_t>().swap(bitmap);
+}
+
+void RoaringBitmap::Container::shrink() {
+    if (isBitmap() && cardinality <= arrayMax) {
+        toArray();
+    }
+}
+
+RoaringBitmap::Container RoaringBitmap::Container::intersect(const Container& a, const Container& b) {
+    Container result;
+    result.key = a.key;
+
+    if (a.isBitmap() && b.isBitmap()) {
+        result.bitmap.resize(bitmapWords);
+        result.cardinality = static_cast<uint32_t>(andWords(a.bitmap.data(), b.bitmap.data(), result.bitmap.data(), bitmapWords));
+        result.shrink();
+        return result;
+    }
+
+    if (a.isBitmap() || b.isBitmap()) {
+        const auto& values = a.isBitmap() ? b.array : a.array;
+        const auto& bits = a.isBitmap() ? a : b;
+        for (uint16_t value : values) {
+            if (bits.contains(value)) {
+                result.array.push_back(value);
+            }
+        }
+    }
+    else {
+        intersectArrays(a.array, b.array, [&result](uint16_t value) { result.array.push_back(value); });
+    }
+    result.cardinality = static_cast<uint32_t>(result.array.size());
+    return result;
+}
+
+RoaringBitmap::Container RoaringBitmap::Container::unite(const Container& a, const Container& b) {
+    Container result;
+    result.key = a.key;
+
+    if (a.isBitmap() && b.isBitmap()) {
+        result.bitmap.resize(bitmapWords);
+        result.cardinality = static_cast<uint32_t>(orWords(a.bitmap.data(), b.bitmap.data(), result.bitmap.data(), bitmapWords));
+        return result;
+    }
+
+    if (a.isBitmap() || b.isBitmap()) {
+        result = a.isBitmap() ? a : b;
+        for (uint16_t value : a.isBitmap() ? b.array : a.array) {
+            result.add(value);
+        }
+        return result;
+    }
+
+    result.array.reserve(a.array.size() + b.array.size());
+    set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), back_inserter(result.array));
+    result.cardinality = static_cast<uint32_t>(result.array.size());
+    if (result.cardinality > arrayMax) {
+        result.toBitmap();
+    }
+    return result;
+}
+
+uint64_t RoaringBitmap::Container::intersectCardinality(const Container& a, const Container& b) {
+    if (a.isBitmap() && b.isBitmap()) {
+        return andWords(a.bitmap.data(), b.bitmap.data(), nullptr, bitmapWords);
+    }
+
+    uint64_t count = 0;
+    if (a.isBitmap() || b.isBitmap()) {
+        const auto& values = a.isBitmap() ? b.array : a.array;
+        const auto& bits = a.isBitmap() ? a : b;
+        for (uint16_t value : values) {
+            count += bits.contains(value);
+        }
+        return count;
+    }
+    intersectArrays(a.array, b.array, [&count](uint16_t) { count++; });
+    return count;
+}
+
+bool RoaringBitmap::Container::contains(uint16_t low) const {
+    if (isBitmap()) {
+        return (bitmap[low >> 6] >> (low & 63)) & 1;
+    }
+    return binary_search(array.begin(), array.end(), low);
+}
+
+size_t RoaringBitmap::lowerBound(uint16_t key) const {
+    auto it = lower_bound(containers.begin(), containers.end(), key,
+        [](const Container& container, uint16_t k) { return container.key < k; });
+    return static_cast<size_t>(it - containers.begin());
+}
+
+bool RoaringBitmap::add(uint32_t value) {
+    uint16_t key = static_cast<uint16_t>(value >> 16);
+    size_t i = lowerBound(key);
+    if (i == containers.size() || containers[i].key != key) {
+        Container container;
+        container.key = key;
+        containers.insert(containers.begin() + i, move(container));
+    }
+    return containers[i].add(static_cast<uint16_t>(value));
+}
+
+bool RoaringBitmap::remove(uint32_t value) {
+    uint16_t key = static_cast<uint16_t>(value >> 16);
+    size_t i = lowerBound(key);
+    if (i == containers.size() || containers[i].key != key) {
+        return false;
+    }
+    if (!containers[i].remove(static_cast<uint16_t>(value))) {
+        return false;
+    }
+    if (containers[i].cardinality == 0) {
+        containers.erase(containers.begin() + i);
+    }
+    return true;
+}
+
+bool RoaringBitmap::contains(uint32_t value) const {
+    uint16_t key = static_cast<uint16_t>(value >> 16);
+    size_t i = lowerBound(key);
+    return i < containers.size() && containers[i].key == key && containers[i].contains(static_cast<uint16_t>(value));
+}
+
+uint64_t RoaringBitmap::cardinality() const {
+    uint64_t total = 0;
+    for (const auto& container : containers) {
+        total += container.cardinality;
+    }
+    return total;
+}
+
+size_t RoaringBitmap::sizeInBytes() const {
+    size_t bytes = sizeof(*this) + containers.capacity() * sizeof(Container);
+    for (const auto& container : containers) {
+        bytes += container.array.capacity() * sizeof(uint16_t) + container.bitmap.capacity() * sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+vector<int> RoaringBitmap::toVector() const {
+    vector<int> result;
+    result.reserve(cardinality());
+    forEach([&result](uint32_t value) { result.push_back(static_cast<int>(value)); });
+    return result;
+}
+
+RoaringBitmap RoaringBitmap::intersect(const RoaringBitmap& a, const RoaringBitmap& b) {
+    RoaringBitmap result;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a.containers.size() && j < b.containers.size()) {
+        const auto& x = a.containers[i];
+        const auto& y = b.containers[j];
+        if (x.key < y.key) {
+            i++;
+        }
+        else if (y.key < x.key) {
+            j++;
+        }
+        else {
+            auto container = Container::intersect(x, y);
+            if (container.cardinality > 0) {
+                result.containers.push_back(move(container));
+            }
+            i++;
+            j++;
+        }
+    }
+    return result;
+}
+
+RoaringBitmap RoaringBitmap::unite(const RoaringBitmap& a, const RoaringBitmap& b) {
+    RoaringBitmap result;
+    result.containers.reserve(a.containers.size() + b.containers.size());
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a.containers.size() || j < b.containers.size()) {
+        if (j == b.containers.size() || (i < a.containers.size() && a.containers[i].key < b.containers[j].key)) {
+            result.containers.push_back(a.containers[i++]);
+        }
+        else if (i == a.containers.size() || b.containers[j].key < a.containers[i].key) {
+            result.containers.push_back(b.containers[j++]);
+        }
+        else {
+            result.containers.push_back(Container::unite(a.containers[i++], b.containers[j++]));
+        }
+    }
+    return result;
+}
+
+uint64_t RoaringBitmap::intersectCardinality(const RoaringBitmap& a, const RoaringBitmap& b) {
+    uint64_t count = 0;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a.containers.size() && j < b.containers.size()) {
+        const auto& x = a.containers[i];
+        const auto& y = b.containers[j];
+        if (x.key < y.key) {
+            i++;
+        }
+        else if (y.key < x.key) {
+            j++;
+        }
+        else {
+            count += Container::intersectCardinality(x, y);
+            i++;
+            j++;
+        }
+    }
+    return count;
+}
+
+uint64_t RoaringBitmap::unionCardinality(const RoaringBitmap& a, const RoaringBitmap& b) {
+    return a.cardinality() + b.cardinality() - intersectCardinality(a, b);
+}
@@ -0,0 +1,86 @@
+﻿#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Сжатое множество 32-битных id в духе Roaring. Значения делятся по старшим
+// 16 битам на блоки; в блоке до 4096 значений хранятся отсортированным
+// массивом uint16 (2 байта на значение), больше - битовой картой на 8 КБ.
+// 100 тыс. подписчиков с id подряд занимают ~16 КБ против ~3 МБ для
+// unordered_set<int> или строк (chat_id, user_id) в памяти.
+//
+// Пересечение и объединение идут поблочно: два массива - слиянием, массив
+// с картой - проверкой битов, две карты - по словам. Слова карт
+// обрабатываются по 256 бит (AND/OR и подсчет единиц AVX2, см. Simd.h),
+// если процессор это умеет; иначе - по 64 бита с popcount.
+class RoaringBitmap {
+public:
+    bool add(uint32_t value);       // false - значение уже было
+    bool remove(uint32_t value);    // false - значения не было
+    bool contains(uint32_t value) const;
+
+    uint64_t cardinality() const;
+    bool empty() const { return containers.empty(); }
+    size_t sizeInBytes() const;
+
+    std::vector<int> toVector() const;
+
+    static RoaringBitmap intersect(const RoaringBitmap& a, const RoaringBitmap& b);
+    static RoaringBitmap unite(const RoaringBitmap& a, const RoaringBitmap& b);
+    // Размер пересечения и объединения без построения результата
+    static uint64_t intersectCardinality(const RoaringBitmap& a, const RoaringBitmap& b);
+    static uint64_t unionCardinality(const RoaringBitmap& a, const RoaringBitmap& b);
+
+    // f(uint32_t) для каждого значения по возрастанию
+    template <typename F>
+    void forEach(F&& f) const {
+        for (const auto& container : containers) {
+            uint32_t base = static_cast<uint32_t>(container.key) << 16;
+            if (!container.isBitmap()) {
+                for (uint16_t low : container.array) {
+                    f(base | low);
+                }
+                continue;
+            }
+            for (size_t i = 0; i < bitmapWords; i++) {
+                uint64_t word = container.bitmap[i];
+                while (word != 0) {
+                    f(base | static_cast<uint32_t>(i * 64 + std::countr_zero(word)));
+                    word &= word - 1;
+                }
+            }
+        }
+    }
+
+private:
+    static constexpr size_t arrayMax = 4096;
+    static constexpr size_t bitmapWords = 65536 / 64;
+
+    // Блок значений с общими старшими 16 битами: массив или битовая карта
+    struct Container {
+        uint16_t key = 0;
+        uint32_t cardinality = 0;
+        std::vector<uint16_t> array;    // по возрастанию; пусто у битовой карты
+        std::vector<uint64_t> bitmap;   // bitmapWords слов или пусто
+
+        bool isBitmap() const { return !bitmap.empty(); }
+        bool add(uint16_t low);
+        bool remove(uint16_t low);
+        bool contains(uint16_t low) const;
+
+        void toBitmap();
+        void toArray();
+        // Результат операции: карта с малым числом значений становится массивом
+        void shrink();
+
+        static Container intersect(const Container& a, const Container& b);
+        static Container unite(const Container& a, const Container& b);
+        static uint64_t intersectCardinality(const Container& a, const Container& b);
+    };
+
+    std::vector<Container> containers;  // по возрастанию key
+
+    size_t lowerBound(uint16_t key) const;
+};
@@ -0,0 +1,143 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <crow.h>
+
+#include "RateLimiter.h"
+
+// Ограничение частоты запросов по пользователю и по IP (token bucket).
+// Стоимость задается вместе с маршрутом при его регистрации (route()):
+// поиск и регистрация дороже обычного чтения. Пользователя передает сам
+// обработчик - id из пути или из поля тела, от имени которого выполняется
+// запрос; заголовкам клиента не верим. Без пользователя действует только
+// лимит по IP.
+// При нехватке токенов - 429 с Retry-After, работа обработчика не начинается.
+class RouteRateLimits {
+public:
+    // Маршрут с его стоимостью и счетчиками; живет, пока жив RouteRateLimits
+    class Route {
+    public:
+        Route(std::string name, uint32_t cost) : name(std::move(name)), cost(cost) {}
+
+    private:
+        friend class RouteRateLimits;
+
+        std::string name;
+        uint32_t cost;
+        std::atomic<uint64_t> allowed{ 0 };
+        std::atomic<uint64_t> throttledByUser{ 0 };
+        std::atomic<uint64_t> throttledByIp{ 0 };
+    };
+
+    struct RouteStats {
+        std::string name;
+        uint32_t cost = 0;
+        uint64_t allowed = 0;
+        uint64_t throttledByUser = 0;
+        uint64_t throttledByIp = 0;
+    };
+
+    bool enabled = true;
+    std::unique_ptr<RateLimiter> perUser = std::make_unique<RateLimiter>(RateLimiter::Config{ 50, 20 });
+    std::unique_ptr<RateLimiter> perIp = std::make_unique<RateLimiter>(RateLimiter::Config{ 2000, 1000 });
+
+    // Вызывается при регистрации маршрутов, до запуска сервера
+    Route& route(std::string name, uint32_t cost) {
+        return routes.emplace_back(std::move(name), cost);
+    }
+
+    // Списать стоимость маршрута с IP и с userId (0 - без пользователя).
+    // false - токенов не хватило, retryAfterMs - когда повторить
+    bool consume(const crow::request& req, Route& route, int userId, uint32_t& retryAfterMs) {
+        return consume(req, route, &userId, 1, retryAfterMs);
+    }
+
+    // То же для запроса от нескольких пользователей (пакет операций):
+    // стоимость списывается с каждого
+    bool consume(const crow::request& req, Route& route, const std::vector<int>& userIds, uint32_t& retryAfterMs) {
+        return consume(req, route, userIds.data(), userIds.size(), retryAfterMs);
+    }
+
+    // consume() для обработчика: при отказе res - 429 и уже завершен
+    template <typename Users>
+    bool admit(const crow::request& req, crow::response& res, Route& route, const Users& users) {
+        uint32_t retryAfterMs = 0;
+        if (consume(req, route, users, retryAfterMs)) {
+            return true;
+        }
+        crow::json::wvalue error;
+        error["error"] = "Too many requests";
+        res = crow::response(429, error);
+        res.set_header("Retry-After", std::to_string(std::max<uint32_t>(1, (retryAfterMs + 999) / 1000)));
+        res.end();
+        return false;
+    }
+
+    bool admit(const crow::request& req, crow::response& res, Route& route) {
+        return admit(req, res, route, 0);
+    }
+
+    std::vector<RouteStats> stats() const {
+        std::vector<RouteStats> result;
+        for (const auto& route : routes) {
+            RouteStats s;
+            s.name = route.name;
+            s.cost = route.cost;
+            s.allowed = route.allowed.load(std::memory_order_relaxed);
+            s.throttledByUser = route.throttledByUser.load(std::memory_order_relaxed);
+            s.throttledByIp = route.throttledByIp.load(std::memory_order_relaxed);
+            result.push_back(s);
+        }
+        return result;
+    }
+
+private:
+    // deque: ссылки на маршруты не меняются при добавлении новых
+    std::deque<Route> routes;
+
+    bool consume(const crow::request& req, Route& route, const int* userIds, size_t count, uint32_t& retryAfterMs) {
+        if (!enabled || route.cost == 0) {
+            return true;
+        }
+
+        auto byIp = perIp->consume(ipKey(req.remote_ip_address), route.cost);
+        if (!byIp.allowed) {
+            route.throttledByIp.fetch_add(1, std::memory_order_relaxed);
+            retryAfterMs = byIp.retryAfterMs;
+            return false;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            if (userIds[i] <= 0) {
+                continue;
+            }
+            auto byUser = perUser->consume(userKey(userIds[i]), route.cost);
+            if (!byUser.allowed) {
+                route.throttledByUser.fetch_add(1, std::memory_order_relaxed);
+                retryAfterMs = byUser.retryAfterMs;
+                return false;
+            }
+        }
+        route.allowed.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    static uint64_t userKey(int userId) {
+        return (uint64_t(1) << 32) | static_cast<uint32_t>(userId);
+    }
+
+    // FNV-1a по строке адреса
+    static uint64_t ipKey(const std::string& ip) {
+        uint64_t hash = 14695981039346656037ULL;
+        for (unsigned char c : ip) {
+            hash = (hash ^ c) * 1099511628211ULL;
+        }
+        return hash != 0 ? hash : 1;
+    }
+};
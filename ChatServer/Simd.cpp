@@ -0,0 +1,125 @@
+﻿#include "Simd.h"
+
+#include <atomic>
+#include <bit>
+
+#ifdef CHATSERVER_X64
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+using namespace std;
+
+namespace {
+
+bool detectAvx2() {
+#if !defined(CHATSERVER_X64)
+    return false;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    // Регистры YMM должны сохраняться ОС (OSXSAVE и XCR0)
+    __cpuid(info, 1);
+    if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+const bool avx2Supported = detectAvx2();
+atomic<bool> useAvx2{ avx2Supported };
+
+size_t intersectScalar(const int* a, size_t na, const int* b, size_t nb, int* out) {
+    size_t i = 0;
+    size_t j = 0;
+    size_t n = 0;
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) {
+            i++;
+        }
+        else if (b[j] < a[i]) {
+            j++;
+        }
+        else {
+            out[n++] = a[i];
+            i++;
+            j++;
+        }
+    }
+    return n;
+}
+
+#ifdef CHATSERVER_X64
+
+// Блоки по 8: каждый элемент блока a сравнивается со всеми элементами
+// блока b (8 циклических сдвигов b), совпадения - маска по элементам a.
+// Продвигается блок с меньшим последним элементом, остаток - слиянием
+CHATSERVER_TARGET_AVX2 size_t intersectAvx2(const int* a, size_t na, const int* b, size_t nb, int* out) {
+    size_t i = 0;
+    size_t j = 0;
+    size_t n = 0;
+    const __m256i rotate = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+    while (i + 8 <= na && j + 8 <= nb) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j));
+        __m256i equal = _mm256_cmpeq_epi32(va, vb);
+        for (int r = 1; r < 8; r++) {
+            vb = _mm256_permutevar8x32_epi32(vb, rotate);
+            equal = _mm256_or_si256(equal, _mm256_cmpeq_epi32(va, vb));
+        }
+
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(equal)));
+        while (mask != 0) {
+            out[n++] = a[i + countr_zero(mask)];
+            mask &= mask - 1;
+        }
+
+        int lastA = a[i + 7];
+        int lastB = b[j + 7];
+        if (lastA <= lastB) {
+            i += 8;
+        }
+        if (lastB <= lastA) {
+            j += 8;
+        }
+    }
+    return n + intersectScalar(a + i, na - i, b + j, nb - j, out + n);
+}
+
+#endif
+
+}
+
+namespace simd {
+
+bool supported() {
+    return avx2Supported;
+}
+
+bool enabled() {
+    return useAvx2.load(memory_order_relaxed);
+}
+
+void enable(bool on) {
+    useAvx2.store(on && avx2Supported, memory_order_relaxed);
+}
+
+size_t intersectSorted(const int* a, size_t na, const int* b, size_t nb, int* out) {
+#ifdef CHATSERVER_X64
+    if (enabled()) {
+        return intersectAvx2(a, na, b, nb, out);
+    }
+#endif
+    return intersectScalar(a, na, b, nb, out);
+}
+
+} // namespace simd
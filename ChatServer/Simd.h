@@ -0,0 +1,29 @@
+﻿#pragma once
+
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHATSERVER_X64
+#ifdef _MSC_VER
+#define CHATSERVER_TARGET_AVX2
+#else
+#define CHATSERVER_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// Векторные инструкции (AVX2) для операций над множествами id. Наличие
+// проверяется при запуске; без них и на других архитектурах работает
+// скалярный код. Функции с AVX2 помечаются CHATSERVER_TARGET_AVX2 и
+// вызываются только при enabled()
+namespace simd {
+
+bool supported();
+bool enabled();
+// Отключение (--no-simd, сравнение в бенчмарках)
+void enable(bool on);
+
+// Пересечение строго возрастающих последовательностей. В out должно
+// помещаться min(na, nb) элементов; возвращает размер пересечения
+size_t intersectSorted(const int* a, size_t na, const int* b, size_t nb, int* out);
+
+} // namespace simd
@@ -0,0 +1,83 @@
+﻿#include "SingleFlight.h"
+
+using namespace std;
+
+asio::awaitable<SingleFlight::Body> SingleFlight::run(string key, asio::awaitable<Body> load) {
+    auto executor = co_await asio::this_coro::executor;
+    shared_ptr<Flight> flight;
+    shared_ptr<Waiter> waiter;
+    {
+        lock_guard<mutex> lock(m);
+        auto it = flights.find(key);
+        if (it == flights.end()) {
+            flight = make_shared<Flight>();
+            flights.emplace(key, flight);
+            leaders++;
+        }
+        else {
+            flight = it->second;
+            waiter = make_shared<Waiter>(executor);
+            waiter->timer.expires_at(asio::steady_timer::time_point::max());
+            flight->waiters.push_back(waiter);
+            joined++;
+        }
+    }
+
+    if (!waiter) {
+        Body result;
+        exception_ptr error;
+        try {
+            result = co_await move(load);
+        }
+        catch (...) {
+            error = current_exception();
+        }
+        finish(key, flight, result, error);
+        if (error) {
+            rethrow_exception(error);
+        }
+        co_return result;
+    }
+
+    // Отмена таймера приходит через post в этот же исполнитель, поэтому
+    // она не может выполниться раньше, чем начнется ожидание
+    co_await waiter->timer.async_wait(asio::as_tuple(asio::use_awaitable));
+
+    exception_ptr error;
+    Body result;
+    {
+        lock_guard<mutex> lock(m);
+        error = flight->error;
+        result = flight->result;
+    }
+    if (error) {
+        rethrow_exception(error);
+    }
+    co_return result;
+}
+
+void SingleFlight::finish(const string& key, const shared_ptr<Flight>& flight, Body result, exception_ptr error) {
+    vector<shared_ptr<Waiter>> waiters;
+    {
+        lock_guard<mutex> lock(m);
+        flights.erase(key);
+        flight->result = move(result);
+        flight->error = error;
+        waiters.swap(flight->waiters);
+    }
+
+    for (auto& waiter : waiters) {
+        asio::post(waiter->timer.get_executor(), [waiter]() {
+            waiter->timer.cancel();
+        });
+    }
+}
+
+SingleFlight::Stats SingleFlight::stats() const {
+    lock_guard<mutex> lock(m);
+    Stats s;
+    s.leaders = leaders;
+    s.joined = joined;
+    s.inFlight = flights.size();
+    return s;
+}
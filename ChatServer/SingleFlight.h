@@ -0,0 +1,60 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <asio.hpp>
+
+// Объединение одинаковых одновременных чтений (single-flight). Ключ -
+// маршрут, параметры и версия ресурса. Первый запрос с ключом выполняет
+// загрузку, остальные, пришедшие до ее окончания, ждут и получают тот же
+// буфер ответа (или то же исключение). После окончания ключ удаляется:
+// дальше результат отдает кэш ответов, а новая версия - это новый ключ.
+//
+// Ожидающие ждут на таймере в своем исполнителе, как в ChatNotifier
+class SingleFlight {
+public:
+    using Body = std::shared_ptr<const std::string>;
+
+    struct Stats {
+        uint64_t leaders = 0;       // выполненные загрузки
+        uint64_t joined = 0;        // запросы, получившие чужой результат
+        size_t inFlight = 0;
+    };
+
+    SingleFlight() = default;
+
+    SingleFlight(const SingleFlight&) = delete;
+    SingleFlight& operator=(const SingleFlight&) = delete;
+
+    // load запускается, только если загрузки с этим ключом сейчас нет;
+    // иначе корутина уничтожается невыполненной
+    asio::awaitable<Body> run(std::string key, asio::awaitable<Body> load);
+
+    Stats stats() const;
+
+private:
+    struct Waiter {
+        explicit Waiter(const asio::any_io_executor& ex) : timer(ex) {}
+
+        asio::steady_timer timer;
+    };
+
+    struct Flight {
+        // Под мьютексом
+        std::vector<std::shared_ptr<Waiter>> waiters;
+        Body result;
+        std::exception_ptr error;
+    };
+
+    mutable std::mutex m;
+    std::unordered_map<std::string, std::shared_ptr<Flight>> flights;
+    uint64_t leaders = 0;
+    uint64_t joined = 0;
+
+    void finish(const std::string& key, const std::shared_ptr<Flight>& flight, Body result, std::exception_ptr error);
+};
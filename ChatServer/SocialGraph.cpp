@@ -0,0 +1,238 @@
+﻿#include "SocialGraph.h"
+
+#include <algorithm>
+#include <bit>
+
+#include "Simd.h"
+
+using namespace std;
+
+namespace {
+
+// Ключ неупорядоченной пары
+uint64_t pairHash(int userId1, int userId2) {
+    uint64_t low = static_cast<uint32_t>(min(userId1, userId2));
+    uint64_t high = static_cast<uint32_t>(max(userId1, userId2));
+    uint64_t x = (high << 32) | low;
+    // splitmix64
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+bool insertSorted(vector<int>& values, int value) {
+    auto it = lower_bound(values.begin(), values.end(), value);
+    if (it != values.end() && *it == value) {
+        return false;
+    }
+    values.insert(it, value);
+    return true;
+}
+
+void eraseSorted(vector<int>& values, int value) {
+    auto it = lower_bound(values.begin(), values.end(), value);
+    if (it != values.end() && *it == value) {
+        values.erase(it);
+    }
+}
+
+}
+
+SocialGraph::SocialGraph()
+    : bloom(bloomMinBits / 64) {
+}
+
+void SocialGraph::load(const vector<pair<int, string>>& users, const vector<Contact>& contacts) {
+    unique_lock<shared_mutex> lock(m);
+    for (const auto& [userId, name] : users) {
+        names[userId] = name;
+    }
+
+    // Массивы собираются целиком и сортируются один раз
+    for (const auto& contact : contacts) {
+        if (contact.userId1 != contact.userId2) {
+            neighbors[contact.userId1].push_back(contact.userId2);
+            neighbors[contact.userId2].push_back(contact.userId1);
+        }
+    }
+    contactCount = 0;
+    for (auto& [userId, list] : neighbors) {
+        sort(list.begin(), list.end());
+        list.erase(unique(list.begin(), list.end()), list.end());
+        contactCount += list.size();
+    }
+    contactCount /= 2;
+    rebuildBloomLocked();
+}
+
+void SocialGraph::addUser(int userId, string name) {
+    unique_lock<shared_mutex> lock(m);
+    names[userId] = move(name);
+}
+
+bool SocialGraph::hasUser(int userId) const {
+    shared_lock<shared_mutex> lock(m);
+    return names.count(userId) > 0;
+}
+
+bool SocialGraph::hasContact(int userId1, int userId2) const {
+    shared_lock<shared_mutex> lock(m);
+    return linkedLocked(userId1, userId2);
+}
+
+int SocialGraph::reserve(int userId1, int userId2) {
+    if (userId1 == userId2) {
+        return -1;
+    }
+    unique_lock<shared_mutex> lock(m);
+    if (names.count(userId1) == 0 || names.count(userId2) == 0) {
+        return -3;
+    }
+    return linkLocked(userId1, userId2) ? 0 : -2;
+}
+
+void SocialGraph::release(int userId1, int userId2) {
+    unique_lock<shared_mutex> lock(m);
+    auto first = neighbors.find(userId1);
+    auto second = neighbors.find(userId2);
+    if (first == neighbors.end() || second == neighbors.end() ||
+        !binary_search(first->second.begin(), first->second.end(), userId2)) {
+        return;
+    }
+    eraseSorted(first->second, userId2);
+    eraseSorted(second->second, userId1);
+    contactCount--;
+}
+
+void SocialGraph::add(int userId1, int userId2) {
+    if (userId1 == userId2) {
+        return;
+    }
+    unique_lock<shared_mutex> lock(m);
+    linkLocked(userId1, userId2);
+}
+
+bool SocialGraph::linkedLocked(int userId1, int userId2) const {
+    checks.fetch_add(1, memory_order_relaxed);
+    if (!bloomMayContain(userId1, userId2)) {
+        bloomNegatives.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+
+    auto first = neighbors.find(userId1);
+    auto second = neighbors.find(userId2);
+    if (first == neighbors.end() || second == neighbors.end()) {
+        return false;
+    }
+    // Поиск в меньшем массиве
+    if (first->second.size() <= second->second.size()) {
+        return binary_search(first->second.begin(), first->second.end(), userId2);
+    }
+    return binary_search(second->second.begin(), second->second.end(), userId1);
+}
+
+bool SocialGraph::linkLocked(int userId1, int userId2) {
+    if (linkedLocked(userId1, userId2)) {
+        return false;
+    }
+    insertSorted(neighbors[userId1], userId2);
+    insertSorted(neighbors[userId2], userId1);
+    contactCount++;
+
+    if (contactCount * bloomBitsPerContact / 2 > bloom.size() * 64) {
+        rebuildBloomLocked();
+    }
+    else {
+        bloomAdd(userId1, userId2);
+    }
+    return true;
+}
+
+void SocialGraph::bloomAdd(int userId1, int userId2) {
+    uint64_t hash = pairHash(userId1, userId2);
+    uint64_t step = (hash >> 32) | 1;
+    uint64_t mask = bloom.size() * 64 - 1;
+    for (size_t i = 0; i < bloomHashes; i++) {
+        uint64_t bit = (hash + i * step) & mask;
+        bloom[bit >> 6] |= uint64_t(1) << (bit & 63);
+    }
+}
+
+bool SocialGraph::bloomMayContain(int userId1, int userId2) const {
+    uint64_t hash = pairHash(userId1, userId2);
+    uint64_t step = (hash >> 32) | 1;
+    uint64_t mask = bloom.size() * 64 - 1;
+    for (size_t i = 0; i < bloomHashes; i++) {
+        uint64_t bit = (hash + i * step) & mask;
+        if (!(bloom[bit >> 6] & (uint64_t(1) << (bit & 63)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void SocialGraph::rebuildBloomLocked() {
+    size_t bits = bit_ceil(max<size_t>(bloomMinBits, static_cast<size_t>(contactCount) * bloomBitsPerContact));
+    bloom.assign(bits / 64, 0);
+    for (const auto& [userId, list] : neighbors) {
+        for (int other : list) {
+            if (userId < other) {
+                bloomAdd(userId, other);
+            }
+        }
+    }
+}
+
+vector<pair<int, string>> SocialGraph::namedLocked(const int* ids, size_t count) const {
+    vector<pair<int, string>> result;
+    result.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        auto it = names.find(ids[i]);
+        if (it != names.end()) {
+            result.push_back({ ids[i], it->second });
+        }
+    }
+    return result;
+}
+
+vector<pair<int, string>> SocialGraph::contacts(int userId) const {
+    shared_lock<shared_mutex> lock(m);
+    auto it = neighbors.find(userId);
+    if (it == neighbors.end()) {
+        return {};
+    }
+    return namedLocked(it->second.data(), it->second.size());
+}
+
+vector<pair<int, string>> SocialGraph::mutual(int userId1, int userId2) const {
+    mutualQueries.fetch_add(1, memory_order_relaxed);
+    shared_lock<shared_mutex> lock(m);
+    auto first = neighbors.find(userId1);
+    auto second = neighbors.find(userId2);
+    if (first == neighbors.end() || second == neighbors.end()) {
+        return {};
+    }
+
+    const auto& a = first->second;
+    const auto& b = second->second;
+    vector<int> common(min(a.size(), b.size()));
+    size_t count = simd::intersectSorted(a.data(), a.size(), b.data(), b.size(), common.data());
+    return namedLocked(common.data(), count);
+}
+
+SocialGraph::Stats SocialGraph::stats() const {
+    Stats s;
+    s.checks = checks.load(memory_order_relaxed);
+    s.bloomNegatives = bloomNegatives.load(memory_order_relaxed);
+    s.mutualQueries = mutualQueries.load(memory_order_relaxed);
+
+    shared_lock<shared_mutex> lock(m);
+    s.users = names.size();
+    s.contacts = contactCount;
+    s.bloomBytes = bloom.size() * sizeof(uint64_t);
+    for (const auto& [userId, list] : neighbors) {
+        s.adjacencyBytes += list.capacity() * sizeof(int);
+    }
+    return s;
+}
@@ -0,0 +1,86 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Database.h"
+
+// Граф контактов в памяти: у каждого пользователя - отсортированный массив
+// соседей. Наличие контакта сначала проверяется фильтром Блума по паре
+// (меньший id, больший id): его "нет" точно, и при добавлении нового
+// контакта - обычный случай - массивы не просматриваются. Списки контактов
+// и общие контакты отвечаются без SQLite; имена пользователей тоже здесь
+// (после регистрации они не меняются). Общие контакты - пересечение двух
+// массивов (simd::intersectSorted).
+//
+// Добавление резервирует контакт в памяти до записи в базу (reserve), так
+// что два одновременных запроса не запишут его дважды; при ошибке записи
+// резерв снимается (release). Фильтр только растет: после release бит
+// остается, и проверка доходит до массива.
+class SocialGraph {
+public:
+    struct Stats {
+        size_t users = 0;
+        uint64_t contacts = 0;
+        size_t adjacencyBytes = 0;
+        size_t bloomBytes = 0;
+        uint64_t checks = 0;            // проверок наличия контакта
+        uint64_t bloomNegatives = 0;    // из них отвечены фильтром без массивов
+        uint64_t mutualQueries = 0;
+    };
+
+    SocialGraph();
+
+    SocialGraph(const SocialGraph&) = delete;
+    SocialGraph& operator=(const SocialGraph&) = delete;
+
+    // Пользователи и контакты из базы (при запуске)
+    void load(const std::vector<std::pair<int, std::string>>& users, const std::vector<Contact>& contacts);
+    void addUser(int userId, std::string name);
+
+    bool hasUser(int userId) const;
+    bool hasContact(int userId1, int userId2) const;
+
+    // Коды Database::addContact: 0 - контакт зарезервирован, -1 - сам себе,
+    // -2 - контакт уже есть, -3 - пользователя нет
+    int reserve(int userId1, int userId2);
+    void release(int userId1, int userId2);
+    // Контакт, записанный в обход reserve (POST /batch)
+    void add(int userId1, int userId2);
+
+    // (id, имя) по возрастанию id
+    std::vector<std::pair<int, std::string>> contacts(int userId) const;
+    std::vector<std::pair<int, std::string>> mutual(int userId1, int userId2) const;
+
+    Stats stats() const;
+
+private:
+    // Фильтр строится с bloomBitsPerContact битами на контакт; когда
+    // контактов становится вдвое больше, он строится заново
+    static constexpr size_t bloomBitsPerContact = 16;
+    static constexpr size_t bloomHashes = 4;
+    static constexpr size_t bloomMinBits = size_t(1) << 16;
+
+    mutable std::shared_mutex m;
+    std::unordered_map<int, std::vector<int>> neighbors;
+    std::unordered_map<int, std::string> names;
+    std::vector<uint64_t> bloom;        // размер в битах - степень двойки
+    uint64_t contactCount = 0;
+
+    mutable std::atomic<uint64_t> checks{ 0 };
+    mutable std::atomic<uint64_t> bloomNegatives{ 0 };
+    mutable std::atomic<uint64_t> mutualQueries{ 0 };
+
+    bool linkedLocked(int userId1, int userId2) const;
+    bool linkLocked(int userId1, int userId2);
+    void bloomAdd(int userId1, int userId2);
+    bool bloomMayContain(int userId1, int userId2) const;
+    void rebuildBloomLocked();
+    std::vector<std::pair<int, std::string>> namedLocked(const int* ids, size_t count) const;
+};
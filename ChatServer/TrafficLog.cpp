@@ -0,0 +1,199 @@
+﻿#include "TrafficLog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+const char magic[] = "CSTRAF01";
+const size_t magicSize = sizeof(magic) - 1;
+
+void putVarint(string& buffer, uint64_t value) {
+    while (value >= 0x80) {
+        buffer.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back(static_cast<char>(value));
+}
+
+void putString(string& buffer, const string& value) {
+    putVarint(buffer, value.size());
+    buffer.append(value);
+}
+
+} // namespace
+
+TrafficLogWriter::TrafficLogWriter(const string& path, size_t maxPending)
+    : out(path, ios::binary | ios::trunc), maxPending(maxPending) {
+    if (!out) {
+        throw runtime_error("Can't open traffic log: " + path);
+    }
+    out.write(magic, magicSize);
+    worker = thread([this]() { run(); });
+}
+
+TrafficLogWriter::~TrafficLogWriter() {
+    {
+        lock_guard<mutex> lock(m);
+        stopping = true;
+    }
+    cv.notify_one();
+    worker.join();
+}
+
+void TrafficLogWriter::record(CapturedRequest request) {
+    {
+        lock_guard<mutex> lock(m);
+        if (pending.size() >= maxPending) {
+            droppedCount++;
+            return;
+        }
+        pending.push_back(move(request));
+    }
+    cv.notify_one();
+}
+
+uint64_t TrafficLogWriter::dropped() const {
+    lock_guard<mutex> lock(m);
+    return droppedCount;
+}
+
+uint64_t TrafficLogWriter::written() const {
+    lock_guard<mutex> lock(m);
+    return writtenCount;
+}
+
+void TrafficLogWriter::run() {
+    vector<CapturedRequest> batch;
+    string buffer;
+
+    while (true) {
+        {
+            unique_lock<mutex> lock(m);
+            cv.wait_for(lock, chrono::milliseconds(100), [this]() { return stopping || !pending.empty(); });
+            if (pending.empty() && stopping) {
+                break;
+            }
+            batch.swap(pending);
+        }
+
+        // Записи приходят в порядке завершения, а в журнале упорядочены по началу
+        stable_sort(batch.begin(), batch.end(),
+            [](const CapturedRequest& a, const CapturedRequest& b) { return a.startUs < b.startUs; });
+
+        buffer.clear();
+        for (const auto& request : batch) {
+            encode(request, buffer);
+        }
+        out.write(buffer.data(), buffer.size());
+        out.flush();
+
+        {
+            lock_guard<mutex> lock(m);
+            writtenCount += batch.size();
+        }
+        batch.clear();
+    }
+}
+
+void TrafficLogWriter::encode(const CapturedRequest& request, string& buffer) {
+    // Между пачками порядок может немного нарушаться: отрицательная дельта сжимается в 0
+    uint64_t delta = request.startUs > lastStartUs ? request.startUs - lastStartUs : 0;
+    lastStartUs = max(lastStartUs, request.startUs);
+
+    putVarint(buffer, delta);
+    putVarint(buffer, request.durationUs);
+    putVarint(buffer, static_cast<uint64_t>(request.status));
+    putString(buffer, request.method);
+    putString(buffer, request.url);
+    putString(buffer, request.body);
+    putVarint(buffer, request.headers.size());
+    for (const auto& [name, value] : request.headers) {
+        putString(buffer, name);
+        putString(buffer, value);
+    }
+}
+
+TrafficLogReader::TrafficLogReader(const string& path) : in(path, ios::binary) {
+    char header[magicSize];
+    if (!in || !in.read(header, magicSize) || string(header, magicSize) != magic) {
+        throw runtime_error("Not a traffic log: " + path);
+    }
+    in.seekg(0, ios::end);
+    fileSize = static_cast<uint64_t>(in.tellg());
+    in.seekg(magicSize);
+}
+
+bool TrafficLogReader::next(CapturedRequest& request) {
+    uint64_t delta, status;
+    if (!readVarint(delta)) {
+        return false;
+    }
+    if (!readVarint(request.durationUs) || !readVarint(status)
+        || !readString(request.method) || !readString(request.url) || !readString(request.body)) {
+        throw runtime_error("Truncated traffic log");
+    }
+    request.headers.clear();
+    // Каждый заголовок занимает хотя бы два байта длин
+    uint64_t headerCount;
+    if (!readVarint(headerCount) || headerCount > remaining() / 2) {
+        throw runtime_error("Truncated traffic log");
+    }
+    for (uint64_t i = 0; i < headerCount; i++) {
+        string name, value;
+        if (!readString(name) || !readString(value)) {
+            throw runtime_error("Truncated traffic log");
+        }
+        request.headers.emplace_back(move(name), move(value));
+    }
+    lastStartUs += delta;
+    request.startUs = lastStartUs;
+    request.status = static_cast<int>(status);
+    return true;
+}
+
+vector<CapturedRequest> TrafficLogReader::readAll(const string& path) {
+    TrafficLogReader reader(path);
+    vector<CapturedRequest> result;
+    CapturedRequest request;
+    while (reader.next(request)) {
+        result.push_back(request);
+    }
+    return result;
+}
+
+bool TrafficLogReader::readVarint(uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = in.get();
+        if (c == EOF) {
+            return false;
+        }
+        value |= static_cast<uint64_t>(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TrafficLogReader::readString(string& value) {
+    uint64_t size;
+    if (!readVarint(size)) {
+        return false;
+    }
+    if (size > remaining()) {
+        return false;
+    }
+    value.resize(size);
+    return size == 0 || static_cast<bool>(in.read(&value[0], size));
+}
+
+uint64_t TrafficLogReader::remaining() {
+    auto position = in.tellg();
+    return position < 0 ? 0 : fileSize - static_cast<uint64_t>(position);
+}
@@ -0,0 +1,80 @@
+﻿#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Запись о запросе в журнале трафика
+struct CapturedRequest {
+    uint64_t startUs = 0;     // время прихода от начала записи, мкс
+    uint64_t durationUs = 0;  // время обработки на сервере, мкс
+    int status = 0;
+    std::string method;
+    std::string url;          // путь вместе со строкой запроса
+    std::string body;
+    // Заголовки, от которых зависит ответ (CaptureMiddleware::capturedHeaders)
+    std::vector<std::pair<std::string, std::string>> headers;
+};
+
+// Формат файла: заголовок "CSTRAF01", затем записи подряд.
+// Запись: varint(дельта startUs от предыдущей), varint(durationUs), varint(status),
+// три строки method, url, body в виде varint(длина) + байты, затем varint(число
+// заголовков) и пары строк имя, значение.
+
+// Асинхронная запись журнала: обработчики только кладут запись в очередь,
+// кодирование и запись на диск идут в фоновом потоке
+class TrafficLogWriter {
+public:
+    explicit TrafficLogWriter(const std::string& path, size_t maxPending = 100000);
+    ~TrafficLogWriter();
+
+    TrafficLogWriter(const TrafficLogWriter&) = delete;
+    TrafficLogWriter& operator=(const TrafficLogWriter&) = delete;
+
+    void record(CapturedRequest request);
+
+    // Записей, отброшенных из-за переполнения очереди
+    uint64_t dropped() const;
+    uint64_t written() const;
+
+private:
+    std::ofstream out;
+    size_t maxPending;
+
+    mutable std::mutex m;
+    std::condition_variable cv;
+    std::vector<CapturedRequest> pending;
+    bool stopping = false;
+    uint64_t droppedCount = 0;
+    uint64_t writtenCount = 0;
+    uint64_t lastStartUs = 0;
+    std::thread worker;
+
+    void run();
+    void encode(const CapturedRequest& request, std::string& buffer);
+};
+
+// Последовательное чтение журнала
+class TrafficLogReader {
+public:
+    explicit TrafficLogReader(const std::string& path);
+
+    bool next(CapturedRequest& request);
+
+    static std::vector<CapturedRequest> readAll(const std::string& path);
+
+private:
+    std::ifstream in;
+    uint64_t lastStartUs = 0;
+    uint64_t fileSize = 0;
+
+    // Байт до конца файла: длины из журнала не должны превышать их
+    uint64_t remaining();
+    bool readVarint(uint64_t& value);
+    bool readString(std::string& value);
+};
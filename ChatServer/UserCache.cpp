@@ -0,0 +1,94 @@
+﻿#include "UserCache.h"
+
+#include <algorithm>
+
+using namespace std;
+
+UserCache::UserCache(const Config& config)
+    : config(config),
+    shardCapacity(max<size_t>(1, config.capacity / max<size_t>(1, config.shards))),
+    shards(max<size_t>(1, config.shards)) {
+}
+
+optional<UserInfo> UserCache::find(Shard& s, int userId) {
+    auto it = s.index.find(userId);
+    if (it == s.index.end()) {
+        misses.fetch_add(1, memory_order_relaxed);
+        return nullopt;
+    }
+    s.lru.splice(s.lru.begin(), s.lru, it->second);
+    hits.fetch_add(1, memory_order_relaxed);
+    return *it->second;
+}
+
+optional<UserInfo> UserCache::get(int userId) {
+    auto& s = shard(userId);
+    lock_guard<mutex> lock(s.m);
+    return find(s, userId);
+}
+
+vector<UserInfo> UserCache::getMany(const vector<int>& userIds, vector<int>& missing) {
+    vector<UserInfo> result;
+    result.reserve(userIds.size());
+    for (int userId : userIds) {
+        auto& s = shard(userId);
+        lock_guard<mutex> lock(s.m);
+        if (auto user = find(s, userId)) {
+            result.push_back(move(*user));
+        }
+        else {
+            missing.push_back(userId);
+        }
+    }
+    return result;
+}
+
+void UserCache::put(const UserInfo& user, uint64_t stamp) {
+    auto& s = shard(user.id);
+    lock_guard<mutex> lock(s.m);
+    if (s.invalidatedAt > stamp) {
+        staleFills.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+
+    auto it = s.index.find(user.id);
+    if (it != s.index.end()) {
+        *it->second = user;
+        s.lru.splice(s.lru.begin(), s.lru, it->second);
+        return;
+    }
+    s.lru.push_front(user);
+    s.index[user.id] = s.lru.begin();
+    if (s.lru.size() > shardCapacity) {
+        s.index.erase(s.lru.back().id);
+        s.lru.pop_back();
+        evictions.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+void UserCache::invalidate(int userId) {
+    auto& s = shard(userId);
+    lock_guard<mutex> lock(s.m);
+    s.invalidatedAt = clock.fetch_add(1, memory_order_acq_rel) + 1;
+    auto it = s.index.find(userId);
+    if (it != s.index.end()) {
+        s.lru.erase(it->second);
+        s.index.erase(it);
+    }
+    invalidations.fetch_add(1, memory_order_relaxed);
+}
+
+UserCache::Stats UserCache::stats() const {
+    Stats s;
+    s.config = config;
+    s.hits = hits.load(memory_order_relaxed);
+    s.misses = misses.load(memory_order_relaxed);
+    s.evictions = evictions.load(memory_order_relaxed);
+    s.invalidations = invalidations.load(memory_order_relaxed);
+    s.staleFills = staleFills.load(memory_order_relaxed);
+    for (const auto& shard : shards) {
+        lock_guard<mutex> lock(shard.m);
+        s.entries += shard.lru.size();
+    }
+    return s;
+}
@@ -0,0 +1,76 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "Database.h"
+
+// Кэш профилей пользователей (id, имя, логин): /users/<id>, /users?ids=
+// и имена отправителей сообщений. LRU, разбитый на шарды по id: у каждого
+// шарда свой мьютекс и своя очередь вытеснения, поэтому параллельные
+// чтения разных пользователей не ждут друг друга.
+//
+// Изменения таблицы users сбрасывают записи (invalidate) после фиксации
+// (Database::onRowsCommitted). Чтение из базы, начатое до фиксации, могло
+// получить старую строку, поэтому put принимает отметку stamp(), взятую
+// перед чтением: если шард сбрасывался позже отметки, запись не кладется
+class UserCache {
+public:
+    struct Config {
+        size_t capacity = 100000;
+        size_t shards = 16;
+    };
+
+    struct Stats {
+        size_t entries = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t invalidations = 0;
+        uint64_t staleFills = 0;        // put, отброшенные из-за сброса во время чтения
+        Config config;
+    };
+
+    explicit UserCache(const Config& config);
+
+    UserCache(const UserCache&) = delete;
+    UserCache& operator=(const UserCache&) = delete;
+
+    std::optional<UserInfo> get(int userId);
+    // Найденные в кэше - в порядке ids; остальные id - в missing
+    std::vector<UserInfo> getMany(const std::vector<int>& userIds, std::vector<int>& missing);
+
+    uint64_t stamp() const { return clock.load(std::memory_order_acquire); }
+    void put(const UserInfo& user, uint64_t stamp);
+    void invalidate(int userId);
+
+    Stats stats() const;
+
+private:
+    struct Shard {
+        mutable std::mutex m;
+        std::list<UserInfo> lru;        // в начале - недавно использованные
+        std::unordered_map<int, std::list<UserInfo>::iterator> index;
+        uint64_t invalidatedAt = 0;
+    };
+
+    Config config;
+    size_t shardCapacity;
+    std::vector<Shard> shards;
+    std::atomic<uint64_t> clock{ 0 };
+
+    std::atomic<uint64_t> hits{ 0 };
+    std::atomic<uint64_t> misses{ 0 };
+    std::atomic<uint64_t> evictions{ 0 };
+    std::atomic<uint64_t> invalidations{ 0 };
+    std::atomic<uint64_t> staleFills{ 0 };
+
+    Shard& shard(int userId) { return shards[static_cast<size_t>(userId) % shards.size()]; }
+    // Под блокировкой шарда
+    std::optional<UserInfo> find(Shard& s, int userId);
+};
@@ -0,0 +1,130 @@
+﻿#include "WebSocketPush.h"
+
+#include "CrowPrivateAccess.h"
+#include "MsgPack.h"
+
+using namespace std;
+
+// Поля соединения Crow: поток соединения и его буферы записи
+namespace crow_private {
+
+struct AdaptorTag {
+    using type = crow::SocketAdaptor ChatWebSocket::*;
+};
+struct SendingBuffersTag {
+    using type = vector<string> ChatWebSocket::*;
+};
+struct WriteBuffersTag {
+    using type = vector<string> ChatWebSocket::*;
+};
+
+AdaptorTag::type member(AdaptorTag);
+SendingBuffersTag::type member(SendingBuffersTag);
+WriteBuffersTag::type member(WriteBuffersTag);
+
+template struct Access<AdaptorTag, &ChatWebSocket::adaptor_>;
+template struct Access<SendingBuffersTag, &ChatWebSocket::sending_buffers_>;
+template struct Access<WriteBuffersTag, &ChatWebSocket::write_buffers_>;
+
+} // namespace crow_private
+
+namespace {
+
+ChatWebSocket* concrete(crow::websocket::connection& conn) {
+    return static_cast<ChatWebSocket*>(&conn);
+}
+
+asio::io_context& connectionContext(ChatWebSocket* conn) {
+    using namespace crow_private;
+    return (conn->*member(AdaptorTag{})).get_io_service();
+}
+
+// Клиенту пропущенные кадры не придут: он должен перечитать чат
+string gapFrame(WireFormat format, uint64_t dropped) {
+    if (format == WireFormat::Json) {
+        crow::json::wvalue gap;
+        gap["type"] = "gap";
+        gap["dropped"] = dropped;
+        return gap.dump();
+    }
+
+    string out;
+    msgpack::Writer writer(out);
+    writer.map(2);
+    writer.str("type");
+    writer.str("gap");
+    writer.str("dropped");
+    writer.uinteger(dropped);
+    return out;
+}
+
+}
+
+WebSocketSubscriber::WebSocketSubscriber(crow::websocket::connection& conn, WireFormat format,
+    const OutboundQueue::Config& config)
+    : FanOut::Subscriber(format, config),
+    conn(concrete(conn)),
+    io(connectionContext(concrete(conn))),
+    retry(io) {
+}
+
+void WebSocketSubscriber::wake() {
+    if (!scheduled.exchange(true)) {
+        asio::post(io, [self = shared_from_this()]() {
+            self->pump();
+        });
+    }
+}
+
+void WebSocketSubscriber::overflow() {
+    asio::post(io, [self = shared_from_this()]() {
+        if (self->open) {
+            self->conn->close("Slow consumer");
+        }
+    });
+}
+
+void WebSocketSubscriber::closed() {
+    open = false;
+    retry.cancel();
+}
+
+void WebSocketSubscriber::pump() {
+    scheduled = false;
+    if (!open) {
+        return;
+    }
+
+    if (crowWriting()) {
+        if (!scheduled.exchange(true)) {
+            retry.expires_after(retryDelay);
+            retry.async_wait([self = shared_from_this()](const asio::error_code&) {
+                self->pump();
+            });
+        }
+        return;
+    }
+
+    uint64_t dropped = 0;
+    auto frames = queue().take(dropped);
+    if (dropped > 0) {
+        send(gapFrame(format(), dropped));
+    }
+    for (const auto& frame : frames) {
+        send(*frame);
+    }
+}
+
+void WebSocketSubscriber::send(const string& frame) {
+    if (format() == WireFormat::Json) {
+        conn->send_text(frame);
+    }
+    else {
+        conn->send_binary(frame);
+    }
+}
+
+bool WebSocketSubscriber::crowWriting() const {
+    using namespace crow_private;
+    return !(conn->*member(SendingBuffersTag{})).empty() || !(conn->*member(WriteBuffersTag{})).empty();
+}
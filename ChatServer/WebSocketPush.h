@@ -0,0 +1,48 @@
+﻿#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <asio.hpp>
+
+#include "ChatApp.h"
+#include "FanOut.h"
+
+// Подписчик рассылки поверх WebSocket-соединения Crow.
+//
+// Кадры ждут в OutboundQueue (общие буферы, без копий) и передаются Crow
+// только когда он дописал в сокет предыдущие: иначе у медленного клиента
+// неограниченно росли бы буферы Crow. Поэтому очередь подписчика - это
+// весь объем, который сервер держит для клиента, и при ее переполнении
+// срабатывает политика SlowConsumerPolicy.
+//
+// Crow принимает сообщение только как std::string, поэтому кадр копируется
+// один раз - в буфер записи сокета в момент отправки.
+//
+// Все обращения к соединению - в его потоке; после closed() (вызывается
+// из onclose) соединение может быть удалено и больше не используется
+class WebSocketSubscriber : public FanOut::Subscriber,
+    public std::enable_shared_from_this<WebSocketSubscriber> {
+public:
+    // Вызывается в потоке соединения (onopen)
+    WebSocketSubscriber(crow::websocket::connection& conn, WireFormat format, const OutboundQueue::Config& config);
+
+    void wake() override;
+    void overflow() override;
+
+    void closed();
+
+private:
+    // Пока Crow занят записью, очередь проверяется с этим интервалом
+    static constexpr std::chrono::milliseconds retryDelay{ 5 };
+
+    ChatWebSocket* conn;
+    asio::io_context& io;
+    asio::steady_timer retry;
+    std::atomic<bool> scheduled{ false };
+    bool open = true;               // только в потоке соединения
+
+    void pump();
+    void send(const std::string& frame);
+    bool crowWriting() const;
+};
@@ -0,0 +1,342 @@
+﻿#include "WireFormat.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+bool isMsgPackType(const string& value) {
+    return value.find("application/msgpack") != string::npos ||
+        value.find("application/x-msgpack") != string::npos ||
+        value.find("application/vnd.msgpack") != string::npos;
+}
+
+void encodeValue(msgpack::Writer& writer, const crow::json::rvalue& value) {
+    switch (value.t()) {
+    case crow::json::type::False:
+    case crow::json::type::True:
+        writer.boolean(value.b());
+        break;
+    case crow::json::type::Number:
+        if (value.nt() == crow::json::num_type::Signed_integer) {
+            writer.integer(value.i());
+        }
+        else if (value.nt() == crow::json::num_type::Unsigned_integer) {
+            writer.uinteger(value.u());
+        }
+        else {
+            writer.real(value.d());
+        }
+        break;
+    case crow::json::type::String: {
+        auto s = value.s();
+        writer.str(string_view(s.begin(), s.size()));
+        break;
+    }
+    case crow::json::type::List:
+        writer.array(value.size());
+        for (const auto& item : value) {
+            encodeValue(writer, item);
+        }
+        break;
+    case crow::json::type::Object:
+        writer.map(value.size());
+        for (const auto& item : value) {
+            const auto& key = item.key();
+            writer.str(string_view(key.begin(), key.size()));
+            encodeValue(writer, item);
+        }
+        break;
+    default:
+        writer.nil();
+        break;
+    }
+}
+
+// Начало ответа со списком: {"status": "success", "<name>": [ ... n элементов
+void beginList(msgpack::Writer& writer, const char* name, size_t size) {
+    writer.map(2);
+    writer.str("status");
+    writer.str("success");
+    writer.str(name);
+    writer.array(size);
+}
+
+}
+
+WireFormat responseFormat(const crow::request& req) {
+    return isMsgPackType(req.get_header_value("Accept")) ? WireFormat::MsgPack : WireFormat::Json;
+}
+
+bool isMsgPackBody(const crow::request& req) {
+    return isMsgPackType(req.get_header_value("Content-Type"));
+}
+
+const char* contentType(WireFormat format) {
+    return format == WireFormat::MsgPack ? "application/msgpack" : "application/json";
+}
+
+RequestBody::RequestBody(const crow::request& req) : binary(isMsgPackBody(req)) {
+    if (!binary) {
+        json = crow::json::load(req.body);
+        valid = static_cast<bool>(json) && json.t() == crow::json::type::Object;
+        return;
+    }
+
+    // Тело - один map, после него ничего нет
+    raw = req.body;
+    msgpack::Reader reader(raw);
+    valid = reader.peek() == msgpack::Type::Map && reader.skip() && reader.atEnd();
+}
+
+RequestBody::RequestBody(const crow::json::rvalue& object)
+    : json(object) {
+    valid = json.t() == crow::json::type::Object;
+}
+
+RequestBody::RequestBody(string_view msgpackMap)
+    : binary(true), raw(msgpackMap) {
+    msgpack::Reader reader(raw);
+    valid = reader.peek() == msgpack::Type::Map && reader.skip() && reader.atEnd();
+}
+
+bool RequestBody::has(const char* key) const {
+    if (!binary) {
+        return json.has(key);
+    }
+    msgpack::Reader value;
+    return find(key, value);
+}
+
+int64_t RequestBody::i(const char* key) const {
+    if (!binary) {
+        return json[key].i();
+    }
+    int64_t result = 0;
+    if (!require(key).integer(result)) {
+        throw runtime_error(string("value is not integer: ") + key);
+    }
+    return result;
+}
+
+bool RequestBody::b(const char* key) const {
+    if (!binary) {
+        return json[key].b();
+    }
+    bool result = false;
+    if (!require(key).boolean(result)) {
+        throw runtime_error(string("value is not boolean: ") + key);
+    }
+    return result;
+}
+
+string RequestBody::s(const char* key) const {
+    if (!binary) {
+        return json[key].s();
+    }
+    string_view result;
+    if (!require(key).str(result)) {
+        throw runtime_error(string("value is not string: ") + key);
+    }
+    return string(result);
+}
+
+vector<int> RequestBody::ints(const char* key) const {
+    vector<int> result;
+    if (!binary) {
+        if (json.has(key) && json[key].t() == crow::json::type::List) {
+            for (const auto& item : json[key]) {
+                result.push_back(static_cast<int>(item.i()));
+            }
+        }
+        return result;
+    }
+
+    msgpack::Reader value;
+    size_t size = 0;
+    if (!find(key, value) || !value.array(size)) {
+        return result;
+    }
+    result.reserve(size);
+    for (size_t n = 0; n < size; n++) {
+        int64_t item = 0;
+        if (!value.integer(item)) {
+            throw runtime_error(string("list item is not integer: ") + key);
+        }
+        result.push_back(static_cast<int>(item));
+    }
+    return result;
+}
+
+bool RequestBody::find(const char* key, msgpack::Reader& value) const {
+    msgpack::Reader reader(raw);
+    size_t size = 0;
+    if (!valid || !reader.map(size)) {
+        return false;
+    }
+
+    string_view wanted(key);
+    for (size_t n = 0; n < size; n++) {
+        string_view name;
+        if (!reader.str(name)) {
+            return false;
+        }
+        if (name == wanted) {
+            value = reader;
+            return true;
+        }
+        if (!reader.skip()) {
+            return false;
+        }
+    }
+    return false;
+}
+
+msgpack::Reader RequestBody::require(const char* key) const {
+    msgpack::Reader value;
+    if (!find(key, value)) {
+        throw runtime_error(string("cannot find key: ") + key);
+    }
+    return value;
+}
+
+crow::response reply(const crow::request& req, int code, crow::json::wvalue& value) {
+    return reply(responseFormat(req), code, value);
+}
+
+crow::response reply(WireFormat format, int code, crow::json::wvalue& value) {
+    if (format == WireFormat::Json) {
+        return crow::response(code, value);
+    }
+
+    // Небольшие ответы (статус, id, ошибки) переводятся из JSON;
+    // большие списки кодируются напрямую функциями wire::
+    auto parsed = crow::json::load(value.dump());
+    string body;
+    msgpack::Writer writer(body);
+    encodeValue(writer, parsed);
+    return msgpackResponse(code, move(body));
+}
+
+crow::response msgpackResponse(int code, string body) {
+    crow::response response(code);
+    response.body = move(body);
+    response.set_header("Content-Type", contentType(WireFormat::MsgPack));
+    return response;
+}
+
+namespace wire {
+
+void encodeMessages(string& out, const vector<Message>& messages, const vector<UserInfo>* users) {
+    size_t textBytes = 0;
+    for (const auto& msg : messages) {
+        textBytes += msg.msg.size() + msg.sendDate.size();
+    }
+    out.reserve(out.size() + 48 + messages.size() * 24 + textBytes);
+
+    msgpack::Writer writer(out);
+    writer.map(users ? 4 : 3);
+    writer.str("status");
+    writer.str("success");
+
+    // Сначала длина varint-последовательности для заголовка bin,
+    // затем сами разности - без промежуточного буфера
+    size_t idBytes = 0;
+    int64_t previous = 0;
+    for (const auto& msg : messages) {
+        idBytes += msgpack::varintSize(msgpack::zigzag(msg.id - previous));
+        previous = msg.id;
+    }
+    writer.str("ids");
+    writer.binHeader(idBytes);
+    previous = 0;
+    for (const auto& msg : messages) {
+        msgpack::writeVarint(out, msgpack::zigzag(msg.id - previous));
+        previous = msg.id;
+    }
+
+    writer.str("messages");
+    writer.array(messages.size());
+    for (const auto& msg : messages) {
+        writer.array(5);
+        writer.integer(msg.userId);
+        writer.str(msg.msg);
+        writer.integer(msg.replyId);
+        writer.str(msg.sendDate);
+        writer.integer(msg.resendId);
+    }
+
+    if (users) {
+        writer.str("users");
+        writer.array(users->size());
+        for (const auto& user : *users) {
+            writer.map(3);
+            writer.str("id");
+            writer.integer(user.id);
+            writer.str("name");
+            writer.str(user.name);
+            writer.str("login");
+            writer.str(user.login);
+        }
+    }
+}
+
+void encodeChats(string& out, const vector<Chat>& chats) {
+    msgpack::Writer writer(out);
+    beginList(writer, "chats", chats.size());
+    for (const auto& chat : chats) {
+        writer.map(5);
+        writer.str("id");
+        writer.integer(chat.id);
+        writer.str("name");
+        writer.str(chat.name);
+        writer.str("isGroup");
+        writer.boolean(chat.isGroup);
+        writer.str("createdBy");
+        writer.integer(chat.createdBy);
+        writer.str("createdAt");
+        writer.str(chat.createdAt);
+    }
+}
+
+void encodeContacts(string& out, const vector<pair<int, string>>& contacts) {
+    msgpack::Writer writer(out);
+    beginList(writer, "contacts", contacts.size());
+    for (const auto& contact : contacts) {
+        writer.map(2);
+        writer.str("userId");
+        writer.integer(contact.first);
+        writer.str("name");
+        writer.str(contact.second);
+    }
+}
+
+void encodeUsers(string& out, const vector<UserSearchResult>& users) {
+    msgpack::Writer writer(out);
+    beginList(writer, "users", users.size());
+    for (const auto& user : users) {
+        writer.map(3);
+        writer.str("id");
+        writer.integer(user.id);
+        writer.str("name");
+        writer.str(user.name);
+        writer.str("login");
+        writer.str(user.login);
+    }
+}
+
+void encodeUser(string& out, const UserInfo& user) {
+    msgpack::Writer writer(out);
+    writer.map(4);
+    writer.str("id");
+    writer.integer(user.id);
+    writer.str("name");
+    writer.str(user.name);
+    writer.str("login");
+    writer.str(user.login);
+    writer.str("status");
+    writer.str("success");
+}
+
+} // namespace wire
@@ -0,0 +1,87 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <crow.h>
+
+#include "Database.h"
+#include "MsgPack.h"
+
+// Формат тел запросов и ответов. JSON по умолчанию; MessagePack - если
+// клиент прислал Content-Type: application/msgpack (тело запроса)
+// или указал его в Accept (тело ответа).
+//
+// В MessagePack ответы - те же объекты, что и в JSON, кроме списков
+// сообщений: они передаются компактно (см. encodeMessages).
+// Ошибки сервера (500/503) и 429 всегда в JSON.
+enum class WireFormat { Json, MsgPack };
+
+WireFormat responseFormat(const crow::request& req);
+bool isMsgPackBody(const crow::request& req);
+const char* contentType(WireFormat format);
+
+// Тело запроса в любом из форматов. Чтение отсутствующего поля или поля
+// другого типа бросает runtime_error, как и у crow::json::rvalue.
+// Для MessagePack тело не копируется: поля ищутся прямо в req.body,
+// поэтому запрос должен жить дольше RequestBody
+class RequestBody {
+public:
+    explicit RequestBody(const crow::request& req);
+
+    // Вложенные объекты (операции POST /batch)
+    explicit RequestBody(const crow::json::rvalue& object);
+    explicit RequestBody(std::string_view msgpackMap);
+
+    explicit operator bool() const { return valid; }
+
+    bool has(const char* key) const;
+    int64_t i(const char* key) const;
+    bool b(const char* key) const;
+    std::string s(const char* key) const;
+    std::vector<int> ints(const char* key) const;   // пусто, если поля нет или это не список
+
+private:
+    bool binary = false;
+    bool valid = false;
+    crow::json::rvalue json;
+    std::string_view raw;
+
+    bool find(const char* key, msgpack::Reader& value) const;
+    msgpack::Reader require(const char* key) const;
+};
+
+// Ответ в формате, который просил клиент
+crow::response reply(const crow::request& req, int code, crow::json::wvalue& value);
+crow::response reply(WireFormat format, int code, crow::json::wvalue& value);
+
+// Готовое тело MessagePack
+crow::response msgpackResponse(int code, std::string body);
+
+// Кодировщики ответов со списками. Пишут сразу в out без промежуточных объектов
+namespace wire {
+
+// {"status", "ids": bin, "messages": [[userId, message, replyId, sendDate, resendId], ...]}
+// ids - id сообщений в том же порядке: разности с предыдущим id (первый -
+// с нулем) в zigzag-кодировке, каждая как varint LEB128. Сообщения идут по
+// возрастанию времени, поэтому разности обычно занимают один байт.
+// С users в ответ добавляется "users": [{"id", "name", "login"}, ...] -
+// авторы сообщений страницы, каждый один раз
+void encodeMessages(std::string& out, const std::vector<Message>& messages,
+    const std::vector<UserInfo>* users = nullptr);
+
+// {"status", "chats": [{"id", "name", "isGroup", "createdBy", "createdAt"}, ...]}
+void encodeChats(std::string& out, const std::vector<Chat>& chats);
+
+// {"status", "contacts": [{"userId", "name"}, ...]}
+void encodeContacts(std::string& out, const std::vector<std::pair<int, std::string>>& contacts);
+
+// {"status", "users": [{"id", "name", "login"}, ...]}
+void encodeUsers(std::string& out, const std::vector<UserSearchResult>& users);
+
+// {"id", "name", "login", "status"}
+void encodeUser(std::string& out, const UserInfo& user);
+
+} // namespace wire
@@ -0,0 +1,265 @@
+﻿// Микробенчмарки класса Database.
+//
+// Размеры наборов данных задаются переменными окружения:
+//   CHATSERVER_BENCH_USERS             - список размеров через запятую (по умолчанию "1000,10000")
+//   CHATSERVER_BENCH_MESSAGES_PER_CHAT - сообщений в каждом чате (по умолчанию 50)
+//   CHATSERVER_BENCH_DIR               - каталог для файлов базы (по умолчанию временный)
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Database.h"
+
+using namespace std;
+
+namespace {
+
+int envInt(const char* name, int defaultValue) {
+    const char* value = getenv(name);
+    return value ? atoi(value) : defaultValue;
+}
+
+vector<int> datasetSizes() {
+    const char* value = getenv("CHATSERVER_BENCH_USERS");
+    string list = value ? value : "1000,10000";
+
+    vector<int> sizes;
+    stringstream ss(list);
+    string item;
+    while (getline(ss, item, ',')) {
+        if (!item.empty()) {
+            sizes.push_back(stoi(item));
+        }
+    }
+    return sizes;
+}
+
+// Сгенерированная база заданного размера
+struct Dataset {
+    unique_ptr<Database> db;
+    filesystem::path path;
+    int users = 0;
+    vector<int> chatIds;
+    vector<vector<int>> chatMembers;
+};
+
+unique_ptr<Dataset> buildDataset(int users) {
+    filesystem::path dir = getenv("CHATSERVER_BENCH_DIR")
+        ? filesystem::path(getenv("CHATSERVER_BENCH_DIR"))
+        : filesystem::temp_directory_path();
+    filesystem::path path = dir / ("chatserver_bench_" + to_string(users) + ".db");
+    filesystem::remove(path);
+
+    auto data = make_unique<Dataset>();
+    data->db = make_unique<Database>(path.string());
+    data->path = path;
+    data->users = users;
+
+    Database& db = *data->db;
+    mt19937 rng(42);
+
+    db.beginTransaction();
+
+    for (int i = 1; i <= users; i++) {
+        db.registerUser("User " + to_string(i), "user" + to_string(i), "password" + to_string(i));
+    }
+
+    // Чаты по 2-8 участников, по одному на пять пользователей
+    uniform_int_distribution<int> userDist(1, users);
+    uniform_int_distribution<int> sizeDist(1, 7);
+    int chats = max(1, users / 5);
+    for (int c = 0; c < chats; c++) {
+        int creator = userDist(rng);
+        vector<int> participants;
+        int count = sizeDist(rng);
+        for (int i = 0; i < count; i++) {
+            participants.push_back(userDist(rng));
+        }
+
+        int chatId = db.createChat("Chat " + to_string(c), count > 1, creator, participants);
+        participants.push_back(creator);
+        data->chatIds.push_back(chatId);
+        data->chatMembers.push_back(participants);
+    }
+
+    // Примерно пять контактов на пользователя
+    for (int i = 1; i <= users; i++) {
+        for (int k = 0; k < 5; k++) {
+            db.addContact(i, userDist(rng));
+        }
+    }
+
+    int messagesPerChat = envInt("CHATSERVER_BENCH_MESSAGES_PER_CHAT", 50);
+    for (size_t c = 0; c < data->chatIds.size(); c++) {
+        const auto& members = data->chatMembers[c];
+        for (int m = 0; m < messagesPerChat; m++) {
+            int sender = members[rng() % members.size()];
+            db.sendMessage(sender, data->chatIds[c], "Message " + to_string(m) + " in chat " + to_string(c));
+        }
+    }
+
+    db.commitTransaction();
+    return data;
+}
+
+// Наборы данных строятся один раз и переиспользуются всеми бенчмарками
+Dataset& dataset(int users) {
+    static map<int, unique_ptr<Dataset>> cache;
+    auto& entry = cache[users];
+    if (!entry) {
+        entry = buildDataset(users);
+    }
+    return *entry;
+}
+
+// Копия набора для бенчмарков записи: общий набор не растет, и чтения
+// не зависят от порядка запуска и числа итераций. Файл копируется вместе
+// с WAL, пока в исходную базу никто не пишет; -shm SQLite восстановит сам
+unique_ptr<Database> writableCopy(const Dataset& data) {
+    filesystem::path copy = data.path;
+    copy.replace_filename(data.path.stem().string() + "_write.db");
+    filesystem::remove(copy.string() + "-shm");
+    for (const char* suffix : { "", "-wal" }) {
+        filesystem::path from = data.path.string() + suffix;
+        filesystem::path to = copy.string() + suffix;
+        filesystem::remove(to);
+        if (filesystem::exists(from)) {
+            filesystem::copy_file(from, to);
+        }
+    }
+    return make_unique<Database>(copy.string());
+}
+
+void BM_RegisterUser(benchmark::State& state) {
+    Dataset& data = dataset(static_cast<int>(state.range(0)));
+    auto db = writableCopy(data);
+    static int counter = 0;
+    for (auto _ : state) {
+        string login = "bench_user_" + to_string(++counter);
+        benchmark::DoNotOptimize(db->registerUser("Bench User", login, "secret"));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_LoginUser(benchmark::State& state) {
+    Dataset& data = dataset(static_cast<int>(state.range(0)));
+    mt19937 rng(1);
+    uniform_int_distribution<int> userDist(1, data.users);
+    User user;
+    for (auto _ : state) {
+        int i = userDist(rng);
+        benchmark::DoNotOptimize(data.db->loginUser("user" + to_string(i), "password" + to_string(i), user));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_SendMessage(benchmark::State& state) {
+    Dataset& data = dataset(static_cast<int>(state.range(0)));
+    auto db = writableCopy(data);
+    mt19937 rng(2);
+    for (auto _ : state) {
+        size_t c = rng() % data.chatIds.size();
+        const auto& members = data.chatMembers[c];
+        int sender = members[rng() % members.size()];
+        benchmark::DoNotOptimize(db->sendMessage(sender, data.chatIds[c], "Benchmark message"));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Те же сообщения пакетами по 1000 (POST /chats/<id>/messages:bulk)
+void BM_InsertMessages(benchmark::State& state) {
+    Dataset& data = dataset(static_cast<int>(state.range(0)));
+    auto db = writableCopy(data);
+    mt19937 rng(7);
+    vector<NewMessage> messages(1000);
+    for (auto _ : state) {
+        size_t c = rng() % data.chatIds.size();
+        const auto& members = data.chatMembers[c];
+        for (auto& msg : messages) {
+            msg.userId = members[rng() % members.size()];
+            msg.msg = "Benchmark message";
+        }
+        int firstId = 0;
+        int lastId = 0;
+        benchmark::DoNotOptimize(db->insertMessages(data.chatIds[c], messages, firstId, lastId));
+    }
+    state.SetItemsProcessed(state.iterations() * messages.size());
+}
+
+void BM_GetChatMessages(benchmark::State& state) {
+    Dataset& data = dataset(static_cast<int>(state.range(0)));
+    mt19937 rng(3);
+    int64_t rows = 0;
+    for (auto _ : state) {
+        auto messages = data.db->getChatMessages(data.chatIds[rng() % data.chatIds.size()]);
+        rows += messages.size();
+        benchmark::DoNotOptimize(messages);
+    }
+    state.SetItemsProcessed(rows);
+}
+
+void BM_GetUserChats(benchmark::State& state) {
+    Dataset& data = dataset(static_cast<int>(state.range(0)));
+    mt19937 rng(4);
+    uniform_int_distribution<int> userDist(1, data.users);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(data.db->getUserChats(userDist(rng)));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_GetUserContacts(benchmark::State& state) {
+    Dataset& data = dataset(static_cast<int>(state.range(0)));
+    mt19937 rng(5);
+    uniform_int_distribution<int> userDist(1, data.users);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(data.db->getUserContacts(userDist(rng)));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_SearchUsers(benchmark::State& state) {
+    Dataset& data = dataset(static_cast<int>(state.range(0)));
+    mt19937 rng(6);
+    uniform_int_distribution<int> userDist(1, data.users);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(data.db->searchUsers("user" + to_string(userDist(rng))));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const pair<const char*, void (*)(benchmark::State&)> benchmarks[] = {
+        {"registerUser", BM_RegisterUser},
+        {"loginUser", BM_LoginUser},
+        {"sendMessage", BM_SendMessage},
+        {"insertMessages", BM_InsertMessages},
+        {"getChatMessages", BM_GetChatMessages},
+        {"getUserChats", BM_GetUserChats},
+        {"getUserContacts", BM_GetUserContacts},
+        {"searchUsers", BM_SearchUsers},
+    };
+
+    for (int users : datasetSizes()) {
+        for (const auto& [name, fn] : benchmarks) {
+            benchmark::RegisterBenchmark(name, fn)->Arg(users)->ArgName("users");
+        }
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
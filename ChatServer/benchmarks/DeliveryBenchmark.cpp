@@ -0,0 +1,152 @@
+﻿// Стоимость стратегий доставки в ленту обновлений (см. Delivery.h).
+//
+// Push платит при записи: pushFanOut растет с числом участников.
+// Pull платит при чтении: каждый участник дочитывает чат отдельным
+// запросом (readPull) вместо общего запроса по id из входящих (readInbox).
+// Точка перехода pushMaxMembers - число участников, при котором
+// pushFanOut на одно сообщение сравнивается с разницей readPull и
+// readInbox, умноженной на число участников, читающих чат между сообщениями.
+//
+//   CHATSERVER_BENCH_DIR - каталог для файла базы (по умолчанию временный)
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Database.h"
+#include "Delivery.h"
+#include "Membership.h"
+
+using namespace std;
+
+namespace {
+
+constexpr int messagesInChat = 10000;
+
+vector<int> members(int count) {
+    vector<int> result;
+    for (int i = 1; i <= count; i++) {
+        result.push_back(i);
+    }
+    return result;
+}
+
+// Один большой чат для чтений из базы
+struct Dataset {
+    unique_ptr<Database> db;
+    int chatId = 0;
+    int firstId = 0;
+    int lastId = 0;
+};
+
+Dataset& dataset() {
+    static unique_ptr<Dataset> data;
+    if (data) {
+        return *data;
+    }
+
+    filesystem::path dir = getenv("CHATSERVER_BENCH_DIR")
+        ? filesystem::path(getenv("CHATSERVER_BENCH_DIR"))
+        : filesystem::temp_directory_path();
+    filesystem::path path = dir / "chatserver_delivery_bench.db";
+    filesystem::remove(path);
+
+    data = make_unique<Dataset>();
+    data->db = make_unique<Database>(path.string());
+    Database& db = *data->db;
+
+    db.beginTransaction();
+    for (int i = 1; i <= 100; i++) {
+        db.registerUser("User " + to_string(i), "user" + to_string(i), "password");
+    }
+    data->chatId = db.createChat("Big group", true, 1, members(100));
+    // Сообщения другого чата вперемешку, как в живой базе
+    int otherChat = db.createChat("Other", true, 2, members(10));
+    for (int m = 0; m < messagesInChat; m++) {
+        int id = db.sendMessage(1 + m % 100, data->chatId, "Message " + to_string(m));
+        db.sendMessage(1 + m % 10, otherChat, "Other " + to_string(m));
+        if (m == 0) {
+            data->firstId = id;
+        }
+        data->lastId = id;
+    }
+    db.commitTransaction();
+    return *data;
+}
+
+void BM_PushFanOut(benchmark::State& state) {
+    Delivery::Config config;
+    config.pushMaxMembers = numeric_limits<size_t>::max();
+    config.pushMaxRate = numeric_limits<double>::max();
+    Membership membership({});
+    Delivery delivery(config, membership);
+    int count = static_cast<int>(state.range(0));
+    membership.addChat(1, members(count));
+    delivery.addChat(1, true);
+
+    int messageId = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(delivery.onMessage(1, ++messageId));
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+
+void BM_PullOnMessage(benchmark::State& state) {
+    Delivery::Config config;
+    config.pushMaxMembers = 0;
+    Membership membership({});
+    Delivery delivery(config, membership);
+    membership.addChat(1, members(static_cast<int>(state.range(0))));
+    delivery.addChat(1, true);
+
+    int messageId = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(delivery.onMessage(1, ++messageId));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Чтение ленты при Push: новые сообщения по id из входящих
+void BM_ReadInbox(benchmark::State& state) {
+    Dataset& data = dataset();
+    int batch = static_cast<int>(state.range(0));
+    mt19937 rng(1);
+    uniform_int_distribution<int> startDist(data.firstId, data.lastId - 2 * batch);
+
+    for (auto _ : state) {
+        vector<int> ids;
+        int start = startDist(rng);
+        for (int i = 0; i < batch; i++) {
+            ids.push_back(start + 2 * i);
+        }
+        benchmark::DoNotOptimize(data.db->getMessagesByIds(ids));
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+
+// Чтение ленты при Pull: дочитывание чата от курсора
+void BM_ReadPull(benchmark::State& state) {
+    Dataset& data = dataset();
+    int batch = static_cast<int>(state.range(0));
+    mt19937 rng(2);
+    uniform_int_distribution<int> startDist(data.firstId, data.lastId - 2 * batch);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(data.db->getChatMessagesAfter(data.chatId, startDist(rng), batch));
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+
+} // namespace
+
+BENCHMARK(BM_PushFanOut)->ArgName("members")->RangeMultiplier(10)->Range(10, 100000);
+BENCHMARK(BM_PullOnMessage)->ArgName("members")->RangeMultiplier(10)->Range(10, 100000);
+BENCHMARK(BM_ReadInbox)->ArgName("messages")->Arg(1)->Arg(20)->Arg(200);
+BENCHMARK(BM_ReadPull)->ArgName("messages")->Arg(1)->Arg(20)->Arg(200);
+
+BENCHMARK_MAIN();
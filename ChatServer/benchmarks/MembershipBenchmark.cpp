@@ -0,0 +1,177 @@
+﻿// Пересечение участников чатов (см. Membership.h): битовые карты против
+// отсортированных списков id, как они хранились раньше.
+//
+// intersect - "участники в сети": чат из N пользователей и множество
+// пользователей в сети (каждый десятый из 1 млн). Dense - id подряд, блоки
+// карт становятся битовыми картами и пересекаются по словам; Sparse - id
+// разбросаны, блоки остаются массивами. Simd/Scalar - с AVX2 и без.
+//
+// mutual - общие контакты (см. SocialGraph.h): пересечение двух
+// отсортированных массивов соседей одинакового размера, пересекающихся
+// примерно на четверть.
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <vector>
+
+#include "RoaringBitmap.h"
+#include "Simd.h"
+
+using namespace std;
+
+namespace {
+
+constexpr int totalUsers = 1000000;
+
+vector<int> denseIds(int count) {
+    vector<int> ids(static_cast<size_t>(count));
+    for (int i = 0; i < count; i++) {
+        ids[static_cast<size_t>(i)] = i + 1;
+    }
+    return ids;
+}
+
+vector<int> sparseIds(int count, unsigned seed) {
+    mt19937 rng(seed);
+    uniform_int_distribution<int> dist(1, totalUsers);
+    vector<int> ids(static_cast<size_t>(count));
+    for (auto& id : ids) {
+        id = dist(rng);
+    }
+    sort(ids.begin(), ids.end());
+    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+    return ids;
+}
+
+vector<int> onlineIds() {
+    vector<int> ids;
+    for (int id = 1; id <= totalUsers; id += 10) {
+        ids.push_back(id);
+    }
+    return ids;
+}
+
+RoaringBitmap bitmap(const vector<int>& ids) {
+    RoaringBitmap result;
+    for (int id : ids) {
+        result.add(static_cast<uint32_t>(id));
+    }
+    return result;
+}
+
+void runBitmap(benchmark::State& state, const vector<int>& members, bool simd) {
+    simd::enable(simd);
+    if (simd && !simd::supported()) {
+        state.SkipWithError("AVX2 is not supported");
+        return;
+    }
+    auto a = bitmap(members);
+    auto b = bitmap(onlineIds());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(RoaringBitmap::intersect(a, b));
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(members.size()));
+    simd::enable(true);
+}
+
+void runCardinality(benchmark::State& state, const vector<int>& members, bool simd) {
+    simd::enable(simd);
+    if (simd && !simd::supported()) {
+        state.SkipWithError("AVX2 is not supported");
+        return;
+    }
+    auto a = bitmap(members);
+    auto b = bitmap(onlineIds());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(RoaringBitmap::intersectCardinality(a, b));
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(members.size()));
+    simd::enable(true);
+}
+
+void runVector(benchmark::State& state, const vector<int>& members) {
+    auto online = onlineIds();
+    for (auto _ : state) {
+        vector<int> result;
+        set_intersection(members.begin(), members.end(), online.begin(), online.end(), back_inserter(result));
+        benchmark::DoNotOptimize(result);
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(members.size()));
+}
+
+void BM_IntersectDenseSimd(benchmark::State& state) {
+    runBitmap(state, denseIds(static_cast<int>(state.range(0))), true);
+}
+
+void BM_IntersectDenseScalar(benchmark::State& state) {
+    runBitmap(state, denseIds(static_cast<int>(state.range(0))), false);
+}
+
+void BM_IntersectDenseVector(benchmark::State& state) {
+    runVector(state, denseIds(static_cast<int>(state.range(0))));
+}
+
+void BM_IntersectSparseBitmap(benchmark::State& state) {
+    runBitmap(state, sparseIds(static_cast<int>(state.range(0)), 1), true);
+}
+
+void BM_IntersectSparseVector(benchmark::State& state) {
+    runVector(state, sparseIds(static_cast<int>(state.range(0)), 1));
+}
+
+void BM_CardinalityDenseSimd(benchmark::State& state) {
+    runCardinality(state, denseIds(static_cast<int>(state.range(0))), true);
+}
+
+void BM_CardinalityDenseScalar(benchmark::State& state) {
+    runCardinality(state, denseIds(static_cast<int>(state.range(0))), false);
+}
+
+void runMutual(benchmark::State& state, bool simdOn) {
+    simd::enable(simdOn);
+    if (simdOn && !simd::supported()) {
+        state.SkipWithError("AVX2 is not supported");
+        return;
+    }
+    int count = static_cast<int>(state.range(0));
+    auto a = sparseIds(count, 2);
+    auto b = sparseIds(count, 3);
+    // Четверть b - те же id, что в a
+    for (size_t i = 0; i < b.size() && i < a.size(); i += 4) {
+        b[i] = a[i];
+    }
+    sort(b.begin(), b.end());
+    b.erase(unique(b.begin(), b.end()), b.end());
+
+    vector<int> out(min(a.size(), b.size()));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(simd::intersectSorted(a.data(), a.size(), b.data(), b.size(), out.data()));
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(a.size() + b.size()));
+    simd::enable(true);
+}
+
+void BM_MutualSimd(benchmark::State& state) {
+    runMutual(state, true);
+}
+
+void BM_MutualScalar(benchmark::State& state) {
+    runMutual(state, false);
+}
+
+} // namespace
+
+BENCHMARK(BM_IntersectDenseSimd)->ArgName("members")->RangeMultiplier(10)->Range(1000, 1000000);
+BENCHMARK(BM_IntersectDenseScalar)->ArgName("members")->RangeMultiplier(10)->Range(1000, 1000000);
+BENCHMARK(BM_IntersectDenseVector)->ArgName("members")->RangeMultiplier(10)->Range(1000, 1000000);
+BENCHMARK(BM_IntersectSparseBitmap)->ArgName("members")->RangeMultiplier(10)->Range(1000, 100000);
+BENCHMARK(BM_IntersectSparseVector)->ArgName("members")->RangeMultiplier(10)->Range(1000, 100000);
+BENCHMARK(BM_CardinalityDenseSimd)->ArgName("members")->RangeMultiplier(10)->Range(1000, 1000000);
+BENCHMARK(BM_CardinalityDenseScalar)->ArgName("members")->RangeMultiplier(10)->Range(1000, 1000000);
+
+BENCHMARK(BM_MutualSimd)->ArgName("contacts")->RangeMultiplier(10)->Range(100, 100000);
+BENCHMARK(BM_MutualScalar)->ArgName("contacts")->RangeMultiplier(10)->Range(100, 100000);
+
+BENCHMARK_MAIN();
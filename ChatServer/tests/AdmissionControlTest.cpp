@@ -0,0 +1,128 @@
+﻿// Контроль допуска: слоты по лимиту, ограниченная очередь, передача
+// освободившегося слота первому в очереди и отказ по сроку ожидания.
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <exception>
+#include <optional>
+
+#include "AdmissionControl.h"
+
+using namespace std;
+
+namespace {
+
+using RouteClass = AdmissionControl::RouteClass;
+
+// Лимит зафиксирован на 1, в очереди - не больше одного запроса
+AdmissionControl::Config singleSlot(chrono::milliseconds queueTimeout) {
+    AdmissionControl::Config config;
+    config.initialLimit = 1;
+    config.minLimit = 1;
+    config.maxLimit = 1;
+    config.maxQueue = 1;
+    config.queueTimeout = queueTimeout;
+    return config;
+}
+
+// Итог одного admit(): слот (пока не отпущен) или отказ
+struct Attempt {
+    optional<AdmissionControl::Permit> permit;
+    bool admitted = false;
+    bool overloaded = false;
+};
+
+asio::awaitable<void> admit(AdmissionControl& admission, RouteClass routeClass, Attempt& attempt) {
+    try {
+        attempt.permit = co_await admission.admit(routeClass);
+        attempt.admitted = true;
+    }
+    catch (const OverloadError&) {
+        attempt.overloaded = true;
+    }
+}
+
+void start(asio::io_context& io, AdmissionControl& admission, RouteClass routeClass, Attempt& attempt) {
+    asio::co_spawn(io, admit(admission, routeClass, attempt), asio::detached);
+}
+
+AdmissionControl::ClassStats readStats(const AdmissionControl& admission) {
+    return admission.stats()[static_cast<size_t>(RouteClass::Read)];
+}
+
+}
+
+TEST(AdmissionControlTest, QueueAndHandOff) {
+    auto config = singleSlot(chrono::seconds(10));
+    AdmissionControl admission(config, config, config);
+    asio::io_context io;
+
+    Attempt first, second, third;
+    start(io, admission, RouteClass::Read, first);
+    io.poll();
+    ASSERT_TRUE(first.admitted);
+
+    // Второй ждет в очереди, для третьего места в очереди нет
+    start(io, admission, RouteClass::Read, second);
+    start(io, admission, RouteClass::Read, third);
+    io.restart();
+    io.poll();
+    EXPECT_FALSE(second.admitted);
+    EXPECT_FALSE(second.overloaded);
+    EXPECT_TRUE(third.overloaded);
+
+    auto stats = readStats(admission);
+    EXPECT_EQ(stats.inFlight, 1u);
+    EXPECT_EQ(stats.queued, 1u);
+    EXPECT_EQ(stats.rejected, 1u);
+
+    // Классы маршрутов независимы
+    Attempt write;
+    start(io, admission, RouteClass::Write, write);
+    io.restart();
+    io.poll();
+    EXPECT_TRUE(write.admitted);
+
+    // Освободившийся слот сразу передается ожидающему
+    first.permit.reset();
+    io.restart();
+    io.poll();
+    EXPECT_TRUE(second.admitted);
+    stats = readStats(admission);
+    EXPECT_EQ(stats.inFlight, 1u);
+    EXPECT_EQ(stats.queued, 0u);
+    EXPECT_EQ(stats.admitted, 2u);
+
+    second.permit.reset();
+    write.permit.reset();
+    EXPECT_EQ(readStats(admission).inFlight, 0u);
+}
+
+TEST(AdmissionControlTest, QueueTimeout) {
+    auto config = singleSlot(chrono::milliseconds(20));
+    AdmissionControl admission(config, config, config);
+    asio::io_context io;
+
+    Attempt first, second;
+    start(io, admission, RouteClass::Read, first);
+    start(io, admission, RouteClass::Read, second);
+    auto started = chrono::steady_clock::now();
+    io.run();
+
+    EXPECT_TRUE(first.admitted);
+    EXPECT_TRUE(second.overloaded);
+    EXPECT_GE(chrono::steady_clock::now() - started, chrono::milliseconds(20));
+    auto stats = readStats(admission);
+    EXPECT_EQ(stats.timedOut, 1u);
+    EXPECT_EQ(stats.queued, 0u);
+}
+
+TEST(AdmissionControlTest, LimitIsClamped) {
+    AdmissionControl::Config config;
+    config.initialLimit = 1000;
+    config.maxLimit = 8;
+    AdmissionControl admission(config, config, config);
+    for (const auto& stats : admission.stats()) {
+        EXPECT_EQ(stats.limit, 8);
+    }
+}
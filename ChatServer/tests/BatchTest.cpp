@@ -0,0 +1,228 @@
+﻿// POST /batch: разбор пакета в JSON и MessagePack и выполнение записей
+// в одной транзакции, в том числе откат атомарного пакета.
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "Batch.h"
+#include "Database.h"
+#include "MsgPack.h"
+
+using namespace std;
+
+namespace {
+
+crow::request jsonRequest(const string& body) {
+    crow::request req;
+    req.body = body;
+    req.headers.emplace("Content-Type", "application/json");
+    return req;
+}
+
+BatchRequest parseJson(const string& body) {
+    BatchRequest batch;
+    string error;
+    EXPECT_TRUE(parseBatch(jsonRequest(body), batch, error)) << error;
+    return batch;
+}
+
+vector<int> statuses(const vector<BatchWriteResult>& results) {
+    vector<int> result;
+    for (const auto& r : results) {
+        result.push_back(r.status);
+    }
+    return result;
+}
+
+// Два пользователя в одном чате и сообщение первого
+class BatchWriteTest : public testing::Test {
+protected:
+    void SetUp() override {
+        alice = db.registerUser("Alice", "alice", "secret");
+        bob = db.registerUser("Bob", "bob", "secret");
+        chatId = db.createChat("chat", false, alice, { bob });
+        messageId = db.sendMessage(alice, chatId, "hello");
+        ASSERT_GT(messageId, 0);
+    }
+
+    string send(const string& text) const {
+        return R"({"method": "POST", "path": "/messages", "body": {"userId": )" + to_string(alice) +
+            R"(, "chatId": )" + to_string(chatId) + R"(, "message": ")" + text + R"("}})";
+    }
+
+    vector<BatchWriteResult> execute(const string& body) {
+        auto batch = parseJson(body);
+        return executeBatchWrites(db, batch.ops, batch.atomic);
+    }
+
+    size_t messageCount() {
+        return db.getChatMessages(chatId).size();
+    }
+
+    Database db{ ":memory:" };
+    int alice = 0;
+    int bob = 0;
+    int chatId = 0;
+    int messageId = 0;
+};
+
+}
+
+TEST(BatchParseTest, JsonOperations) {
+    auto batch = parseJson(R"({"atomic": true, "ops": [
+        {"method": "GET", "path": "/chats/12"},
+        {"method": "GET", "path": "/users/search/bob?limit=5"},
+        {"method": "POST", "path": "/messages", "body": {"userId": 1, "chatId": 2, "message": "hi", "replyId": 3}},
+        {"method": "PUT", "path": "/messages/7", "body": {"userId": 1, "message": "edited"}},
+        {"method": "DELETE", "path": "/messages/8", "body": {"userId": 1}},
+        {"method": "GET", "path": "/metrics/cache"},
+        {"method": "POST", "path": "/messages"}
+    ]})");
+    EXPECT_TRUE(batch.atomic);
+    ASSERT_EQ(batch.ops.size(), 7u);
+
+    EXPECT_EQ(batch.ops[0].type, BatchOpType::GetChats);
+    EXPECT_EQ(batch.ops[0].id, 12);
+    EXPECT_EQ(batch.ops[1].type, BatchOpType::SearchUsers);
+    EXPECT_EQ(batch.ops[1].text, "bob");
+
+    const auto& send = batch.ops[2];
+    EXPECT_EQ(send.type, BatchOpType::SendMessage);
+    EXPECT_EQ(send.userId, 1);
+    EXPECT_EQ(send.chatId, 2);
+    EXPECT_EQ(send.text, "hi");
+    EXPECT_EQ(send.replyId, 3);
+    EXPECT_EQ(send.resendId, 0);
+
+    EXPECT_EQ(batch.ops[3].type, BatchOpType::EditMessage);
+    EXPECT_EQ(batch.ops[3].id, 7);
+    EXPECT_EQ(batch.ops[3].text, "edited");
+    EXPECT_EQ(batch.ops[4].type, BatchOpType::DeleteMessage);
+    EXPECT_EQ(batch.ops[4].id, 8);
+
+    // Ошибки отдельных операций не отменяют разбор пакета
+    EXPECT_EQ(batch.ops[5].errorStatus, 404);
+    EXPECT_EQ(batch.ops[6].errorStatus, 400);
+    EXPECT_TRUE(batch.hasWrites());
+}
+
+TEST(BatchParseTest, InvalidJson) {
+    BatchRequest batch;
+    string error;
+    EXPECT_FALSE(parseBatch(jsonRequest("{"), batch, error));
+    EXPECT_FALSE(parseBatch(jsonRequest(R"({"ops": {}})"), batch, error));
+    EXPECT_FALSE(parseBatch(jsonRequest("[]"), batch, error));
+
+    string ops;
+    for (size_t i = 0; i <= maxBatchOps; i++) {
+        ops += string(i ? "," : "") + R"({"method": "GET", "path": "/chats/1"})";
+    }
+    EXPECT_FALSE(parseBatch(jsonRequest(R"({"ops": [)" + ops + "]}"), batch, error));
+    EXPECT_NE(error.find("Too many operations"), string::npos);
+}
+
+TEST(BatchParseTest, MsgPack) {
+    string body;
+    msgpack::Writer writer(body);
+    writer.map(3);
+    writer.str("ops");
+    writer.array(2);
+    writer.map(2);
+    writer.str("method");
+    writer.str("GET");
+    writer.str("path");
+    writer.str("/contacts/4");
+    writer.map(3);
+    writer.str("path");
+    writer.str("/messages/forward");
+    writer.str("method");
+    writer.str("POST");
+    writer.str("body");
+    writer.map(3);
+    writer.str("originalMessageId");
+    writer.integer(10);
+    writer.str("targetChatId");
+    writer.integer(20);
+    writer.str("userId");
+    writer.integer(30);
+    writer.str("unknown");
+    writer.array(0);
+    writer.str("atomic");
+    writer.boolean(true);
+
+    crow::request req;
+    req.headers.emplace("Content-Type", "application/msgpack");
+    req.body = body;
+    BatchRequest batch;
+    string error;
+    ASSERT_TRUE(parseBatch(req, batch, error)) << error;
+    EXPECT_TRUE(batch.atomic);
+    ASSERT_EQ(batch.ops.size(), 2u);
+    EXPECT_EQ(batch.ops[0].type, BatchOpType::GetContacts);
+    EXPECT_EQ(batch.ops[0].id, 4);
+    EXPECT_EQ(batch.ops[1].type, BatchOpType::ForwardMessage);
+    EXPECT_EQ(batch.ops[1].id, 10);
+    EXPECT_EQ(batch.ops[1].chatId, 20);
+    EXPECT_EQ(batch.ops[1].userId, 30);
+
+    // Лишние байты после пакета и обрезанный пакет
+    BatchRequest rejected;
+    req.body = body + '\xc0';
+    EXPECT_FALSE(parseBatch(req, rejected, error));
+    req.body = body.substr(0, body.size() - 1);
+    EXPECT_FALSE(parseBatch(req, rejected, error));
+}
+
+TEST_F(BatchWriteTest, NonAtomicCommitsSuccessfulWrites) {
+    auto results = execute(R"({"ops": [)" + send("one") + R"(,
+        {"method": "PUT", "path": "/messages/99999", "body": {"userId": 1, "message": "x"}}]})");
+    EXPECT_EQ(statuses(results), (vector<int>{ 200, 404 }));
+    EXPECT_TRUE(results[0].hasId);
+    EXPECT_EQ(results[0].changedChatId, chatId);
+    EXPECT_EQ(messageCount(), 2u);
+}
+
+// Правка несуществующего сообщения ничего не меняет в базе, но должна
+// откатить атомарный пакет
+TEST_F(BatchWriteTest, AtomicRollsBackOnMissingMessage) {
+    auto results = execute(R"({"atomic": true, "ops": [)" + send("one") + R"(,
+        {"method": "PUT", "path": "/messages/99999", "body": {"userId": 1, "message": "x"}}]})");
+    EXPECT_EQ(statuses(results), (vector<int>{ 409, 404 }));
+    EXPECT_EQ(messageCount(), 1u);
+}
+
+TEST_F(BatchWriteTest, AtomicRollsBackOnForeignMessage) {
+    auto results = execute(R"({"atomic": true, "ops": [)" + send("one") +
+        R"(, {"method": "DELETE", "path": "/messages/)" + to_string(messageId) +
+        R"(", "body": {"userId": )" + to_string(bob) + "}}]}");
+    EXPECT_EQ(statuses(results), (vector<int>{ 409, 403 }));
+    EXPECT_EQ(messageCount(), 1u);
+
+    int authorId = 0;
+    string text;
+    EXPECT_TRUE(db.getMessageInfo(messageId, authorId, text));
+    EXPECT_EQ(text, "hello");
+}
+
+TEST_F(BatchWriteTest, AtomicCommitsWhenAllSucceed) {
+    auto results = execute(R"({"atomic": true, "ops": [)" + send("one") +
+        R"(, {"method": "PUT", "path": "/messages/)" + to_string(messageId) +
+        R"(", "body": {"userId": )" + to_string(alice) + R"(, "message": "edited"}}]})");
+    EXPECT_EQ(statuses(results), (vector<int>{ 200, 200 }));
+    EXPECT_EQ(results[1].changedChatId, chatId);
+    EXPECT_EQ(messageCount(), 2u);
+
+    int authorId = 0;
+    string text;
+    EXPECT_TRUE(db.getMessageInfo(messageId, authorId, text));
+    EXPECT_EQ(text, "edited");
+}
+
+// Операция, которую не удалось разобрать, тоже откатывает атомарный пакет
+TEST_F(BatchWriteTest, AtomicRollsBackOnInvalidOperation) {
+    auto results = execute(R"({"atomic": true, "ops": [)" + send("one") +
+        R"(, {"method": "POST", "path": "/chats"}]})");
+    EXPECT_EQ(statuses(results), (vector<int>{ 409, 400 }));
+    EXPECT_EQ(messageCount(), 1u);
+}
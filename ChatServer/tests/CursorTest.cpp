@@ -0,0 +1,69 @@
+﻿// Курсор ленты обновлений (GET /updates): формат "эпоха.номер.чат:id...",
+// разбор недопустимых значений и сброс курсора другой эпохи.
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "Delivery.h"
+#include "Membership.h"
+
+using namespace std;
+
+namespace {
+
+Delivery::Cursor parse(const string& text) {
+    Delivery::Cursor cursor;
+    EXPECT_TRUE(Delivery::parseCursor(text, cursor)) << text;
+    return cursor;
+}
+
+class CursorTest : public testing::Test {
+protected:
+    Membership membership{ Membership::Config{} };
+    Delivery delivery{ Delivery::Config{}, membership };
+};
+
+}
+
+TEST_F(CursorTest, RoundTrip) {
+    Delivery::Cursor cursor;
+    cursor.epoch = "1700000000000";
+    cursor.seq = 42;
+    cursor.chats = { { 3, 100 }, { 17, 5 } };
+
+    auto parsed = parse(delivery.formatCursor(cursor));
+    EXPECT_EQ(parsed.epoch, cursor.epoch);
+    EXPECT_EQ(parsed.seq, 42u);
+    EXPECT_EQ(parsed.chats, cursor.chats);
+}
+
+TEST_F(CursorTest, WithoutChats) {
+    auto cursor = parse("123.0");
+    EXPECT_EQ(cursor.epoch, "123");
+    EXPECT_EQ(cursor.seq, 0u);
+    EXPECT_TRUE(cursor.chats.empty());
+}
+
+TEST_F(CursorTest, InvalidCursors) {
+    for (const char* text : { "", "123", "abc.1", "123.x", "123.-1", "123.1.", "123.1.5",
+                              "123.1.5:", "123.1.:5", "123.1.5:x", "123.1.5:-2", "123..1" }) {
+        Delivery::Cursor cursor;
+        EXPECT_FALSE(Delivery::parseCursor(text, cursor)) << text;
+    }
+}
+
+// Курсор другого запуска сервера недействителен: клиент перечитывает чаты
+TEST_F(CursorTest, OtherEpochResets) {
+    auto fresh = delivery.pending(1, Delivery::Cursor{}, 100);
+    EXPECT_FALSE(fresh.reset);
+    EXPECT_FALSE(fresh.cursor.epoch.empty());
+
+    auto current = parse(delivery.formatCursor(fresh.cursor));
+    EXPECT_FALSE(delivery.pending(1, current, 100).reset);
+
+    Delivery::Cursor stale = current;
+    stale.epoch = "1";
+    auto pending = delivery.pending(1, stale, 100);
+    EXPECT_TRUE(pending.reset);
+    EXPECT_EQ(pending.cursor.epoch, fresh.cursor.epoch);
+}
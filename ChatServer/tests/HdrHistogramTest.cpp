@@ -0,0 +1,91 @@
+﻿// Гистограмма задержек нагрузочного генератора: точные значения до 2048,
+// дальше относительная погрешность перцентилей не больше ~0.1%.
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <random>
+
+#include "HdrHistogram.h"
+
+using namespace std;
+
+TEST(HdrHistogramTest, Empty) {
+    HdrHistogram histogram;
+    EXPECT_EQ(histogram.count(), 0u);
+    EXPECT_EQ(histogram.percentile(50), 0);
+    EXPECT_EQ(histogram.mean(), 0);
+    EXPECT_EQ(histogram.min(), 0);
+    EXPECT_EQ(histogram.max(), 0);
+}
+
+TEST(HdrHistogramTest, SmallValuesAreExact) {
+    HdrHistogram histogram;
+    for (int64_t value = 1; value <= 2000; value++) {
+        histogram.record(value);
+    }
+    EXPECT_EQ(histogram.percentile(50), 1000);
+    EXPECT_EQ(histogram.percentile(99), 1980);
+    EXPECT_EQ(histogram.percentile(100), 2000);
+    EXPECT_EQ(histogram.min(), 1);
+    EXPECT_EQ(histogram.max(), 2000);
+    EXPECT_NEAR(histogram.mean(), 1000.5, 0.5);
+}
+
+// Перцентиль - верхняя граница подкорзины значения: не меньше его
+// и не больше чем на 0.1%, в том числе на границах корзин
+TEST(HdrHistogramTest, RelativeError) {
+    for (int64_t value : { int64_t(2047), int64_t(2048), int64_t(2049), int64_t(4095), int64_t(4096),
+                           int64_t(4097), int64_t(123456), int64_t(1) << 20, int64_t(59'999'999) }) {
+        HdrHistogram histogram;
+        histogram.record(value);
+        histogram.record(60'000'000);
+        int64_t p50 = histogram.percentile(50);
+        EXPECT_GE(p50, value) << value;
+        EXPECT_LE(p50, value + value / 1000) << value;
+        EXPECT_EQ(histogram.percentile(100), 60'000'000);
+    }
+}
+
+TEST(HdrHistogramTest, PercentilesOfUniformValues) {
+    HdrHistogram histogram;
+    mt19937 rng(1);
+    uniform_int_distribution<int64_t> dist(1, 10'000'000);
+    for (int i = 0; i < 100000; i++) {
+        histogram.record(dist(rng));
+    }
+    for (double p : { 50.0, 90.0, 99.0, 99.9 }) {
+        double expected = p / 100 * 10'000'000;
+        EXPECT_NEAR(static_cast<double>(histogram.percentile(p)), expected, expected * 0.02) << p;
+    }
+    EXPECT_NEAR(histogram.mean(), 5'000'000, 50'000);
+}
+
+TEST(HdrHistogramTest, ValuesAreClamped) {
+    HdrHistogram histogram(1'000'000);
+    histogram.record(-5);
+    histogram.record(5'000'000);
+    EXPECT_EQ(histogram.min(), 0);
+    EXPECT_EQ(histogram.max(), 1'000'000);
+    EXPECT_EQ(histogram.percentile(100), 1'000'000);
+}
+
+TEST(HdrHistogramTest, MergeAndReset) {
+    HdrHistogram a(1'000'000);
+    HdrHistogram b;
+    for (int64_t value = 1; value <= 100; value++) {
+        a.record(value);
+        b.record(value * 100000);
+    }
+    a.merge(b);
+    EXPECT_EQ(a.count(), 200u);
+    EXPECT_EQ(a.min(), 1);
+    EXPECT_EQ(a.max(), 10'000'000);
+    EXPECT_EQ(a.percentile(50), 100);
+    EXPECT_NEAR(static_cast<double>(a.percentile(75)), 5'000'000, 5'000);
+
+    a.reset();
+    EXPECT_EQ(a.count(), 0u);
+    EXPECT_EQ(a.percentile(99), 0);
+    a.record(42);
+    EXPECT_EQ(a.min(), 42);
+}
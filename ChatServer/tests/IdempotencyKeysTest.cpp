@@ -0,0 +1,126 @@
+﻿// Ключи Idempotency-Key: повтор возвращает id первой записи, тот же ключ
+// с другим телом - конфликт, ключи старше ttl не действуют.
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "Database.h"
+#include "IdempotencyKeys.h"
+
+using namespace std;
+
+namespace {
+
+IdempotencyKeys::Key makeKey(const string& key, const string& bodyHash, int userId = 1) {
+    return IdempotencyKeys::Key{ userId, "POST /messages", key, bodyHash };
+}
+
+class IdempotencyKeysTest : public testing::Test {
+protected:
+    // Запись, которая выдает id 10, 20, 30...
+    IdempotencyKeys::Result write(IdempotencyKeys& keys, const IdempotencyKeys::Key& key) {
+        return keys.write(db, key, [this](Database&) { return ++calls * 10; });
+    }
+
+    Database db{ ":memory:" };
+    int calls = 0;
+};
+
+}
+
+TEST(IdempotencyKeysValidTest, ValidKey) {
+    EXPECT_TRUE(IdempotencyKeys::validKey("a"));
+    EXPECT_TRUE(IdempotencyKeys::validKey("3f2c-11ee~!"));
+    EXPECT_TRUE(IdempotencyKeys::validKey(string(IdempotencyKeys::maxKeyLength, 'k')));
+    EXPECT_FALSE(IdempotencyKeys::validKey(""));
+    EXPECT_FALSE(IdempotencyKeys::validKey(string(IdempotencyKeys::maxKeyLength + 1, 'k')));
+    EXPECT_FALSE(IdempotencyKeys::validKey("with space"));
+    EXPECT_FALSE(IdempotencyKeys::validKey("tab\t"));
+    EXPECT_FALSE(IdempotencyKeys::validKey("\xd0\xba"));
+}
+
+TEST_F(IdempotencyKeysTest, ReplayFromDatabase) {
+    IdempotencyKeys keys({});
+    auto first = write(keys, makeKey("k1", "hash"));
+    EXPECT_EQ(first.id, 10);
+    EXPECT_FALSE(first.replayed);
+
+    auto second = write(keys, makeKey("k1", "hash"));
+    EXPECT_EQ(second.id, 10);
+    EXPECT_TRUE(second.replayed);
+    EXPECT_EQ(calls, 1);
+
+    // Ключ действует для пары (пользователь, маршрут)
+    EXPECT_EQ(write(keys, makeKey("k1", "hash", 2)).id, 20);
+    EXPECT_EQ(keys.stats().databaseHits, 1u);
+    EXPECT_EQ(keys.stats().writes, 2u);
+}
+
+TEST_F(IdempotencyKeysTest, ConflictFromDatabase) {
+    IdempotencyKeys keys({});
+    EXPECT_EQ(write(keys, makeKey("k1", "hash")).id, 10);
+
+    auto conflict = write(keys, makeKey("k1", "other"));
+    EXPECT_TRUE(conflict.conflict);
+    EXPECT_FALSE(conflict.replayed);
+    EXPECT_EQ(conflict.id, 0);
+    EXPECT_EQ(calls, 1);
+    EXPECT_EQ(keys.stats().conflicts, 1u);
+}
+
+// Неудачная запись не сохраняет ключ: повтор выполняет ее заново
+TEST_F(IdempotencyKeysTest, FailedWriteIsNotSaved) {
+    IdempotencyKeys keys({});
+    auto failed = keys.write(db, makeKey("k1", "hash"), [](Database&) { return -1; });
+    EXPECT_EQ(failed.id, -1);
+    EXPECT_EQ(write(keys, makeKey("k1", "hash")).id, 10);
+    EXPECT_EQ(calls, 1);
+}
+
+TEST_F(IdempotencyKeysTest, MemoryTable) {
+    IdempotencyKeys::Config config;
+    config.capacity = 2;
+    IdempotencyKeys keys(config);
+
+    EXPECT_FALSE(keys.find(makeKey("k1", "hash")).has_value());
+    keys.remember(makeKey("k1", "hash"), 10);
+    keys.remember(makeKey("k2", "hash"), 20);
+
+    auto replay = keys.find(makeKey("k1", "hash"));
+    ASSERT_TRUE(replay.has_value());
+    EXPECT_TRUE(replay->replayed);
+    EXPECT_EQ(replay->id, 10);
+
+    auto conflict = keys.find(makeKey("k2", "other"));
+    ASSERT_TRUE(conflict.has_value());
+    EXPECT_TRUE(conflict->conflict);
+
+    // k2 найден последним, поэтому при переполнении вытесняется k1
+    keys.remember(makeKey("k3", "hash"), 30);
+    EXPECT_TRUE(keys.find(makeKey("k2", "hash")).has_value());
+    EXPECT_FALSE(keys.find(makeKey("k1", "hash")).has_value());
+    EXPECT_EQ(keys.stats().entries, 2u);
+    EXPECT_EQ(keys.stats().evictions, 1u);
+}
+
+// ttl = 0: ключ перестает действовать, как только прошла хоть секунда
+// (в базе время хранится с точностью до секунды) и удаляется при очистке
+TEST_F(IdempotencyKeysTest, ExpiredKeys) {
+    IdempotencyKeys::Config config;
+    config.ttl = chrono::seconds(0);
+    config.pruneEvery = 1;
+    IdempotencyKeys keys(config);
+
+    EXPECT_EQ(write(keys, makeKey("k1", "hash")).id, 10);
+    keys.remember(makeKey("k1", "hash"), 10);
+    this_thread::sleep_for(chrono::milliseconds(1100));
+
+    EXPECT_FALSE(keys.find(makeKey("k1", "hash")).has_value());
+    auto again = write(keys, makeKey("k1", "other"));
+    EXPECT_FALSE(again.replayed);
+    EXPECT_FALSE(again.conflict);
+    EXPECT_EQ(again.id, 20);
+    EXPECT_EQ(keys.stats().pruned, 1u);
+}
@@ -0,0 +1,210 @@
+﻿// MessagePack: запись и чтение всех типов на границах форматов, отказ на
+// обрезанных и некорректных данных (позиция чтения при этом не меняется)
+// и varint/zigzag журнала трафика.
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+
+#include "MsgPack.h"
+
+using namespace std;
+
+namespace {
+
+string encodeInteger(int64_t value) {
+    string out;
+    msgpack::Writer(out).integer(value);
+    return out;
+}
+
+string encodeString(size_t size) {
+    string out;
+    msgpack::Writer(out).str(string(size, 'x'));
+    return out;
+}
+
+}
+
+TEST(MsgPackTest, IntegerRoundTrip) {
+    const int64_t values[] = {
+        0, 1, 127, 128, 255, 256, 65535, 65536, 4294967295LL, 4294967296LL,
+        numeric_limits<int64_t>::max(),
+        -1, -32, -33, -128, -129, -32768, -32769, -2147483648LL, -2147483649LL,
+        numeric_limits<int64_t>::min()
+    };
+    for (int64_t value : values) {
+        string data = encodeInteger(value);
+        msgpack::Reader reader(data);
+        EXPECT_EQ(reader.peek(), msgpack::Type::Int);
+        int64_t read = 0;
+        EXPECT_TRUE(reader.integer(read)) << value;
+        EXPECT_EQ(read, value);
+        EXPECT_TRUE(reader.atEnd());
+    }
+}
+
+// Самая короткая форма: fixint, затем 1, 2, 4 и 8 байт
+TEST(MsgPackTest, IntegerSizes) {
+    EXPECT_EQ(encodeInteger(127).size(), 1u);
+    EXPECT_EQ(encodeInteger(-32).size(), 1u);
+    EXPECT_EQ(encodeInteger(128).size(), 2u);
+    EXPECT_EQ(encodeInteger(-33).size(), 2u);
+    EXPECT_EQ(encodeInteger(65535).size(), 3u);
+    EXPECT_EQ(encodeInteger(65536).size(), 5u);
+    EXPECT_EQ(encodeInteger(4294967296LL).size(), 9u);
+}
+
+TEST(MsgPackTest, UnsignedAboveInt64IsRejected) {
+    string data;
+    msgpack::Writer(data).uinteger(numeric_limits<uint64_t>::max());
+    msgpack::Reader reader(data);
+    int64_t value = 0;
+    EXPECT_FALSE(reader.integer(value));
+    EXPECT_FALSE(reader.atEnd());
+}
+
+TEST(MsgPackTest, StringSizes) {
+    for (size_t size : { 0, 31, 32, 255, 256, 65535, 65536 }) {
+        string data = encodeString(size);
+        msgpack::Reader reader(data);
+        string_view value;
+        EXPECT_TRUE(reader.str(value)) << size;
+        EXPECT_EQ(value, string(size, 'x'));
+        EXPECT_TRUE(reader.atEnd());
+    }
+}
+
+TEST(MsgPackTest, MixedValues) {
+    string data;
+    msgpack::Writer writer(data);
+    writer.map(3);
+    writer.str("list");
+    writer.array(4);
+    writer.nil();
+    writer.boolean(true);
+    writer.real(2.5);
+    writer.bin(string("\x00\x01\x02", 3));
+    writer.str("empty");
+    writer.map(0);
+    writer.str("n");
+    writer.integer(-7);
+
+    msgpack::Reader reader(data);
+    size_t fields = 0;
+    ASSERT_TRUE(reader.map(fields));
+    EXPECT_EQ(fields, 3u);
+
+    string_view key;
+    size_t size = 0;
+    ASSERT_TRUE(reader.str(key));
+    EXPECT_EQ(key, "list");
+    ASSERT_TRUE(reader.array(size));
+    EXPECT_EQ(size, 4u);
+    EXPECT_TRUE(reader.nil());
+    bool flag = false;
+    EXPECT_TRUE(reader.boolean(flag));
+    EXPECT_TRUE(flag);
+    double real = 0;
+    EXPECT_TRUE(reader.real(real));
+    EXPECT_EQ(real, 2.5);
+    string_view bytes;
+    EXPECT_TRUE(reader.bin(bytes));
+    EXPECT_EQ(bytes, string_view("\x00\x01\x02", 3));
+
+    ASSERT_TRUE(reader.str(key));
+    EXPECT_EQ(key, "empty");
+    string_view nested;
+    EXPECT_TRUE(reader.value(nested));
+    EXPECT_EQ(nested, "\x80");
+
+    ASSERT_TRUE(reader.str(key));
+    int64_t n = 0;
+    // Целое читается и как число с плавающей точкой
+    msgpack::Reader copy = reader;
+    EXPECT_TRUE(copy.real(real));
+    EXPECT_EQ(real, -7);
+    EXPECT_TRUE(reader.integer(n));
+    EXPECT_EQ(n, -7);
+    EXPECT_TRUE(reader.atEnd());
+}
+
+// Неудачное чтение не сдвигает позицию: можно прочитать значение другим типом
+TEST(MsgPackTest, WrongTypeKeepsPosition) {
+    string data;
+    msgpack::Writer(data).str("text");
+    msgpack::Reader reader(data);
+    int64_t value = 0;
+    size_t size = 0;
+    EXPECT_FALSE(reader.integer(value));
+    EXPECT_FALSE(reader.array(size));
+    string_view text;
+    EXPECT_TRUE(reader.str(text));
+    EXPECT_EQ(text, "text");
+}
+
+TEST(MsgPackTest, TruncatedInputIsRejected) {
+    string data;
+    msgpack::Writer writer(data);
+    writer.array(2);
+    writer.str(string(300, 'y'));
+    writer.integer(1LL << 40);
+
+    for (size_t size = 0; size < data.size(); size++) {
+        msgpack::Reader reader(string_view(data).substr(0, size));
+        EXPECT_FALSE(reader.skip()) << size;
+    }
+    msgpack::Reader reader(data);
+    EXPECT_TRUE(reader.skip());
+    EXPECT_TRUE(reader.atEnd());
+}
+
+// Длина строки больше оставшихся данных - отказ, а не чтение за концом
+TEST(MsgPackTest, OversizedLengthIsRejected) {
+    const string data("\xdb\xff\xff\xff\xf0" "abc", 8);
+    msgpack::Reader reader(data);
+    string_view value;
+    EXPECT_FALSE(reader.str(value));
+    EXPECT_FALSE(reader.skip());
+}
+
+TEST(MsgPackTest, NestingDepthIsLimited) {
+    string deep(100, '\x91');
+    deep += '\xc0';
+    EXPECT_FALSE(msgpack::Reader(deep).skip());
+
+    string shallow(10, '\x91');
+    shallow += '\xc0';
+    EXPECT_TRUE(msgpack::Reader(shallow).skip());
+}
+
+TEST(MsgPackTest, Varint) {
+    for (uint64_t value : { uint64_t(0), uint64_t(127), uint64_t(128), uint64_t(16383), uint64_t(16384),
+                            numeric_limits<uint64_t>::max() }) {
+        string out;
+        msgpack::writeVarint(out, value);
+        EXPECT_EQ(out.size(), msgpack::varintSize(value));
+
+        string_view view = out;
+        uint64_t read = 0;
+        EXPECT_TRUE(msgpack::readVarint(view, read));
+        EXPECT_EQ(read, value);
+        EXPECT_TRUE(view.empty());
+
+        // Без последнего байта varint не дочитывается
+        string_view truncated = string_view(out).substr(0, out.size() - 1);
+        EXPECT_FALSE(msgpack::readVarint(truncated, read));
+    }
+}
+
+TEST(MsgPackTest, Zigzag) {
+    EXPECT_EQ(msgpack::zigzag(0), 0u);
+    EXPECT_EQ(msgpack::zigzag(-1), 1u);
+    EXPECT_EQ(msgpack::zigzag(1), 2u);
+    for (int64_t value : { int64_t(0), int64_t(-1), int64_t(1), int64_t(-1000000), numeric_limits<int64_t>::max(),
+                           numeric_limits<int64_t>::min() }) {
+        EXPECT_EQ(msgpack::unzigzag(msgpack::zigzag(value)), value);
+    }
+}
@@ -0,0 +1,95 @@
+﻿// Token bucket: расход и пополнение ведра, Retry-After, запрос дороже ведра,
+// переполнение таблицы (fail-open) и повторное использование простаивающих слотов.
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+#include "RateLimiter.h"
+
+using namespace std;
+
+namespace {
+
+RateLimiter::Config config(uint32_t capacity, uint32_t refillPerSecond) {
+    RateLimiter::Config result;
+    result.capacity = capacity;
+    result.refillPerSecond = refillPerSecond;
+    return result;
+}
+
+}
+
+TEST(RateLimiterTest, BucketEmptiesAndReportsRetryAfter) {
+    RateLimiter limiter(config(5, 1));
+    for (int i = 0; i < 5; i++) {
+        EXPECT_TRUE(limiter.consume(1, 1).allowed) << i;
+    }
+    auto denied = limiter.consume(1, 1);
+    EXPECT_FALSE(denied.allowed);
+    // Один токен при 1 токене в секунду
+    EXPECT_GT(denied.retryAfterMs, 900u);
+    EXPECT_LE(denied.retryAfterMs, 1000u);
+
+    // Ведра разных ключей независимы
+    EXPECT_TRUE(limiter.consume(2, 5).allowed);
+    EXPECT_FALSE(limiter.consume(2, 1).allowed);
+}
+
+TEST(RateLimiterTest, CostAboveCapacity) {
+    RateLimiter limiter(config(5, 1));
+    // Иначе такой запрос не прошел бы никогда: он забирает все ведро
+    EXPECT_TRUE(limiter.consume(1, 100).allowed);
+    EXPECT_FALSE(limiter.consume(1, 1).allowed);
+    EXPECT_TRUE(limiter.consume(1, 0).allowed);
+}
+
+TEST(RateLimiterTest, Refill) {
+    RateLimiter limiter(config(2, 1000));
+    EXPECT_TRUE(limiter.consume(1, 2).allowed);
+    auto denied = limiter.consume(1, 2);
+    EXPECT_FALSE(denied.allowed);
+    EXPECT_LE(denied.retryAfterMs, 2u);
+
+    this_thread::sleep_for(chrono::milliseconds(10));
+    // Ведро пополняется не больше чем до capacity
+    EXPECT_TRUE(limiter.consume(1, 2).allowed);
+    EXPECT_FALSE(limiter.consume(1, 2).allowed);
+}
+
+TEST(RateLimiterTest, TableFullFailsOpen) {
+    auto c = config(1, 1);
+    c.shards = 1;
+    c.slotsPerShard = 16;
+    RateLimiter limiter(c);
+
+    for (uint64_t key = 1; key <= 16; key++) {
+        EXPECT_TRUE(limiter.consume(key, 1).allowed);
+    }
+    EXPECT_EQ(limiter.activeKeys(), 16u);
+
+    // Свободных слотов нет, а занятые не простаивают: запрос пропускается без учета
+    EXPECT_TRUE(limiter.consume(17, 1).allowed);
+    EXPECT_TRUE(limiter.consume(17, 1).allowed);
+    EXPECT_EQ(limiter.tableFull(), 2u);
+}
+
+// Ведро, простаивавшее дольше полного пополнения, уже полное: его слот
+// отдается новому ключу
+TEST(RateLimiterTest, IdleSlotsAreReused) {
+    auto c = config(1, 1000);
+    c.shards = 1;
+    c.slotsPerShard = 16;
+    RateLimiter limiter(c);
+
+    for (uint64_t key = 1; key <= 16; key++) {
+        EXPECT_TRUE(limiter.consume(key, 1).allowed);
+    }
+    this_thread::sleep_for(chrono::milliseconds(20));
+    EXPECT_EQ(limiter.activeKeys(), 0u);
+
+    EXPECT_TRUE(limiter.consume(17, 1).allowed);
+    EXPECT_FALSE(limiter.consume(17, 1).allowed);
+    EXPECT_EQ(limiter.tableFull(), 0u);
+    EXPECT_EQ(limiter.activeKeys(), 1u);
+}
@@ -0,0 +1,128 @@
+﻿// RoaringBitmap (участники чатов в Membership): блоки-массивы, переход
+// в битовую карту после arrayMax значений и операции над множествами
+// в сравнении с std::set.
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "RoaringBitmap.h"
+
+using namespace std;
+
+namespace {
+
+RoaringBitmap fromSet(const set<uint32_t>& values) {
+    RoaringBitmap bitmap;
+    for (uint32_t value : values) {
+        bitmap.add(value);
+    }
+    return bitmap;
+}
+
+vector<int> toInts(const set<uint32_t>& values) {
+    return vector<int>(values.begin(), values.end());
+}
+
+// Значения в нескольких блоках по 65536: плотные (битовые карты) и редкие (массивы)
+set<uint32_t> randomValues(unsigned seed, size_t dense, size_t sparse) {
+    mt19937 rng(seed);
+    set<uint32_t> values;
+    uniform_int_distribution<uint32_t> denseDist(0, 3 * 65536 - 1);
+    while (values.size() < dense) {
+        values.insert(denseDist(rng));
+    }
+    uniform_int_distribution<uint32_t> sparseDist(0, 1u << 30);
+    while (values.size() < dense + sparse) {
+        values.insert(sparseDist(rng));
+    }
+    return values;
+}
+
+}
+
+TEST(RoaringBitmapTest, AddRemoveContains) {
+    RoaringBitmap bitmap;
+    EXPECT_TRUE(bitmap.empty());
+    EXPECT_TRUE(bitmap.add(5));
+    EXPECT_FALSE(bitmap.add(5));
+    EXPECT_TRUE(bitmap.add(70000));
+    EXPECT_TRUE(bitmap.contains(5));
+    EXPECT_TRUE(bitmap.contains(70000));
+    EXPECT_FALSE(bitmap.contains(6));
+    EXPECT_EQ(bitmap.cardinality(), 2u);
+
+    EXPECT_TRUE(bitmap.remove(5));
+    EXPECT_FALSE(bitmap.remove(5));
+    EXPECT_TRUE(bitmap.remove(70000));
+    EXPECT_TRUE(bitmap.empty());
+    EXPECT_EQ(bitmap.cardinality(), 0u);
+}
+
+// Блок переходит в битовую карту после 4096 значений и обратно в массив
+// при удалении; содержимое при этом не меняется
+TEST(RoaringBitmapTest, ArrayBitmapConversion) {
+    RoaringBitmap bitmap;
+    for (uint32_t i = 0; i < 5000; i++) {
+        bitmap.add(i * 2);
+    }
+    EXPECT_EQ(bitmap.cardinality(), 5000u);
+    for (uint32_t i = 0; i < 10000; i++) {
+        EXPECT_EQ(bitmap.contains(i), i % 2 == 0) << i;
+    }
+
+    for (uint32_t i = 0; i < 4900; i++) {
+        EXPECT_TRUE(bitmap.remove(i * 2));
+    }
+    EXPECT_EQ(bitmap.cardinality(), 100u);
+    vector<int> expected;
+    for (int i = 4900; i < 5000; i++) {
+        expected.push_back(i * 2);
+    }
+    EXPECT_EQ(bitmap.toVector(), expected);
+}
+
+TEST(RoaringBitmapTest, ToVectorIsSorted) {
+    auto values = randomValues(1, 6000, 500);
+    auto bitmap = fromSet(values);
+    EXPECT_EQ(bitmap.toVector(), toInts(values));
+    EXPECT_EQ(bitmap.cardinality(), values.size());
+
+    vector<int> visited;
+    bitmap.forEach([&](int value) { visited.push_back(value); });
+    EXPECT_EQ(visited, toInts(values));
+}
+
+TEST(RoaringBitmapTest, SetOperationsMatchStdSet) {
+    auto a = randomValues(2, 8000, 300);
+    auto b = randomValues(3, 2000, 300);
+    // Общая часть, в том числе в редких блоках
+    for (uint32_t value : { 7u, 65536u * 5 + 1, 1u << 29 }) {
+        a.insert(value);
+        b.insert(value);
+    }
+    auto bitmapA = fromSet(a);
+    auto bitmapB = fromSet(b);
+
+    set<uint32_t> both;
+    set_intersection(a.begin(), a.end(), b.begin(), b.end(), inserter(both, both.end()));
+    set<uint32_t> either;
+    set_union(a.begin(), a.end(), b.begin(), b.end(), inserter(either, either.end()));
+
+    EXPECT_EQ(RoaringBitmap::intersect(bitmapA, bitmapB).toVector(), toInts(both));
+    EXPECT_EQ(RoaringBitmap::unite(bitmapA, bitmapB).toVector(), toInts(either));
+    EXPECT_EQ(RoaringBitmap::intersectCardinality(bitmapA, bitmapB), both.size());
+    EXPECT_EQ(RoaringBitmap::unionCardinality(bitmapA, bitmapB), either.size());
+}
+
+TEST(RoaringBitmapTest, OperationsWithEmpty) {
+    auto bitmap = fromSet({ 1, 2, 100000 });
+    RoaringBitmap empty;
+    EXPECT_TRUE(RoaringBitmap::intersect(bitmap, empty).empty());
+    EXPECT_EQ(RoaringBitmap::unite(bitmap, empty).toVector(), bitmap.toVector());
+    EXPECT_EQ(RoaringBitmap::intersectCardinality(empty, bitmap), 0u);
+    EXPECT_EQ(RoaringBitmap::unionCardinality(empty, bitmap), 3u);
+}
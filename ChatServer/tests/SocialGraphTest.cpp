@@ -0,0 +1,170 @@
+﻿// Граф контактов: фильтр Блума перед проверкой массивов соседей,
+// резервирование контакта и общие контакты через simd::intersectSorted
+// (с AVX2 и скалярный вариант).
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Simd.h"
+#include "SocialGraph.h"
+
+using namespace std;
+
+namespace {
+
+vector<pair<int, string>> users(int count) {
+    vector<pair<int, string>> result;
+    for (int id = 1; id <= count; id++) {
+        result.emplace_back(id, "user" + to_string(id));
+    }
+    return result;
+}
+
+vector<int> ids(const vector<pair<int, string>>& named) {
+    vector<int> result;
+    for (const auto& [id, name] : named) {
+        result.push_back(id);
+    }
+    return result;
+}
+
+// Восстанавливает исходное состояние simd::enable после теста
+class SimdModes : public testing::TestWithParam<bool> {
+protected:
+    void SetUp() override {
+        if (GetParam() && !simd::supported()) {
+            GTEST_SKIP() << "AVX2 is not supported";
+        }
+        saved = simd::enabled();
+        simd::enable(GetParam());
+    }
+
+    void TearDown() override {
+        simd::enable(saved);
+    }
+
+    bool saved = false;
+};
+
+vector<int> sortedIds(unsigned seed, size_t count) {
+    mt19937 rng(seed);
+    uniform_int_distribution<int> dist(1, 20000);
+    set<int> values;
+    while (values.size() < count) {
+        values.insert(dist(rng));
+    }
+    return vector<int>(values.begin(), values.end());
+}
+
+}
+
+TEST_P(SimdModes, IntersectSortedMatchesStd) {
+    for (size_t na : { 0, 1, 7, 8, 9, 100, 1000 }) {
+        for (size_t nb : { 0, 3, 8, 16, 500, 3000 }) {
+            auto a = sortedIds(static_cast<unsigned>(na), na);
+            auto b = sortedIds(static_cast<unsigned>(nb + 1000), nb);
+            vector<int> expected;
+            set_intersection(a.begin(), a.end(), b.begin(), b.end(), back_inserter(expected));
+
+            vector<int> out(min(na, nb));
+            size_t size = simd::intersectSorted(a.data(), na, b.data(), nb, out.data());
+            out.resize(size);
+            EXPECT_EQ(out, expected) << na << " x " << nb;
+        }
+    }
+}
+
+TEST_P(SimdModes, MutualContacts) {
+    SocialGraph graph;
+    vector<Contact> contacts;
+    int id = 0;
+    // У 1 и 2 общие контакты - все кратные 3
+    for (int other = 3; other <= 300; other++) {
+        if (other % 3 == 0 || other % 2 == 0) {
+            contacts.push_back(Contact{ ++id, 1, other });
+        }
+        if (other % 3 == 0 || other % 5 == 0) {
+            contacts.push_back(Contact{ ++id, other, 2 });
+        }
+    }
+    graph.load(users(300), contacts);
+
+    vector<int> expected;
+    for (int other = 3; other <= 300; other++) {
+        bool first = other % 3 == 0 || other % 2 == 0;
+        bool second = other % 3 == 0 || other % 5 == 0;
+        if (first && second) {
+            expected.push_back(other);
+        }
+    }
+    EXPECT_EQ(ids(graph.mutual(1, 2)), expected);
+    EXPECT_EQ(graph.mutual(1, 2).front().second, "user" + to_string(expected.front()));
+}
+
+INSTANTIATE_TEST_SUITE_P(SocialGraphTest, SimdModes, testing::Values(false, true),
+    [](const testing::TestParamInfo<bool>& info) { return info.param ? "Avx2" : "Scalar"; });
+
+// Фильтр не дает ложноотрицательных ответов, а большинство отсутствующих
+// пар отсекает без обращения к массивам
+TEST(SocialGraphTest, BloomFilter) {
+    const int count = 2000;
+    SocialGraph graph;
+    vector<Contact> contacts;
+    set<pair<int, int>> linked;
+    mt19937 rng(7);
+    uniform_int_distribution<int> dist(1, count);
+    while (linked.size() < 5000) {
+        int a = dist(rng);
+        int b = dist(rng);
+        if (a != b && linked.insert(minmax(a, b)).second) {
+            contacts.push_back(Contact{ static_cast<int>(linked.size()), a, b });
+        }
+    }
+    graph.load(users(count), contacts);
+
+    for (const auto& [a, b] : linked) {
+        EXPECT_TRUE(graph.hasContact(a, b));
+        EXPECT_TRUE(graph.hasContact(b, a));
+    }
+
+    uint64_t absent = 0;
+    auto before = graph.stats();
+    for (int i = 0; i < 10000; i++) {
+        int a = dist(rng);
+        int b = dist(rng);
+        if (a != b && !linked.count(minmax(a, b))) {
+            EXPECT_FALSE(graph.hasContact(a, b));
+            absent++;
+        }
+    }
+    auto after = graph.stats();
+    EXPECT_EQ(after.contacts, linked.size());
+    EXPECT_GT(after.bloomNegatives - before.bloomNegatives, absent * 9 / 10);
+}
+
+TEST(SocialGraphTest, ReserveAndRelease) {
+    SocialGraph graph;
+    graph.load(users(3), {});
+
+    EXPECT_EQ(graph.reserve(1, 1), -1);
+    EXPECT_EQ(graph.reserve(1, 4), -3);
+    EXPECT_EQ(graph.reserve(1, 2), 0);
+    EXPECT_EQ(graph.reserve(2, 1), -2);
+    EXPECT_TRUE(graph.hasContact(2, 1));
+
+    // Запись в базу не удалась: контакт снова можно добавить
+    graph.release(1, 2);
+    EXPECT_FALSE(graph.hasContact(1, 2));
+    EXPECT_EQ(graph.reserve(2, 1), 0);
+
+    graph.addUser(4, "user4");
+    graph.add(4, 1);
+    EXPECT_EQ(ids(graph.contacts(1)), (vector<int>{ 2, 4 }));
+    EXPECT_EQ(graph.contacts(4), (vector<pair<int, string>>{ { 1, "user1" } }));
+}
@@ -0,0 +1,136 @@
+﻿// Журнал трафика: запись и чтение записей с заголовками, отказ на обрезанном
+// файле и на длинах, которые больше оставшейся части файла.
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "MsgPack.h"
+#include "TrafficLog.h"
+
+using namespace std;
+
+namespace {
+
+string tempPath(const string& name) {
+    return testing::TempDir() + "chatserver_" + name + ".traffic";
+}
+
+CapturedRequest makeRequest(uint64_t startUs, const string& url) {
+    CapturedRequest request;
+    request.startUs = startUs;
+    request.durationUs = 1500;
+    request.status = 200;
+    request.method = "POST";
+    request.url = url;
+    request.body = string("{\"message\": \"\xd0\xbf\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82\"}") + string(1, '\0');
+    request.headers = { { "Content-Type", "application/json" }, { "Idempotency-Key", "k-1" } };
+    return request;
+}
+
+void writeFile(const string& path, const string& data) {
+    ofstream out(path, ios::binary | ios::trunc);
+    out.write(data.data(), static_cast<streamsize>(data.size()));
+}
+
+string readFile(const string& path) {
+    ifstream in(path, ios::binary);
+    return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+void expectEqual(const CapturedRequest& actual, const CapturedRequest& expected) {
+    EXPECT_EQ(actual.startUs, expected.startUs);
+    EXPECT_EQ(actual.durationUs, expected.durationUs);
+    EXPECT_EQ(actual.status, expected.status);
+    EXPECT_EQ(actual.method, expected.method);
+    EXPECT_EQ(actual.url, expected.url);
+    EXPECT_EQ(actual.body, expected.body);
+    EXPECT_EQ(actual.headers, expected.headers);
+}
+
+}
+
+// Записи, пришедшие не по порядку начала, в журнале упорядочены по startUs
+TEST(TrafficLogTest, RoundTrip) {
+    string path = tempPath("round_trip");
+    vector<CapturedRequest> requests = {
+        makeRequest(100, "/messages"),
+        makeRequest(5000000, "/chats/1?limit=10"),
+        makeRequest(20, "/users/search/a"),
+    };
+    requests[2].method = "GET";
+    requests[2].body.clear();
+    requests[2].headers.clear();
+    requests[2].status = 404;
+    {
+        TrafficLogWriter writer(path);
+        for (const auto& request : requests) {
+            writer.record(request);
+        }
+    }
+
+    auto read = TrafficLogReader::readAll(path);
+    ASSERT_EQ(read.size(), 3u);
+    expectEqual(read[0], requests[2]);
+    expectEqual(read[1], requests[0]);
+    expectEqual(read[2], requests[1]);
+    filesystem::remove(path);
+}
+
+TEST(TrafficLogTest, NotATrafficLog) {
+    string path = tempPath("not_a_log");
+    writeFile(path, "CSTRAF00");
+    EXPECT_THROW(TrafficLogReader reader(path), runtime_error);
+    EXPECT_THROW(TrafficLogReader reader(tempPath("missing")), runtime_error);
+    filesystem::remove(path);
+}
+
+// Обрезанная последняя запись - ошибка, а не молча потерянный конец
+TEST(TrafficLogTest, TruncatedRecord) {
+    string path = tempPath("truncated");
+    {
+        TrafficLogWriter writer(path);
+        writer.record(makeRequest(1, "/messages"));
+        writer.record(makeRequest(2, "/messages"));
+    }
+    string data = readFile(path);
+    writeFile(path, data.substr(0, data.size() - 3));
+
+    TrafficLogReader reader(path);
+    CapturedRequest request;
+    EXPECT_TRUE(reader.next(request));
+    EXPECT_THROW(reader.next(request), runtime_error);
+    filesystem::remove(path);
+}
+
+// Длины из поврежденного журнала не выделяют память больше размера файла
+TEST(TrafficLogTest, HugeLengths) {
+    string path = tempPath("huge");
+    string header = "CSTRAF01";
+
+    string hugeString = header;
+    msgpack::writeVarint(hugeString, 1);
+    msgpack::writeVarint(hugeString, 1);
+    msgpack::writeVarint(hugeString, 200);
+    msgpack::writeVarint(hugeString, uint64_t(1) << 63);
+    hugeString += "GET";
+    writeFile(path, hugeString);
+    EXPECT_THROW(TrafficLogReader::readAll(path), runtime_error);
+
+    string hugeHeaders = header;
+    msgpack::writeVarint(hugeHeaders, 1);
+    msgpack::writeVarint(hugeHeaders, 1);
+    msgpack::writeVarint(hugeHeaders, 200);
+    for (const char* text : { "GET", "/", "" }) {
+        msgpack::writeVarint(hugeHeaders, strlen(text));
+        hugeHeaders += text;
+    }
+    msgpack::writeVarint(hugeHeaders, uint64_t(1) << 40);
+    writeFile(path, hugeHeaders);
+    EXPECT_THROW(TrafficLogReader::readAll(path), runtime_error);
+    filesystem::remove(path);
+}
@@ -0,0 +1,672 @@
+﻿// Импорт истории из старой системы в chat.db без сервера.
+//
+// Вход - NDJSON (файл или "-" для stdin), по объекту в строке:
+//   {"type": "user", "id": 7, "name": "...", "login": "...", "password": "..."}
+//   {"type": "chat", "id": 3, "name": "...", "isGroup": true, "createdBy": 7,
+//    "createdAt": "2019-01-01 10:00:00", "members": [7, 8]}
+//   {"type": "member", "chatId": 3, "userId": 9}
+//   {"type": "message", "id": 100, "chatId": 3, "userId": 7, "message": "...",
+//    "replyId": 0, "resendId": 0, "sendDate": "2019-01-01 10:00:05"}
+// id необязательны: без них строка получает следующий id таблицы. Пароль
+// хэшируется так же, как при регистрации; готовый хэш - "passwordHash".
+// Строки с уже существующим id (или логином) пропускаются, так что прерванный
+// импорт в копию базы можно повторить.
+//
+// Чтение, разбор и запись идут конвейером: файл читается блоками по целым
+// строкам, блоки разбирают --threads потоков, а единственный писатель вставляет
+// готовые строки подготовленными запросами по порядку блоков, коммитя каждые
+// --batch строк. На время загрузки отключены журнал и fsync, а вторичные индексы
+// таблиц удаляются и строятся заново одним проходом в конце.
+// Без журнала сбой посреди загрузки портит базу: импорт делается в новую базу
+// или копию, сервер в это время не запущен (база открывается монопольно).
+//
+// Пример:
+//   chatserver_import --db=chat.db --threads=4 history.ndjson
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <crow.h>
+
+#include "Database.h"
+#include "ToolOptions.h"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+namespace {
+
+struct Options {
+    string dbPath = "chat.db";
+    string input;
+    size_t threads = thread::hardware_concurrency() > 1 ? thread::hardware_concurrency() - 1 : 1;
+    long long batch = 500000;       // строк на транзакцию
+    size_t blockSize = 4 << 20;     // байт входа на задачу разбора
+    long long maxErrors = 100;
+    bool fresh = false;
+
+    static Options parse(const ToolOptions& args) {
+        Options o;
+        o.dbPath = args.get("db", o.dbPath);
+        o.input = args.argument();
+        o.threads = static_cast<size_t>(max(1LL, args.getInt("threads", static_cast<long long>(o.threads))));
+        o.batch = max(1LL, args.getInt("batch", o.batch));
+        o.blockSize = static_cast<size_t>(max(64LL, args.getInt("block-kb", static_cast<long long>(o.blockSize >> 10)))) << 10;
+        o.maxErrors = args.getInt("max-errors", o.maxErrors);
+        o.fresh = args.has("fresh");
+        return o;
+    }
+};
+
+// Кусок входа из целых строк
+struct Block {
+    size_t sequence = 0;
+    long long firstLine = 1;
+    string text;
+};
+
+struct UserRow {
+    long long id = 0;               // 0 - следующий id таблицы
+    string name;
+    string login;
+    string password;                // уже хэшированный
+};
+
+struct ChatRow {
+    long long id = 0;
+    string name;
+    bool isGroup = false;
+    long long createdBy = 0;
+    string createdAt;               // пусто - время импорта
+};
+
+struct MemberRow {
+    long long chatId = 0;
+    long long userId = 0;
+};
+
+struct MessageRow {
+    long long id = 0;
+    long long userId = 0;
+    long long chatId = 0;
+    string message;
+    long long replyId = 0;
+    long long resendId = 0;
+    string sendDate;
+};
+
+struct LineError {
+    long long line = 0;
+    string error;
+};
+
+// Разобранный блок. Писатель вставляет пользователей, чаты, участников
+// и сообщения блока в этом порядке, так что ссылки внутри блока уже разрешены
+struct ParsedBlock {
+    vector<UserRow> users;
+    vector<ChatRow> chats;
+    vector<MemberRow> members;
+    vector<MessageRow> messages;
+    vector<LineError> errors;
+
+    size_t rows() const {
+        return users.size() + chats.size() + members.size() + messages.size();
+    }
+};
+
+// Очередь фиксированной емкости между читателем и потоками разбора
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    // false - очередь закрыта
+    bool push(T item) {
+        unique_lock<mutex> lock(mtx);
+        notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed) {
+            return false;
+        }
+        items.push_back(move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // false - очередь закрыта и пуста
+    bool pop(T& item) {
+        unique_lock<mutex> lock(mtx);
+        notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty()) {
+            return false;
+        }
+        item = move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        lock_guard<mutex> lock(mtx);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    mutex mtx;
+    condition_variable notFull;
+    condition_variable notEmpty;
+    deque<T> items;
+    bool closed = false;
+};
+
+// Разобранные блоки в порядке номеров: потоки разбора заканчивают блоки
+// вразнобой, а писатель берет их строго по очереди. Вперед принимается
+// не больше capacity блоков, поэтому память ограничена
+class ReorderBuffer {
+public:
+    explicit ReorderBuffer(size_t capacity) : capacity(capacity) {}
+
+    bool put(size_t sequence, ParsedBlock block) {
+        unique_lock<mutex> lock(mtx);
+        changed.wait(lock, [&] { return aborted || sequence < next + capacity; });
+        if (aborted) {
+            return false;
+        }
+        ready.emplace(sequence, move(block));
+        changed.notify_all();
+        return true;
+    }
+
+    // false - все блоки выданы или загрузка прервана
+    bool take(ParsedBlock& block) {
+        unique_lock<mutex> lock(mtx);
+        changed.wait(lock, [this] { return aborted || next == total || ready.count(next) > 0; });
+        if (aborted || next == total) {
+            return false;
+        }
+        auto it = ready.find(next);
+        block = move(it->second);
+        ready.erase(it);
+        next++;
+        changed.notify_all();
+        return true;
+    }
+
+    // Читатель закончил: всего блоков - total
+    void finish(size_t blocks) {
+        lock_guard<mutex> lock(mtx);
+        total = blocks;
+        changed.notify_all();
+    }
+
+    void abort() {
+        lock_guard<mutex> lock(mtx);
+        aborted = true;
+        changed.notify_all();
+    }
+
+private:
+    size_t capacity;
+    mutex mtx;
+    condition_variable changed;
+    map<size_t, ParsedBlock> ready;
+    size_t next = 0;
+    size_t total = SIZE_MAX;
+    bool aborted = false;
+};
+
+long long optionalInt(const crow::json::rvalue& json, const char* key) {
+    return json.has(key) && json[key].t() != crow::json::type::Null ? json[key].i() : 0;
+}
+
+string optionalString(const crow::json::rvalue& json, const char* key) {
+    return json.has(key) && json[key].t() != crow::json::type::Null ? string(json[key].s()) : string();
+}
+
+void parseLine(const char* data, size_t size, ParsedBlock& out) {
+    auto json = crow::json::load(data, size);
+    if (!json || json.t() != crow::json::type::Object || !json.has("type")) {
+        throw runtime_error("expected a JSON object with \"type\"");
+    }
+
+    string type = json["type"].s();
+    if (type == "message") {
+        MessageRow row;
+        row.id = optionalInt(json, "id");
+        row.chatId = json["chatId"].i();
+        row.userId = json["userId"].i();
+        row.message = json["message"].s();
+        row.replyId = optionalInt(json, "replyId");
+        row.resendId = optionalInt(json, "resendId");
+        row.sendDate = optionalString(json, "sendDate");
+        if (row.chatId <= 0 || row.userId <= 0) {
+            throw runtime_error("chatId and userId must be positive");
+        }
+        out.messages.push_back(move(row));
+    }
+    else if (type == "member") {
+        MemberRow row{ json["chatId"].i(), json["userId"].i() };
+        out.members.push_back(row);
+    }
+    else if (type == "chat") {
+        ChatRow row;
+        row.id = optionalInt(json, "id");
+        row.name = optionalString(json, "name");
+        row.isGroup = json.has("isGroup") && json["isGroup"].b();
+        row.createdBy = optionalInt(json, "createdBy");
+        row.createdAt = optionalString(json, "createdAt");
+        if (json.has("members")) {
+            if (row.id <= 0) {
+                throw runtime_error("chat with members needs an id");
+            }
+            for (const auto& userId : json["members"]) {
+                out.members.push_back({ row.id, userId.i() });
+            }
+        }
+        out.chats.push_back(move(row));
+    }
+    else if (type == "user") {
+        UserRow row;
+        row.id = optionalInt(json, "id");
+        row.name = json["name"].s();
+        row.login = json["login"].s();
+        // Тот же формат хэша, что и в Database::registerUser
+        row.password = json.has("passwordHash")
+            ? string(json["passwordHash"].s())
+            : to_string(hash<string>{}(string(json["password"].s())));
+        out.users.push_back(move(row));
+    }
+    else {
+        throw runtime_error("unknown type \"" + type + "\"");
+    }
+}
+
+ParsedBlock parseBlock(const Block& block) {
+    ParsedBlock parsed;
+    long long line = block.firstLine;
+    size_t pos = 0;
+    while (pos < block.text.size()) {
+        size_t end = block.text.find('\n', pos);
+        if (end == string::npos) {
+            end = block.text.size();
+        }
+        size_t size = end - pos;
+        if (size > 0 && block.text[pos + size - 1] == '\r') {
+            size--;
+        }
+        if (size > 0) {
+            try {
+                parseLine(block.text.data() + pos, size, parsed);
+            }
+            catch (const exception& e) {
+                parsed.errors.push_back({ line, e.what() });
+            }
+        }
+        pos = end + 1;
+        line++;
+    }
+    return parsed;
+}
+
+void exec(sqlite3* db, const string& sql) {
+    char* errMsg = nullptr;
+    if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errMsg) != SQLITE_OK) {
+        string error = "SQL error: " + string(errMsg);
+        sqlite3_free(errMsg);
+        throw runtime_error(error);
+    }
+}
+
+// Подготовленный запрос вставки; 0 вместо id и пустая строка даты - NULL,
+// то есть следующий id и значение по умолчанию
+class Insert {
+public:
+    Insert(sqlite3* db, const char* sql) : db(db) {
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+            throw runtime_error("SQL error: " + string(sqlite3_errmsg(db)));
+        }
+    }
+
+    ~Insert() {
+        sqlite3_finalize(stmt);
+    }
+
+    Insert& bind(int index, long long value) {
+        sqlite3_bind_int64(stmt, index, value);
+        return *this;
+    }
+
+    Insert& bindId(int index, long long value) {
+        if (value > 0) {
+            sqlite3_bind_int64(stmt, index, value);
+        }
+        else {
+            sqlite3_bind_null(stmt, index);
+        }
+        return *this;
+    }
+
+    Insert& bind(int index, const string& value) {
+        sqlite3_bind_text(stmt, index, value.data(), static_cast<int>(value.size()), SQLITE_STATIC);
+        return *this;
+    }
+
+    Insert& bindOptional(int index, const string& value) {
+        if (value.empty()) {
+            sqlite3_bind_null(stmt, index);
+        }
+        else {
+            bind(index, value);
+        }
+        return *this;
+    }
+
+    // false - строка уже есть (OR IGNORE)
+    bool insert() {
+        int result = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (result != SQLITE_DONE) {
+            throw runtime_error("SQL error: " + string(sqlite3_errmsg(db)));
+        }
+        return sqlite3_changes(db) > 0;
+    }
+
+private:
+    sqlite3* db;
+    sqlite3_stmt* stmt = nullptr;
+};
+
+const char* const importedTables = "'users', 'chats', 'user_chats', 'messages'";
+
+// Вторичные индексы таблиц импорта (без автоматических для PRIMARY KEY/UNIQUE):
+// имя и CREATE INDEX
+vector<pair<string, string>> secondaryIndexes(sqlite3* db) {
+    string sql = string("SELECT name, sql FROM sqlite_master WHERE type = 'index' AND sql IS NOT NULL "
+        "AND tbl_name IN (") + importedTables + ")";
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        throw runtime_error("SQL error: " + string(sqlite3_errmsg(db)));
+    }
+    vector<pair<string, string>> indexes;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        indexes.emplace_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+            reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)));
+    }
+    sqlite3_finalize(stmt);
+    return indexes;
+}
+
+struct Counts {
+    long long users = 0;
+    long long chats = 0;
+    long long members = 0;
+    long long messages = 0;
+    long long skipped = 0;          // строки с уже существующим ключом
+    long long errors = 0;
+};
+
+// Единственный писатель: вставляет разобранные блоки по порядку
+class Writer {
+public:
+    Writer(sqlite3* db, const Options& options)
+        : db(db), options(options),
+        insertUser(db, "INSERT OR IGNORE INTO users (id, name, login, password) VALUES (?, ?, ?, ?)"),
+        insertChat(db, "INSERT OR IGNORE INTO chats (id, name, is_group, created_by, created_at) "
+            "VALUES (?, ?, ?, ?, COALESCE(?, CURRENT_TIMESTAMP))"),
+        insertMember(db, "INSERT OR IGNORE INTO user_chats (user_id, chat_id) VALUES (?, ?)"),
+        insertMessage(db, "INSERT OR IGNORE INTO messages (id, user_id, chat_id, msg, reply_id, send_date, resend_id) "
+            "VALUES (?, ?, ?, ?, ?, COALESCE(?, CURRENT_TIMESTAMP), ?)"),
+        started(Clock::now()) {
+        exec(db, "BEGIN");
+    }
+
+    void write(const ParsedBlock& block) {
+        for (const auto& error : block.errors) {
+            if (++counts.errors <= 10) {
+                fprintf(stderr, "\r  line %lld: %s\n", error.line, error.error.c_str());
+            }
+        }
+        if (options.maxErrors >= 0 && counts.errors > options.maxErrors) {
+            throw runtime_error("too many invalid lines (--max-errors=" + to_string(options.maxErrors) + ")");
+        }
+
+        for (const auto& user : block.users) {
+            count(insertUser.bindId(1, user.id).bind(2, user.name).bind(3, user.login).bind(4, user.password).insert(),
+                counts.users);
+        }
+        for (const auto& chat : block.chats) {
+            count(insertChat.bindId(1, chat.id).bind(2, chat.name).bind(3, chat.isGroup ? 1 : 0)
+                .bind(4, chat.createdBy).bindOptional(5, chat.createdAt).insert(), counts.chats);
+        }
+        for (const auto& member : block.members) {
+            count(insertMember.bind(1, member.userId).bind(2, member.chatId).insert(), counts.members);
+        }
+        for (const auto& message : block.messages) {
+            count(insertMessage.bindId(1, message.id).bind(2, message.userId).bind(3, message.chatId)
+                .bind(4, message.message).bind(5, message.replyId).bindOptional(6, message.sendDate)
+                .bind(7, message.resendId).insert(), counts.messages);
+        }
+    }
+
+    // Фиксирует записанное и после ошибки: без журнала откатить все равно нельзя
+    void finish() {
+        if (!sqlite3_get_autocommit(db)) {
+            exec(db, "COMMIT");
+        }
+        double seconds = chrono::duration<double>(Clock::now() - started).count();
+        fprintf(stderr, "\r  %lld rows in %.1fs (%.0f rows/s)%20s\n", rows, seconds, seconds > 0 ? rows / seconds : 0.0, "");
+    }
+
+    const Counts& totals() const {
+        return counts;
+    }
+
+private:
+    sqlite3* db;
+    const Options& options;
+    Insert insertUser;
+    Insert insertChat;
+    Insert insertMember;
+    Insert insertMessage;
+    Counts counts;
+    long long rows = 0;
+    Clock::time_point started;
+
+    void count(bool inserted, long long& counter) {
+        if (inserted) {
+            counter++;
+        }
+        else {
+            counts.skipped++;
+        }
+        if (++rows % options.batch == 0) {
+            exec(db, "COMMIT");
+            exec(db, "BEGIN");
+            double seconds = chrono::duration<double>(Clock::now() - started).count();
+            fprintf(stderr, "\r  %12lld rows (%.0f rows/s)", rows, rows / seconds);
+        }
+    }
+};
+
+// Конвейер: читатель (текущий поток) -> потоки разбора -> писатель
+Counts load(sqlite3* db, istream& input, const Options& options) {
+    BoundedQueue<Block> blocks(options.threads * 2);
+    ReorderBuffer parsed(options.threads * 4);
+
+    vector<thread> parsers;
+    for (size_t i = 0; i < options.threads; i++) {
+        parsers.emplace_back([&]() {
+            Block block;
+            while (blocks.pop(block)) {
+                if (!parsed.put(block.sequence, parseBlock(block))) {
+                    return;
+                }
+            }
+            });
+    }
+
+    Writer writer(db, options);
+    exception_ptr writeError;
+    thread writerThread([&]() {
+        try {
+            ParsedBlock block;
+            while (parsed.take(block)) {
+                writer.write(block);
+            }
+        }
+        catch (...) {
+            writeError = current_exception();
+            blocks.close();
+            parsed.abort();
+        }
+        });
+
+    // Блоки режутся по последнему переводу строки, остаток переходит в следующий
+    size_t sequence = 0;
+    long long line = 1;
+    string carry;
+    vector<char> buffer(options.blockSize);
+    while (input) {
+        input.read(buffer.data(), static_cast<streamsize>(buffer.size()));
+        size_t read = static_cast<size_t>(input.gcount());
+        if (read == 0) {
+            break;
+        }
+        string text = move(carry);
+        text.append(buffer.data(), read);
+        size_t cut = text.rfind('\n');
+        if (cut == string::npos) {
+            carry = move(text);
+            continue;
+        }
+        carry = text.substr(cut + 1);
+        text.resize(cut + 1);
+
+        long long lines = count(text.begin(), text.end(), '\n');
+        if (!blocks.push({ sequence++, line, move(text) })) {
+            break;
+        }
+        line += lines;
+    }
+    if (!carry.empty()) {
+        blocks.push({ sequence++, line, move(carry) });
+    }
+    blocks.close();
+    parsed.finish(sequence);
+
+    for (auto& parser : parsers) {
+        parser.join();
+    }
+    writerThread.join();
+    writer.finish();
+    if (writeError) {
+        rethrow_exception(writeError);
+    }
+    return writer.totals();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    ToolOptions args(argc, argv);
+    Options options = Options::parse(args);
+    if (args.has("help") || options.input.empty()) {
+        cout << "Usage: chatserver_import [--db=chat.db] [--fresh] [--threads=N] [--batch=500000]\n"
+            "  [--block-kb=4096] [--max-errors=100] <history.ndjson | ->" << endl;
+        return args.has("help") ? 0 : 1;
+    }
+
+    try {
+        if (options.fresh) {
+            filesystem::remove(options.dbPath);
+        }
+
+        // Схему создает сам сервер
+        {
+            Database schema(options.dbPath);
+        }
+
+        ifstream file;
+        if (options.input != "-") {
+            file.open(options.input, ios::binary);
+            if (!file) {
+                throw runtime_error("Cannot open " + options.input);
+            }
+        }
+        istream& input = options.input == "-" ? cin : file;
+
+        sqlite3* db;
+        if (sqlite3_open(options.dbPath.c_str(), &db) != SQLITE_OK) {
+            throw runtime_error("Can't open database: " + string(sqlite3_errmsg(db)));
+        }
+
+        auto started = Clock::now();
+        cerr << "Importing " << options.input << " into " << options.dbPath
+            << " (" << options.threads << " parser threads)" << endl;
+
+        // Монопольно: без журнала одновременная запись другого процесса испортит базу
+        exec(db, "PRAGMA locking_mode=EXCLUSIVE");
+        exec(db, "PRAGMA journal_mode=OFF");
+        exec(db, "PRAGMA synchronous=OFF");
+        exec(db, "PRAGMA cache_size=-262144");
+        exec(db, "PRAGMA temp_store=MEMORY");
+
+        // Индексы строятся после загрузки: одна сортировка вместо вставки
+        // в B-дерево индекса на каждую строку
+        auto indexes = secondaryIndexes(db);
+        for (const auto& index : indexes) {
+            exec(db, "DROP INDEX \"" + index.first + "\"");
+        }
+
+        Counts counts;
+        exception_ptr loadError;
+        try {
+            counts = load(db, input, options);
+        }
+        catch (...) {
+            loadError = current_exception();
+        }
+
+        // Индексы возвращаются и после ошибки: база без них работает, но медленно
+        for (const auto& index : indexes) {
+            auto indexStarted = Clock::now();
+            exec(db, index.second);
+            fprintf(stderr, "  index %s built in %.1fs\n", index.first.c_str(),
+                chrono::duration<double>(Clock::now() - indexStarted).count());
+        }
+        exec(db, "PRAGMA journal_mode=WAL");
+        sqlite3_close(db);
+        if (loadError) {
+            rethrow_exception(loadError);
+        }
+
+        cerr << "  users " << counts.users << ", chats " << counts.chats << ", members " << counts.members
+            << ", messages " << counts.messages << ", skipped " << counts.skipped
+            << ", invalid lines " << counts.errors << endl;
+        cerr << "Done in " << chrono::duration<double>(Clock::now() - started).count() << "s" << endl;
+    }
+    catch (const exception& e) {
+        cerr << "Import failed: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,530 @@
+﻿// Генератор синтетических данных для нагрузочного тестирования.
+//
+// Заполняет таблицы users, chats, user_chats, contacts и messages
+// (схема из Database::createTables) реалистичными распределениями:
+//   - активность чатов по закону Ципфа (немного "горячих" чатов получают большую часть сообщений);
+//   - размеры групп по степенному закону, большинство чатов - личные переписки;
+//   - длина сообщений по логнормальному закону, смесь кириллицы, латиницы и эмодзи;
+//   - число контактов пользователя по степенному закону.
+// Вставка идет крупными транзакциями через подготовленные запросы.
+// При одинаковом --seed результат полностью воспроизводим.
+//
+// Пример:
+//   chatserver_datagen --db=chat.db --users=1000000 --chats=300000 --messages=20000000 --seed=42
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "Database.h"
+#include "ToolOptions.h"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+namespace {
+
+struct Options {
+    string dbPath = "chat.db";
+    long long users = 10000;
+    long long chats = 5000;
+    long long messages = 1000000;
+    double contactsPerUser = 10;
+    double directRatio = 0.7;      // доля личных чатов
+    double groupAlpha = 2.2;       // показатель степенного закона размеров групп
+    int maxGroupSize = 5000;
+    double zipfS = 1.1;            // показатель Ципфа для активности чатов
+    double cyrillicRatio = 0.6;
+    double emojiRatio = 0.05;      // вероятность эмодзи вместо слова
+    double replyRatio = 0.1;
+    double forwardRatio = 0.02;
+    int days = 365;                // период истории сообщений
+    long long endTime = 1767225600; // конец истории (unix time), фиксирован ради воспроизводимости
+    long long batch = 200000;      // строк на транзакцию
+    unsigned long long seed = 42;
+    bool fresh = false;
+
+    static Options parse(const ToolOptions& args) {
+        Options o;
+        o.dbPath = args.get("db", o.dbPath);
+        o.users = args.getInt("users", o.users);
+        o.chats = args.getInt("chats", o.chats);
+        o.messages = args.getInt("messages", o.messages);
+        o.contactsPerUser = args.getDouble("contacts-per-user", o.contactsPerUser);
+        o.directRatio = args.getDouble("direct-ratio", o.directRatio);
+        o.groupAlpha = args.getDouble("group-alpha", o.groupAlpha);
+        o.maxGroupSize = static_cast<int>(args.getInt("max-group-size", o.maxGroupSize));
+        o.zipfS = args.getDouble("zipf-s", o.zipfS);
+        o.cyrillicRatio = args.getDouble("cyrillic-ratio", o.cyrillicRatio);
+        o.emojiRatio = args.getDouble("emoji-ratio", o.emojiRatio);
+        o.replyRatio = args.getDouble("reply-ratio", o.replyRatio);
+        o.forwardRatio = args.getDouble("forward-ratio", o.forwardRatio);
+        o.days = static_cast<int>(args.getInt("days", o.days));
+        o.endTime = args.getInt("end-time", o.endTime);
+        o.batch = args.getInt("batch", o.batch);
+        o.seed = static_cast<unsigned long long>(args.getInt("seed", static_cast<long long>(o.seed)));
+        o.fresh = args.has("fresh");
+
+        // users и batch - делители (rng() % users, rows % batch), groupAlpha - 1 тоже
+        if (o.users < 1) {
+            throw invalid_argument("--users must be at least 1");
+        }
+        if (o.batch < 1) {
+            throw invalid_argument("--batch must be at least 1");
+        }
+        if (o.groupAlpha <= 1) {
+            throw invalid_argument("--group-alpha must be greater than 1");
+        }
+        if (o.chats < 0 || o.messages < 0 || o.days < 0 || o.contactsPerUser < 0) {
+            throw invalid_argument("--chats, --messages, --days and --contacts-per-user must not be negative");
+        }
+        return o;
+    }
+};
+
+const vector<string> cyrillicWords = {
+    "привет", "как", "дела", "сегодня", "завтра", "встреча", "отчет", "проект", "задача", "готово",
+    "спасибо", "пожалуйста", "хорошо", "отлично", "понял", "сделаю", "вечером", "утром", "код", "релиз",
+    "сервер", "база", "данных", "ошибка", "исправил", "посмотри", "ссылка", "документ", "созвон", "минут",
+    "да", "нет", "может", "быть", "очень", "нужно", "срочно", "потом", "тест", "работает",
+};
+
+const vector<string> latinWords = {
+    "hello", "ok", "thanks", "meeting", "deploy", "review", "merge", "build", "test", "done",
+    "please", "check", "link", "today", "tomorrow", "lunch", "call", "bug", "fix", "release",
+    "the", "and", "is", "it", "for", "on", "in", "we", "you", "this",
+};
+
+const vector<string> emojis = {
+    "😀", "😂", "👍", "🔥", "🎉", "❤️", "🙏", "😅", "🤔", "👀", "✅", "🚀",
+};
+
+const vector<string> firstNames = {
+    "Алексей", "Мария", "Иван", "Ольга", "Дмитрий", "Анна", "Сергей", "Елена",
+    "John", "Emma", "Michael", "Sophia", "David", "Olivia", "Daniel", "Mia",
+};
+
+const vector<string> lastNames = {
+    "Иванов", "Смирнова", "Кузнецов", "Попова", "Соколов", "Лебедева", "Козлов", "Новикова",
+    "Smith", "Johnson", "Brown", "Taylor", "Miller", "Wilson", "Moore", "Clark",
+};
+
+// Обертка над sqlite3 для потоковой вставки через один подготовленный запрос
+class BulkInserter {
+public:
+    BulkInserter(sqlite3* db, const char* sql) : db(db) {
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+            throw runtime_error("SQL error: " + string(sqlite3_errmsg(db)));
+        }
+    }
+
+    ~BulkInserter() {
+        sqlite3_finalize(stmt);
+    }
+
+    BulkInserter& bind(int index, long long value) {
+        sqlite3_bind_int64(stmt, index, value);
+        return *this;
+    }
+
+    BulkInserter& bind(int index, const string& value) {
+        sqlite3_bind_text(stmt, index, value.data(), static_cast<int>(value.size()), SQLITE_STATIC);
+        return *this;
+    }
+
+    void insert() {
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            throw runtime_error("SQL error: " + string(sqlite3_errmsg(db)));
+        }
+        sqlite3_reset(stmt);
+    }
+
+private:
+    sqlite3* db;
+    sqlite3_stmt* stmt = nullptr;
+};
+
+void exec(sqlite3* db, const string& sql) {
+    char* errMsg = nullptr;
+    if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errMsg) != SQLITE_OK) {
+        string error = "SQL error: " + string(errMsg);
+        sqlite3_free(errMsg);
+        throw runtime_error(error);
+    }
+}
+
+// Коммитит транзакцию каждые batch строк и печатает прогресс
+class Progress {
+public:
+    Progress(sqlite3* db, const string& table, long long total, long long batch)
+        : db(db), table(table), total(total), batch(batch), started(Clock::now()) {
+        exec(db, "BEGIN");
+    }
+
+    void row() {
+        if (++rows % batch == 0) {
+            exec(db, "COMMIT");
+            exec(db, "BEGIN");
+            double seconds = chrono::duration<double>(Clock::now() - started).count();
+            fprintf(stderr, "\r  %-10s %12lld / %lld  (%.0f rows/s)", table.c_str(), rows, total, rows / seconds);
+        }
+    }
+
+    void finish() {
+        exec(db, "COMMIT");
+        double seconds = chrono::duration<double>(Clock::now() - started).count();
+        fprintf(stderr, "\r  %-10s %12lld rows in %.1fs (%.0f rows/s)\n",
+            table.c_str(), rows, seconds, seconds > 0 ? rows / seconds : 0.0);
+    }
+
+private:
+    sqlite3* db;
+    string table;
+    long long total;
+    long long batch;
+    long long rows = 0;
+    Clock::time_point started;
+};
+
+// Выборка ранга по закону Ципфа через предвычисленную функцию распределения
+class ZipfDistribution {
+public:
+    ZipfDistribution(size_t n, double s) : cdf(n) {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum += 1.0 / pow(static_cast<double>(i + 1), s);
+            cdf[i] = sum;
+        }
+        for (auto& value : cdf) {
+            value /= sum;
+        }
+    }
+
+    template <typename Rng>
+    size_t operator()(Rng& rng) {
+        double u = uniform_real_distribution<double>(0, 1)(rng);
+        return min(static_cast<size_t>(lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin()), cdf.size() - 1);
+    }
+
+private:
+    vector<double> cdf;
+};
+
+// Дискретный степенной закон на [minValue, maxValue]
+template <typename Rng>
+long long powerLaw(Rng& rng, double alpha, long long minValue, long long maxValue) {
+    double u = uniform_real_distribution<double>(0, 1)(rng);
+    double value = minValue * pow(1.0 - u, -1.0 / (alpha - 1.0));
+    // Хвост может выйти за пределы long long, поэтому ограничиваем до приведения
+    return static_cast<long long>(min(static_cast<double>(maxValue), value));
+}
+
+string formatTimestamp(time_t t) {
+    tm parts{};
+#ifdef _WIN32
+    gmtime_s(&parts, &t);
+#else
+    gmtime_r(&t, &parts);
+#endif
+    char buffer[20];
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &parts);
+    return buffer;
+}
+
+class Generator {
+public:
+    Generator(sqlite3* db, const Options& options) : db(db), options(options), rng(options.seed) {
+    }
+
+    void run() {
+        generateUsers();
+        generateChats();
+        generateContacts();
+        generateMessages();
+    }
+
+private:
+    sqlite3* db;
+    const Options& options;
+    mt19937_64 rng;
+
+    long long firstUserId = 0;
+    vector<long long> chatIds;
+    vector<vector<long long>> chatMembers;
+
+    long long randomUser() {
+        return firstUserId + static_cast<long long>(rng() % options.users);
+    }
+
+    // count разных пользователей, кроме exclude, без возвращения (алгоритм Флойда):
+    // ровно count шагов при любом соотношении count и users
+    vector<long long> sampleUsers(long long count, long long exclude) {
+        long long n = options.users - 1;
+        long long skipped = exclude - firstUserId;
+        unordered_set<long long> chosen;
+        vector<long long> result;
+        result.reserve(count);
+        for (long long j = n - count; j < n; j++) {
+            long long t = uniform_int_distribution<long long>(0, j)(rng);
+            long long index = chosen.count(t) ? j : t;
+            chosen.insert(index);
+            result.push_back(firstUserId + (index >= skipped ? index + 1 : index));
+        }
+        return result;
+    }
+
+    template <typename T>
+    const T& pick(const vector<T>& items) {
+        return items[rng() % items.size()];
+    }
+
+    long long lastInsertId() {
+        return sqlite3_last_insert_rowid(db);
+    }
+
+    void generateUsers() {
+        BulkInserter insert(db, "INSERT INTO users (name, login, password) VALUES (?, ?, ?)");
+        Progress progress(db, "users", options.users, options.batch);
+
+        // Логины продолжают нумерацию, если база уже не пуста
+        long long offset = 0;
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, "SELECT IFNULL(MAX(id), 0) FROM users", -1, &stmt, nullptr) == SQLITE_OK) {
+            if (sqlite3_step(stmt) == SQLITE_ROW) {
+                offset = sqlite3_column_int64(stmt, 0);
+            }
+            sqlite3_finalize(stmt);
+        }
+
+        for (long long i = 1; i <= options.users; i++) {
+            string name = pick(firstNames) + " " + pick(lastNames);
+            string login = "user" + to_string(offset + i);
+            // Тот же формат хэша, что и в Database::registerUser
+            string password = to_string(hash<string>{}("password" + to_string(offset + i)));
+            insert.bind(1, name).bind(2, login).bind(3, password).insert();
+            if (i == 1) {
+                firstUserId = lastInsertId();
+            }
+            progress.row();
+        }
+        progress.finish();
+    }
+
+    void generateChats() {
+        BulkInserter insertChat(db, "INSERT INTO chats (name, is_group, created_by, created_at) VALUES (?, ?, ?, ?)");
+        BulkInserter insertMember(db, "INSERT OR IGNORE INTO user_chats (user_id, chat_id) VALUES (?, ?)");
+        Progress progress(db, "chats", options.chats, options.batch);
+
+        time_t start = static_cast<time_t>(options.endTime) - static_cast<time_t>(options.days) * 86400;
+
+        long long memberships = 0;
+        chatIds.reserve(options.chats);
+        chatMembers.reserve(options.chats);
+
+        for (long long c = 0; c < options.chats; c++) {
+            bool isGroup = uniform_real_distribution<double>(0, 1)(rng) >= options.directRatio;
+            long long size = isGroup
+                ? powerLaw(rng, options.groupAlpha, 3, min<long long>(options.maxGroupSize, options.users))
+                : 2;
+            size = clamp<long long>(size, 1, options.users);
+
+            long long creator = randomUser();
+            vector<long long> members = sampleUsers(size - 1, creator);
+            members.push_back(creator);
+            sort(members.begin(), members.end());
+
+            string name = isGroup ? "Группа " + to_string(c + 1) : "Direct " + to_string(c + 1);
+            string createdAt = formatTimestamp(start + static_cast<time_t>(rng() % 86400));
+            insertChat.bind(1, name).bind(2, isGroup ? 1 : 0).bind(3, creator).bind(4, createdAt).insert();
+            long long chatId = lastInsertId();
+
+            for (long long userId : members) {
+                insertMember.bind(1, userId).bind(2, chatId).insert();
+            }
+            memberships += members.size();
+
+            chatIds.push_back(chatId);
+            chatMembers.push_back(move(members));
+            progress.row();
+        }
+        progress.finish();
+        fprintf(stderr, "  user_chats %12lld rows\n", memberships);
+    }
+
+    void generateContacts() {
+        // Пары (min, max) собираются заранее, чтобы не было дубликатов в обе стороны
+        vector<pair<long long, long long>> pairs;
+        pairs.reserve(static_cast<size_t>(options.users * options.contactsPerUser / 2));
+
+        double minDegree = max(1.0, options.contactsPerUser * 0.3);
+        for (long long i = 0; i < options.users; i++) {
+            long long userId = firstUserId + i;
+            long long degree = powerLaw(rng, 2.5, static_cast<long long>(minDegree), options.users - 1) / 2;
+            for (long long k = 0; k < degree; k++) {
+                long long other = randomUser();
+                if (other != userId) {
+                    pairs.emplace_back(min(userId, other), max(userId, other));
+                }
+            }
+        }
+        sort(pairs.begin(), pairs.end());
+        pairs.erase(unique(pairs.begin(), pairs.end()), pairs.end());
+        // Порядок вставки не должен коррелировать с id
+        shuffle(pairs.begin(), pairs.end(), rng);
+
+        BulkInserter insert(db, "INSERT INTO contacts (user_id1, user_id2) VALUES (?, ?)");
+        Progress progress(db, "contacts", static_cast<long long>(pairs.size()), options.batch);
+        for (const auto& [userId1, userId2] : pairs) {
+            insert.bind(1, userId1).bind(2, userId2).insert();
+            progress.row();
+        }
+        progress.finish();
+    }
+
+    // Логнормальная длина сообщения: медиана ~40 символов, длинный хвост
+    string randomText() {
+        lognormal_distribution<double> lengthDist(3.7, 0.9);
+        size_t length = static_cast<size_t>(clamp(lengthDist(rng), 1.0, 4000.0));
+        bool cyrillic = uniform_real_distribution<double>(0, 1)(rng) < options.cyrillicRatio;
+        const vector<string>& words = cyrillic ? cyrillicWords : latinWords;
+
+        // Длина считается в символах, а не байтах
+        string text;
+        size_t chars = 0;
+        while (chars < length) {
+            if (!text.empty()) {
+                text += ' ';
+                chars++;
+            }
+            if (uniform_real_distribution<double>(0, 1)(rng) < options.emojiRatio) {
+                text += pick(emojis);
+                chars++;
+            }
+            else {
+                const string& word = pick(words);
+                text += word;
+                chars += cyrillic ? word.size() / 2 : word.size();
+            }
+        }
+        return text;
+    }
+
+    void generateMessages() {
+        if (chatIds.empty()) {
+            return;
+        }
+
+        BulkInserter insert(db,
+            "INSERT INTO messages (user_id, chat_id, msg, reply_id, send_date, resend_id) VALUES (?, ?, ?, ?, ?, ?)");
+        Progress progress(db, "messages", options.messages, options.batch);
+
+        // Ранги "популярности" случайно распределяются по чатам
+        vector<size_t> byRank(chatIds.size());
+        for (size_t i = 0; i < byRank.size(); i++) {
+            byRank[i] = i;
+        }
+        shuffle(byRank.begin(), byRank.end(), rng);
+        ZipfDistribution chatDist(chatIds.size(), options.zipfS);
+
+        vector<long long> lastMessage(chatIds.size(), 0);
+
+        time_t end = static_cast<time_t>(options.endTime);
+        time_t start = end - static_cast<time_t>(options.days) * 86400;
+        double step = static_cast<double>(end - start) / max(1LL, options.messages);
+
+        uniform_real_distribution<double> unit(0, 1);
+        for (long long m = 0; m < options.messages; m++) {
+            size_t chat = byRank[chatDist(rng)];
+            const auto& members = chatMembers[chat];
+            long long userId = members[rng() % members.size()];
+
+            long long replyId = 0;
+            long long resendId = 0;
+            string text = randomText();
+            if (lastMessage[chat] && unit(rng) < options.replyRatio) {
+                replyId = lastMessage[chat];
+            }
+            else if (unit(rng) < options.forwardRatio) {
+                // Как в /messages/forward: resend_id хранит автора оригинала
+                resendId = randomUser();
+                text = "[Forwarded] " + text;
+            }
+
+            string sendDate = formatTimestamp(start + static_cast<time_t>(m * step));
+            insert.bind(1, userId).bind(2, chatIds[chat]).bind(3, text)
+                .bind(4, replyId).bind(5, sendDate).bind(6, resendId).insert();
+            lastMessage[chat] = lastInsertId();
+            progress.row();
+        }
+        progress.finish();
+    }
+};
+
+} // namespace
+
+int main(int argc, char** argv) {
+    ToolOptions args(argc, argv);
+    if (args.has("help")) {
+        cout << "Usage: chatserver_datagen [--db=chat.db] [--fresh] [--seed=42]\n"
+            "  [--users=10000] [--chats=5000] [--messages=1000000] [--contacts-per-user=10]\n"
+            "  [--direct-ratio=0.7] [--group-alpha=2.2] [--max-group-size=5000] [--zipf-s=1.1]\n"
+            "  [--cyrillic-ratio=0.6] [--emoji-ratio=0.05] [--reply-ratio=0.1] [--forward-ratio=0.02]\n"
+            "  [--days=365] [--end-time=1767225600] [--batch=200000]" << endl;
+        return 0;
+    }
+
+    Options options;
+    try {
+        options = Options::parse(args);
+    }
+    catch (const invalid_argument& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    try {
+        if (options.fresh) {
+            filesystem::remove(options.dbPath);
+        }
+
+        // Схему создает сам сервер
+        {
+            Database schema(options.dbPath);
+        }
+
+        sqlite3* db;
+        if (sqlite3_open(options.dbPath.c_str(), &db) != SQLITE_OK) {
+            throw runtime_error("Can't open database: " + string(sqlite3_errmsg(db)));
+        }
+
+        // Данные генерируются заново при сбое, поэтому журнал и fsync не нужны
+        exec(db, "PRAGMA journal_mode=MEMORY");
+        exec(db, "PRAGMA synchronous=OFF");
+        exec(db, "PRAGMA cache_size=-262144");
+        exec(db, "PRAGMA temp_store=MEMORY");
+
+        auto started = Clock::now();
+        cerr << "Generating dataset into " << options.dbPath << " (seed " << options.seed << ")" << endl;
+
+        Generator(db, options).run();
+
+        sqlite3_close(db);
+        cerr << "Done in " << chrono::duration<double>(Clock::now() - started).count() << "s" << endl;
+    }
+    catch (const exception& e) {
+        cerr << "Generation failed: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,188 @@
+﻿#pragma once
+
+#include <asio.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+
+// Минимальный асинхронный HTTP/1.1 клиент поверх asio с keep-alive.
+// Одно соединение обслуживает один запрос за раз; при обрыве
+// переподключается перед следующим запросом.
+class HttpConnection : public std::enable_shared_from_this<HttpConnection> {
+public:
+    struct Response {
+        int status = 0;
+        std::string body;
+        int retryAfter = 0; // секунды из Retry-After, 0 - заголовка нет
+        std::chrono::steady_clock::duration latency{};
+    };
+
+    using Handler = std::function<void(const std::error_code&, Response&)>;
+
+    HttpConnection(asio::io_context& io, asio::ip::tcp::resolver::results_type endpoints, std::string host)
+        : socket(io), endpoints(std::move(endpoints)), host(std::move(host)) {
+    }
+
+    // extraHeaders - строки "Имя: значение\r\n"; Content-Type из них заменяет
+    // application/json по умолчанию
+    void request(const std::string& method, const std::string& target, const std::string& body,
+        Handler handler, const std::string& extraHeaders = "") {
+        current = std::move(handler);
+        response = Response{};
+        started = std::chrono::steady_clock::now();
+
+        outgoing = method + " " + target + " HTTP/1.1\r\n"
+            "Host: " + host + "\r\n"
+            "Connection: keep-alive\r\n" + extraHeaders;
+        if (!body.empty() || method == "POST" || method == "PUT" || method == "DELETE") {
+            if (!hasHeader(extraHeaders, "content-type:")) {
+                outgoing += "Content-Type: application/json\r\n";
+            }
+            outgoing += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+        }
+        outgoing += "\r\n";
+        outgoing += body;
+
+        if (connected) {
+            write();
+            return;
+        }
+
+        auto self = shared_from_this();
+        asio::async_connect(socket, endpoints,
+            [this, self](const std::error_code& ec, const asio::ip::tcp::endpoint&) {
+                if (ec) {
+                    finish(ec);
+                    return;
+                }
+                socket.set_option(asio::ip::tcp::no_delay(true));
+                connected = true;
+                write();
+            });
+    }
+
+    void close() {
+        std::error_code ignored;
+        socket.close(ignored);
+        connected = false;
+    }
+
+private:
+    asio::ip::tcp::socket socket;
+    asio::ip::tcp::resolver::results_type endpoints;
+    std::string host;
+    bool connected = false;
+    bool keepAlive = true;
+
+    std::string outgoing;
+    asio::streambuf incoming;
+    Response response;
+    Handler current;
+    std::chrono::steady_clock::time_point started;
+
+    // name - имя в нижнем регистре с двоеточием
+    static bool hasHeader(const std::string& headers, const std::string& name) {
+        size_t lineStart = 0;
+        while (lineStart < headers.size()) {
+            if (headers.size() - lineStart >= name.size() &&
+                std::equal(name.begin(), name.end(), headers.begin() + lineStart, [](char a, char b) {
+                    return a == std::tolower(static_cast<unsigned char>(b));
+                    })) {
+                return true;
+            }
+            size_t lineEnd = headers.find("\r\n", lineStart);
+            if (lineEnd == std::string::npos) {
+                break;
+            }
+            lineStart = lineEnd + 2;
+        }
+        return false;
+    }
+
+    void write() {
+        auto self = shared_from_this();
+        asio::async_write(socket, asio::buffer(outgoing),
+            [this, self](const std::error_code& ec, size_t) {
+                if (ec) {
+                    finish(ec);
+                    return;
+                }
+                readHeaders();
+            });
+    }
+
+    void readHeaders() {
+        auto self = shared_from_this();
+        asio::async_read_until(socket, incoming, "\r\n\r\n",
+            [this, self](const std::error_code& ec, size_t headerBytes) {
+                if (ec) {
+                    finish(ec);
+                    return;
+                }
+
+                std::string headers(asio::buffers_begin(incoming.data()),
+                    asio::buffers_begin(incoming.data()) + headerBytes);
+                incoming.consume(headerBytes);
+
+                // "HTTP/1.1 200 OK"
+                size_t space = headers.find(' ');
+                response.status = space == std::string::npos ? 0 : std::atoi(headers.c_str() + space + 1);
+
+                size_t contentLength = 0;
+                std::string lower(headers);
+                for (auto& c : lower) {
+                    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+                }
+                size_t pos = lower.find("\r\ncontent-length:");
+                if (pos != std::string::npos) {
+                    contentLength = std::strtoull(lower.c_str() + pos + 17, nullptr, 10);
+                }
+                pos = lower.find("\r\nretry-after:");
+                if (pos != std::string::npos) {
+                    response.retryAfter = std::atoi(lower.c_str() + pos + 14);
+                }
+                keepAlive = lower.find("\r\nconnection: close") == std::string::npos;
+
+                readBody(contentLength);
+            });
+    }
+
+    void readBody(size_t contentLength) {
+        if (incoming.size() >= contentLength) {
+            response.body.assign(asio::buffers_begin(incoming.data()),
+                asio::buffers_begin(incoming.data()) + contentLength);
+            incoming.consume(contentLength);
+            if (!keepAlive) {
+                close();
+            }
+            finish({});
+            return;
+        }
+
+        auto self = shared_from_this();
+        asio::async_read(socket, incoming, asio::transfer_exactly(contentLength - incoming.size()),
+            [this, self, contentLength](const std::error_code& ec, size_t) {
+                if (ec) {
+                    finish(ec);
+                    return;
+                }
+                readBody(contentLength);
+            });
+    }
+
+    void finish(const std::error_code& ec) {
+        response.latency = std::chrono::steady_clock::now() - started;
+        if (ec) {
+            close();
+            incoming.consume(incoming.size());
+        }
+        Handler handler = std::move(current);
+        current = nullptr;
+        handler(ec, response);
+    }
+};
@@ -0,0 +1,446 @@
+﻿// Генератор HTTP нагрузки для ChatServer.
+//
+// Каждый виртуальный пользователь регистрируется, логинится, создает чаты
+// и затем до окончания теста чередует отправку сообщений с чтением истории
+// и списка чатов, делая паузы "на размышление" между запросами.
+// По завершении печатается пропускная способность и p50/p99/p999 задержки
+// по каждому маршруту. Пропускная способность считается только по запросам,
+// завершившимся в устойчивом режиме - после разгона (--ramp-up) и до конца
+// теста. Регистрация и логин при ответах 429/503 повторяются с экспоненциальной
+// задержкой; число повторов печатается отдельно.
+//
+// Пример:
+//   chatserver_loadgen --users=200 --duration=60 --send-weight=1 --history-weight=4 --think-ms=50
+#include <crow/json.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HdrHistogram.h"
+#include "HttpClient.h"
+#include "ToolOptions.h"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+enum Route {
+    RouteRegister,
+    RouteLogin,
+    RouteCreateChat,
+    RouteSendMessage,
+    RouteChatMessages,
+    RouteUserChats,
+    RouteCount
+};
+
+const char* const routeNames[RouteCount] = {
+    "POST /auth/register",
+    "POST /auth/login",
+    "POST /chats",
+    "POST /messages",
+    "GET /chats/<id>/messages",
+    "GET /chats/<id>",
+};
+
+struct Options {
+    string host = "127.0.0.1";
+    string port = "18080";
+    int users = 50;
+    int threads = 1;
+    double duration = 30;      // секунды
+    double rampUp = 1;         // секунды на запуск всех пользователей
+    int chatsPerUser = 2;
+    int membersPerChat = 3;
+    double sendWeight = 1;
+    double historyWeight = 3;
+    double chatListWeight = 1;
+    double thinkMs = 100;      // среднее экспоненциального распределения, 0 - без пауз
+    int messageBytes = 64;
+    int maxRetries = 5;        // повторов регистрации и логина при 429/503
+    double retryBaseMs = 100;  // задержка перед первым повтором, дальше удваивается
+    unsigned seed = 1;
+    string runId;
+
+    static Options parse(const ToolOptions& args) {
+        Options o;
+        o.host = args.get("host", o.host);
+        o.port = args.get("port", o.port);
+        o.users = static_cast<int>(args.getInt("users", o.users));
+        o.threads = static_cast<int>(args.getInt("threads", max(1u, thread::hardware_concurrency())));
+        o.duration = args.getDouble("duration", o.duration);
+        o.rampUp = args.getDouble("ramp-up", o.rampUp);
+        o.chatsPerUser = static_cast<int>(args.getInt("chats-per-user", o.chatsPerUser));
+        o.membersPerChat = static_cast<int>(args.getInt("members-per-chat", o.membersPerChat));
+        o.sendWeight = args.getDouble("send-weight", o.sendWeight);
+        o.historyWeight = args.getDouble("history-weight", o.historyWeight);
+        o.chatListWeight = args.getDouble("chat-list-weight", o.chatListWeight);
+        o.thinkMs = args.getDouble("think-ms", o.thinkMs);
+        o.messageBytes = static_cast<int>(args.getInt("message-bytes", o.messageBytes));
+        o.maxRetries = static_cast<int>(args.getInt("max-retries", o.maxRetries));
+        o.retryBaseMs = args.getDouble("retry-base-ms", o.retryBaseMs);
+        o.seed = static_cast<unsigned>(args.getInt("seed", o.seed));
+        // Логины должны быть уникальны между прогонами на одной базе
+        o.runId = args.get("run-id", to_string(chrono::duration_cast<chrono::seconds>(
+            chrono::system_clock::now().time_since_epoch()).count()));
+        return o;
+    }
+};
+
+// Поток с собственным io_context и собственными гистограммами:
+// все пользователи потока работают на нем без блокировок
+struct Worker {
+    asio::io_context io;
+    array<HdrHistogram, RouteCount> latency;
+    array<uint64_t, RouteCount> errors{};
+    array<uint64_t, RouteCount> retries{};
+    array<uint64_t, RouteCount> steady{};   // завершены в устойчивом режиме
+};
+
+// Зарегистрированные пользователи, из которых выбираются участники чатов
+class UserRegistry {
+public:
+    void add(int userId) {
+        lock_guard<mutex> lock(m);
+        ids.push_back(userId);
+    }
+
+    vector<int> sample(mt19937& rng, int count, int exclude) {
+        lock_guard<mutex> lock(m);
+        vector<int> result;
+        for (int i = 0; i < count * 4 && static_cast<int>(result.size()) < count && !ids.empty(); i++) {
+            int id = ids[rng() % ids.size()];
+            if (id != exclude) {
+                result.push_back(id);
+            }
+        }
+        return result;
+    }
+
+private:
+    mutex m;
+    vector<int> ids;
+};
+
+class VirtualUser : public enable_shared_from_this<VirtualUser> {
+public:
+    VirtualUser(Worker& worker, const asio::ip::tcp::resolver::results_type& endpoints,
+        const Options& options, UserRegistry& registry, int index,
+        Clock::time_point steadyFrom, Clock::time_point deadline)
+        : worker(worker), options(options), registry(registry), index(index),
+        steadyFrom(steadyFrom), deadline(deadline),
+        rng(options.seed * 7919u + index),
+        timer(worker.io),
+        conn(make_shared<HttpConnection>(worker.io, endpoints, options.host)) {
+    }
+
+    void start(Clock::duration delay) {
+        auto self = shared_from_this();
+        timer.expires_after(delay);
+        timer.async_wait([this, self](const error_code&) { registerUser(); });
+    }
+
+private:
+    Worker& worker;
+    const Options& options;
+    UserRegistry& registry;
+    int index;
+    Clock::time_point steadyFrom;
+    Clock::time_point deadline;
+    mt19937 rng;
+    asio::steady_timer timer;
+    shared_ptr<HttpConnection> conn;
+
+    int userId = 0;
+    vector<int> chats;
+
+    using Callback = function<void(bool ok, const crow::json::rvalue& json)>;
+
+    // attempt - номер попытки; повторяются только вызовы с retry = true
+    void call(Route route, const string& method, const string& target, const string& body, Callback done,
+        bool retry = false, int attempt = 0) {
+        auto self = shared_from_this();
+        conn->request(method, target, body,
+            [this, self, route, method, target, body, done, retry, attempt](const error_code& ec, HttpConnection::Response& response) {
+                // Сервер перегружен (503) или ограничил частоту (429) - запрос не выполнялся.
+                // Повторяемые попытки учитываются только в retries: быстрые отказы
+                // не должны сдвигать перцентили и пропускную способность
+                auto now = Clock::now();
+                bool rejected = !ec && (response.status == 429 || response.status == 503);
+                if (rejected && retry && attempt < options.maxRetries && now < deadline) {
+                    worker.retries[route]++;
+                    timer.expires_after(backoff(attempt, response.retryAfter));
+                    timer.async_wait([this, self, route, method, target, body, done, attempt](const error_code&) {
+                        call(route, method, target, body, done, true, attempt + 1);
+                    });
+                    return;
+                }
+
+                worker.latency[route].record(chrono::duration_cast<chrono::microseconds>(response.latency).count());
+                if (now >= steadyFrom && now < deadline) {
+                    worker.steady[route]++;
+                }
+
+                bool ok = !ec && response.status >= 200 && response.status < 300;
+                if (!ok) {
+                    worker.errors[route]++;
+                    done(false, crow::json::rvalue());
+                    return;
+                }
+                done(true, crow::json::load(response.body));
+            });
+    }
+
+    // Экспоненциальная задержка со случайным разбросом ±50%, чтобы повторы
+    // пользователей не приходили одной волной; не меньше Retry-After
+    Clock::duration backoff(int attempt, int retryAfterSeconds) {
+        double ms = options.retryBaseMs * (1 << min(attempt, 16));
+        ms *= uniform_real_distribution<double>(0.5, 1.5)(rng);
+        ms = max(ms, retryAfterSeconds * 1000.0);
+        return chrono::duration_cast<Clock::duration>(chrono::duration<double, milli>(ms));
+    }
+
+    string login() const {
+        return "lg" + options.runId + "_" + to_string(index);
+    }
+
+    void registerUser() {
+        crow::json::wvalue body;
+        body["name"] = "Load User " + to_string(index);
+        body["login"] = login();
+        body["password"] = "password";
+
+        call(RouteRegister, "POST", "/auth/register", body.dump(),
+            [this](bool ok, const crow::json::rvalue&) {
+                if (ok) {
+                    loginUser();
+                }
+            }, true);
+    }
+
+    void loginUser() {
+        crow::json::wvalue body;
+        body["login"] = login();
+        body["password"] = "password";
+
+        call(RouteLogin, "POST", "/auth/login", body.dump(),
+            [this](bool ok, const crow::json::rvalue& json) {
+                if (!ok || !json || !json.has("id")) {
+                    return;
+                }
+                userId = static_cast<int>(json["id"].i());
+                registry.add(userId);
+                createChat();
+            }, true);
+    }
+
+    void createChat() {
+        if (static_cast<int>(chats.size()) >= options.chatsPerUser) {
+            think();
+            return;
+        }
+
+        vector<int> participants = registry.sample(rng, options.membersPerChat - 1, userId);
+
+        crow::json::wvalue body;
+        body["name"] = "Load chat " + to_string(index) + "-" + to_string(chats.size());
+        body["isGroup"] = participants.size() > 1;
+        body["createdBy"] = userId;
+        crow::json::wvalue::list list;
+        for (int id : participants) {
+            list.push_back(id);
+        }
+        body["participants"] = move(list);
+
+        call(RouteCreateChat, "POST", "/chats", body.dump(),
+            [this](bool ok, const crow::json::rvalue& json) {
+                if (ok && json && json.has("id")) {
+                    chats.push_back(static_cast<int>(json["id"].i()));
+                    createChat();
+                }
+                else {
+                    think();
+                }
+            });
+    }
+
+    void think() {
+        if (Clock::now() >= deadline) {
+            conn->close();
+            return;
+        }
+        if (options.thinkMs <= 0) {
+            next();
+            return;
+        }
+
+        exponential_distribution<double> pause(1.0 / options.thinkMs);
+        auto self = shared_from_this();
+        timer.expires_after(chrono::microseconds(static_cast<int64_t>(pause(rng) * 1000)));
+        timer.async_wait([this, self](const error_code&) { next(); });
+    }
+
+    void next() {
+        if (Clock::now() >= deadline) {
+            conn->close();
+            return;
+        }
+
+        double send = chats.empty() ? 0 : options.sendWeight;
+        double history = chats.empty() ? 0 : options.historyWeight;
+        double total = send + history + options.chatListWeight;
+        double pick = uniform_real_distribution<double>(0, total > 0 ? total : 1)(rng);
+
+        auto again = [this](bool, const crow::json::rvalue&) { think(); };
+
+        if (pick < send) {
+            crow::json::wvalue body;
+            body["userId"] = userId;
+            body["chatId"] = randomChat();
+            body["message"] = randomText();
+            call(RouteSendMessage, "POST", "/messages", body.dump(), again);
+        }
+        else if (pick < send + history) {
+            call(RouteChatMessages, "GET", "/chats/" + to_string(randomChat()) + "/messages", "", again);
+        }
+        else {
+            call(RouteUserChats, "GET", "/chats/" + to_string(userId), "", again);
+        }
+    }
+
+    int randomChat() {
+        return chats[rng() % chats.size()];
+    }
+
+    string randomText() {
+        static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz     ";
+        string text(options.messageBytes, ' ');
+        for (auto& c : text) {
+            c = alphabet[rng() % (sizeof(alphabet) - 1)];
+        }
+        return text;
+    }
+};
+
+int main(int argc, char** argv) {
+    ToolOptions args(argc, argv);
+    if (args.has("help")) {
+        cout << "Usage: chatserver_loadgen [--host=127.0.0.1] [--port=18080] [--users=50] [--threads=N]\n"
+            "  [--duration=30] [--ramp-up=1] [--chats-per-user=2] [--members-per-chat=3]\n"
+            "  [--send-weight=1] [--history-weight=3] [--chat-list-weight=1]\n"
+            "  [--think-ms=100] [--message-bytes=64] [--max-retries=5] [--retry-base-ms=100]\n"
+            "  [--seed=1] [--run-id=ID]" << endl;
+        return 0;
+    }
+
+    Options options = Options::parse(args);
+    if (options.duration <= 0) {
+        cerr << "--duration must be positive" << endl;
+        return 1;
+    }
+    if (options.threads < 1) {
+        cerr << "--threads must be at least 1" << endl;
+        return 1;
+    }
+
+    vector<unique_ptr<Worker>> workers;
+    for (int i = 0; i < options.threads; i++) {
+        workers.push_back(make_unique<Worker>());
+    }
+
+    asio::ip::tcp::resolver resolver(workers[0]->io);
+    asio::ip::tcp::resolver::results_type endpoints;
+    try {
+        endpoints = resolver.resolve(options.host, options.port);
+    }
+    catch (const exception& e) {
+        cerr << "Can't resolve " << options.host << ":" << options.port << ": " << e.what() << endl;
+        return 1;
+    }
+
+    UserRegistry registry;
+    auto started = Clock::now();
+    auto steadyFrom = started + chrono::duration_cast<Clock::duration>(
+        chrono::duration<double>(options.rampUp));
+    auto deadline = steadyFrom + chrono::duration_cast<Clock::duration>(
+        chrono::duration<double>(options.duration));
+
+    for (int i = 0; i < options.users; i++) {
+        Worker& worker = *workers[i % workers.size()];
+        auto user = make_shared<VirtualUser>(worker, endpoints, options, registry, i, steadyFrom, deadline);
+        auto delay = chrono::duration_cast<Clock::duration>(
+            chrono::duration<double>(options.rampUp * i / max(1, options.users)));
+        user->start(delay);
+    }
+
+    cout << "Running " << options.users << " virtual users on " << options.threads << " threads against "
+        << options.host << ":" << options.port << " for " << options.duration << "s" << endl;
+
+    vector<thread> threads;
+    for (auto& worker : workers) {
+        threads.emplace_back([&worker]() { worker->io.run(); });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    array<HdrHistogram, RouteCount> latency;
+    array<uint64_t, RouteCount> errors{};
+    array<uint64_t, RouteCount> retries{};
+    array<uint64_t, RouteCount> steady{};
+    for (auto& worker : workers) {
+        for (int r = 0; r < RouteCount; r++) {
+            latency[r].merge(worker->latency[r]);
+            errors[r] += worker->errors[r];
+            retries[r] += worker->retries[r];
+            steady[r] += worker->steady[r];
+        }
+    }
+
+    HdrHistogram overall;
+    uint64_t totalErrors = 0;
+    uint64_t totalRetries = 0;
+    uint64_t totalSteady = 0;
+
+    // count и задержки - по всем запросам, кроме повторенных, req/s - только по устойчивому режиму
+    printf("\nreq/s over %.1fs after a %.1fs ramp-up\n", options.duration, options.rampUp);
+    printf("%-26s %9s %7s %7s %10s %9s %9s %9s %9s\n",
+        "route", "count", "errors", "retries", "req/s", "p50 ms", "p99 ms", "p999 ms", "max ms");
+    for (int r = 0; r < RouteCount; r++) {
+        const HdrHistogram& h = latency[r];
+        overall.merge(h);
+        totalErrors += errors[r];
+        totalRetries += retries[r];
+        totalSteady += steady[r];
+        printf("%-26s %9llu %7llu %7llu %10.1f %9.2f %9.2f %9.2f %9.2f\n",
+            routeNames[r],
+            static_cast<unsigned long long>(h.count()),
+            static_cast<unsigned long long>(errors[r]),
+            static_cast<unsigned long long>(retries[r]),
+            steady[r] / options.duration,
+            h.percentile(50) / 1000.0,
+            h.percentile(99) / 1000.0,
+            h.percentile(99.9) / 1000.0,
+            h.max() / 1000.0);
+    }
+    printf("%-26s %9llu %7llu %7llu %10.1f %9.2f %9.2f %9.2f %9.2f\n",
+        "total",
+        static_cast<unsigned long long>(overall.count()),
+        static_cast<unsigned long long>(totalErrors),
+        static_cast<unsigned long long>(totalRetries),
+        totalSteady / options.duration,
+        overall.percentile(50) / 1000.0,
+        overall.percentile(99) / 1000.0,
+        overall.percentile(99.9) / 1000.0,
+        overall.max() / 1000.0);
+
+    return 0;
+}
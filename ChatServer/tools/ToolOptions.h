@@ -0,0 +1,55 @@
+﻿#pragma once
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+
+// Разбор аргументов вида --key=value (или --flag) для утилит из tools/
+class ToolOptions {
+public:
+    ToolOptions(int argc, char** argv) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg.rfind("--", 0) != 0) {
+                positional = arg;
+                continue;
+            }
+            size_t eq = arg.find('=');
+            if (eq == std::string::npos) {
+                values[arg.substr(2)] = "1";
+            }
+            else {
+                values[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+            }
+        }
+    }
+
+    bool has(const std::string& key) const {
+        return values.count(key) > 0;
+    }
+
+    std::string get(const std::string& key, const std::string& defaultValue) const {
+        auto it = values.find(key);
+        return it == values.end() ? defaultValue : it->second;
+    }
+
+    long long getInt(const std::string& key, long long defaultValue) const {
+        auto it = values.find(key);
+        return it == values.end() ? defaultValue : std::atoll(it->second.c_str());
+    }
+
+    double getDouble(const std::string& key, double defaultValue) const {
+        auto it = values.find(key);
+        return it == values.end() ? defaultValue : std::atof(it->second.c_str());
+    }
+
+    // Последний аргумент без "--" (например, путь к файлу)
+    const std::string& argument() const {
+        return positional;
+    }
+
+private:
+    std::map<std::string, std::string> values;
+    std::string positional;
+};
@@ -0,0 +1,313 @@
+﻿// Воспроизведение журнала трафика, записанного ChatServer --capture=<файл>.
+//
+// В режиме --speed=N запросы отправляются по исходному расписанию, ускоренному
+// в N раз (1 - реальное время). Каждый запрос уходит в свое время независимо
+// от того, ответил ли сервер на предыдущие, поэтому сохраняется исходная
+// степень параллелизма. В режиме --speed=max запросы идут подряд через
+// --concurrency соединений (по умолчанию - пиковая параллельность из журнала).
+// Запросы уходят с записанными заголовками (Content-Type, Accept,
+// Accept-Encoding, Idempotency-Key), так что сервер выбирает тот же формат.
+//
+// Пример:
+//   chatserver_replay --log=traffic.bin --port=18081 --speed=4
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HdrHistogram.h"
+#include "HttpClient.h"
+#include "ToolOptions.h"
+#include "TrafficLog.h"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+namespace {
+
+struct RouteStats {
+    HdrHistogram latency;
+    uint64_t errors = 0;
+    uint64_t statusMismatches = 0;
+
+    void merge(const RouteStats& other) {
+        latency.merge(other.latency);
+        errors += other.errors;
+        statusMismatches += other.statusMismatches;
+    }
+};
+
+// "/chats/15/messages?x=1" -> "GET /chats/<id>/messages"
+string routeKey(const CapturedRequest& request) {
+    string path = request.url.substr(0, request.url.find('?'));
+    string key = request.method + " ";
+    size_t i = 0;
+    while (i < path.size()) {
+        if (isdigit(static_cast<unsigned char>(path[i])) && (i == 0 || path[i - 1] == '/')) {
+            size_t j = i;
+            while (j < path.size() && isdigit(static_cast<unsigned char>(path[j]))) {
+                j++;
+            }
+            if (j == path.size() || path[j] == '/') {
+                key += "<id>";
+                i = j;
+                continue;
+            }
+        }
+        key += path[i++];
+    }
+    return key;
+}
+
+// Пиковое число одновременно обрабатывавшихся запросов в журнале
+size_t peakConcurrency(const vector<CapturedRequest>& requests) {
+    vector<pair<uint64_t, int>> events;
+    events.reserve(requests.size() * 2);
+    for (const auto& r : requests) {
+        events.emplace_back(r.startUs, 1);
+        events.emplace_back(r.startUs + r.durationUs, -1);
+    }
+    sort(events.begin(), events.end());
+    int current = 0;
+    int peak = 0;
+    for (const auto& event : events) {
+        current += event.second;
+        peak = max(peak, current);
+    }
+    return static_cast<size_t>(max(1, peak));
+}
+
+class Worker {
+public:
+    asio::io_context io;
+    map<string, RouteStats> stats;
+    HdrHistogram lag;
+
+    Worker(const asio::ip::tcp::resolver::results_type& endpoints, string host)
+        : endpoints(endpoints), host(move(host)), timer(io) {
+    }
+
+    // Открытый цикл: запросы по расписанию, соединения берутся из пула
+    void startScheduled(vector<const CapturedRequest*> requests, Clock::time_point origin, double speed) {
+        scheduled = move(requests);
+        this->origin = origin;
+        this->speed = speed;
+        scheduleNext();
+    }
+
+    // Закрытый цикл: lanes соединений выбирают запросы из общего счетчика
+    void startLanes(const vector<CapturedRequest>& all, atomic<size_t>& cursor, int lanes) {
+        for (int i = 0; i < lanes; i++) {
+            auto conn = make_shared<HttpConnection>(io, endpoints, host);
+            runLane(all, cursor, conn);
+        }
+    }
+
+private:
+    asio::ip::tcp::resolver::results_type endpoints;
+    string host;
+    asio::steady_timer timer;
+
+    vector<const CapturedRequest*> scheduled;
+    size_t next = 0;
+    Clock::time_point origin;
+    double speed = 1;
+    vector<shared_ptr<HttpConnection>> idle;
+
+    void scheduleNext() {
+        if (next >= scheduled.size()) {
+            return;
+        }
+        const CapturedRequest* request = scheduled[next];
+        auto due = origin + chrono::microseconds(static_cast<int64_t>(request->startUs / speed));
+        timer.expires_at(due);
+        timer.async_wait([this, request, due](const error_code&) {
+            lag.record(chrono::duration_cast<chrono::microseconds>(Clock::now() - due).count());
+
+            shared_ptr<HttpConnection> conn;
+            if (idle.empty()) {
+                conn = make_shared<HttpConnection>(io, endpoints, host);
+            }
+            else {
+                conn = idle.back();
+                idle.pop_back();
+            }
+            send(*request, conn, [this, conn]() { idle.push_back(conn); });
+
+            next++;
+            scheduleNext();
+        });
+    }
+
+    void runLane(const vector<CapturedRequest>& all, atomic<size_t>& cursor, shared_ptr<HttpConnection> conn) {
+        size_t index = cursor.fetch_add(1);
+        if (index >= all.size()) {
+            conn->close();
+            return;
+        }
+        send(all[index], conn, [this, &all, &cursor, conn]() { runLane(all, cursor, conn); });
+    }
+
+    void send(const CapturedRequest& request, shared_ptr<HttpConnection> conn, function<void()> done) {
+        RouteStats& route = stats[routeKey(request)];
+        int expectedStatus = request.status;
+        string headers;
+        for (const auto& [name, value] : request.headers) {
+            headers += name + ": " + value + "\r\n";
+        }
+        conn->request(request.method, request.url, request.body,
+            [&route, expectedStatus, done](const error_code& ec, HttpConnection::Response& response) {
+                route.latency.record(chrono::duration_cast<chrono::microseconds>(response.latency).count());
+                if (ec || response.status >= 500) {
+                    route.errors++;
+                }
+                if (!ec && response.status != expectedStatus) {
+                    route.statusMismatches++;
+                }
+                done();
+            }, headers);
+    }
+};
+
+} // namespace
+
+int main(int argc, char** argv) {
+    ToolOptions args(argc, argv);
+    string logPath = args.get("log", args.argument());
+    if (args.has("help") || logPath.empty()) {
+        cout << "Usage: chatserver_replay --log=traffic.bin [--host=127.0.0.1] [--port=18080]\n"
+            "  [--speed=1|N|max] [--threads=1] [--concurrency=N] [--limit=N]" << endl;
+        return logPath.empty() && !args.has("help") ? 1 : 0;
+    }
+
+    vector<CapturedRequest> requests;
+    try {
+        requests = TrafficLogReader::readAll(logPath);
+    }
+    catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    long long limit = args.getInt("limit", 0);
+    if (limit > 0 && static_cast<size_t>(limit) < requests.size()) {
+        requests.resize(static_cast<size_t>(limit));
+    }
+    if (requests.empty()) {
+        cerr << "Traffic log is empty" << endl;
+        return 1;
+    }
+
+    string host = args.get("host", "127.0.0.1");
+    string port = args.get("port", "18080");
+    string speedArg = args.get("speed", "1");
+    bool maxSpeed = speedArg == "max";
+    double speed = maxSpeed ? 0 : max(0.001, atof(speedArg.c_str()));
+    int threads = static_cast<int>(max(1LL, args.getInt("threads", 1)));
+
+    asio::io_context resolverContext;
+    asio::ip::tcp::resolver resolver(resolverContext);
+    asio::ip::tcp::resolver::results_type endpoints;
+    try {
+        endpoints = resolver.resolve(host, port);
+    }
+    catch (const exception& e) {
+        cerr << "Can't resolve " << host << ":" << port << ": " << e.what() << endl;
+        return 1;
+    }
+
+    vector<unique_ptr<Worker>> workers;
+    for (int i = 0; i < threads; i++) {
+        workers.push_back(make_unique<Worker>(endpoints, host));
+    }
+
+    double capturedSeconds = (requests.back().startUs - requests.front().startUs) / 1e6;
+    size_t peak = peakConcurrency(requests);
+    cout << "Replaying " << requests.size() << " requests (" << capturedSeconds << "s captured, peak concurrency "
+        << peak << ") at " << (maxSpeed ? string("max") : speedArg + "x") << " speed" << endl;
+
+    atomic<size_t> cursor{0};
+    auto started = Clock::now();
+    if (maxSpeed) {
+        int concurrency = static_cast<int>(args.getInt("concurrency", static_cast<long long>(peak)));
+        for (int i = 0; i < threads; i++) {
+            int lanes = concurrency / threads + (i < concurrency % threads ? 1 : 0);
+            workers[i]->startLanes(requests, cursor, lanes);
+        }
+    }
+    else {
+        // Время отсчитывается от первого запроса журнала
+        uint64_t first = requests.front().startUs;
+        for (auto& request : requests) {
+            request.startUs -= first;
+        }
+        vector<vector<const CapturedRequest*>> parts(threads);
+        for (size_t i = 0; i < requests.size(); i++) {
+            parts[i % threads].push_back(&requests[i]);
+        }
+        auto origin = Clock::now() + chrono::milliseconds(100);
+        for (int i = 0; i < threads; i++) {
+            workers[i]->startScheduled(move(parts[i]), origin, speed);
+        }
+    }
+
+    vector<thread> pool;
+    for (auto& worker : workers) {
+        pool.emplace_back([&worker]() { worker->io.run(); });
+    }
+    for (auto& t : pool) {
+        t.join();
+    }
+    double elapsed = chrono::duration<double>(Clock::now() - started).count();
+
+    map<string, RouteStats> stats;
+    HdrHistogram lag;
+    for (auto& worker : workers) {
+        for (const auto& [key, route] : worker->stats) {
+            stats[key].merge(route);
+        }
+        lag.merge(worker->lag);
+    }
+
+    printf("\n%-32s %9s %7s %8s %10s %9s %9s %9s %9s\n",
+        "route", "count", "errors", "status!=", "req/s", "p50 ms", "p99 ms", "p999 ms", "max ms");
+    RouteStats total;
+    for (const auto& [key, route] : stats) {
+        total.merge(route);
+        printf("%-32s %9llu %7llu %8llu %10.1f %9.2f %9.2f %9.2f %9.2f\n",
+            key.c_str(),
+            static_cast<unsigned long long>(route.latency.count()),
+            static_cast<unsigned long long>(route.errors),
+            static_cast<unsigned long long>(route.statusMismatches),
+            route.latency.count() / elapsed,
+            route.latency.percentile(50) / 1000.0,
+            route.latency.percentile(99) / 1000.0,
+            route.latency.percentile(99.9) / 1000.0,
+            route.latency.max() / 1000.0);
+    }
+    printf("%-32s %9llu %7llu %8llu %10.1f %9.2f %9.2f %9.2f %9.2f\n",
+        "total",
+        static_cast<unsigned long long>(total.latency.count()),
+        static_cast<unsigned long long>(total.errors),
+        static_cast<unsigned long long>(total.statusMismatches),
+        total.latency.count() / elapsed,
+        total.latency.percentile(50) / 1000.0,
+        total.latency.percentile(99) / 1000.0,
+        total.latency.percentile(99.9) / 1000.0,
+        total.latency.max() / 1000.0);
+
+    if (!maxSpeed) {
+        // Если отставание велико, генератор не успевает за расписанием
+        printf("\nschedule lag: p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+            lag.percentile(50) / 1000.0, lag.percentile(99) / 1000.0, lag.max() / 1000.0);
+    }
+    return 0;
+}